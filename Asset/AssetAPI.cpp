@@ -22,6 +22,8 @@
 #include "Platform.h"
 #include <QDir>
 #include <QFileSystemWatcher>
+#include <QStringList>
+#include <algorithm>
 
 DEFINE_POCO_LOGGING_FUNCTIONS("Asset")
 
@@ -30,7 +32,11 @@ using namespace Foundation;
 AssetAPI::AssetAPI(bool isHeadless)
 :assetCache(0),
 diskSourceChangeWatcher(0),
-isHeadless_(isHeadless)
+isHeadless_(isHeadless),
+isPrefetchingDependencies(false),
+accessCounter(0),
+memoryBudget(0),
+memoryBudgetCheckTimer(0.0)
 {
     // The Asset API always understands at least this single built-in asset type "Binary".
     // You can use this type to request asset data as binary, without generating any kind of in-memory representation or loading for it.
@@ -290,7 +296,7 @@ AssetPtr AssetAPI::CreateAssetFromFile(QString assetType, QString assetFile)
 
 void AssetAPI::ForgetAsset(QString assetRef, bool removeDiskSource)
 {
-    AssetPtr asset = GetAsset(assetRef);
+    AssetPtr asset = FindAsset(assetRef);
     if (asset.get())
         ForgetAsset(asset, removeDiskSource);
 }
@@ -325,12 +331,13 @@ void AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
     }
     if (diskSourceChangeWatcher && !asset->DiskSource().isEmpty())
         diskSourceChangeWatcher->removePath(asset->DiskSource());
+    RemoveAssetDependencies(asset->Name());
     assets.erase(iter);
 }
 
 void AssetAPI::DeleteAssetFromStorage(QString assetRef)
 {
-    AssetPtr asset = GetAsset(assetRef);
+    AssetPtr asset = FindAsset(assetRef);
 
     AssetProviderPtr provider = (asset.get() ? asset->GetAssetProvider() : AssetProviderPtr());
     if (!provider)
@@ -470,6 +477,8 @@ void AssetAPI::ForgetAllAssets()
 
     assets.clear();
     currentTransfers.clear();
+    assetDependencies.clear();
+    assetDependents.clear();
 }
 
 std::vector<AssetTransferPtr> AssetAPI::PendingTransfers()
@@ -537,6 +546,10 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType)
     AssetMap::iterator iter2 = assets.find(assetRef);
     if (iter2 != assets.end())
     {
+        // If the asset was unloaded to meet the memory budget, bring it back from its disk source before handing it out.
+        MarkAssetAccessed(iter2->second);
+        ReloadUnloadedAsset(iter2->second);
+
         // Whenever the client requests an asset that was loaded before, we create a request for that asset nevertheless.
         // The idea is to have the code path run the same independent of whether the asset existed or had to be downloaded, i.e.
         // a request is always made, and the receiver writes only a single asynchronous code path for handling the asset.
@@ -614,6 +627,12 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType)
     assert(currentTransfers.find(assetRef) == currentTransfers.end());
     currentTransfers[assetRef] = transfer;
     connect(transfer.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnAssetLoaded(AssetPtr)));
+
+    // If we have seen this asset before, we know its dependencies already. Start fetching them now in parallel with this asset,
+    // instead of discovering them one level at a time as each parent asset finishes loading.
+    if (!isPrefetchingDependencies)
+        PrefetchAssetDependencies(assetRef);
+
     return transfer;
 }
 
@@ -715,7 +734,7 @@ QString AssetAPI::GenerateUniqueAssetName(QString assetTypePrefix, QString asset
     for(int i = 0; i < 10000; ++i) // The intent is to loop 'infinitely' until a name is found, but do an artificial limit to avoid voodoo bugs.
     {
         assetName = assetTypePrefix + "_" + assetNamePrefix + (assetNamePrefix.isEmpty() ? "" : "_") + QString::number(uniqueRunningAssetCounter++);
-        if (!GetAsset(assetName))
+        if (!FindAsset(assetName))
             return assetName;
     }
     assert(false);
@@ -787,10 +806,21 @@ AssetPtr AssetAPI::GetAsset(QString assetRef)
 {
     AssetMap::iterator iter = assets.find(assetRef);
     if (iter != assets.end())
+    {
+        // Like in RequestAsset(), bring back an asset that was unloaded to meet the memory budget.
+        MarkAssetAccessed(iter->second);
+        ReloadUnloadedAsset(iter->second);
         return iter->second;
+    }
     return AssetPtr();
 }
 
+AssetPtr AssetAPI::FindAsset(const QString &assetRef) const
+{
+    AssetMap::const_iterator iter = assets.find(assetRef);
+    return iter != assets.end() ? iter->second : AssetPtr();
+}
+
 AssetPtr AssetAPI::GetAssetByHash(QString assetHash)
 {
     ///\todo Implement.
@@ -799,6 +829,8 @@ AssetPtr AssetAPI::GetAssetByHash(QString assetHash)
 
 void AssetAPI::Update(f64 frametime)
 {
+    ALLOCATION_SCOPE(Asset);
+
     for(size_t i = 0; i < providers.size(); ++i)
         providers[i]->Update(frametime);
 
@@ -812,6 +844,129 @@ void AssetAPI::Update(f64 frametime)
     for(size_t i = 0; i < readyTransfers.size(); ++i)
         AssetTransferCompleted(readyTransfers[i].get());
     readyTransfers.clear();
+
+    // Summing up the memory usage walks through all the assets, so don't do it every frame.
+    const f64 cMemoryBudgetCheckInterval = 1.0;
+    memoryBudgetCheckTimer += frametime;
+    if (memoryBudget > 0 && memoryBudgetCheckTimer >= cMemoryBudgetCheckInterval)
+    {
+        memoryBudgetCheckTimer = 0.0;
+        EnforceMemoryBudget();
+    }
+}
+
+void AssetAPI::MarkAssetAccessed(const AssetPtr &asset)
+{
+    asset->lastAccessStamp = ++accessCounter;
+}
+
+AssetAPI::AssetTypeMemoryUsageMap AssetAPI::MemoryUsageByType() const
+{
+    AssetTypeMemoryUsageMap usage;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+    {
+        AssetTypeMemoryUsage &typeUsage = usage[iter->second->Type()];
+        ++typeUsage.numAssets;
+        if (iter->second->IsLoaded())
+        {
+            ++typeUsage.numLoaded;
+            typeUsage.numBytes += iter->second->MemoryUsage();
+        }
+    }
+    return usage;
+}
+
+size_t AssetAPI::TotalMemoryUsage() const
+{
+    size_t numBytes = 0;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        if (iter->second->IsLoaded())
+            numBytes += iter->second->MemoryUsage();
+    return numBytes;
+}
+
+void AssetAPI::SetMemoryBudget(size_t numBytes)
+{
+    memoryBudget = numBytes;
+    if (memoryBudget > 0)
+        EnforceMemoryBudget();
+}
+
+bool AssetAPI::IsAssetEvictable(const AssetPtr &asset) const
+{
+    // The only strong reference must be the one in the assets map. Any other holder, like an ongoing transfer or a component, keeps the asset loaded.
+    if (asset.use_count() > 1 || !asset->IsLoaded() || asset->HasExternalReferences())
+        return false;
+
+    // We must be able to load the asset back in when it is requested the next time.
+    if (asset->DiskSource().isEmpty() || !QFile::exists(asset->DiskSource()))
+        return false;
+
+    // Loaded assets that depend on this asset may use its contents, e.g. a material uses its textures.
+    AssetDependenciesMap::const_iterator dependents = assetDependents.find(asset->Name());
+    if (dependents != assetDependents.end())
+        for(AssetRefSet::const_iterator iter = dependents->second.begin(); iter != dependents->second.end(); ++iter)
+        {
+            AssetMap::const_iterator dependent = assets.find(*iter);
+            if (dependent != assets.end() && dependent->second->IsLoaded())
+                return false;
+        }
+
+    return true;
+}
+
+size_t AssetAPI::EnforceMemoryBudget()
+{
+    if (memoryBudget == 0)
+        return 0;
+
+    size_t memoryUsage = TotalMemoryUsage();
+    if (memoryUsage <= memoryBudget)
+        return 0;
+
+    // Gather the unload candidates and sort them in least recently used order.
+    std::vector<std::pair<u64, QString> > candidates;
+    for(AssetMap::iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        if (iter->second->MemoryUsage() > 0 && IsAssetEvictable(iter->second))
+            candidates.push_back(std::make_pair(iter->second->lastAccessStamp, iter->first));
+    std::sort(candidates.begin(), candidates.end());
+
+    size_t numBytesFreed = 0;
+    for(size_t i = 0; i < candidates.size() && memoryUsage > memoryBudget; ++i)
+    {
+        AssetMap::iterator iter = assets.find(candidates[i].second);
+        // Unloading an asset can release references to other assets, so re-check each candidate before unloading it.
+        if (iter == assets.end() || !IsAssetEvictable(iter->second))
+            continue;
+
+        size_t assetMemory = iter->second->MemoryUsage();
+        LogDebug("AssetAPI: Unloading asset \"" + iter->second->ToString() + "\" (" + QString::number(assetMemory) + " bytes) to stay within the asset memory budget.");
+        iter->second->Unload();
+        memoryUsage -= std::min(memoryUsage, assetMemory);
+        numBytesFreed += assetMemory;
+    }
+
+    if (memoryUsage > memoryBudget)
+        LogDebug("AssetAPI: Loaded assets take up " + QString::number(memoryUsage) + " bytes, which exceeds the asset memory budget of " +
+            QString::number(memoryBudget) + " bytes, but no more unreferenced assets could be unloaded.");
+
+    return numBytesFreed;
+}
+
+bool AssetAPI::ReloadUnloadedAsset(AssetPtr asset)
+{
+    if (asset->IsLoaded())
+        return true;
+    if (asset->DiskSource().isEmpty())
+        return false;
+
+    // Go through the same path as assets found in the cache on startup, so that the dependencies of the asset are requested again.
+    bool success = asset->LoadFromCache();
+    if (success)
+        LogDebug("AssetAPI: Reloaded unloaded asset \"" + asset->ToString() + "\" from \"" + asset->DiskSource() + "\".");
+    else
+        LogError("AssetAPI: Failed to reload unloaded asset \"" + asset->ToString() + "\" from \"" + asset->DiskSource() + "\"!");
+    return success;
 }
 
 QString GuaranteeTrailingSlash(const QString &source)
@@ -893,6 +1048,7 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         LogWarning("AssetAPI: Overwriting a previously downloaded asset \"" + existing->Name() + "\", type \"" + existing->Type() + "\" with asset of same name!");
     }
     assets[transfer->source.ref] = transfer->asset;
+    MarkAssetAccessed(transfer->asset);
     if (diskSourceChangeWatcher && !transfer->asset->DiskSource().isEmpty())
         diskSourceChangeWatcher->addPath(transfer->asset->DiskSource());
     emit AssetCreated(transfer->asset);
@@ -1000,17 +1156,23 @@ void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
     /// Delete all old stored asset dependencies for this asset.
     RemoveAssetDependencies(asset->Name());
 
+    QStringList manifest;
     std::vector<AssetReference> refs = asset->FindReferences();
     for(size_t i = 0; i < refs.size(); ++i)
     {
-        // Turn named storage (and default storage) specifiers to absolute specifiers.
         QString ref = refs[i].ref;
         if (ref.isEmpty())
             continue;
 
         // Remember this assetref for future lookup.
-        assetDependencies.push_back(std::make_pair(asset->Name(), ref));
+        if (assetDependencies[asset->Name()].insert(ref).second)
+            manifest << ref;
+        assetDependents[ref].insert(asset->Name());
     }
+
+    // Persist the dependencies so that the next time this asset is requested, they can be prefetched right away.
+    if (assetCache)
+        assetCache->StoreDependencyManifest(asset->Name(), manifest);
 }
 
 void AssetAPI::RequestAssetDependencies(AssetPtr asset)
@@ -1025,9 +1187,11 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
         if (ref.isEmpty())
             continue;
 
-        AssetPtr existing = GetAsset(ref);
+        AssetPtr existing = GetAsset(ref); // Reloads the dependency if it was unloaded to meet the memory budget.
         if (existing)
+        {
             asset->DependencyLoaded(existing);
+        }
         else // We don't have the given asset yet, request it.
         {
             LogDebug("Asset " + asset->ToString() + " depends on asset " + ref + " which has not been loaded yet. Requesting..");
@@ -1036,27 +1200,123 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
     }
 }
 
-void AssetAPI::RemoveAssetDependencies(QString asset)
+namespace
 {
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
-        if (QString::compare(assetDependencies[i].first, asset, Qt::CaseInsensitive) == 0)
+    /// A stack frame of the iterative depth-first walk in AssetAPI::PrefetchAssetDependencies.
+    struct DependencyWalkEntry
+    {
+        QString ref;
+        QStringList dependencies;
+        int nextDependency;
+        int batch;
+    };
+}
+
+void AssetAPI::PrefetchAssetDependencies(QString assetRef)
+{
+    if (!assetCache)
+        return;
+
+    // Walk the dependency manifests depth-first, and assign each known dependency a batch index: leaves go to batch 0, and each
+    // other asset goes to the batch after the deepest batch of its own dependencies. Cycles in the graph are cut at the first revisit.
+    std::map<QString, int, QStringLessThanNoCase> batchOfAsset;
+    std::vector<std::vector<QString> > batches;
+
+    std::vector<DependencyWalkEntry> stack;
+
+    DependencyWalkEntry root;
+    root.ref = assetRef;
+    root.dependencies = assetCache->GetDependencyManifest(assetRef);
+    root.nextDependency = 0;
+    root.batch = -1;
+    if (root.dependencies.isEmpty())
+        return;
+    stack.push_back(root);
+    batchOfAsset[assetRef] = -1; // Mark the root visited, it is already being requested by the caller.
+
+    while(!stack.empty())
+    {
+        DependencyWalkEntry &top = stack.back();
+        if (top.nextDependency < top.dependencies.size())
         {
-            assetDependencies.erase(assetDependencies.begin() + i);
-            --i;
+            QString ref = LookupAssetRefToStorage(top.dependencies[top.nextDependency++]);
+            std::map<QString, int, QStringLessThanNoCase>::iterator visited = batchOfAsset.find(ref);
+            if (visited != batchOfAsset.end())
+            {
+                top.batch = std::max(top.batch, visited->second);
+                continue;
+            }
+            batchOfAsset[ref] = 0;
+
+            DependencyWalkEntry child;
+            child.ref = ref;
+            child.nextDependency = 0;
+            child.batch = -1;
+            // Already loaded assets have their dependencies in memory, and will not be requested from the manifests.
+            if (!FindAsset(ref))
+                child.dependencies = assetCache->GetDependencyManifest(ref);
+            stack.push_back(child);
         }
+        else
+        {
+            DependencyWalkEntry finished = stack.back();
+            stack.pop_back();
+            if (stack.empty())
+                break; // This was the root.
+
+            int batch = finished.batch + 1;
+            batchOfAsset[finished.ref] = batch;
+            stack.back().batch = std::max(stack.back().batch, batch);
+            if ((int)batches.size() <= batch)
+                batches.resize(batch + 1);
+            batches[batch].push_back(finished.ref);
+        }
+    }
+
+    // Issue all the requests in one go. The asset providers will run them concurrently, and since the leaf dependencies were
+    // requested first, they are typically ready by the time their dependents have been loaded.
+    isPrefetchingDependencies = true;
+    for(size_t i = 0; i < batches.size(); ++i)
+        for(size_t j = 0; j < batches[i].size(); ++j)
+            if (!FindAsset(batches[i][j]) && !GetPendingTransfer(batches[i][j]))
+            {
+                LogDebug("Prefetching asset " + batches[i][j] + " (batch " + QString::number(i) + "), a known dependency of " + assetRef + ".");
+                RequestAsset(batches[i][j]);
+            }
+    isPrefetchingDependencies = false;
+}
+
+void AssetAPI::RemoveAssetDependencies(QString asset)
+{
+    AssetDependenciesMap::iterator iter = assetDependencies.find(asset);
+    if (iter == assetDependencies.end())
+        return;
+
+    // Clean up the reverse index entries that refer to this asset.
+    for(AssetRefSet::iterator dep = iter->second.begin(); dep != iter->second.end(); ++dep)
+    {
+        AssetDependenciesMap::iterator dependents = assetDependents.find(*dep);
+        if (dependents == assetDependents.end())
+            continue;
+        dependents->second.erase(asset);
+        if (dependents->second.empty())
+            assetDependents.erase(dependents);
+    }
+    assetDependencies.erase(iter);
 }
 
 std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
 {
     std::vector<AssetPtr> dependents;
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
+    AssetDependenciesMap::iterator iter = assetDependents.find(dependee);
+    if (iter == assetDependents.end())
+        return dependents;
+
+    for(AssetRefSet::iterator dependent = iter->second.begin(); dependent != iter->second.end(); ++dependent)
     {
-        if (QString::compare(assetDependencies[i].second, dependee, Qt::CaseInsensitive) == 0)
-        {
-            AssetMap::iterator iter = assets.find(assetDependencies[i].first);
-            if (iter != assets.end())
-                dependents.push_back(iter->second);
-        }
+        AssetMap::iterator asset = assets.find(*dependent);
+        if (asset != assets.end())
+            dependents.push_back(asset->second);
     }
     return dependents;
 }
@@ -1072,7 +1332,7 @@ int AssetAPI::NumPendingDependencies(AssetPtr asset)
         if (ref.isEmpty())
             continue;
 
-        AssetPtr existing = GetAsset(refs[i].ref);
+        AssetPtr existing = FindAsset(refs[i].ref);
         if (!existing)
         {
             // Not loaded, just mark the single one
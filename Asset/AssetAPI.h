@@ -7,6 +7,7 @@
 #include <vector>
 #include <utility>
 #include <map>
+#include <set>
 
 #include "CoreTypes.h"
 #include "AssetFwd.h"
@@ -99,6 +100,8 @@ public:
         }
     };
 
+    typedef std::set<QString, AssetAPI::QStringLessThanNoCase> AssetRefSet;
+
     /// Specifies the different possible results for AssetAPI::QueryFileLocation.
     enum FileQueryResult
     {
@@ -171,6 +174,7 @@ public slots:
     AssetTypeFactoryPtr GetAssetTypeFactory(QString typeName);
 
     /// Returns the given asset by full URL ref if it exists, or null otherwise.
+    /// If the asset was unloaded to meet the memory budget, it is reloaded from its disk source first.
     /// @note The "name" of an asset is in most cases the URL ref of the asset, so use this function to query an asset by name.
     AssetPtr GetAsset(QString assetRef);
     
@@ -310,6 +314,37 @@ public slots:
     /// An utility function that counts the number of dependencies the given asset has to other assets that have not been loaded in.
     int NumPendingDependencies(AssetPtr asset);
 
+    /// Describes the memory used by the assets of a single asset type.
+    struct AssetTypeMemoryUsage
+    {
+        AssetTypeMemoryUsage() : numAssets(0), numLoaded(0), numBytes(0) {}
+        /// The number of assets of this type known to the Asset API.
+        int numAssets;
+        /// The number of assets of this type currently loaded in memory.
+        int numLoaded;
+        /// The sum of IAsset::MemoryUsage() over all loaded assets of this type.
+        size_t numBytes;
+    };
+    typedef std::map<QString, AssetTypeMemoryUsage> AssetTypeMemoryUsageMap;
+
+    /// Returns the memory usage of all known assets, grouped by asset type.
+    AssetTypeMemoryUsageMap MemoryUsageByType() const;
+
+    /// Returns the total memory usage of all currently loaded assets, in bytes.
+    size_t TotalMemoryUsage() const;
+
+    /// Returns the asset memory budget in bytes. 0 means unlimited, which is the default.
+    size_t MemoryBudget() const { return memoryBudget; }
+
+    /// Sets the asset memory budget in bytes. When the loaded assets take up more memory than this, the Asset API unloads
+    /// assets that have no live references, in least recently used order. Unloaded assets are reloaded from their disk source
+    /// the next time they are requested. Pass in 0 to disable the budget.
+    void SetMemoryBudget(size_t numBytes);
+
+    /// Unloads unreferenced assets in least recently used order until the total asset memory usage is below the memory budget.
+    /// This is called periodically from Update(), but can be called manually to force a check. Returns the number of bytes freed.
+    size_t EnforceMemoryBudget();
+
 signals:
     /// Emitted for each new asset that was created and added to the system. When this signal is triggered, the dependencies of an asset
     /// may not yet have been loaded.
@@ -344,14 +379,24 @@ private:
     /// Stores all the currently ongoing asset uploads, maps full assetRefs to the asset upload transfer structures.
     AssetUploadTransferMap currentUploadTransfers;
 
-    typedef std::vector<std::pair<QString, QString> > AssetDependenciesMap;
-    /// Keeps track of all the dependencies each asset has to each other asset.
-    /// \todo Find a more effective data structure for this. Needs something like boost::bimap but for multi-indices.
+    typedef std::map<QString, AssetRefSet, AssetAPI::QStringLessThanNoCase> AssetDependenciesMap;
+    /// Keeps track of all the dependencies each asset has to each other asset. Maps an assetRef to the set of assetRefs it depends on.
     AssetDependenciesMap assetDependencies;
 
+    /// The reverse index of assetDependencies. Maps an assetRef to the set of assetRefs that depend on it.
+    AssetDependenciesMap assetDependents;
+
     /// Removes from AssetDependenciesMap all dependencies the given asset has.
     void RemoveAssetDependencies(QString asset);
 
+    /// Looks up the dependency manifests stored in the asset cache for the given asset, and issues requests to all the known (transitive)
+    /// dependencies of it right away, instead of waiting for each parent asset to finish loading before discovering its dependencies.
+    /// The requests are issued in topological batches, leaf dependencies first.
+    void PrefetchAssetDependencies(QString assetRef);
+
+    /// Set to true for the duration of PrefetchAssetDependencies, so that the requests it issues don't recursively start new prefetches.
+    bool isPrefetchingDependencies;
+
     /// Stores a list of asset requests to assets that have already been downloaded into the system. These requests don't go to the asset providers
     /// to process, but are internally filled by the Asset API. This member vector is needed to be able to delay the requests and virtual completions
     /// by one frame, so that the client gets a chance to connect his handler's Qt signals to the AssetTransferPtr slots.
@@ -387,6 +432,27 @@ private:
     std::vector<AssetProviderPtr> providers;
 
     AssetCache *assetCache;
+
+    /// Stamps the given asset as the most recently used one.
+    void MarkAssetAccessed(const AssetPtr &asset);
+
+    /// Returns true if the given asset can be unloaded to meet the memory budget.
+    bool IsAssetEvictable(const AssetPtr &asset) const;
+
+    /// If the given asset was unloaded by the memory budget, loads it back in from its disk source. Returns true if the asset is loaded after the call.
+    bool ReloadUnloadedAsset(AssetPtr asset);
+
+    /// Returns the given asset if it exists, or null otherwise. Unlike GetAsset(), does not count as an access of the asset or reload it.
+    AssetPtr FindAsset(const QString &assetRef) const;
+
+    /// A running counter that is incremented each time an asset is accessed, used to order assets by their last use.
+    u64 accessCounter;
+
+    /// The asset memory budget in bytes, or 0 if unlimited.
+    size_t memoryBudget;
+
+    /// Accumulates frame time to check the memory budget only periodically instead of every frame.
+    f64 memoryBudgetCheckTimer;
 };
 
 #include "AssetAPI.inl"
@@ -11,6 +11,7 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QDataStream>
+#include <QTextStream>
 #include <QCryptographicHash>
 #include <QScopedPointer>
 
@@ -60,6 +61,9 @@ AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) :
     if (!assetDir.exists("metadata"))
         assetDir.mkdir("metadata");
     assetMetaDataDir = QDir(cacheDirectory + "metadata");
+    if (!assetDir.exists("derived"))
+        assetDir.mkdir("derived");
+    assetDerivedDataDir = QDir(cacheDirectory + "derived");
 
     // Set for QNetworkDiskCache
     setCacheDirectory(cacheDirectory);
@@ -158,6 +162,10 @@ bool AssetCache::remove(const QUrl &url)
     QString absoluteDataFile = GetAbsoluteFilePath(false, url);
     if (QFile::exists(absoluteDataFile))
         success = QFile::remove(absoluteDataFile);
+    // The dependency manifest is only a prefetch hint, so failing to remove it is not an error.
+    QString absoluteManifestFile = GetAbsoluteDependencyManifestFilePath(url.toString());
+    if (QFile::exists(absoluteManifestFile))
+        QFile::remove(absoluteManifestFile);
     return success;
 }
 
@@ -259,6 +267,55 @@ QString AssetCache::StoreAsset(const u8 *data, size_t numBytes, const QString &a
     return "";
 }
 
+bool AssetCache::StoreDependencyManifest(const QString &assetRef, const QStringList &dependencies)
+{
+    QString absolutePath = GetAbsoluteDependencyManifestFilePath(assetRef);
+    if (dependencies.isEmpty())
+    {
+        // Don't keep empty manifests around, a missing manifest already means "no known dependencies".
+        if (QFile::exists(absolutePath))
+            QFile::remove(absolutePath);
+        return true;
+    }
+
+    // Avoid rewriting the manifest on each load if the dependencies did not change.
+    if (GetDependencyManifest(assetRef) == dependencies)
+        return true;
+
+    QFile manifestFile(absolutePath);
+    if (!manifestFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        LogError("AssetCache::StoreDependencyManifest Could not open dependency manifest file: " + absolutePath.toStdString());
+        return false;
+    }
+
+    QTextStream manifestStream(&manifestFile);
+    manifestStream.setCodec("UTF-8");
+    foreach(QString dependency, dependencies)
+        manifestStream << dependency << "\n";
+    manifestFile.close();
+    return true;
+}
+
+QStringList AssetCache::GetDependencyManifest(const QString &assetRef)
+{
+    QStringList dependencies;
+    QFile manifestFile(GetAbsoluteDependencyManifestFilePath(assetRef));
+    if (!manifestFile.exists() || !manifestFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        return dependencies;
+
+    QTextStream manifestStream(&manifestFile);
+    manifestStream.setCodec("UTF-8");
+    while(!manifestStream.atEnd())
+    {
+        QString dependency = manifestStream.readLine().trimmed();
+        if (!dependency.isEmpty())
+            dependencies << dependency;
+    }
+    manifestFile.close();
+    return dependencies;
+}
+
 void AssetCache::DeleteAsset(const QString &assetRef)
 {
     DeleteAsset(QUrl(assetRef, QUrl::TolerantMode));
@@ -270,10 +327,58 @@ void AssetCache::DeleteAsset(const QUrl &assetUrl)
         LogWarning("AssetCache::DeleteAsset Failed to delete asset " + assetUrl.toString().toStdString());
 }
 
+bool AssetCache::StoreDerivedData(const QString &sourceContentHash, const QString &derivedType, const std::vector<u8> &data)
+{
+    if (sourceContentHash.isEmpty() || data.empty())
+        return false;
+
+    // Write to a temporary file first and rename it, so that a partially written entry is never read.
+    QString absolutePath = GetAbsoluteDerivedDataFilePath(sourceContentHash, derivedType);
+    QString tempPath = absolutePath + ".tmp";
+    QFile derivedFile(tempPath);
+    if (!derivedFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("AssetCache::StoreDerivedData Could not open derived data file: " + tempPath.toStdString());
+        return false;
+    }
+    bool success = derivedFile.write((const char*)&data[0], data.size()) == (qint64)data.size();
+    derivedFile.close();
+
+    if (success)
+    {
+        QFile::remove(absolutePath);
+        success = QFile::rename(tempPath, absolutePath);
+    }
+    if (!success)
+    {
+        LogError("AssetCache::StoreDerivedData Could not write derived data file: " + absolutePath.toStdString());
+        QFile::remove(tempPath);
+    }
+    return success;
+}
+
+bool AssetCache::LoadDerivedData(const QString &sourceContentHash, const QString &derivedType, std::vector<u8> &data)
+{
+    if (sourceContentHash.isEmpty())
+        return false;
+    QString absolutePath = GetAbsoluteDerivedDataFilePath(sourceContentHash, derivedType);
+    if (!QFile::exists(absolutePath))
+        return false;
+    return LoadFileToVector(absolutePath.toStdString().c_str(), data) && !data.empty();
+}
+
+void AssetCache::DeleteDerivedData(const QString &sourceContentHash, const QString &derivedType)
+{
+    QString absolutePath = GetAbsoluteDerivedDataFilePath(sourceContentHash, derivedType);
+    if (QFile::exists(absolutePath))
+        QFile::remove(absolutePath);
+}
+
 void AssetCache::ClearAssetCache()
 {
     ClearDirectory(assetDataDir.absolutePath());
     ClearDirectory(assetMetaDataDir.absolutePath());
+    ClearDirectory(assetDerivedDataDir.absolutePath());
 }
 
 bool AssetCache::WriteMetadata(const QString &filePath, const QNetworkCacheMetaData &metaData)
@@ -362,6 +467,16 @@ QString AssetCache::GetAbsoluteDataFilePath(const QString &filename)
     return assetDataDir.absolutePath() + "/" + SanitateAssetRefForCache(filename);
 }
 
+QString AssetCache::GetAbsoluteDependencyManifestFilePath(const QString &assetRef)
+{
+    return assetMetaDataDir.absolutePath() + "/" + SanitateAssetRefForCache(assetRef) + ".dependencies";
+}
+
+QString AssetCache::GetAbsoluteDerivedDataFilePath(const QString &sourceContentHash, const QString &derivedType)
+{
+    return assetDerivedDataDir.absolutePath() + "/" + sourceContentHash + "." + SanitateAssetRefForCache(derivedType);
+}
+
 void AssetCache::ClearDirectory(const QString &absoluteDirPath)
 {
     QDir targetDir(absoluteDirPath);
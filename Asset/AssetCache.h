@@ -6,6 +6,7 @@
 #define incl_Asset_AssetCache_h
 
 #include <QString>
+#include <QStringList>
 #include <QNetworkCookieJar>
 #include <QNetworkDiskCache>
 #include <QNetworkCacheMetaData>
@@ -15,6 +16,8 @@
 #include <QDir>
 #include <QObject>
 
+#include <vector>
+
 #include "CoreTypes.h"
 #include "AssetFwd.h"
 
@@ -68,6 +71,20 @@ public:
     /// \note QNetworkDiskCache override. Don't call directly, used by QNetworkAccessManager.
     virtual qint64 expire();
 
+    /// Saves data derived from an asset, e.g. a preprocessed form of it, to the cache.
+    /// The entry is keyed by the content hash of the source asset data, so it is never used for other content of the same asset.
+    /// @param QString content hash of the source asset data.
+    /// @param QString type of the derived data. Include a version in it, and bump the version when the processing changes, to invalidate the old entries.
+    /// @return True if the data was written, false otherwise.
+    bool StoreDerivedData(const QString &sourceContentHash, const QString &derivedType, const std::vector<u8> &data);
+
+    /// Reads data derived from an asset, stored earlier with StoreDerivedData.
+    /// @return True if the entry exists and was read, false otherwise.
+    bool LoadDerivedData(const QString &sourceContentHash, const QString &derivedType, std::vector<u8> &data);
+
+    /// Deletes data derived from an asset, e.g. if it turned out to be corrupt.
+    void DeleteDerivedData(const QString &sourceContentHash, const QString &derivedType);
+
 public slots:
     /// Returns an absolute path to a disk source of the url.
     /// @param QString asset ref
@@ -98,6 +115,17 @@ public slots:
     /// @return QString the absolute path name to the asset cache entry. If not successfull returns an empty string.
     QString StoreAsset(const u8 *data, size_t numBytes, const QString &assetName, const QString &assetContentHash);
 
+    /// Saves the list of assetRefs the given asset depends on to the cache, so that the dependencies can be prefetched the next time the asset is requested.
+    /// @param QString asset reference.
+    /// @param QStringList the assetRefs the asset refers to directly.
+    /// @return True if the dependency manifest was written, false otherwise.
+    bool StoreDependencyManifest(const QString &assetRef, const QStringList &dependencies);
+
+    /// Returns the list of assetRefs the given asset was known to depend on when it was last loaded.
+    /// @param QString asset reference.
+    /// @return QStringList of dependency assetRefs. Returns an empty list if no manifest exists for the asset.
+    QStringList GetDependencyManifest(const QString &assetRef);
+
     /// Deletes the asset with the given assetRef from the cache, if it exists.
     /// @param QString asset reference.
     void DeleteAsset(const QString &assetRef);
@@ -133,6 +161,12 @@ private slots:
     /// Genrates the absolute path to an data asset cache entry.
     QString GetAbsoluteDataFilePath(const QString &filename);
 
+    /// Genrates the absolute path to the dependency manifest file of an asset cache entry.
+    QString GetAbsoluteDependencyManifestFilePath(const QString &assetRef);
+
+    /// Genrates the absolute path to a derived data cache entry.
+    QString GetAbsoluteDerivedDataFilePath(const QString &sourceContentHash, const QString &derivedType);
+
     /// Removes all files from a directory. Will not delete the folder itself or any subfolders it has.
     void ClearDirectory(const QString &absoluteDirPath);
 
@@ -149,6 +183,9 @@ private:
     /// Asset metadata dir.
     QDir assetMetaDataDir;
 
+    /// Derived data dir.
+    QDir assetDerivedDataDir;
+
     /// Internal tracking of prepared QUrl to QIODevice pairs.
     QHash<QString, QFile*> preparedItems;
 };
@@ -50,6 +50,8 @@ public:
 
     bool IsLoaded() const { return data.size() > 0; }
 
+    virtual size_t MemoryUsage() const { return data.capacity(); }
+
     std::vector<u8> data;
 };
 
@@ -14,7 +14,7 @@ DEFINE_POCO_LOGGING_FUNCTIONS("IAsset")
 #include "AssetAPI.h"
 
 IAsset::IAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:assetAPI(owner), type(type_), name(name_), contentHashChanged(true)
+:assetAPI(owner), type(type_), name(name_), contentHashChanged(true), lastAccessStamp(0)
 {
     assert(assetAPI);
 }
@@ -112,6 +112,14 @@ public:
     /// Called whenever another asset this asset depends on is loaded.
     virtual void DependencyLoaded(AssetPtr dependee) { }
 
+    /// Returns an estimate of the number of bytes of memory this asset takes up while loaded, including GPU and audio device memory.
+    /// Used by the Asset API memory budget. The default implementation returns 0, which means the asset is not accounted for.
+    virtual size_t MemoryUsage() const { return 0; }
+
+    /// Returns true if something outside the Asset API, e.g. an Ogre entity holding the Ogre resource of this asset, still uses the contents of this asset.
+    /// The Asset API never unloads such assets to meet its memory budget. The default implementation returns false.
+    virtual bool HasExternalReferences() const { return false; }
+
     /// Handle load error, override this in subclasses if you want to do more inspecting before printing error.
     /// If you failed the load command in your asset subclass due to some reason (eg. headless) and it was intentional, you can skip the print if youd like.
     virtual void HandleLoadError(const QString &loadError);
@@ -173,6 +181,12 @@ protected:
     /// Boolean if assets content hash has changed.
     /// @note This is reseted to false always after Loaded() signal is emitted.
     bool contentHashChanged;
+
+private:
+    friend class AssetAPI;
+
+    /// The value of the Asset API access counter at the time this asset was last requested. Used to unload assets in least recently used order.
+    u64 lastAccessStamp;
 };
 
 #endif
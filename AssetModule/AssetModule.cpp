@@ -13,6 +13,7 @@
 #include "CoreException.h"
 #include "AssetAPI.h"
 #include "ConsoleAPI.h"
+#include "CoreStringUtils.h"
 
 #include <QDir>
 
@@ -59,6 +60,14 @@ namespace Asset
             "AddHttpStorage", "Adds a new Http asset storage to the known storages. Usage: AddHttpStorage(url, name)", 
             ConsoleBind(this, &AssetModule::AddHttpStorage)));
 
+        framework_->Console()->RegisterCommand(CreateConsoleCommand(
+            "AssetMemory", "Prints the memory used by loaded assets, by asset type. Usage: AssetMemory",
+            ConsoleBind(this, &AssetModule::ConsoleAssetMemory)));
+
+        framework_->Console()->RegisterCommand(CreateConsoleCommand(
+            "SetAssetMemoryBudget", "Sets the amount of memory loaded assets may take up before unreferenced assets are unloaded. Usage: SetAssetMemoryBudget(megabytes). Pass 0 for unlimited.",
+            ConsoleBind(this, &AssetModule::ConsoleSetAssetMemoryBudget)));
+
         ProcessCommandLineOptions();
     }
 
@@ -68,6 +77,13 @@ namespace Asset
 
         const boost::program_options::variables_map &options = framework_->ProgramOptions();
 
+        if (options.count("assetmemorybudget") > 0)
+        {
+            int megabytes = options["assetmemorybudget"].as<int>();
+            if (megabytes > 0)
+                framework_->Asset()->SetMemoryBudget((size_t)megabytes * 1024 * 1024);
+        }
+
         if (options.count("file") > 0)
         {
             std::string startup_scene_ = QString(options["file"].as<std::string>().c_str()).trimmed().toStdString();
@@ -136,6 +152,38 @@ namespace Asset
         framework_->Asset()->AddAssetStorage(params[0].c_str(), params[1].c_str(), true);       
         return ConsoleResultSuccess();
     }
+
+    ConsoleCommandResult AssetModule::ConsoleAssetMemory(const StringVector &params)
+    {
+        AssetAPI *asset = framework_->Asset();
+        AssetAPI::AssetTypeMemoryUsageMap usage = asset->MemoryUsageByType();
+
+        size_t totalBytes = 0;
+        framework_->Console()->Print("Asset memory usage by type (loaded/total assets, KB):");
+        for(AssetAPI::AssetTypeMemoryUsageMap::iterator iter = usage.begin(); iter != usage.end(); ++iter)
+        {
+            framework_->Console()->Print(QString("  %1: %2/%3 assets, %4 KB").arg(iter->first).arg(iter->second.numLoaded)
+                .arg(iter->second.numAssets).arg(iter->second.numBytes / 1024));
+            totalBytes += iter->second.numBytes;
+        }
+
+        QString budget = asset->MemoryBudget() > 0 ? QString::number(asset->MemoryBudget() / (1024 * 1024)) + " MB" : QString("unlimited");
+        framework_->Console()->Print(QString("Total: %1 KB, budget: %2").arg(totalBytes / 1024).arg(budget));
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult AssetModule::ConsoleSetAssetMemoryBudget(const StringVector &params)
+    {
+        if (params.size() != 1)
+            return ConsoleResultFailure("Usage: SetAssetMemoryBudget(megabytes)");
+
+        int megabytes = ParseString<int>(params[0], -1);
+        if (megabytes < 0)
+            return ConsoleResultFailure("Usage: SetAssetMemoryBudget(megabytes)");
+
+        framework_->Asset()->SetMemoryBudget((size_t)megabytes * 1024 * 1024);
+        return ConsoleResultSuccess();
+    }
 }
 
 extern "C" void POCO_LIBRARY_API SetProfiler(Foundation::Profiler *profiler);
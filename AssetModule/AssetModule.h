@@ -30,6 +30,16 @@ namespace Asset
         virtual void Initialize();
         virtual void PostInitialize();
 
+        //! The module has no update of its own. The asset transfers are processed by AssetAPI::Update on the main thread,
+        //! after the module updates, because the providers use QNetworkAccessManager and the loaded assets create Ogre resources.
+        virtual ModuleUpdateInfo UpdateInfo() const
+        {
+            ModuleUpdateInfo info;
+            info.reads = MUA_None;
+            info.writes = MUA_None;
+            return info;
+        }
+
         MODULE_LOGGING_FUNCTIONS
 
         //! callback for console command
@@ -37,6 +47,12 @@ namespace Asset
 
         ConsoleCommandResult AddHttpStorage(const StringVector &params);
 
+        //! Prints the memory used by loaded assets, broken down by asset type.
+        ConsoleCommandResult ConsoleAssetMemory(const StringVector &params);
+
+        //! Sets the asset memory budget in megabytes.
+        ConsoleCommandResult ConsoleSetAssetMemoryBudget(const StringVector &params);
+
         //! returns name of this module. Needed for logging.
         static const std::string &NameStatic() { return type_name_static_; }
 
@@ -137,3 +137,13 @@ bool AudioAsset::IsLoaded() const
 {
     return handle != 0;
 }
+
+size_t AudioAsset::MemoryUsage() const
+{
+    if (!handle)
+        return 0;
+
+    ALint size = 0;
+    alGetBufferi(handle, AL_SIZE, &size);
+    return size > 0 ? (size_t)size : 0;
+}
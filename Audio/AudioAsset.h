@@ -47,6 +47,9 @@ public:
 
     bool IsLoaded() const;
 
+    /// Returns the size of the OpenAL audio buffer.
+    virtual size_t MemoryUsage() const;
+
 private:
     /// The actual sound data is stored in an OpenAL internal audio buffer. This handle specifies the buffer.
     /// If == 0, then this AudioAsset is unloaded.
@@ -29,6 +29,8 @@ public:
     virtual void DependencyLoaded(AssetPtr dependee);
     //! Check if asset is loaded. Checks only XML data size
     bool IsLoaded() const;
+    //! Return the size of the stored appearance XML data
+    virtual size_t MemoryUsage() const { return avatarAppearanceXML_.size() * sizeof(QChar); }
 
 private:
     //! Asset references have changed. (Re)request them and trigger appearance changed when all are loaded
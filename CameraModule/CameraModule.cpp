@@ -53,6 +53,8 @@ namespace Camera
 
         //Get Scene and Network event Category 
         scene_event_category_ = framework_->GetEventManager()->QueryEventCategory("Scene");
+        framework_->GetEventManager()->RegisterEventInterest(this, scene_event_category_, Scene::Events::EVENT_ENTITY_CLICKED);
+        framework_->GetEventManager()->RegisterEventInterest(this, scene_event_category_, Scene::Events::EVENT_ENTITY_NONE_CLICKED);
 		connect(framework_->Scene(), SIGNAL(DefaultWorldSceneChanged(Scene::SceneManager *)), SLOT(DefaultWorldSceneChanged(Scene::SceneManager *)));        
 
         framework_->Ui()->RegisterUiWidgetFactory(UiWidgetFactoryPtr(this));
@@ -34,8 +34,10 @@
 #include "InputAPI.h"
 #include "UiAPI.h"
 #include "UiMainWindow.h"
+#include "Platform.h"
 
 #include <utility>
+#include <fstream>
 #include <QDebug>
 
 #ifdef Q_WS_WIN
@@ -63,7 +65,10 @@ DebugStatsModule::DebugStatsModule() :
     profilerWindow_(0),
     profilerWidget_(0),
     participantWindow_(0),
-    godMode_(false)
+    godMode_(false),
+    processMetrics_(600),
+    processMetricsInterval_(1.0),
+    timeSinceProcessMetrics_(0.0)
 {
 }
 
@@ -110,6 +115,30 @@ void DebugStatsModule::PostInitialize()
         "Invokes action execution in entity",
         ConsoleBind(this, &DebugStatsModule::Exec)));
 
+    framework_->Console()->RegisterCommand(CreateConsoleCommand("ProcessStats",
+        "Outputs the latest CPU, memory, I/O and context switch metrics of the process. "
+        "Usage: ProcessStats(), ProcessStats(perf) to enable the perf counters, ProcessStats(interval, seconds) to set the sampling interval.",
+        ConsoleBind(this, &DebugStatsModule::ShowProcessStats)));
+
+    framework_->Console()->RegisterCommand(CreateConsoleCommand("ProcessStatsDump",
+        "Writes the sampled process metrics as comma-separated values. Usage: ProcessStatsDump(filename). "
+        "Default: processstats.csv in the application data directory.",
+        ConsoleBind(this, &DebugStatsModule::DumpProcessStats)));
+
+    const boost::program_options::variables_map &options = framework_->ProgramOptions();
+    if (options.count("processstatsfile") > 0 && ProcessMetrics::IsSupported())
+    {
+        processStatsFile_ = options["processstatsfile"].as<std::string>();
+        std::ofstream file(processStatsFile_.c_str(), std::ios::out | std::ios::trunc);
+        if (file.is_open())
+            file << ProcessMetrics::ColumnNames() << std::endl;
+        else
+        {
+            LogError("Could not open process stats file " + processStatsFile_);
+            processStatsFile_.clear();
+        }
+    }
+
     frameworkEventCategory_ = framework_->GetEventManager()->QueryEventCategory("Framework");
 
     inputContext = framework_->Input()->RegisterInputContext("DebugStatsInput", 90);
@@ -197,6 +226,21 @@ void DebugStatsModule::Update(f64 frametime)
 {
     RESETPROFILER;
 
+    if (ProcessMetrics::IsSupported() && processMetricsInterval_ > 0.0)
+    {
+        timeSinceProcessMetrics_ += frametime;
+        bool sample = timeSinceProcessMetrics_ >= processMetricsInterval_;
+#ifdef PROFILING
+        // Sample every frame of a profiler capture, so that the counters show up in the captured timeline.
+        sample = sample || framework_->GetProfiler().IsCapturing();
+#endif
+        if (sample)
+        {
+            timeSinceProcessMetrics_ = 0.0;
+            SampleProcessMetrics();
+        }
+    }
+
 #ifdef _WINDOWS
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
@@ -328,6 +372,115 @@ bool DebugStatsModule::HandleEvent(event_category_id_t category_id, event_id_t e
     return false;
 }
 
+void DebugStatsModule::SampleProcessMetrics()
+{
+    PROFILE(DebugStats_SampleProcessMetrics);
+
+    if (!processMetrics_.Sample())
+        return;
+
+    const ProcessMetricsSample &sample = processMetrics_.Latest();
+    if (!processStatsFile_.empty())
+    {
+        std::ofstream file(processStatsFile_.c_str(), std::ios::out | std::ios::app);
+        file << ProcessMetrics::FormatSample(sample) << std::endl;
+    }
+
+#ifdef PROFILING
+    Foundation::Profiler &profiler = framework_->GetProfiler();
+    if (profiler.IsCapturing())
+    {
+        profiler.RecordCounter("Process resident MB", sample.residentBytes / (1024.0 * 1024.0));
+        profiler.RecordCounter("Process CPU seconds", sample.userCpuTime + sample.systemCpuTime);
+        profiler.RecordCounter("Process context switches", (double)(sample.voluntaryContextSwitches + sample.involuntaryContextSwitches));
+        profiler.RecordCounter("Process page faults", (double)(sample.minorFaults + sample.majorFaults));
+        if (sample.hasPerfCounters)
+        {
+            profiler.RecordCounter("Process cycles", (double)sample.cycles);
+            profiler.RecordCounter("Process cache misses", (double)sample.cacheMisses);
+        }
+
+        Foundation::AllocationTracker *allocations = Foundation::AllocationTracker::Instance();
+        if (allocations)
+            for(int tag = 0; tag < Foundation::NumAllocationTags; ++tag)
+                profiler.RecordCounter(std::string("Allocations/frame ") + Foundation::AllocationTracker::TagName(tag), (double)allocations->LastFrame(tag).numAllocs);
+    }
+#endif
+}
+
+ConsoleCommandResult DebugStatsModule::ShowProcessStats(const StringVector &params)
+{
+    if (!ProcessMetrics::IsSupported())
+        return ConsoleResultFailure("Process metrics are only supported on Linux.");
+
+    if (params.size() > 0 && params[0] == "perf")
+    {
+        if (!processMetrics_.EnablePerfCounters())
+            return ConsoleResultFailure(processMetrics_.Error());
+        if (!processMetrics_.Error().empty())
+            return ConsoleResultSuccess("Some perf counters are unavailable: " + processMetrics_.Error());
+        return ConsoleResultSuccess("Perf counters enabled.");
+    }
+    if (params.size() > 1 && params[0] == "interval")
+    {
+        processMetricsInterval_ = std::max(0.0, ParseString<double>(params[1], 1.0));
+        return ConsoleResultSuccess("Process metrics sampling interval set to " + params[1] + " seconds.");
+    }
+
+    // Take a fresh sample, so that the output is up to date even with a long sampling interval.
+    SampleProcessMetrics();
+    const size_t numSamples = processMetrics_.NumSamples();
+    if (numSamples == 0)
+        return ConsoleResultFailure("Could not sample process metrics: " + processMetrics_.Error());
+
+    // Compute the rates over at least a second, if the history allows.
+    const ProcessMetricsSample &latest = processMetrics_.Latest();
+    size_t previousIndex = numSamples - 1;
+    while(previousIndex > 0 && latest.time - processMetrics_.GetSample(previousIndex).time < 1.0)
+        --previousIndex;
+    const ProcessMetricsSample &previous = processMetrics_.GetSample(previousIndex);
+    const double interval = latest.time - previous.time;
+    ConsoleAPI *console = framework_->Console();
+    char str[256];
+    sprintf(str, "Memory: %.1f MB resident, %.1f MB virtual, %d threads", latest.residentBytes / (1024.0 * 1024.0),
+        latest.virtualBytes / (1024.0 * 1024.0), latest.numThreads);
+    console->Print(str);
+    sprintf(str, "CPU time: %.2f s user, %.2f s system", latest.userCpuTime, latest.systemCpuTime);
+    console->Print(str);
+    sprintf(str, "Page faults: %llu minor, %llu major. Context switches: %llu voluntary, %llu involuntary",
+        (unsigned long long)latest.minorFaults, (unsigned long long)latest.majorFaults,
+        (unsigned long long)latest.voluntaryContextSwitches, (unsigned long long)latest.involuntaryContextSwitches);
+    console->Print(str);
+    sprintf(str, "Storage I/O: %.1f MB read, %.1f MB written", latest.readBytes / (1024.0 * 1024.0), latest.writeBytes / (1024.0 * 1024.0));
+    console->Print(str);
+    if (latest.hasPerfCounters)
+    {
+        sprintf(str, "Perf counters: %llu cycles, %llu cache misses, %llu page faults", (unsigned long long)latest.cycles,
+            (unsigned long long)latest.cacheMisses, (unsigned long long)latest.pageFaults);
+        console->Print(str);
+    }
+    if (interval > 0.0)
+    {
+        sprintf(str, "Over the last %.2f s: %.1f%% CPU, %.0f context switches/s, %.0f page faults/s", interval,
+            100.0 * (latest.userCpuTime + latest.systemCpuTime - previous.userCpuTime - previous.systemCpuTime) / interval,
+            (double)(latest.voluntaryContextSwitches + latest.involuntaryContextSwitches - previous.voluntaryContextSwitches - previous.involuntaryContextSwitches) / interval,
+            (double)(latest.minorFaults + latest.majorFaults - previous.minorFaults - previous.majorFaults) / interval);
+        console->Print(str);
+    }
+    return ConsoleResultSuccess();
+}
+
+ConsoleCommandResult DebugStatsModule::DumpProcessStats(const StringVector &params)
+{
+    if (!ProcessMetrics::IsSupported())
+        return ConsoleResultFailure("Process metrics are only supported on Linux.");
+
+    const std::string filename = params.size() > 0 ? params[0] : framework_->GetPlatform()->GetApplicationDataDirectory() + "/processstats.csv";
+    if (!processMetrics_.WriteStatsFile(filename))
+        return ConsoleResultFailure("Could not write " + filename);
+    return ConsoleResultSuccess("Wrote " + ToString(processMetrics_.NumSamples()) + " samples to " + filename);
+}
+
 ConsoleCommandResult DebugStatsModule::SendRandomNetworkInPacket(const StringVector &params)
 {
     if (params.size() == 0)
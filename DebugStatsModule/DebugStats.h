@@ -15,6 +15,7 @@
 #include "ModuleLoggingFunctions.h"
 #include "RexTypes.h"
 #include "UiWidget.h"
+#include "ProcessMetrics.h"
 
 #include <QObject>
 #include <QPointer>
@@ -92,6 +93,15 @@ namespace DebugStats
         /// Invokes action in entity.
         ConsoleCommandResult Exec(const StringVector &params);
 
+        /// Outputs the latest process metrics, or changes how they are sampled.
+        ConsoleCommandResult ShowProcessStats(const StringVector &params);
+
+        /// Writes the sampled process metrics to a file.
+        ConsoleCommandResult DumpProcessStats(const StringVector &params);
+
+        /// Samples the process metrics, appends the sample to the stats file and records it to the profiler capture.
+        void SampleProcessMetrics();
+
         /// A history of estimated frame times.
         std::vector<std::pair<uint64_t, double> > frameTimes;
 
@@ -129,6 +139,18 @@ namespace DebugStats
 
         /// Is god mode on.
         bool godMode_;
+
+        /// CPU, memory and I/O metrics of the process.
+        ProcessMetrics processMetrics_;
+
+        /// Interval of sampling the process metrics, in seconds. 0 disables sampling.
+        f64 processMetricsInterval_;
+
+        /// Time since the process metrics were last sampled, in seconds.
+        f64 timeSinceProcessMetrics_;
+
+        /// File each process metrics sample is appended to, if set.
+        std::string processStatsFile_;
     };
 }
 
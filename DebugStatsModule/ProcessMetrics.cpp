@@ -0,0 +1,306 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ProcessMetrics.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+namespace DebugStats
+{
+
+namespace
+{
+    /// The perf counters sampled by ProcessMetrics.
+    enum PerfCounterType
+    {
+        PerfCycles,
+        PerfCacheMisses,
+        PerfPageFaults,
+        NumPerfCounterTypes
+    };
+
+    const ProcessMetricsSample cEmptySample;
+
+#ifdef __linux__
+    /// Returns the value following the given key in a "Key: value" file such as /proc/self/status, or 0 if not found.
+    boost::uint64_t ReadKeyValue(const std::string &contents, const char *key)
+    {
+        size_t pos = contents.find(key);
+        if (pos == std::string::npos)
+            return 0;
+        std::istringstream value(contents.substr(pos + strlen(key)));
+        boost::uint64_t result = 0;
+        value >> result;
+        return result;
+    }
+
+    /// Reads a whole /proc file. Returns an empty string if it could not be read.
+    std::string ReadProcFile(const char *filename)
+    {
+        std::ifstream file(filename);
+        if (!file.is_open())
+            return std::string();
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    int OpenPerfCounter(PerfCounterType type, pid_t thread)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        switch(type)
+        {
+        case PerfCycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfCacheMisses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        }
+        // Count the threads the thread creates as well, and only user mode, which is allowed with the default paranoid setting.
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attr, thread, -1, -1, 0);
+    }
+#endif
+}
+
+ProcessMetricsSample::ProcessMetricsSample() :
+    time(0.0),
+    userCpuTime(0.0),
+    systemCpuTime(0.0),
+    residentBytes(0),
+    virtualBytes(0),
+    numThreads(0),
+    minorFaults(0),
+    majorFaults(0),
+    voluntaryContextSwitches(0),
+    involuntaryContextSwitches(0),
+    readBytes(0),
+    writeBytes(0),
+    hasPerfCounters(false),
+    cycles(0),
+    cacheMisses(0),
+    pageFaults(0)
+{
+}
+
+ProcessMetrics::ProcessMetrics(size_t historySize) :
+    samples_(std::max<size_t>(historySize, 1)),
+    next_(0),
+    numSamples_(0),
+    clockTicks_(100),
+    pageSize_(4096),
+    startTime_(GetCurrentClockTime())
+{
+#ifdef __linux__
+    clockTicks_ = sysconf(_SC_CLK_TCK);
+    pageSize_ = sysconf(_SC_PAGESIZE);
+#endif
+}
+
+ProcessMetrics::~ProcessMetrics()
+{
+    DisablePerfCounters();
+}
+
+bool ProcessMetrics::IsSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ProcessMetrics::EnablePerfCounters()
+{
+#ifdef __linux__
+    DisablePerfCounters();
+    error_.clear();
+
+    // A counter opened for a thread only covers the threads it creates afterwards, so open one for each thread that exists now.
+    std::vector<pid_t> threads;
+    DIR *dir = opendir("/proc/self/task");
+    if (dir)
+    {
+        while(dirent *entry = readdir(dir))
+            if (entry->d_name[0] != '.')
+                threads.push_back((pid_t)atoi(entry->d_name));
+        closedir(dir);
+    }
+    if (threads.empty())
+        threads.push_back(getpid());
+
+    for(int type = 0; type < NumPerfCounterTypes; ++type)
+        for(size_t i = 0; i < threads.size(); ++i)
+        {
+            int fd = OpenPerfCounter((PerfCounterType)type, threads[i]);
+            if (fd < 0)
+            {
+                error_ = std::string("perf_event_open failed: ") + strerror(errno) + ". Check /proc/sys/kernel/perf_event_paranoid.";
+                continue;
+            }
+            PerfCounter counter = { type, fd };
+            perfCounters_.push_back(counter);
+        }
+
+    return !perfCounters_.empty();
+#else
+    error_ = "Perf counters are only supported on Linux.";
+    return false;
+#endif
+}
+
+void ProcessMetrics::DisablePerfCounters()
+{
+#ifdef __linux__
+    for(size_t i = 0; i < perfCounters_.size(); ++i)
+        close(perfCounters_[i].fd);
+#endif
+    perfCounters_.clear();
+}
+
+boost::uint64_t ProcessMetrics::ReadPerfCounter(int type) const
+{
+    boost::uint64_t total = 0;
+#ifdef __linux__
+    for(size_t i = 0; i < perfCounters_.size(); ++i)
+    {
+        boost::uint64_t value = 0;
+        if (perfCounters_[i].type == type && read(perfCounters_[i].fd, &value, sizeof(value)) == sizeof(value))
+            total += value;
+    }
+#endif
+    return total;
+}
+
+bool ProcessMetrics::Sample()
+{
+#ifdef __linux__
+    ProcessMetricsSample sample;
+    sample.time = (double)(GetCurrentClockTime() - startTime_) / (double)GetCurrentClockFreq();
+
+    // The command name in parentheses may contain spaces, so parse the fields after it.
+    std::string stat = ReadProcFile("/proc/self/stat");
+    size_t end = stat.rfind(')');
+    if (end == std::string::npos)
+    {
+        error_ = "Could not read /proc/self/stat.";
+        return false;
+    }
+    std::istringstream fields(stat.substr(end + 2));
+    std::string state;
+    long ignored = 0;
+    unsigned long minorFaults = 0, majorFaults = 0, userTicks = 0, systemTicks = 0, virtualBytes = 0;
+    long numThreads = 0, residentPages = 0;
+    fields >> state >> ignored >> ignored >> ignored >> ignored >> ignored >> ignored // ppid, pgrp, session, tty_nr, tpgid, flags
+        >> minorFaults >> ignored >> majorFaults >> ignored >> userTicks >> systemTicks // cminflt, cmajflt in between
+        >> ignored >> ignored >> ignored >> ignored >> numThreads >> ignored >> ignored // cutime, cstime, priority, nice, itrealvalue, starttime
+        >> virtualBytes >> residentPages;
+
+    sample.minorFaults = minorFaults;
+    sample.majorFaults = majorFaults;
+    sample.userCpuTime = (double)userTicks / clockTicks_;
+    sample.systemCpuTime = (double)systemTicks / clockTicks_;
+    sample.numThreads = (int)numThreads;
+    sample.virtualBytes = virtualBytes;
+    sample.residentBytes = (boost::uint64_t)residentPages * pageSize_;
+
+    std::string status = ReadProcFile("/proc/self/status");
+    sample.voluntaryContextSwitches = ReadKeyValue(status, "\nvoluntary_ctxt_switches:");
+    sample.involuntaryContextSwitches = ReadKeyValue(status, "\nnonvoluntary_ctxt_switches:");
+
+    // /proc/self/io is missing if the kernel was built without task I/O accounting.
+    std::string io = ReadProcFile("/proc/self/io");
+    sample.readBytes = ReadKeyValue(io, "\nread_bytes:");
+    sample.writeBytes = ReadKeyValue(io, "\nwrite_bytes:");
+
+    if (!perfCounters_.empty())
+    {
+        sample.hasPerfCounters = true;
+        sample.cycles = ReadPerfCounter(PerfCycles);
+        sample.cacheMisses = ReadPerfCounter(PerfCacheMisses);
+        sample.pageFaults = ReadPerfCounter(PerfPageFaults);
+    }
+
+    samples_[next_] = sample;
+    next_ = (next_ + 1) % samples_.size();
+    numSamples_ = std::min(numSamples_ + 1, samples_.size());
+    return true;
+#else
+    return false;
+#endif
+}
+
+const ProcessMetricsSample &ProcessMetrics::GetSample(size_t index) const
+{
+    if (index >= numSamples_)
+        return cEmptySample;
+    return samples_[(next_ + samples_.size() - numSamples_ + index) % samples_.size()];
+}
+
+const ProcessMetricsSample &ProcessMetrics::Latest() const
+{
+    return numSamples_ > 0 ? GetSample(numSamples_ - 1) : cEmptySample;
+}
+
+std::string ProcessMetrics::ColumnNames()
+{
+    return "time,user_cpu_s,system_cpu_s,resident_bytes,virtual_bytes,threads,minor_faults,major_faults,"
+        "voluntary_ctx_switches,involuntary_ctx_switches,read_bytes,write_bytes,cycles,cache_misses,page_faults";
+}
+
+std::string ProcessMetrics::FormatSample(const ProcessMetricsSample &sample)
+{
+    std::ostringstream line;
+    line << sample.time << "," << sample.userCpuTime << "," << sample.systemCpuTime << "," << sample.residentBytes << ","
+         << sample.virtualBytes << "," << sample.numThreads << "," << sample.minorFaults << "," << sample.majorFaults << ","
+         << sample.voluntaryContextSwitches << "," << sample.involuntaryContextSwitches << "," << sample.readBytes << ","
+         << sample.writeBytes << ",";
+    if (sample.hasPerfCounters)
+        line << sample.cycles << "," << sample.cacheMisses << "," << sample.pageFaults;
+    else
+        line << ",,";
+    return line.str();
+}
+
+bool ProcessMetrics::WriteStatsFile(const std::string &filename) const
+{
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    file << ColumnNames() << std::endl;
+    for(size_t i = 0; i < numSamples_; ++i)
+        file << FormatSample(GetSample(i)) << std::endl;
+    return file.good();
+}
+
+}
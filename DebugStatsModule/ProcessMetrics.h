@@ -0,0 +1,140 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_DebugStats_ProcessMetrics_h
+#define incl_DebugStats_ProcessMetrics_h
+
+#include "HighPerfClock.h"
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+#include <string>
+
+namespace DebugStats
+{
+    /// One sample of the resource usage of the process. The counts are cumulative since the start of the process (or since
+    /// the perf counters were enabled), so the usage during an interval is the difference of two samples.
+    struct ProcessMetricsSample
+    {
+        ProcessMetricsSample();
+
+        /// Time of the sample, in seconds since the ProcessMetrics object was created.
+        double time;
+        /// CPU time spent in user mode, in seconds.
+        double userCpuTime;
+        /// CPU time spent in kernel mode, in seconds.
+        double systemCpuTime;
+        /// Resident set size, in bytes.
+        boost::uint64_t residentBytes;
+        /// Virtual memory size, in bytes.
+        boost::uint64_t virtualBytes;
+        /// Number of threads.
+        int numThreads;
+        /// Page faults that did not need disk access.
+        boost::uint64_t minorFaults;
+        /// Page faults that needed disk access.
+        boost::uint64_t majorFaults;
+        /// Context switches where a thread gave up the CPU, e.g. to wait for a lock or I/O.
+        boost::uint64_t voluntaryContextSwitches;
+        /// Context switches where a thread was preempted.
+        boost::uint64_t involuntaryContextSwitches;
+        /// Bytes fetched from storage.
+        boost::uint64_t readBytes;
+        /// Bytes sent to storage.
+        boost::uint64_t writeBytes;
+
+        /// True if the perf counters below are valid.
+        bool hasPerfCounters;
+        /// CPU cycles spent in user mode.
+        boost::uint64_t cycles;
+        /// Last level cache misses.
+        boost::uint64_t cacheMisses;
+        /// Page faults, as counted by the perf subsystem.
+        boost::uint64_t pageFaults;
+    };
+
+    /// Samples the CPU, memory, I/O and context switch metrics of the process into a ring buffer.
+    /** On Linux, the metrics are read from /proc/self/stat, /proc/self/status and /proc/self/io. Hardware counters for CPU
+        cycles and cache misses can additionally be enabled with EnablePerfCounters(), which uses perf_event_open and may be
+        denied by the kernel.perf_event_paranoid setting. On other platforms sampling is not supported and Sample() does nothing.
+
+        Reading the /proc files takes some tens of microseconds, so sample at most a few times per second.
+    */
+    class ProcessMetrics
+    {
+    public:
+        /// @param historySize The number of samples kept in the ring buffer.
+        explicit ProcessMetrics(size_t historySize);
+        ~ProcessMetrics();
+
+        /// Returns true if process metrics can be sampled on this platform.
+        static bool IsSupported();
+
+        /// Opens the perf counters for all threads of the process, including the threads created later.
+        /** @return True if at least one of the counters could be opened. On failure, Error() describes the reason.
+        */
+        bool EnablePerfCounters();
+
+        /// Closes the perf counters.
+        void DisablePerfCounters();
+
+        /// Returns true if the perf counters are enabled.
+        bool PerfCountersEnabled() const { return !perfCounters_.empty(); }
+
+        /// Returns the description of the last failure.
+        const std::string &Error() const { return error_; }
+
+        /// Takes a new sample and appends it to the ring buffer, overwriting the oldest sample if the buffer is full.
+        /** @return False if the metrics could not be read.
+        */
+        bool Sample();
+
+        /// Returns the number of samples in the ring buffer.
+        size_t NumSamples() const { return numSamples_; }
+
+        /// Returns a sample from the ring buffer. 0 is the oldest sample and NumSamples() - 1 the newest.
+        const ProcessMetricsSample &GetSample(size_t index) const;
+
+        /// Returns the newest sample, or a zero sample if there are none.
+        const ProcessMetricsSample &Latest() const;
+
+        /// Returns the names of the columns written by FormatSample(), separated by commas.
+        static std::string ColumnNames();
+
+        /// Formats a sample as a line of comma-separated values, without a line break.
+        static std::string FormatSample(const ProcessMetricsSample &sample);
+
+        /// Writes all the samples in the ring buffer to the given file as comma-separated values.
+        bool WriteStatsFile(const std::string &filename) const;
+
+    private:
+        ProcessMetrics(const ProcessMetrics &); // N/I
+        ProcessMetrics &operator=(const ProcessMetrics &); // N/I
+
+        /// Reads a perf counter, summing up the per-thread counters.
+        boost::uint64_t ReadPerfCounter(int type) const;
+
+        /// A counter opened for a single thread.
+        struct PerfCounter
+        {
+            /// Index of the counter type, see the PerfCounterType enum in the source.
+            int type;
+            int fd;
+        };
+
+        std::vector<ProcessMetricsSample> samples_;
+        /// Index of the next sample to write in samples_.
+        size_t next_;
+        size_t numSamples_;
+        std::vector<PerfCounter> perfCounters_;
+        std::string error_;
+        /// Clock ticks per second, used to convert CPU times.
+        long clockTicks_;
+        /// Page size in bytes.
+        long pageSize_;
+        /// Creation time of the object.
+        tick_t startTime_;
+    };
+}
+
+#endif
@@ -2081,6 +2081,20 @@ void TimeProfilerWindow::RefreshSceneComplexityProfilingData()
     
     text << "# of loaded skeletons: " << GetNumResources(Ogre::SkeletonManager::getSingleton()) << std::endl;
     text << std::endl;
+
+    Foundation::AllocationTracker *allocations = Foundation::AllocationTracker::Instance();
+    if (allocations)
+    {
+        text << "Allocations (last frame / live)" << std::endl;
+        for(int tag = 0; tag < Foundation::NumAllocationTags; ++tag)
+        {
+            const Foundation::AllocationCounters &frame = allocations->LastFrame(tag);
+            const Foundation::AllocationCounters totals = allocations->Totals(tag);
+            text << Foundation::AllocationTracker::TagName(tag) << ": " << frame.numAllocs << " allocs, " << frame.bytesAllocated / 1024
+                 << " KBytes / " << totals.LiveObjects() << " objects, " << totals.LiveBytes() / 1024 << " KBytes" << std::endl;
+        }
+        text << std::endl;
+    }
     
     // Update only if no selection
     QTextCursor cursor(text_scenecomplexity_->textCursor());
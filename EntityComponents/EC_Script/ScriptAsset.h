@@ -38,6 +38,8 @@ public:
 
     bool IsLoaded() const;
 
+    virtual size_t MemoryUsage() const { return scriptContent.size() * sizeof(QChar); }
+
 private slots:
     /// Parse internal references from script
     void ParseReferences();
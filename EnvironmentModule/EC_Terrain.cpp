@@ -20,10 +20,18 @@
 #include "OgreConversionUtils.h"
 #include "LoggingFunctions.h"
 #include "TextureAsset.h"
+#include "Framework.h"
+#include "JobSystem.h"
+#include "HighPerfClock.h"
+#include "FrameAPI.h"
+#include "TerrainIndexBuffers.h"
 DEFINE_POCO_LOGGING_FUNCTIONS("EC_Terrain")
 
 #include <Ogre.h>
 #include <utility>
+#include <algorithm>
+#include <sstream>
+#include <boost/bind.hpp>
 
 using namespace std;
 using namespace OgreRenderer;
@@ -52,9 +60,14 @@ EC_Terrain::EC_Terrain(IModule* module) :
     vScale(this, "Tex. V scale"),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    rootNode(0),
+    batchWidth(1),
+    batchHeight(1),
+    lodDistance(64.f)
 {
     QObject::connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
+    connect(framework_->Frame(), SIGNAL(Updated(float)), this, SLOT(UpdateLod()));
+    connect(framework_->Frame(), SIGNAL(Updated(float)), this, SLOT(LoadPendingPatches()));
 
     static AttributeMetadata heightRefMetadata;
     AttributeMetadata::ButtonInfoList heightRefButtons;
@@ -95,6 +108,7 @@ EC_Terrain::EC_Terrain(IModule* module) :
     xPatches.Set(1, AttributeChange::Disconnected);
     yPatches.Set(1, AttributeChange::Disconnected);
     patches.resize(1);
+    batches.resize(1);
     MakePatchFlat(0, 0, 0.f);
     uScale.Set(0.13f, AttributeChange::Disconnected);
     vScale.Set(0.13f, AttributeChange::Disconnected);
@@ -160,6 +174,9 @@ void EC_Terrain::UpdateSignals()
 
 void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
 {
+    // Otherwise, if the patch is still waiting in the streamed terrain file, decoding it later would replace the new heights.
+    DiscardPendingPatch(y * patchWidth + x);
+
     Patch &patch = GetPatch(x, y);
     patch.heightData.clear();
     patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
@@ -168,6 +185,7 @@ void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
 {
+    DiscardPendingPatches();
     for(int y = 0; y < this->yPatches.Get(); ++y)
         for(int x = 0; x < this->xPatches.Get(); ++x)
             MakePatchFlat(x, y, heightValue);
@@ -177,14 +195,22 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
 {
     PROFILE(EC_Terrain_ResizeTerrain);
 
-    const int maxPatchSize = 32;
-    // Do an artificial limit to a preset N patches per side. (This limit is way too large already for the current terrain vertex LOD management.)
+    const int maxPatchSize = 256;
+    // Do an artificial limit to a preset N patches per side.
     newPatchWidth = max(1, min(maxPatchSize, newPatchWidth));
     newPatchHeight = max(1, min(maxPatchSize, newPatchHeight));
 
     if (newPatchWidth == patchWidth && newPatchHeight == patchHeight)
         return;
 
+    // The patches still streaming in are tracked by their index, which is about to change.
+    DecodePendingPatches(pendingPatches.size());
+
+    // The batches are laid out by the patch grid, so recreate them all. This also puts the patch nodes back into the scene.
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+            DestroyBatch(x, y);
+
     // If the width changes, we need to also regenerate the old right-most column to generate the new seams. (If we are shrinking, this is not necessary)
     if (patchWidth < newPatchWidth)
         for(int y = 0; y < patchHeight; ++y)
@@ -213,6 +239,7 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
     int oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
     patchHeight = newPatchHeight;
+    ResizeBatches();
 
     // Init any new patches to flat planes with the given fixed height.
 
@@ -234,6 +261,14 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
         }
 }
 
+void EC_Terrain::ResizeBatches()
+{
+    batchWidth = (patchWidth + cBatchSize - 1) / cBatchSize;
+    batchHeight = (patchHeight + cBatchSize - 1) / cBatchSize;
+    batches.clear();
+    batches.resize(batchWidth * batchHeight);
+}
+
 void EC_Terrain::OnAttributeUpdated(IAttribute *attribute)
 {
     std::string changedAttribute = attribute->GetNameString();
@@ -320,6 +355,8 @@ void EC_Terrain::MaterialAssetLoaded(AssetPtr asset_)
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
             UpdateTerrainPatchMaterial(x, y);
+    for(size_t i = 0; i < batches.size(); ++i)
+        SetTileMaterial(batches[i].entity);
 /*
     // The material of the terrain has changed. Since we specify the textures of that material as attributes,
     // we need to re-apply the textures from the attributes to the new material we set.
@@ -400,10 +437,66 @@ void EC_Terrain::DestroyPatch(int x, int y)
         catch (...) {}
         patch.meshGeometryName = "";
     }
+
+    patch.vertexSpacing = 0;
+    patch.lodKey = -1;
+}
+
+/// Releases all GPU resources used for the given batch.
+void EC_Terrain::DestroyBatch(int batchX, int batchY)
+{
+    if (!BatchExists(batchX, batchY))
+        return;
+
+    // Put the patches of the batch back into the scene.
+    SetBatchDrawn(batchX, batchY, false);
+
+    if (!GetFramework())
+        return;
+
+    boost::shared_ptr<OgreRenderer::Renderer> renderer = GetFramework()->GetServiceManager()->GetService<OgreRenderer::Renderer>().lock();
+    if (!renderer) // Oops! Inconvenient dtor order - can't delete our own stuff since we can't get an instance to the owner.
+        return;
+
+    Ogre::SceneManager *sceneMgr = renderer->GetSceneManager();
+    if (!sceneMgr) // Oops! Same as above.
+        return;
+
+    PatchBatch &batch = GetBatch(batchX, batchY);
+
+    if (batch.node)
+    {
+        batch.node->detachAllObjects();
+        sceneMgr->destroySceneNode(batch.node);
+        batch.node = 0;
+    }
+    if (batch.entity)
+    {
+        sceneMgr->destroyEntity(batch.entity);
+        batch.entity = 0;
+    }
+
+    if (batch.meshGeometryName.length() > 0)
+    {
+        try
+        {
+            Ogre::MeshManager::getSingleton().remove(batch.meshGeometryName);
+        }
+        catch (...) {}
+        batch.meshGeometryName = "";
+    }
+
+    batch.batch_geometry_dirty = true;
+    batch.vertexSpacing = 0;
+    batch.lodKey = -1;
 }
 
 void EC_Terrain::Destroy()
 {
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+            DestroyBatch(x, y);
+
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
             DestroyPatch(x, y);
@@ -425,6 +518,8 @@ void EC_Terrain::Destroy()
         rootNode = 0;
     }
 
+    indexBuffers.reset();
+
     ///\todo Clear up materials and textures.
 }
 
@@ -439,7 +534,10 @@ float EC_Terrain::GetPoint(int x, int y) const
     if (y >= cPatchSize * patchHeight)
         y = cPatchSize * patchHeight - 1;
 
-    return GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
+    const Patch &patch = GetPatch(x / cPatchSize, y / cPatchSize);
+    if (patch.heightData.empty()) // The patch has not been loaded in yet.
+        return 0.f;
+    return patch.heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
 }
 
 void EC_Terrain::SetPointHeight(int x, int y, float height)
@@ -447,7 +545,15 @@ void EC_Terrain::SetPointHeight(int x, int y, float height)
     if (x < 0 || y < 0 || x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    Patch &patch = GetPatch(x / cPatchSize, y / cPatchSize);
+    if (patch.heightData.size() < cPatchSize*cPatchSize)
+    {
+        // The patch is still waiting in the streamed terrain file. Decode it first, so that its other heights are kept.
+        DecodePendingPatch((y / cPatchSize) * patchWidth + x / cPatchSize);
+        if (patch.heightData.size() < cPatchSize*cPatchSize)
+            return; // The patch has no heights to set.
+    }
+    patch.heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
 }
 
 namespace
@@ -723,6 +829,171 @@ Vector3df EC_Terrain::CalculateNormal(int x, int y, int xinside, int yinside) co
     return normal;
 }
 
+namespace
+{
+    /// Identifies the current terrain file format. The older format starts directly with the patch count, which is never this large.
+    const char cTerrainFileMagic[3] = { 'N', 'T', 'F' };
+    const u8 cTerrainFileVersion = 2;
+
+    /// The heights are quantized to this precision in the terrain files, unless the height range of a patch is too large for 16 bits of it.
+    const float cHeightPrecision = 0.001f;
+
+    /// The size of the header of a height block: the minimum and maximum height, and the number of bits per height.
+    const size_t cHeightBlockHeaderSize = 4 + 4 + 1;
+
+    /// The number of streamed patches to decode per frame.
+    const size_t cPatchesDecodedPerFrame = 256;
+
+    void WriteU32(std::vector<u8> &dst, u32 value)
+    {
+        for(int i = 0; i < 4; ++i)
+            dst.push_back((u8)(value >> (8 * i)));
+    }
+
+    void WriteFloat(std::vector<u8> &dst, float value)
+    {
+        u32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        WriteU32(dst, bits);
+    }
+
+    /// Reads a little-endian u32, regardless of the alignment of the data and the byte order of the CPU.
+    u32 ReadU32(const u8 *data)
+    {
+        return (u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24);
+    }
+
+    float ReadFloat(const u8 *data)
+    {
+        u32 bits = ReadU32(data);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    float QuantizationStep(float minHeight, float maxHeight)
+    {
+        return max(cHeightPrecision, (maxHeight - minHeight) / 65535.f);
+    }
+
+    /// Predicts a quantized height from the already coded heights to the left of and below it. Exact on planar slopes.
+    int PredictHeight(const std::vector<int> &heights, int x, int y)
+    {
+        const int N = EC_Terrain::cPatchSize;
+        if (x > 0 && y > 0)
+            return heights[y*N + x-1] + heights[(y-1)*N + x] - heights[(y-1)*N + x-1];
+        if (x > 0)
+            return heights[x-1];
+        if (y > 0)
+            return heights[(y-1)*N];
+        return 0;
+    }
+
+    /// Appends the height block of a patch: the height range, and the prediction errors of the quantized heights, bit-packed.
+    void EncodeHeightBlock(const std::vector<float> &heights, std::vector<u8> &dst)
+    {
+        const int N = EC_Terrain::cPatchSize;
+        const float minHeight = *std::min_element(heights.begin(), heights.end());
+        const float maxHeight = *std::max_element(heights.begin(), heights.end());
+        const float step = QuantizationStep(minHeight, maxHeight);
+
+        std::vector<int> quantized(N*N);
+        for(int i = 0; i < N*N; ++i)
+            quantized[i] = (int)((heights[i] - minHeight) / step + 0.5f);
+
+        // Map the signed errors to unsigned values that are small for small errors of either sign.
+        std::vector<u32> errors(N*N);
+        u32 allBits = 0;
+        for(int y = 0; y < N; ++y)
+            for(int x = 0; x < N; ++x)
+            {
+                const int error = quantized[y*N + x] - PredictHeight(quantized, x, y);
+                errors[y*N + x] = (error < 0) ? ((u32)(-error) << 1) - 1 : (u32)error << 1;
+                allBits |= errors[y*N + x];
+            }
+        u8 bits = 0;
+        while((allBits >> bits) != 0)
+            ++bits;
+
+        WriteFloat(dst, minHeight);
+        WriteFloat(dst, maxHeight);
+        dst.push_back(bits);
+
+        u64 pending = 0;
+        int pendingBits = 0;
+        for(int i = 0; i < N*N; ++i)
+        {
+            pending |= (u64)errors[i] << pendingBits;
+            pendingBits += bits;
+            while(pendingBits >= 8)
+            {
+                dst.push_back((u8)pending);
+                pending >>= 8;
+                pendingBits -= 8;
+            }
+        }
+        if (pendingBits > 0)
+            dst.push_back((u8)pending);
+    }
+
+    /// Decodes a height block written by EncodeHeightBlock. Returns false if the block is malformed.
+    bool DecodeHeightBlock(const u8 *data, size_t numBytes, std::vector<float> &heights)
+    {
+        const int N = EC_Terrain::cPatchSize;
+        if (numBytes < cHeightBlockHeaderSize)
+            return false;
+
+        const float minHeight = ReadFloat(data);
+        const float maxHeight = ReadFloat(data + 4);
+        const int bits = data[8];
+        if (bits > 24 || numBytes < cHeightBlockHeaderSize + (N*N*bits + 7) / 8)
+            return false;
+        const float step = QuantizationStep(minHeight, maxHeight);
+
+        std::vector<int> quantized(N*N);
+        heights.resize(N*N);
+        const u8 *src = data + cHeightBlockHeaderSize;
+        u64 pending = 0;
+        int pendingBits = 0;
+        for(int y = 0; y < N; ++y)
+            for(int x = 0; x < N; ++x)
+            {
+                while(pendingBits < bits)
+                {
+                    pending |= (u64)*src++ << pendingBits;
+                    pendingBits += 8;
+                }
+                const u32 code = (u32)(pending & ((1 << bits) - 1));
+                pending >>= bits;
+                pendingBits -= bits;
+
+                const int error = (code & 1) ? -(int)((code + 1) >> 1) : (int)(code >> 1);
+                quantized[y*N + x] = PredictHeight(quantized, x, y) + error;
+                heights[y*N + x] = minHeight + quantized[y*N + x] * step;
+            }
+        return true;
+    }
+
+    /// Orders patch indices by their distance to a point on the patch grid.
+    struct NearerPatch
+    {
+        NearerPatch(float x, float y, int patchWidth):x_(x), y_(y), patchWidth_(patchWidth) {}
+
+        float DistanceSq(int patch) const
+        {
+            const float dx = (patch % patchWidth_ + 0.5f) * EC_Terrain::cPatchSize - x_;
+            const float dy = (patch / patchWidth_ + 0.5f) * EC_Terrain::cPatchSize - y_;
+            return dx*dx + dy*dy;
+        }
+
+        bool operator()(int a, int b) const { return DistanceSq(a) < DistanceSq(b); }
+
+        float x_;
+        float y_;
+        int patchWidth_;
+    };
+}
+
 bool EC_Terrain::SaveToFile(QString filename)
 {
     if (patchWidth * patchHeight != (int)patches.size())
@@ -731,27 +1002,41 @@ bool EC_Terrain::SaveToFile(QString filename)
         return false;
     }
 
-    FILE *handle = fopen(filename.toStdString().c_str(), "wb");
-    if (!handle)
-    {
-        LogError("Could not open file " + filename.toStdString() + ".");
-        return false;
-    }
+    // Any patches still streaming in need their heights before they can be written out.
+    DecodePendingPatches(pendingPatches.size());
+
+    const u32 numPatches = patchWidth * patchHeight;
 
-    const u32 xPatches = patchWidth;
-    const u32 yPatches = patchHeight;
-    fwrite(&xPatches, sizeof(u32), 1, handle);
-    fwrite(&yPatches, sizeof(u32), 1, handle);
+    std::vector<u8> data;
+    data.insert(data.end(), cTerrainFileMagic, cTerrainFileMagic + sizeof(cTerrainFileMagic));
+    data.push_back(cTerrainFileVersion);
+    WriteU32(data, patchWidth);
+    WriteU32(data, patchHeight);
 
-    assert(sizeof(float) == 4);
+    // Leave room for the offset table, and fill it in once the blocks are written. The last offset is the end of the last block.
+    const size_t offsetTable = data.size();
+    data.resize(data.size() + (numPatches + 1) * 4);
 
-    for(int i = 0; i < xPatches*yPatches; ++i)
+    std::vector<u8> offsets;
+    for(u32 i = 0; i < numPatches; ++i)
     {
         if (patches[i].heightData.size() < cPatchSize*cPatchSize)
             patches[i].heightData.resize(cPatchSize*cPatchSize);
 
-        fwrite(&patches[i].heightData[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
+        WriteU32(offsets, (u32)data.size());
+        EncodeHeightBlock(patches[i].heightData, data);
     }
+    WriteU32(offsets, (u32)data.size());
+    std::copy(offsets.begin(), offsets.end(), data.begin() + offsetTable);
+
+    FILE *handle = fopen(filename.toStdString().c_str(), "wb");
+    if (!handle)
+    {
+        LogError("Could not open file " + filename.toStdString() + ".");
+        return false;
+    }
+
+    fwrite(&data[0], 1, data.size(), handle);
     fflush(handle);
     if (ferror(handle))
     LogError("Write error in SaveToFile");
@@ -764,7 +1049,7 @@ u32 ReadU32(const char *dataPtr, size_t numBytes, int &offset)
 {
     if (offset + 4 > numBytes)
         throw Exception("Not enough bytes to deserialize!");
-    u32 data = *(u32*)(dataPtr + offset); ///\note Requires unaligned load support from the CPU and assumes data storage endianness to be the same for loader and saver.
+    u32 data = ReadU32((const u8 *)dataPtr + offset);
     offset += 4;
     return data;
 }
@@ -788,13 +1073,28 @@ bool EC_Terrain::LoadFromFile(QString filename)
 
 bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
 {
+    std::vector<Patch> newPatches;
     int offset = 0;
+
+    const bool streamed = numBytes >= 4 && memcmp(data, cTerrainFileMagic, sizeof(cTerrainFileMagic)) == 0;
+    std::vector<u32> blockOffsets;
+    if (streamed)
+    {
+        const u8 version = (u8)data[3];
+        if (version != cTerrainFileVersion)
+        {
+            LogError("Unsupported terrain file version " + ToString((int)version) + ".");
+            return false;
+        }
+        offset = 4;
+    }
+
     u32 xPatches = ReadU32(data, numBytes, offset);
     u32 yPatches = ReadU32(data, numBytes, offset);
 
     // Load all the data from the file to an intermediate buffer first, so that we can first see
     // if the file is not broken, and reject it without losing the old terrain.
-    std::vector<Patch> newPatches(xPatches*yPatches);
+    newPatches.resize(xPatches*yPatches);
 
     // Initialize the new height data structure.
     for(int y = 0; y < yPatches; ++y)
@@ -804,18 +1104,32 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
             newPatches[y*xPatches+x].y = y;
         }
 
-    assert(sizeof(float) == 4);
-
-    // Load the new data.
-    for(size_t i = 0; i < newPatches.size(); ++i)
+    if (streamed)
     {
-        newPatches[i].heightData.resize(cPatchSize*cPatchSize);
-        newPatches[i].patch_geometry_dirty = true;
-        if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
-            throw Exception("Not enough bytes to deserialize!");
-
-        memcpy(&newPatches[i].heightData[0], data + offset, cPatchSize*cPatchSize*sizeof(float));
-        offset += cPatchSize*cPatchSize*sizeof(float);
+        // Only check the offset table now. The height blocks are decoded as the patches are needed.
+        blockOffsets.resize(newPatches.size() + 1);
+        const size_t tableEnd = offset + blockOffsets.size() * 4;
+        for(size_t i = 0; i < blockOffsets.size(); ++i)
+        {
+            blockOffsets[i] = ReadU32(data, numBytes, offset);
+            if (blockOffsets[i] < tableEnd || blockOffsets[i] > numBytes || (i > 0 && blockOffsets[i] < blockOffsets[i-1]))
+                throw Exception("Invalid height block offset in terrain file!");
+        }
+    }
+    else
+    {
+        // The older format stores the heights of each patch as raw little-endian floats.
+        for(size_t i = 0; i < newPatches.size(); ++i)
+        {
+            newPatches[i].heightData.resize(cPatchSize*cPatchSize);
+            newPatches[i].patch_geometry_dirty = true;
+            if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
+                throw Exception("Not enough bytes to deserialize!");
+
+            for(int j = 0; j < cPatchSize*cPatchSize; ++j)
+                newPatches[i].heightData[j] = ReadFloat((const u8 *)data + offset + j * sizeof(float));
+            offset += cPatchSize*cPatchSize*sizeof(float);
+        }
     }
 
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
@@ -824,9 +1138,26 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     patches = newPatches;
     patchWidth = xPatches;
     patchHeight = yPatches;
+    ResizeBatches();
 
-    // Re-do all the geometry on the GPU.
-    RegenerateDirtyTerrainPatches();
+    if (streamed)
+    {
+        streamedTerrainData.assign((const u8 *)data, (const u8 *)data + numBytes);
+        streamedBlockOffsets.swap(blockOffsets);
+        pendingPatches.resize(patches.size());
+        for(size_t i = 0; i < pendingPatches.size(); ++i)
+            pendingPatches[i] = (int)i;
+
+        // Decode the first patches, nearest to the camera, right away. This also regenerates them.
+        LoadPendingPatches();
+    }
+    else
+    {
+        pendingPatches.clear();
+
+        // Re-do all the geometry on the GPU.
+        RegenerateDirtyTerrainPatches();
+    }
 
     // Set the new number of patches this terrain has. These changes only need to be done locally, since the other
     // peers have loaded the terrain from the same file, and they will also locally do this change. This change is also
@@ -840,6 +1171,92 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     return true;
 }
 
+size_t EC_Terrain::DecodePendingPatches(size_t maxPatches)
+{
+    const size_t count = min(maxPatches, pendingPatches.size());
+    if (count == 0)
+        return 0;
+
+    PROFILE(EC_Terrain_DecodePendingPatches);
+
+    // Without a camera, like on a server, there is nothing to prioritize by.
+    Renderer *renderer = framework_->GetService<Renderer>();
+    if (count < pendingPatches.size() && rootNode && renderer && renderer->GetCurrentCamera())
+    {
+        const Ogre::Vector3 cameraPos = GetWorldTransform(rootNode).inverse() * renderer->GetCurrentCamera()->getDerivedPosition();
+        std::partial_sort(pendingPatches.begin(), pendingPatches.begin() + count, pendingPatches.end(),
+            NearerPatch(cameraPos.x, cameraPos.y, patchWidth));
+    }
+
+    for(size_t i = 0; i < count; ++i)
+        DecodeStreamedPatch(pendingPatches[i]);
+    pendingPatches.erase(pendingPatches.begin(), pendingPatches.begin() + count);
+
+    if (pendingPatches.empty())
+        ReleaseStreamedTerrainData();
+    return count;
+}
+
+void EC_Terrain::DecodeStreamedPatch(int index)
+{
+    const u32 blockStart = streamedBlockOffsets[index];
+    const u32 blockEnd = streamedBlockOffsets[index + 1];
+    Patch &patch = patches[index];
+    if (!DecodeHeightBlock(&streamedTerrainData[0] + blockStart, blockEnd - blockStart, patch.heightData))
+    {
+        LogWarning("Malformed height block for terrain patch (" + ToString(patch.x) + ", " + ToString(patch.y) + "), flattening it.");
+        patch.heightData.assign(cPatchSize*cPatchSize, 0.f);
+    }
+    patch.patch_geometry_dirty = true;
+}
+
+void EC_Terrain::DecodePendingPatch(int index)
+{
+    std::vector<int>::iterator iter = std::find(pendingPatches.begin(), pendingPatches.end(), index);
+    if (iter == pendingPatches.end())
+        return;
+
+    DecodeStreamedPatch(index);
+    pendingPatches.erase(iter);
+    if (pendingPatches.empty())
+        ReleaseStreamedTerrainData();
+}
+
+void EC_Terrain::DiscardPendingPatch(int index)
+{
+    std::vector<int>::iterator iter = std::find(pendingPatches.begin(), pendingPatches.end(), index);
+    if (iter == pendingPatches.end())
+        return;
+
+    pendingPatches.erase(iter);
+    if (pendingPatches.empty())
+        ReleaseStreamedTerrainData();
+}
+
+void EC_Terrain::DiscardPendingPatches()
+{
+    pendingPatches.clear();
+    ReleaseStreamedTerrainData();
+}
+
+void EC_Terrain::ReleaseStreamedTerrainData()
+{
+    std::vector<u8>().swap(streamedTerrainData);
+    std::vector<u32>().swap(streamedBlockOffsets);
+}
+
+void EC_Terrain::LoadPendingPatches()
+{
+    if (pendingPatches.empty())
+        return;
+
+    // Without a camera there is no one to see the terrain stream in, so decode all of it at once.
+    Renderer *renderer = framework_->GetService<Renderer>();
+    const bool viewed = ViewEnabled() && renderer && renderer->GetCurrentCamera();
+    if (DecodePendingPatches(viewed ? cPatchesDecodedPerFrame : pendingPatches.size()) > 0)
+        RegenerateDirtyTerrainPatches();
+}
+
 void EC_Terrain::NormalizeImage(QString filename) const
 {
     Ogre::Image image;
@@ -908,6 +1325,9 @@ bool EC_Terrain::LoadFromImageFile(QString filename, float offset, float scale)
     yPatches.Set(image.getHeight() / cPatchSize, AttributeChange::Disconnected);
     ResizeTerrain(xPatches.Get(), yPatches.Get());
 
+    // All the heights are overwritten, so the patches still waiting in a streamed terrain file are not needed any more.
+    DiscardPendingPatches();
+
     for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
         {
@@ -1077,19 +1497,199 @@ void GetUnskinnedMeshGeometry(
     }
 }
 
-float FindClosestRayIntersection(const Ogre::Ray &ray, const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices)
+namespace
 {
-    using namespace std;
+    /// The triangles of a mesh bucketed into a uniform grid on the XY plane, for finding the highest point of the mesh at a given XY position
+    /// without going through all the triangles.
+    class TriangleHeightGrid
+    {
+    public:
+        TriangleHeightGrid(const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices,
+            const Ogre::Vector3 &minExtents, const Ogre::Vector3 &maxExtents)
+        :vertices_(vertices), indices_(indices), originX_(minExtents.x), originY_(minExtents.y)
+        {
+            PROFILE(TriangleHeightGrid_Build);
+
+            // Aim at a couple of triangles per cell, but not at cells smaller than the spacing of the terrain vertices
+            float width = max(maxExtents.x - minExtents.x, 1.f);
+            float height = max(maxExtents.y - minExtents.y, 1.f);
+            size_t numTriangles = max<size_t>(indices.size() / 3, 1);
+            cellSize_ = max(1.f, sqrt(width * height / numTriangles));
+            cellsX_ = (int)(width / cellSize_) + 1;
+            cellsY_ = (int)(height / cellSize_) + 1;
+
+            // Count the triangles of each cell first, so that the triangle lists of all the cells fit in a single array
+            cellStart_.assign(cellsX_ * cellsY_ + 1, 0);
+            for(size_t i = 0; i+2 < indices.size(); i += 3)
+            {
+                int x0, y0, x1, y1;
+                GetCellRange(i, x0, y0, x1, y1);
+                for(int y = y0; y <= y1; ++y)
+                    for(int x = x0; x <= x1; ++x)
+                        ++cellStart_[y * cellsX_ + x + 1];
+            }
+            for(size_t i = 1; i < cellStart_.size(); ++i)
+                cellStart_[i] += cellStart_[i-1];
+
+            cellTriangles_.resize(cellStart_.back());
+            std::vector<uint> cellFill(cellStart_.begin(), cellStart_.end() - 1);
+            for(size_t i = 0; i+2 < indices.size(); i += 3)
+            {
+                int x0, y0, x1, y1;
+                GetCellRange(i, x0, y0, x1, y1);
+                for(int y = y0; y <= y1; ++y)
+                    for(int x = x0; x <= x1; ++x)
+                        cellTriangles_[cellFill[y * cellsX_ + x]++] = (uint)i;
+            }
+        }
+
+        /// Returns the height of the highest triangle at the given XY position, or false if there is no triangle there.
+        /// This is the same as the closest hit of a ray cast straight down from above the mesh.
+        bool GetHeight(float px, float py, float &outHeight) const
+        {
+            int cx = (int)((px - originX_) / cellSize_);
+            int cy = (int)((py - originY_) / cellSize_);
+            if (cx < 0 || cy < 0 || cx >= cellsX_ || cy >= cellsY_)
+                return false;
+
+            bool found = false;
+            const int cell = cy * cellsX_ + cx;
+            for(uint i = cellStart_[cell]; i < cellStart_[cell+1]; ++i)
+            {
+                const uint t = cellTriangles_[i];
+                const Ogre::Vector3 &a = vertices_[indices_[t]];
+                const Ogre::Vector3 &b = vertices_[indices_[t+1]];
+                const Ogre::Vector3 &c = vertices_[indices_[t+2]];
+
+                // Barycentric coordinates of the point in the projection of the triangle on the XY plane. Vertical triangles are never hit.
+                float det = (b.y - c.y) * (a.x - c.x) + (c.x - b.x) * (a.y - c.y);
+                if (fabs(det) < 1e-12f)
+                    continue;
+                float u = ((b.y - c.y) * (px - c.x) + (c.x - b.x) * (py - c.y)) / det;
+                float v = ((c.y - a.y) * (px - c.x) + (a.x - c.x) * (py - c.y)) / det;
+                float w = 1.f - u - v;
+                const float epsilon = -1e-5f;
+                if (u < epsilon || v < epsilon || w < epsilon)
+                    continue;
+
+                float z = u * a.z + v * b.z + w * c.z;
+                if (!found || z > outHeight)
+                    outHeight = z;
+                found = true;
+            }
+            return found;
+        }
+
+    private:
+        /// Returns the range of cells the XY bounding box of the triangle starting at the given index overlaps.
+        void GetCellRange(size_t i, int &x0, int &y0, int &x1, int &y1) const
+        {
+            const Ogre::Vector3 &a = vertices_[indices_[i]];
+            const Ogre::Vector3 &b = vertices_[indices_[i+1]];
+            const Ogre::Vector3 &c = vertices_[indices_[i+2]];
+            x0 = ClampCell((min(a.x, min(b.x, c.x)) - originX_) / cellSize_, cellsX_);
+            y0 = ClampCell((min(a.y, min(b.y, c.y)) - originY_) / cellSize_, cellsY_);
+            x1 = ClampCell((max(a.x, max(b.x, c.x)) - originX_) / cellSize_, cellsX_);
+            y1 = ClampCell((max(a.y, max(b.y, c.y)) - originY_) / cellSize_, cellsY_);
+        }
 
-    float distance = 1e9f;
-    for(size_t i = 0; i+2 < indices.size(); i += 3)
+        static int ClampCell(float cell, int numCells)
+        {
+            return min(max((int)cell, 0), numCells - 1);
+        }
+
+        const std::vector<Ogre::Vector3> &vertices_;
+        const std::vector<uint> &indices_;
+        float originX_;
+        float originY_;
+        float cellSize_;
+        int cellsX_;
+        int cellsY_;
+        /// For each cell, the index of its first triangle in cellTriangles_. Has an extra element at the end.
+        std::vector<uint> cellStart_;
+        /// Indices of the first vertex index of the triangles of each cell.
+        std::vector<uint> cellTriangles_;
+    };
+
+    /// Computes the heights of the terrain vertex rows [beginRow, endRow) from the triangle grid. Vertices with no triangle get height 1e9f.
+    void ComputeHeightRows(const TriangleHeightGrid *grid, float originX, float originY, int width, std::vector<float> *heights, int beginRow, int endRow)
+    {
+        for(int y = beginRow; y < endRow; ++y)
+            for(int x = 0; x < width; ++x)
+            {
+                float height;
+                (*heights)[y * width + x] = grid->GetHeight(originX + x, originY + y, height) ? height : 1e9f;
+            }
+    }
+
+    /// Computes the heights of the terrain vertices, width x height starting from the minimum corner of the mesh, from the triangle grid.
+    /// Vertices with no triangle get height 1e9f. If the job system is given, the rows are computed in parallel in it.
+    void ComputeMeshHeights(const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices, const Ogre::Vector3 &minExtents,
+        const Ogre::Vector3 &maxExtents, int width, int height, std::vector<float> &heights, Foundation::JobSystem *jobs)
     {
-        std::pair<bool, Ogre::Real> hit = Ogre::Math::intersects(ray, vertices[indices[i]],
-            vertices[indices[i+1]], vertices[indices[i+2]], true, true);
-        if (hit.first && hit.second >= 0.f)
-            distance = min(distance, hit.second);
+        TriangleHeightGrid grid(vertices, indices, minExtents, maxExtents);
+        heights.resize(width * height);
+        if (jobs)
+            jobs->ParallelFor(0, height, boost::bind(&ComputeHeightRows, &grid, minExtents.x, minExtents.y, width, &heights, _1, _2));
+        else
+            ComputeHeightRows(&grid, minExtents.x, minExtents.y, width, &heights, 0, height);
+    }
+
+    /// The original raycast against every triangle of the mesh, kept as the reference for BenchmarkTerrainFromMesh.
+    float FindClosestRayIntersection(const Ogre::Ray &ray, const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices)
+    {
+        float distance = 1e9f;
+        for(size_t i = 0; i+2 < indices.size(); i += 3)
+        {
+            std::pair<bool, Ogre::Real> hit = Ogre::Math::intersects(ray, vertices[indices[i]],
+                vertices[indices[i+1]], vertices[indices[i+2]], true, true);
+            if (hit.first && hit.second >= 0.f)
+                distance = min(distance, hit.second);
+        }
+        return distance;
+    }
+
+    /// Same as ComputeMeshHeights, with the original ray cast down from above the mesh at each vertex.
+    void ComputeMeshHeightsReference(const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices, const Ogre::Vector3 &minExtents,
+        const Ogre::Vector3 &maxExtents, int width, int height, std::vector<float> &heights)
+    {
+        const float raycastHeight = maxExtents.z + 100.f;
+        heights.resize(width * height);
+        for(int y = 0; y < height; ++y)
+            for(int x = 0; x < width; ++x)
+            {
+                Ogre::Ray r(Ogre::Vector3(minExtents.x + x, minExtents.y + y, raycastHeight), Ogre::Vector3(0,0,-1.f));
+                float distance = FindClosestRayIntersection(r, vertices, indices);
+                heights[y * width + x] = distance < 1e8f ? raycastHeight - distance : 1e9f;
+            }
+    }
+
+    /// Creates a mesh of rolling hills, size x size units with quadsPerUnit x quadsPerUnit quads in each unit square, for BenchmarkTerrainFromMesh.
+    void CreateHillsMesh(int size, int quadsPerUnit, std::vector<Ogre::Vector3> &vertices, std::vector<uint> &indices)
+    {
+        const int quads = size * quadsPerUnit;
+        const float step = 1.f / quadsPerUnit;
+        vertices.clear();
+        indices.clear();
+        for(int y = 0; y <= quads; ++y)
+            for(int x = 0; x <= quads; ++x)
+            {
+                const float px = x * step;
+                const float py = y * step;
+                vertices.push_back(Ogre::Vector3(px, py, 10.f * sin(px * 0.1f) * cos(py * 0.13f) + sin(px * 0.7f + py * 0.5f)));
+            }
+        for(int y = 0; y < quads; ++y)
+            for(int x = 0; x < quads; ++x)
+            {
+                const uint i = y * (quads + 1) + x;
+                indices.push_back(i);
+                indices.push_back(i + 1);
+                indices.push_back(i + quads + 1);
+                indices.push_back(i + 1);
+                indices.push_back(i + quads + 2);
+                indices.push_back(i + quads + 1);
+            }
     }
-    return distance;
 }
 
 void ComputeAABB(const std::vector<Ogre::Vector3> &vertices, Ogre::Vector3 &minExtents, Ogre::Vector3 &maxExtents)
@@ -1160,6 +1760,8 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
 {
     using namespace std;
 
+    PROFILE(EC_Terrain_GenerateFromOgreMesh);
+
     Ogre::Mesh *mesh = dynamic_cast<Ogre::Mesh*>(Ogre::MeshManager::getSingleton().getByName(ogreMeshResourceName.toStdString().c_str()).get());
     if (!mesh)
     {
@@ -1197,16 +1799,16 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     float minHeight = std::numeric_limits<float>::max();
     float maxHeight = -std::numeric_limits<float>::max();
 
-    const float raycastHeight = maxExtents.z + 100.f;
+    // Find the top surface of the mesh at each terrain vertex. The rows are independent, so compute them in parallel.
+    std::vector<float> heights;
+    ComputeMeshHeights(vertices, indices, minExtents, maxExtents, xVertices, yVertices, heights, GetFramework()->GetJobSystem().get());
 
     for(int y = 0; y < yVertices; ++y)
         for(int x = 0; x < xVertices; ++x)
         {
-            Ogre::Ray r(Ogre::Vector3(minExtents.x + x, minExtents.y + y, raycastHeight), Ogre::Vector3(0,0,-1.f));
-            float height = FindClosestRayIntersection(r, vertices, indices);
+            float height = heights[y * xVertices + x];
             if (height < 1e8f)
             {
-                height = raycastHeight - height;
                 SetPointHeight(x, y, height);
                 minHeight = min(minHeight, height);
                 maxHeight = max(maxHeight, height);
@@ -1231,8 +1833,79 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     RegenerateDirtyTerrainPatches();
 }
 
+std::string BenchmarkTerrainFromMesh(int maxSize, Foundation::JobSystem *jobSystem)
+{
+    // The reference casts a ray per terrain vertex against every triangle, so leave it out where it would take minutes.
+    const double maxReferenceTests = 2e9;
+
+    std::stringstream ss;
+    ss << "Heights of terrain generated from a mesh, per-ray reference against the triangle grid";
+    if (jobSystem)
+        ss << " (also in " << jobSystem->NumWorkerThreads() << " worker threads)";
+    ss << ":";
+
+    std::vector<Ogre::Vector3> vertices;
+    std::vector<uint> indices;
+    std::vector<float> reference;
+    std::vector<float> heights;
+    for(int size = 32; size <= maxSize; size *= 2)
+        for(int quadsPerUnit = 1; quadsPerUnit <= 4; quadsPerUnit *= 4)
+        {
+            CreateHillsMesh(size, quadsPerUnit, vertices, indices);
+            Ogre::Vector3 minExtents;
+            Ogre::Vector3 maxExtents;
+            ComputeAABB(vertices, minExtents, maxExtents);
+
+            // Same terrain size as GenerateFromOgreMesh would make.
+            const int width = ((size + EC_Terrain::cPatchSize - 1) / EC_Terrain::cPatchSize) * EC_Terrain::cPatchSize;
+            const size_t numTriangles = indices.size() / 3;
+            ss << "\n  " << size << "x" << size << " units, " << numTriangles << " triangles, " << width * width << " terrain vertices: ";
+
+            double referenceTime = 0.0;
+            const bool runReference = (double)width * width * numTriangles <= maxReferenceTests;
+            tick_t start = GetCurrentClockTime();
+            if (runReference)
+            {
+                ComputeMeshHeightsReference(vertices, indices, minExtents, maxExtents, width, width, reference);
+                referenceTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+                ss << "reference " << referenceTime * 1000.0 << " ms, ";
+            }
+            else
+                ss << "reference skipped, ";
+
+            start = GetCurrentClockTime();
+            ComputeMeshHeights(vertices, indices, minExtents, maxExtents, width, width, heights, 0);
+            const double gridTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+            ss << "grid " << gridTime * 1000.0 << " ms";
+            if (runReference)
+                ss << " (" << referenceTime / std::max(gridTime, 1e-9) << "x)";
+
+            if (jobSystem)
+            {
+                start = GetCurrentClockTime();
+                ComputeMeshHeights(vertices, indices, minExtents, maxExtents, width, width, heights, jobSystem);
+                const double parallelTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+                ss << ", parallel " << parallelTime * 1000.0 << " ms";
+                if (runReference)
+                    ss << " (" << referenceTime / std::max(parallelTime, 1e-9) << "x)";
+            }
+
+            if (runReference)
+            {
+                float maxError = 0.f;
+                for(size_t i = 0; i < heights.size(); ++i)
+                    if (heights[i] < 1e8f || reference[i] < 1e8f)
+                        maxError = max(maxError, fabs(heights[i] - reference[i]));
+                ss << ", largest height difference " << maxError;
+            }
+            ss << ".";
+        }
+    return ss.str();
+}
+
 void EC_Terrain::AffineTransform(float scale, float offset)
 {
+    DecodePendingPatches(pendingPatches.size());
     for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
             SetPointHeight(x, y, GetPoint(x, y) * scale + offset);
@@ -1240,6 +1913,8 @@ void EC_Terrain::AffineTransform(float scale, float offset)
 
 void EC_Terrain::RemapHeightValues(float minHeight, float maxHeight)
 {
+    DecodePendingPatches(pendingPatches.size());
+
     float minHeightCur = 1e9f;
     float maxHeightCur = -1e9f;
 
@@ -1287,14 +1962,17 @@ void EC_Terrain::SetTerrainMaterialTexture(int index, const char *textureName)
 
 void EC_Terrain::UpdateTerrainPatchMaterial(int patchX, int patchY)
 {
-    Patch &patch = GetPatch(patchX, patchY);
+    SetTileMaterial(GetPatch(patchX, patchY).entity);
+}
 
-    if (!patch.entity)
+void EC_Terrain::SetTileMaterial(Ogre::Entity *entity)
+{
+    if (!entity)
         return;
 
-    for(int i = 0; i < patch.entity->getNumSubEntities(); ++i)
+    for(int i = 0; i < entity->getNumSubEntities(); ++i)
     {
-        Ogre::SubEntity *sub = patch.entity->getSubEntity(i);
+        Ogre::SubEntity *sub = entity->getSubEntity(i);
         if (sub)
             sub->setMaterialName(currentMaterial.toStdString().c_str());
     }
@@ -1339,7 +2017,15 @@ void EC_Terrain::AttachTerrainRootNode()
     {
         Ogre::SceneNode *parent = pos->GetSceneNode();
         parent->addChild(rootNode);
-        rootNode->setVisible(pos->visible.Get()); // Re-apply visibility on all the geometry.
+        const bool visible = pos->visible.Get();
+        rootNode->setVisible(visible); // Re-apply visibility on all the geometry.
+        // The patches of the batches drawn in their place, and the batches not drawn, are not attached to the root node at the moment.
+        for(size_t i = 0; i < patches.size(); ++i)
+            if (patches[i].node)
+                patches[i].node->setVisible(visible);
+        for(size_t i = 0; i < batches.size(); ++i)
+            if (batches[i].node)
+                batches[i].node->setVisible(visible);
     }
     else
     {
@@ -1348,154 +2034,210 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-/// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
-/// patch if the associated Ogre resources already exist.
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
+namespace
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    /// The number of floats in a terrain vertex: position, normal and two texture coordinates.
+    const int cTileVertexFloats = 3 + 3 + 2 + 2;
 
-    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+    /// The number of floats in the vertices of a tile.
+    const int cTileFloats = (EC_Terrain::cPatchSize + 1) * (EC_Terrain::cPatchSize + 1) * cTileVertexFloats;
 
-    Renderer *renderer = framework_->GetService<Renderer>();
-    if (!renderer)
-        return;
-    if (!ViewEnabled())
-        return;
+    /// The number of tiles to compute at a time when regenerating. Bounds the memory needed for the computed vertices.
+    const size_t cTilesPerPass = 256;
 
-    Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
-    if (!node)
+    /// The offsets to the neighboring patch or batch at each TerrainIndexBuffers::Side.
+    const int cSideOffsets[TerrainIndexBuffers::NumSides][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+
+    /// Adds the node to the given parent, or removes it from the scene.
+    void AttachTileNode(Ogre::SceneNode *parent, Ogre::SceneNode *node, bool attach)
     {
-        CreateOgreTerrainPatchNode(node, patch.x, patch.y);
-        patch.node = node;
+        if (attach && parent && !node->getParentSceneNode())
+            parent->addChild(node);
+        else if (!attach && node->getParentSceneNode())
+            node->getParentSceneNode()->removeChild(node);
     }
-    assert(node);
-
-    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
-    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
-        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
-
-    Ogre::SceneManager *sceneMgr = renderer->GetSceneManager();
-    Ogre::ManualObject *manual = sceneMgr->createManualObject(renderer->GetUniqueObjectName("EC_Terrain_manual"));
-    manual->setCastShadows(false);
 
-    manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
-
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-//        const Ogre::Vector3 patchOrigin(patch.y * patchSpacingY, 0.f, patch.x * patchSpacingX);
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
-
-    int curIndex = 0;
+    /// Returns the distance from the given point to the bounding box of a square tile of the terrain.
+    float DistanceToTile(const Ogre::Vector3 &point, int x, int y, int size, float minHeight, float maxHeight)
+    {
+        const float dx = max(max(x - point.x, point.x - (x + size)), 0.f);
+        const float dy = max(max(y - point.y, point.y - (y + size)), 0.f);
+        const float dz = max(max(minHeight - point.z, point.z - maxHeight), 0.f);
+        return sqrt(dx*dx + dy*dy + dz*dz);
+    }
+}
 
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
+void EC_Terrain::ComputeTileVertices(int mapX, int mapY, int spacing, float *vertices, float &minHeight, float &maxHeight) const
+{
+    const int tileVertices = cPatchSize + 1;
+    const int lastX = VerticesWidth() - 1;
+    const int lastY = VerticesHeight() - 1;
 
     const float uScale = this->uScale.Get();
     const float vScale = this->vScale.Get();
 
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
+    minHeight = std::numeric_limits<float>::max();
+    maxHeight = -std::numeric_limits<float>::max();
+
+    float *v = vertices;
+    for(int y = 0; y < tileVertices; ++y)
+        for(int x = 0; x < tileVertices; ++x)
         {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
+            // The tiles at the far edges of the terrain reach past it. Their outermost vertices are clamped to the edge, which leaves
+            // empty triangles there.
+            const int X = min(mapX + x * spacing, lastX);
+            const int Y = min(mapY + y * spacing, lastY);
+            const float height = GetPoint(X, Y);
+            minHeight = min(minHeight, height);
+            maxHeight = max(maxHeight, height);
 
             // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
             // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-// Ogre:                pos.x = vertexSpacingY * y;
-// Ogre:                pos.z = vertexSpacingX * x;
-            pos.x = vertexSpacingX * x;
-            pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
-            {
-                thisPatch = &patch;
+            *v++ = (float)(X - mapX);
+            *v++ = (float)(Y - mapY);
+            *v++ = height;
 
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    manual->index(curIndex);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex+stride);
+            const Vector3df normal = CalculateNormal(X, Y);
+            *v++ = normal.x;
+            *v++ = normal.y;
+            *v++ = normal.z;
 
-                    manual->index(curIndex+1);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+stride);
-                }
-            }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
-            }
-            else if (x == cPatchVertexWidth)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
-            }
-            else // (y == patchHeight)
-            {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
-            }
+            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
+            *v++ = X * uScale;
+            *v++ = Y * vScale;
 
-// Ogre:        pos.y = thisPatch->heightData[Y*patchSize+X];
-            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
+            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+            *v++ = (float)X / lastX;
+            *v++ = (float)Y / lastY;
+        }
+}
 
-            manual->position(pos);
-            manual->normal(OgreRenderer::ToOgreVector3(CalculateNormal(thisPatch->x, thisPatch->y, X, Y)));
+void EC_Terrain::GenerateRequestedTiles(bool batchTiles)
+{
+    if (!ViewEnabled() || !framework_->GetService<Renderer>())
+        return;
 
-            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-// Ogre:                manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
+    for(size_t first = 0; first < tileRequests.size(); first += cTilesPerPass)
+    {
+        const size_t count = min(cTilesPerPass, tileRequests.size() - first);
+        tileVertices.resize(cTilesPerPass * cTileFloats);
 
-            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
+        // Computing the vertices only reads the height data, so the tiles are computed in parallel. Only the upload is left to this thread.
+        {
+            PROFILE(EC_Terrain_ComputeTileVertices);
+            Foundation::JobSystemPtr jobs = GetFramework()->GetJobSystem();
+            if (jobs)
+                jobs->ParallelFor((int)first, (int)(first + count), boost::bind(&EC_Terrain::ComputeTileVertexRange, this, (int)first, _1, _2));
+            else
+                ComputeTileVertexRange((int)first, (int)first, (int)(first + count));
+        }
 
-            ++curIndex;
+        for(size_t i = 0; i < count; ++i)
+        {
+            const TileRequest &request = tileRequests[first + i];
+            if (batchTiles)
+                GenerateTerrainGeometryForOneBatch(request.tileX, request.tileY, &tileVertices[i * cTileFloats], request.minHeight, request.maxHeight);
+            else
+                GenerateTerrainGeometryForOnePatch(request.tileX, request.tileY, &tileVertices[i * cTileFloats], request.minHeight, request.maxHeight);
         }
+    }
+}
+
+void EC_Terrain::ComputeTileVertexRange(int firstRequest, int begin, int end)
+{
+    for(int i = begin; i < end; ++i)
+    {
+        TileRequest &request = tileRequests[i];
+        ComputeTileVertices(request.mapX, request.mapY, request.spacing, &tileVertices[(i - firstRequest) * cTileFloats],
+            request.minHeight, request.maxHeight);
+    }
+}
+
+void EC_Terrain::UpdateTileEntity(Ogre::SceneNode *node, Ogre::Entity *&entity, std::string &meshGeometryName, const float *vertices,
+    int spacing, float minHeight, float maxHeight)
+{
+    if (!entity)
+    {
+        CreateTileEntity(node, entity, meshGeometryName, vertices, spacing, minHeight, maxHeight);
+        return;
+    }
+
+    // The layout of the tile vertices never changes, so write the new vertices over the old ones in the existing buffer.
+    Ogre::MeshPtr terrainMesh = entity->getMesh();
+    Ogre::HardwareVertexBufferSharedPtr vertexBuffer = terrainMesh->getSubMesh(0)->vertexData->vertexBufferBinding->getBuffer(0);
+    vertexBuffer->writeData(0, vertexBuffer->getSizeInBytes(), vertices, true);
+
+    const float size = (float)(cPatchSize * spacing);
+    const Ogre::AxisAlignedBox bounds(0.f, 0.f, minHeight, size, size, maxHeight);
+    terrainMesh->_setBounds(bounds);
+    terrainMesh->_setBoundingSphereRadius((bounds.getMaximum() - bounds.getMinimum()).length() / 2.f);
+    node->needUpdate();
+}
 
-    manual->end();
+void EC_Terrain::CreateTileEntity(Ogre::SceneNode *node, Ogre::Entity *&entity, std::string &meshGeometryName, const float *vertices,
+    int spacing, float minHeight, float maxHeight)
+{
+    Renderer *renderer = framework_->GetService<Renderer>();
+    if (!renderer)
+        return;
+    Ogre::SceneManager *sceneMgr = renderer->GetSceneManager();
+
+    if (!indexBuffers)
+        indexBuffers = boost::shared_ptr<TerrainIndexBuffers>(new TerrainIndexBuffers(cPatchSize));
+
+    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
 
     // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+    if (meshGeometryName.length() > 0)
     {
         try
         {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            Ogre::MeshManager::getSingleton().remove(meshGeometryName);
         }
         catch (...) {}
     }
 
-    patch.meshGeometryName = renderer->GetUniqueObjectName("EC_Terrain_patchmesh");
-    Ogre::MeshPtr terrainMesh = manual->convertToMesh(patch.meshGeometryName);
-
-    // Odd: destroyManualObject seems to leave behind a memory leak if we don't call manualObject->clear first.
-    manual->clear();
-    sceneMgr->destroyManualObject(manual);
-
-    patch.entity = sceneMgr->createEntity(renderer->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
-    patch.entity->setUserAny(Ogre::Any(parent_entity_));
-    patch.entity->setCastShadows(false);
+    meshGeometryName = renderer->GetUniqueObjectName("EC_Terrain_patchmesh");
+    Ogre::MeshPtr terrainMesh = Ogre::MeshManager::getSingleton().createManual(meshGeometryName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+    Ogre::SubMesh *subMesh = terrainMesh->createSubMesh();
+    subMesh->useSharedVertices = false;
+    subMesh->vertexData = OGRE_NEW Ogre::VertexData();
+    subMesh->vertexData->vertexStart = 0;
+    subMesh->vertexData->vertexCount = cTileFloats / cTileVertexFloats;
+
+    Ogre::VertexDeclaration *decl = subMesh->vertexData->vertexDeclaration;
+    size_t offset = 0;
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+
+    // The vertex data is read back when raycasting against the terrain, so keep a shadow copy of it in system memory.
+    Ogre::HardwareVertexBufferSharedPtr vertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(offset,
+        subMesh->vertexData->vertexCount, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    vertexBuffer->writeData(0, vertexBuffer->getSizeInBytes(), vertices, true);
+    subMesh->vertexData->vertexBufferBinding->setBinding(0, vertexBuffer);
+
+    // Start at the full level of detail. UpdateLod() switches the index buffer as the camera moves.
+    const int fullDetail[TerrainIndexBuffers::NumSides] = { 1, 1, 1, 1 };
+    subMesh->indexData->indexStart = 0;
+    subMesh->indexData->indexBuffer = indexBuffers->Get(1, fullDetail, subMesh->indexData->indexCount);
+    subMesh->setMaterialName(terrainMaterial->getName());
+
+    const float size = (float)(cPatchSize * spacing);
+    const Ogre::AxisAlignedBox bounds(0.f, 0.f, minHeight, size, size, maxHeight);
+    terrainMesh->_setBounds(bounds);
+    terrainMesh->_setBoundingSphereRadius((bounds.getMaximum() - bounds.getMinimum()).length() / 2.f);
+    terrainMesh->load();
+
+    entity = sceneMgr->createEntity(renderer->GetUniqueObjectName("EC_Terrain_patchentity"), meshGeometryName);
+    entity->setUserAny(Ogre::Any(parent_entity_));
+    entity->setCastShadows(false);
     // Set UserAny also on subentities
-    for (uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
-        patch.entity->getSubEntity(i)->setUserAny(patch.entity->getUserAny());
+    for (uint i = 0; i < entity->getNumSubEntities(); ++i)
+        entity->getSubEntity(i)->setUserAny(entity->getUserAny());
 
     // Explicitly destroy all attached MovableObjects previously bound to this terrain node.
     Ogre::SceneNode::ObjectIterator iter = node->getAttachedObjectIterator();
@@ -1506,14 +2248,275 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
     }
     node->detachAllObjects();
     // Now attach the new built terrain mesh.
-    node->attachObject(patch.entity);
+    node->attachObject(entity);
+}
+
+/// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
+/// patch if the associated Ogre resources already exist.
+void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY, const float *vertices, float minHeight, float maxHeight)
+{
+    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+
+    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+
+    Renderer *renderer = framework_->GetService<Renderer>();
+    if (!renderer)
+        return;
+    if (!ViewEnabled())
+        return;
+
+    const int batchX = patchX / cBatchSize;
+    const int batchY = patchY / cBatchSize;
+
+    if (!patch.node)
+    {
+        CreateOgreTerrainPatchNode(patch.node, patch.x, patch.y);
+        // While the batch of the patch is drawn in its place, the patch stays out of the scene.
+        if (patch.node && GetBatch(batchX, batchY).drawn)
+            AttachTileNode(rootNode, patch.node, false);
+    }
+    assert(patch.node);
+    if (!patch.node)
+        return;
+
+    // A new entity starts at the full level of detail.
+    if (!patch.entity)
+        patch.lodKey = -1;
+    patch.minHeight = minHeight;
+    patch.maxHeight = maxHeight;
+    UpdateTileEntity(patch.node, patch.entity, patch.meshGeometryName, vertices, 1, minHeight, maxHeight);
 
     patch.patch_geometry_dirty = false;
 
+    // The batch of the patch, and the batches to the west and south whose edges run along the first column and row of the patch, are now out of date.
+    const bool westEdge = (patchX % cBatchSize == 0 && batchX > 0);
+    const bool southEdge = (patchY % cBatchSize == 0 && batchY > 0);
+    GetBatch(batchX, batchY).batch_geometry_dirty = true;
+    if (westEdge)
+        GetBatch(batchX - 1, batchY).batch_geometry_dirty = true;
+    if (southEdge)
+        GetBatch(batchX, batchY - 1).batch_geometry_dirty = true;
+    if (westEdge && southEdge)
+        GetBatch(batchX - 1, batchY - 1).batch_geometry_dirty = true;
+
     ///\todo Regression. Re-enable this to have the EnvironmentEditor module function again.
 //    emit HeightmapGeometryUpdated();
 }
 
+void EC_Terrain::GenerateTerrainGeometryForOneBatch(int batchX, int batchY, const float *vertices, float minHeight, float maxHeight)
+{
+    PROFILE(EC_Terrain_GenerateTerrainGeometryForOneBatch);
+
+    PatchBatch &batch = GetBatch(batchX, batchY);
+
+    Renderer *renderer = framework_->GetService<Renderer>();
+    if (!renderer)
+        return;
+    if (!ViewEnabled())
+        return;
+
+    if (!batch.node)
+    {
+        CreateOgreTerrainPatchNode(batch.node, batchX * cBatchSize, batchY * cBatchSize);
+        // The batch is only put into the scene once UpdateLod() decides to draw it.
+        if (batch.node && !batch.drawn)
+            AttachTileNode(rootNode, batch.node, false);
+    }
+    if (!batch.node)
+        return;
+
+    if (!batch.entity)
+        batch.lodKey = -1;
+    batch.minHeight = minHeight;
+    batch.maxHeight = maxHeight;
+    UpdateTileEntity(batch.node, batch.entity, batch.meshGeometryName, vertices, cBatchSize, minHeight, maxHeight);
+
+    batch.batch_geometry_dirty = false;
+}
+
+void EC_Terrain::SetLodDistance(float distance)
+{
+    lodDistance = max(distance, 1.f);
+}
+
+int EC_Terrain::VertexSpacingAtDistance(float distance) const
+{
+    // Each doubling of the distance past lodDistance doubles the spacing, up to the coarsest level of detail of a batch.
+    int spacing = 1;
+    while(spacing < cBatchSize * cPatchSize / 2 && distance >= lodDistance * spacing)
+        spacing *= 2;
+    return spacing;
+}
+
+int EC_Terrain::PatchEdgeSpacing(int patchX, int patchY, int side) const
+{
+    const int spacing = GetPatch(patchX, patchY).vertexSpacing;
+    const int x = patchX + cSideOffsets[side][0];
+    const int y = patchY + cSideOffsets[side][1];
+    if (!PatchExists(x, y))
+        return spacing;
+
+    // Of two adjacent edges, the coarser one wins.
+    const int batchX = x / cBatchSize;
+    const int batchY = y / cBatchSize;
+    if (GetBatch(batchX, batchY).vertexSpacing > 0)
+        return max(spacing, BatchEdgeSpacing(batchX, batchY, (side + 2) % TerrainIndexBuffers::NumSides));
+    return max(spacing, GetPatch(x, y).vertexSpacing);
+}
+
+int EC_Terrain::BatchEdgeSpacing(int batchX, int batchY, int side) const
+{
+    const int spacing = GetBatch(batchX, batchY).vertexSpacing;
+    const int x = batchX + cSideOffsets[side][0];
+    const int y = batchY + cSideOffsets[side][1];
+    if (!BatchExists(x, y))
+        return spacing;
+
+    const PatchBatch &neighbor = GetBatch(x, y);
+    if (neighbor.vertexSpacing > 0)
+        return max(spacing, neighbor.vertexSpacing);
+
+    // The neighbor draws its patches. Match the coarsest of the patches along the shared edge, which in turn match this edge.
+    int edgeSpacing = spacing;
+    for(int i = 0; i < cBatchSize; ++i)
+    {
+        int patchX, patchY;
+        switch(side)
+        {
+        case TerrainIndexBuffers::SideSouth: patchX = batchX * cBatchSize + i; patchY = y * cBatchSize + cBatchSize - 1; break;
+        case TerrainIndexBuffers::SideEast: patchX = x * cBatchSize; patchY = batchY * cBatchSize + i; break;
+        case TerrainIndexBuffers::SideNorth: patchX = batchX * cBatchSize + i; patchY = y * cBatchSize; break;
+        default: patchX = x * cBatchSize + cBatchSize - 1; patchY = batchY * cBatchSize + i; break; // SideWest
+        }
+        if (PatchExists(patchX, patchY))
+            edgeSpacing = max(edgeSpacing, GetPatch(patchX, patchY).vertexSpacing);
+    }
+    return edgeSpacing;
+}
+
+void EC_Terrain::SetTileLod(Ogre::Entity *entity, int &lodKey, int step, const int edgeSteps[4])
+{
+    const int key = (int)TerrainIndexBuffers::Key(step, edgeSteps);
+    if (!entity || !indexBuffers || key == lodKey)
+        return;
+
+    Ogre::IndexData *indexData = entity->getMesh()->getSubMesh(0)->indexData;
+    indexData->indexStart = 0;
+    indexData->indexBuffer = indexBuffers->Get(step, edgeSteps, indexData->indexCount);
+    lodKey = key;
+}
+
+void EC_Terrain::SetBatchDrawn(int batchX, int batchY, bool drawn)
+{
+    PatchBatch &batch = GetBatch(batchX, batchY);
+    if (batch.drawn == drawn)
+        return;
+    batch.drawn = drawn;
+
+    // Only the nodes in the scene are visited when rendering, so swap the nodes in and out of the scene instead of hiding them.
+    if (batch.node)
+        AttachTileNode(rootNode, batch.node, drawn);
+    for(int y = batchY * cBatchSize; y < min((batchY + 1) * cBatchSize, patchHeight); ++y)
+        for(int x = batchX * cBatchSize; x < min((batchX + 1) * cBatchSize, patchWidth); ++x)
+        {
+            Patch &patch = GetPatch(x, y);
+            if (patch.node)
+                AttachTileNode(rootNode, patch.node, !drawn);
+            if (drawn)
+                patch.vertexSpacing = 0;
+        }
+}
+
+void EC_Terrain::UpdateLod()
+{
+    if (!rootNode || !ViewEnabled())
+        return;
+
+    Renderer *renderer = framework_->GetService<Renderer>();
+    if (!renderer || !renderer->GetCurrentCamera())
+        return;
+
+    PROFILE(EC_Terrain_UpdateLod);
+
+    // Measure the distances in the local space of the terrain, i.e. in terrain vertices.
+    const Ogre::Vector3 cameraPos = GetWorldTransform(rootNode).inverse() * renderer->GetCurrentCamera()->getDerivedPosition();
+    const int batchVertices = cBatchSize * cPatchSize;
+
+    // A batch is drawn in place of its patches when all of it is far enough away to be drawn with the vertex spacing of the batch.
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+        {
+            PatchBatch &batch = GetBatch(x, y);
+            batch.vertexSpacing = 0;
+            if (!batch.entity || batch.batch_geometry_dirty)
+                continue;
+
+            const int spacing = VertexSpacingAtDistance(DistanceToTile(cameraPos, x * batchVertices, y * batchVertices, batchVertices,
+                batch.minHeight, batch.maxHeight));
+            if (spacing >= cBatchSize)
+                batch.vertexSpacing = spacing;
+        }
+
+    // A patch edge can drop at most down to its two corner vertices, so the batches next to drawn patches can not be coarser than that.
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+        {
+            PatchBatch &batch = GetBatch(x, y);
+            for(int side = 0; side < TerrainIndexBuffers::NumSides && batch.vertexSpacing > cPatchSize; ++side)
+            {
+                const int neighborX = x + cSideOffsets[side][0];
+                const int neighborY = y + cSideOffsets[side][1];
+                if (BatchExists(neighborX, neighborY) && GetBatch(neighborX, neighborY).vertexSpacing == 0)
+                    batch.vertexSpacing = cPatchSize;
+            }
+        }
+
+    // Pick the spacing of the patches of the batches that are not drawn.
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+        {
+            SetBatchDrawn(x, y, GetBatch(x, y).vertexSpacing > 0);
+            if (GetBatch(x, y).vertexSpacing > 0)
+                continue;
+
+            for(int patchY = y * cBatchSize; patchY < min((y + 1) * cBatchSize, patchHeight); ++patchY)
+                for(int patchX = x * cBatchSize; patchX < min((x + 1) * cBatchSize, patchWidth); ++patchX)
+                {
+                    Patch &patch = GetPatch(patchX, patchY);
+                    patch.vertexSpacing = 0;
+                    if (patch.entity)
+                        patch.vertexSpacing = min(cPatchSize / 2, VertexSpacingAtDistance(DistanceToTile(cameraPos, patchX * cPatchSize,
+                            patchY * cPatchSize, cPatchSize, patch.minHeight, patch.maxHeight)));
+                }
+        }
+
+    // Now that the spacing of every drawn tile is known, stitch the edges of each to its neighbors.
+    int edgeSteps[TerrainIndexBuffers::NumSides];
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+        {
+            PatchBatch &batch = GetBatch(x, y);
+            if (batch.vertexSpacing > 0)
+            {
+                for(int side = 0; side < TerrainIndexBuffers::NumSides; ++side)
+                    edgeSteps[side] = BatchEdgeSpacing(x, y, side) / cBatchSize;
+                SetTileLod(batch.entity, batch.lodKey, batch.vertexSpacing / cBatchSize, edgeSteps);
+                continue;
+            }
+
+            for(int patchY = y * cBatchSize; patchY < min((y + 1) * cBatchSize, patchHeight); ++patchY)
+                for(int patchX = x * cBatchSize; patchX < min((x + 1) * cBatchSize, patchWidth); ++patchX)
+                {
+                    Patch &patch = GetPatch(patchX, patchY);
+                    if (patch.vertexSpacing == 0)
+                        continue;
+                    for(int side = 0; side < TerrainIndexBuffers::NumSides; ++side)
+                        edgeSteps[side] = PatchEdgeSpacing(patchX, patchY, side);
+                    SetTileLod(patch.entity, patch.lodKey, patch.vertexSpacing, edgeSteps);
+                }
+        }
+}
+
 void EC_Terrain::CreateRootNode()
 {
     // If we already have the patch root node, no need to re-create it.
@@ -1606,6 +2609,10 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
 {
     PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
 
+    // The range of the regenerated patches, reported with PatchesRegenerated.
+    int minX = patchWidth, minY = patchHeight, maxX = -1, maxY = -1;
+
+    tileRequests.clear();
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
         {
@@ -1636,15 +2643,49 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
             }
 
             if (neighborsLoaded)
-                GenerateTerrainGeometryForOnePatch(x, y);
+            {
+                // The patch connects to the first row and column of vertices of its neighbors, so it has (cPatchSize+1) x (cPatchSize+1) vertices.
+                TileRequest request = { x, y, x * cPatchSize, y * cPatchSize, 1, 0.f, 0.f };
+                tileRequests.push_back(request);
+                minX = min(minX, x);
+                minY = min(minY, y);
+                maxX = max(maxX, x);
+                maxY = max(maxY, y);
+            }
         }
-    
+    GenerateRequestedTiles(false);
+
+    // Regenerate the out of date batches whose patches all have their geometry generated.
+    tileRequests.clear();
+    for(int y = 0; y < batchHeight; ++y)
+        for(int x = 0; x < batchWidth; ++x)
+        {
+            if (!GetBatch(x, y).batch_geometry_dirty)
+                continue;
+
+            bool patchesGenerated = true;
+            for(int patchY = y * cBatchSize; patchY < min((y + 1) * cBatchSize, patchHeight); ++patchY)
+                for(int patchX = x * cBatchSize; patchX < min((x + 1) * cBatchSize, patchWidth); ++patchX)
+                    if (GetPatch(patchX, patchY).patch_geometry_dirty || !GetPatch(patchX, patchY).entity)
+                        patchesGenerated = false;
+
+            if (patchesGenerated)
+            {
+                // A batch has as many vertices as a patch, spread cBatchSize times as far apart.
+                TileRequest request = { x, y, x * cBatchSize * cPatchSize, y * cBatchSize * cPatchSize, cBatchSize, 0.f, 0.f };
+                tileRequests.push_back(request);
+            }
+        }
+    GenerateRequestedTiles(true);
+
     // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
     // we need to hide all newly created geometry.
     AttachTerrainRootNode();
 
     ///\todo If this terrain only exists for physics heightfield purposes, don't create GPU resources for it at all.
 
+    if (maxX >= 0)
+        emit PatchesRegenerated(minX, minY, maxX, maxY);
     emit TerrainRegenerated();
 }
 
@@ -19,9 +19,16 @@ namespace Ogre
     class Matrix4;
 }
 
+namespace Foundation
+{
+    class JobSystem;
+}
+
 namespace Environment
 {
 
+class TerrainIndexBuffers;
+
 /// Adds a heightmap-based terrain to the scene.
 /**
 <table class="header">
@@ -32,6 +39,9 @@ namespace Environment
 Adds a heightmap-based terrain to the scene. A Terrain is composed of a rectangular grid of adjacent "patches".
 Each patch is a fixed-size 16x16 height map.
 
+The patches are drawn with a level of detail that depends on their distance to the camera, and distant patches are drawn in batches of
+4x4 patches, so that the number of draw calls and vertices follows the screen coverage of the terrain instead of its size.
+
 Registered by Environment::EnvironmentModule.
 
 <b>Attributes:</b>
@@ -118,6 +128,9 @@ public:
     /// Each patch is a square containing this many vertices per side.
     static const int cPatchSize = 16;
 
+    /// Distant patches are drawn in batches of cBatchSize x cBatchSize patches.
+    static const int cBatchSize = 4;
+
     /// Describes a single patch that is present in the scene.
     /** A patch can be in one of the following three states:
         - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
@@ -127,7 +140,7 @@ public:
     */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true), minHeight(0.f), maxHeight(0.f), vertexSpacing(0), lodKey(-1) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         int x;
@@ -153,6 +166,16 @@ public:
         /// in yet.
         bool patch_geometry_dirty;
 
+        /// The height range of the GPU geometry, for the level of detail selection.
+        float minHeight;
+        float maxHeight;
+
+        /// The spacing of the vertices the patch is currently drawn with, or 0 if the patch is not drawn on its own.
+        int vertexSpacing;
+
+        /// Identifies the index buffer the patch is currently drawn with, or -1 if none has been set yet.
+        int lodKey;
+
         /// Call only when you've checked that this patch has been loaded in.
         float GetHeightValue(int x, int y) const { return heightData[y*cPatchSize+x]; }
     };
@@ -305,7 +328,9 @@ public slots:
     int VerticesHeight() const { return PatchHeight() * cPatchSize; }
 
     /// Saves the height map data and the associated per-vertex attributes to a Naali Terrain File.
-    /** This is a binary dump file, and as a convention, use the file suffix ".ntf" for these.
+    /** As a convention, use the file suffix ".ntf" for these. The file starts with a header and a table of offsets to the height blocks
+        of each patch, so that the patches can be decoded in any order. Each block stores the height range of its patch, and the heights
+        quantized to 1 mm (or finer, within 16 bits of the range), predicted from the neighboring heights and bit-packed.
         @return True if the save succeeded.
     */
     bool SaveToFile(QString filename);
@@ -321,6 +346,9 @@ public slots:
     bool LoadFromFile(QString filename);
 
     /// Loads the terrain height map data from the given in-memory .ntf file buffer.
+    /** Reads both the current format and the older format of raw float heights. With the current format, only the header is read
+        right away. The patches nearest to the camera are decoded first, and the rest are decoded over the next frames.
+    */
     bool LoadFromDataInMemory(const char *data, size_t numBytes);
 
     void NormalizeImage(QString filename) const;
@@ -380,10 +408,21 @@ public slots:
     /** This function blindly iterates through the whole terrain, so avoid calling it in performance-critical code. */
     float GetTerrainMaxHeight() const;
 
+    /// Sets the distance, in terrain vertices, up to which the terrain is drawn at the full level of detail.
+    /** Each doubling of the distance beyond this halves the density of the drawn vertices. */
+    void SetLodDistance(float distance);
+
+    /// Returns the distance up to which the terrain is drawn at the full level of detail.
+    float GetLodDistance() const { return lodDistance; }
+
 signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted before TerrainRegenerated when some patches were regenerated, with the inclusive range of the regenerated patches.
+    /// Lets the users of the height data, like the physics heightfield, update only the changed part of the terrain.
+    void PatchesRegenerated(int minPatchX, int minPatchY, int maxPatchX, int maxPatchY);
+
 private slots:
     //! Open asset editor for given asset attribute.
     void View(const QString &attributeName);
@@ -402,7 +441,38 @@ private slots:
     /// Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node.s
     void AttachTerrainRootNode();
 
+    /// Selects the level of detail of each patch and batch for the current camera, and the patches or batches to draw.
+    void UpdateLod();
+
+    /// Decodes the next patches of a streamed terrain file, nearest to the camera first, and regenerates them.
+    void LoadPendingPatches();
+
 private:
+    /// A group of cBatchSize x cBatchSize patches that is drawn with a single mesh when it is far from the camera.
+    struct PatchBatch
+    {
+        PatchBatch():node(0), entity(0), batch_geometry_dirty(true), drawn(false), minHeight(0.f), maxHeight(0.f), vertexSpacing(0), lodKey(-1) {}
+
+        Ogre::SceneNode *node;
+        Ogre::Entity *entity;
+        std::string meshGeometryName;
+
+        /// If true, some of the patches of the batch have been regenerated since the batch was.
+        bool batch_geometry_dirty;
+
+        /// If true, the batch is drawn instead of its patches, and the batch node is attached to the terrain root node instead of the patch nodes.
+        bool drawn;
+
+        float minHeight;
+        float maxHeight;
+
+        /// The spacing of the vertices the batch is drawn with, or 0 if the patches of the batch are drawn instead.
+        int vertexSpacing;
+
+        /// Identifies the index buffer the batch is currently drawn with, or -1 if none has been set yet.
+        int lodKey;
+    };
+
     explicit EC_Terrain(IModule* module);
 
     /// Creates the patch parent/root node if it does not exist.
@@ -428,7 +498,98 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(int index, const char *textureName);
 
-    void GenerateTerrainGeometryForOnePatch(int patchX, int patchY);
+    /// Uploads the given vertices, computed by ComputeTileVertices, as the geometry of the given patch.
+    void GenerateTerrainGeometryForOnePatch(int patchX, int patchY, const float *vertices, float minHeight, float maxHeight);
+
+    /// Uploads the given vertices, computed by ComputeTileVertices, as the geometry of the given batch.
+    void GenerateTerrainGeometryForOneBatch(int batchX, int batchY, const float *vertices, float minHeight, float maxHeight);
+
+    /// A patch or a batch whose geometry is being regenerated.
+    struct TileRequest
+    {
+        /// Coordinates of the patch or the batch.
+        int tileX;
+        int tileY;
+
+        /// The map vertex the tile starts at, and the spacing of its vertices.
+        int mapX;
+        int mapY;
+        int spacing;
+
+        /// The height range of the tile, filled in by ComputeTileVertexRange.
+        float minHeight;
+        float maxHeight;
+    };
+
+    /// Computes the vertices of the tiles in tileRequests in the worker threads of the job system, and uploads them in the calling thread.
+    void GenerateRequestedTiles(bool batchTiles);
+
+    /// Computes the vertices of the tile requests [begin, end[ into tileVertices, which starts at the request firstRequest. Thread-safe.
+    void ComputeTileVertexRange(int firstRequest, int begin, int end);
+
+    /// Computes the vertices of a tile of (cPatchSize+1) x (cPatchSize+1) vertices that starts at the given map vertex, with the given
+    /// spacing between the vertices. Each vertex has a position relative to the tile origin, a normal and two texture coordinates.
+    /// Only reads the height data, so it can be called from several threads at once.
+    void ComputeTileVertices(int mapX, int mapY, int spacing, float *vertices, float &minHeight, float &maxHeight) const;
+
+    /// Writes the given vertices into the vertex buffer of the tile entity, or creates the mesh and the entity if the tile does not have them yet.
+    void UpdateTileEntity(Ogre::SceneNode *node, Ogre::Entity *&entity, std::string &meshGeometryName, const float *vertices,
+        int spacing, float minHeight, float maxHeight);
+
+    /// Replaces the mesh and the entity attached to the given tile node with new ones created from the given vertices.
+    void CreateTileEntity(Ogre::SceneNode *node, Ogre::Entity *&entity, std::string &meshGeometryName, const float *vertices,
+        int spacing, float minHeight, float maxHeight);
+
+    /// Sets the entity of a tile to use the currently set material.
+    void SetTileMaterial(Ogre::Entity *entity);
+
+    /// Sets the entity of a tile to draw with every step'th vertex, and the given vertex steps on its edges.
+    void SetTileLod(Ogre::Entity *entity, int &lodKey, int step, const int edgeSteps[4]);
+
+    /// Returns the vertex spacing the terrain is drawn with at the given distance from the camera.
+    int VertexSpacingAtDistance(float distance) const;
+
+    /// Returns the vertex spacing the patch, drawn on its own, uses on its edge at the given side.
+    int PatchEdgeSpacing(int patchX, int patchY, int side) const;
+
+    /// Returns the vertex spacing the batch, when drawn, uses on its edge at the given side.
+    int BatchEdgeSpacing(int batchX, int batchY, int side) const;
+
+    /// Switches between drawing the given batch and drawing its patches.
+    void SetBatchDrawn(int batchX, int batchY, bool drawn);
+
+    /// Releases all GPU resources used for the given batch.
+    void DestroyBatch(int batchX, int batchY);
+
+    /// Lays out the batches over the current patch grid. The batches must have been destroyed before calling this.
+    void ResizeBatches();
+
+    /// Decodes at most the given number of the patches still waiting in the streamed terrain file. Does not regenerate them.
+    /** @return The number of patches decoded. */
+    size_t DecodePendingPatches(size_t maxPatches);
+
+    /// Decodes the patch at the given index in patches from the streamed terrain file. Flattens the patch if its height block is malformed.
+    void DecodeStreamedPatch(int index);
+
+    /// Decodes the patch at the given index in patches, if it is still waiting in the streamed terrain file. Does not regenerate it.
+    void DecodePendingPatch(int index);
+
+    /// Forgets the patch at the given index in patches, if it is still waiting in the streamed terrain file, so that its heights can be
+    /// overwritten without being replaced by the decoded ones later.
+    void DiscardPendingPatch(int index);
+
+    /// Forgets all the patches still waiting in the streamed terrain file, and releases the file. Call before overwriting all the heights.
+    void DiscardPendingPatches();
+
+    /// Releases the streamed terrain file once no patches are waiting in it.
+    void ReleaseStreamedTerrainData();
+
+    /// Returns the batch at the given batch grid coordinates.
+    PatchBatch &GetBatch(int batchX, int batchY) { return batches[batchY * batchWidth + batchX]; }
+    const PatchBatch &GetBatch(int batchX, int batchY) const { return batches[batchY * batchWidth + batchX]; }
+
+    /// Returns true if the given batch exists.
+    bool BatchExists(int batchX, int batchY) const { return batchX >= 0 && batchY >= 0 && batchX < batchWidth && batchY < batchHeight; }
 
     boost::shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -448,7 +609,36 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    int batchWidth;
+    int batchHeight;
+
+    /// The batches of patches, batchWidth x batchHeight of them.
+    std::vector<PatchBatch> batches;
+
+    /// The index buffers shared by all the patches and batches.
+    boost::shared_ptr<TerrainIndexBuffers> indexBuffers;
+
+    /// The distance up to which the terrain is drawn at the full level of detail.
+    float lodDistance;
+
+    /// The tiles being regenerated, and the vertices computed for them. Kept between regenerations so that they are allocated only once.
+    std::vector<TileRequest> tileRequests;
+    std::vector<float> tileVertices;
+
+    /// The terrain file the patches are being decoded from, and the offsets of the height block of each patch in it.
+    std::vector<u8> streamedTerrainData;
+    std::vector<u32> streamedBlockOffsets;
+
+    /// Indices of the patches not yet decoded from streamedTerrainData.
+    std::vector<int> pendingPatches;
 };
+
+/// Times the heights GenerateFromOgreMesh finds on meshes of rolling hills with the original per-vertex raycast and with the
+/// triangle grid, and returns a report. The meshes are 32 units wide, doubled up to maxSize, each at two triangle densities.
+/// @param jobSystem If specified, the grid is also timed with the rows computed in parallel in its worker threads.
+std::string BenchmarkTerrainFromMesh(int maxSize, Foundation::JobSystem *jobSystem);
+
 }
 
 #endif
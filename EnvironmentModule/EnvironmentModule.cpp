@@ -23,6 +23,7 @@
 #include "EC_EnvironmentLight.h"
 #include "TerrainWeightEditor.h"
 #include "EC_OgreEnvironment.h"
+#include "TerrainDecoder.h"
 
 #include "UiAPI.h"
 #include "SceneAPI.h"
@@ -38,6 +39,8 @@
 #include "EventManager.h"
 #include "RexNetworkUtils.h"
 #include "CompositionHandler.h"
+#include "ConsoleAPI.h"
+#include "ConsoleCommandUtils.h"
 #include "EC_Name.h"
 #include "WorldBuildingServiceInterface.h"
 #include "../TundraLogicModule/TundraEvents.h"
@@ -102,6 +105,32 @@ namespace Environment
             connect(wb_service.get(), SIGNAL(OverrideServerTime(int)), environment_editor_, SLOT(TimeOfDayOverrideChanged(int)));
             connect(wb_service.get(), SIGNAL(SetOverrideTime(int)), environment_editor_, SLOT(TimeValueChanged(int)));
         }
+
+        framework_->Console()->RegisterCommand(CreateConsoleCommand("BenchmarkTerrainDecoder",
+            "Times the decompression of random OpenSim terrain patches. Usage: BenchmarkTerrainDecoder(numPatches)",
+            ConsoleBind(this, &EnvironmentModule::BenchmarkTerrainDecoder)));
+        framework_->Console()->RegisterCommand(CreateConsoleCommand("BenchmarkTerrainFromMesh",
+            "Times generating terrain heights from meshes of growing size, with the original per-vertex raycast and with the triangle grid. "
+            "Usage: BenchmarkTerrainFromMesh(maxSize)",
+            ConsoleBind(this, &EnvironmentModule::BenchmarkTerrainFromMesh)));
+    }
+
+    ConsoleCommandResult EnvironmentModule::BenchmarkTerrainDecoder(const StringVector &params)
+    {
+        const int numPatches = params.size() > 0 ? ParseString<int>(params[0], 0) : 4096;
+        if (numPatches <= 0)
+            return ConsoleResultFailure("Invalid number of patches " + params[0]);
+
+        return ConsoleResultSuccess(Environment::BenchmarkTerrainDecoder(numPatches, framework_->GetJobSystem().get()));
+    }
+
+    ConsoleCommandResult EnvironmentModule::BenchmarkTerrainFromMesh(const StringVector &params)
+    {
+        const int maxSize = params.size() > 0 ? ParseString<int>(params[0], 0) : 128;
+        if (maxSize < 32)
+            return ConsoleResultFailure("Invalid mesh size " + params[0] + ", the smallest mesh is 32 units wide");
+
+        return ConsoleResultSuccess(Environment::BenchmarkTerrainFromMesh(maxSize, framework_->GetJobSystem().get()));
     }
 
     void EnvironmentModule::Uninitialize()
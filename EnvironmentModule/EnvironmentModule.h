@@ -179,6 +179,12 @@ namespace Environment
         //! @return Returns type of this module. Needed for logging.
         static std::string type_name_static_;
 
+        //! Console command for timing the terrain patch decoder. Usage: BenchmarkTerrainDecoder(numPatches)
+        ConsoleCommandResult BenchmarkTerrainDecoder(const StringVector &params);
+
+        //! Console command for timing the terrain generation from a mesh. Usage: BenchmarkTerrainFromMesh(maxSize)
+        ConsoleCommandResult BenchmarkTerrainFromMesh(const StringVector &params);
+
         //! Create the terrain.
         void CreateTerrain();
 
@@ -517,7 +517,7 @@ namespace Environment
             SetupOpenSimTerrainParameters();
 
             std::vector<DecodedTerrainPatch> patches;
-            DecompressLand(patches, bits, header);
+            DecompressLand(patches, bits, header, owner_->GetFramework()->GetJobSystem().get());
             for(size_t i = 0; i < patches.size(); ++i)
                 CreateOrUpdateTerrainPatchHeightData(patches[i], header.patchSize);
 
@@ -15,6 +15,15 @@
 #include "BitStream.h"
 #include "TerrainDecoder.h"
 #include "EnvironmentModule.h"
+#include "JobSystem.h"
+#include "HighPerfClock.h"
+
+#include <boost/bind.hpp>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TERRAIN_DECODER_SSE
+#include <xmmintrin.h>
+#endif
 
 namespace Environment
 {
@@ -23,6 +32,7 @@ namespace
 {
 const int cEndOfPatches = 97; ///< Magic number that denotes in a LayerData header that there are no more patches present in the packet.
 const float OO_SQRT2 = 0.7071067811865475244008443621049f;
+const int cPatchesPerJob = 16; ///< The number of patches to transform in one job when decompressing in worker threads.
 
 /// Code adapted from libopenmetaverse.org project, TerrainCompressor.cs / TerrainManager.cs
 /// Stores precomputed tables of coefficients needed in the IDCT transform.
@@ -39,6 +49,7 @@ public:
 
     float dequantizeTable16[16*16];
     float cosineTable16[16*16];
+    float idctTable16[16*16]; ///< The cosine table with the DC row replaced by its weight, so that both IDCT passes are plain matrix products.
     int copyMatrix16[16*16];
     float quantizeTable16[16*16];
 
@@ -63,6 +74,11 @@ public:
         for (int u = 0; u < 16; u++)
             for (int n = 0; n < 16; n++)
                 cosineTable16[u*16 + n] = (float)cosf((2.0f * (float)n + 1.0f) * (float)u * hposz);
+
+        for (int n = 0; n < 16; n++)
+            idctTable16[n] = OO_SQRT2;
+        for (int n = 16; n < 16*16; n++)
+            idctTable16[n] = cosineTable16[n];
     }
 
     void BuildCopyMatrix16()
@@ -215,7 +231,8 @@ void IDCTLine16(const float *linein, float *lineout, int line)
 }
 
 /// Code adapted from libopenmetaverse.org project, TerrainCompressor.cs / TerrainManager.cs
-void DecompressTerrainPatch(std::vector<float> &output, int *patchData, const TerrainPatchHeader &patchHeader, const TerrainPatchGroupHeader &groupHeader)
+/// The original scalar decoder, kept as the reference for BenchmarkTerrainDecoder.
+void DecompressTerrainPatchReference(std::vector<float> &output, int *patchData, const TerrainPatchHeader &patchHeader, const TerrainPatchGroupHeader &groupHeader)
 {
     std::vector<float> block(groupHeader.patchSize * groupHeader.patchSize);
     output.clear();
@@ -247,35 +264,200 @@ void DecompressTerrainPatch(std::vector<float> &output, int *patchData, const Te
         output[j] = block[j] * mult + addval;
 }
 
+/// Reorders the zigzag-ordered coefficients of a 16x16 patch to a row-major block and dequantizes them.
+void DequantizePatch(const int *patchData, std::vector<float> &block)
+{
+    block.resize(16*16);
+    for(int n = 0; n < 16 * 16; n++)
+        block[n] = patchData[precompTables.copyMatrix16[n]] * precompTables.dequantizeTable16[n];
+}
+
+/// Performs a 16x16 IDCT in place, and maps the results to heights with output = result * scale + offset.
+/// Both passes accumulate whole rows of 16 elements at a time, which vectorizes to four SSE registers per row.
+/// @param temp Scratch space for 16*16 floats.
+void IDCT16x16(float *block, float *temp, float scale, float offset)
+{
+    const float *table = precompTables.idctTable16;
+#ifdef TERRAIN_DECODER_SSE
+    // The column pass. Output row n is the sum of the input rows u weighted by table[u][n].
+    for(int n = 0; n < 16; n++)
+    {
+        __m128 sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for(int u = 0; u < 16; u++)
+        {
+            const __m128 weight = _mm_set1_ps(table[u*16 + n]);
+            for(int i = 0; i < 4; i++)
+                sum[i] = _mm_add_ps(sum[i], _mm_mul_ps(weight, _mm_loadu_ps(block + u*16 + i*4)));
+        }
+        for(int i = 0; i < 4; i++)
+            _mm_storeu_ps(temp + n*16 + i*4, sum[i]);
+    }
+
+    // The row pass. Output row l is the sum of the table rows u weighted by temp[l][u].
+    const __m128 scaleVec = _mm_set1_ps(scale * 2.0f / 16.0f);
+    const __m128 offsetVec = _mm_set1_ps(offset);
+    for(int l = 0; l < 16; l++)
+    {
+        __m128 sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for(int u = 0; u < 16; u++)
+        {
+            const __m128 weight = _mm_set1_ps(temp[l*16 + u]);
+            for(int i = 0; i < 4; i++)
+                sum[i] = _mm_add_ps(sum[i], _mm_mul_ps(weight, _mm_loadu_ps(table + u*16 + i*4)));
+        }
+        for(int i = 0; i < 4; i++)
+            _mm_storeu_ps(block + l*16 + i*4, _mm_add_ps(_mm_mul_ps(sum[i], scaleVec), offsetVec));
+    }
+#else
+    for(int n = 0; n < 16; n++)
+    {
+        float sum[16] = { 0 };
+        for(int u = 0; u < 16; u++)
+            for(int i = 0; i < 16; i++)
+                sum[i] += table[u*16 + n] * block[u*16 + i];
+        for(int i = 0; i < 16; i++)
+            temp[n*16 + i] = sum[i];
+    }
+
+    const float rowScale = scale * 2.0f / 16.0f;
+    for(int l = 0; l < 16; l++)
+    {
+        float sum[16] = { 0 };
+        for(int u = 0; u < 16; u++)
+            for(int i = 0; i < 16; i++)
+                sum[i] += temp[l*16 + u] * table[u*16 + i];
+        for(int i = 0; i < 16; i++)
+            block[l*16 + i] = sum[i] * rowScale + offset;
+    }
+#endif
+}
+
+/// Turns the dequantized coefficients in the height data of the patches [begin, end) to heights.
+void InverseTransformPatchRange(std::vector<DecodedTerrainPatch> *patches, int begin, int end)
+{
+    float temp[16*16];
+    for(int i = begin; i < end; ++i)
+    {
+        DecodedTerrainPatch &patch = (*patches)[i];
+        int prequant = (patch.header.quantWBits >> 4) + 2;
+        int quantize = 1 << prequant;
+        float ooq = 1.0f / (float)quantize;
+        float mult = ooq * (float)patch.header.range;
+        float addval = mult * (float)(1 << (prequant - 1)) + patch.header.dcOffset;
+
+        IDCT16x16(&patch.heightData[0], temp, mult, addval);
+    }
+}
+
+/// Transforms the patches [begin, end), in parallel if a job system is given and there are enough patches to split.
+void InverseTransformPatches(std::vector<DecodedTerrainPatch> &patches, int begin, int end, Foundation::JobSystem *jobSystem)
+{
+    if (jobSystem && end - begin > cPatchesPerJob)
+        jobSystem->ParallelFor(begin, end, boost::bind(&InverseTransformPatchRange, &patches, _1, _2), cPatchesPerJob);
+    else
+        InverseTransformPatchRange(&patches, begin, end);
+}
+
 } // ~unnamed namespace
 
 /// Code adapted from libopenmetaverse.org project, TerrainCompressor.cs / TerrainManager.cs
-void DecompressLand(std::vector<DecodedTerrainPatch> &patches, ProtocolUtilities::BitStream &bits, const TerrainPatchGroupHeader &groupHeader)
+void DecompressLand(std::vector<DecodedTerrainPatch> &patches, ProtocolUtilities::BitStream &bits, const TerrainPatchGroupHeader &groupHeader,
+    Foundation::JobSystem *jobSystem)
 {
+    if (groupHeader.patchSize != 16)
+    {
+        EnvironmentModule::LogWarning("TerrainDecoder:DecompressLand: Unsupported patch size present!");
+        return;
+    }
+
+    // Reading the packet is inherently serial, so read all the patches first, and only then run the transforms, which are independent of each other.
+    const int firstPatch = (int)patches.size();
+    int patchData[16*16];
     while(bits.BitsLeft() > 0)
     {
-        DecodedTerrainPatch patch;
-        patch.header = DecodePatchHeader(bits);
+        TerrainPatchHeader header = DecodePatchHeader(bits);
 
-        if (patch.header.quantWBits == cEndOfPatches)
+        if (header.quantWBits == cEndOfPatches)
             break;
 
         const int cPatchesPerEdge = 16;
 
         // The MSB of header.x and header.y are unused, or used for some other purpose?
-        if (patch.header.x >= cPatchesPerEdge || patch.header.y >= cPatchesPerEdge)
+        if (header.x >= cPatchesPerEdge || header.y >= cPatchesPerEdge)
         {
             EnvironmentModule::LogWarning("TerrainDecoder:DecompressLand: Invalid patch data!");
-            return;
+            break;
         }
 
-        int patchData[16*16];
-        DecodeTerrainPatch(patchData, bits, patch.header, groupHeader.patchSize);
+        DecodeTerrainPatch(patchData, bits, header, groupHeader.patchSize);
 
-        DecompressTerrainPatch(patch.heightData, patchData, patch.header, groupHeader);
+        patches.push_back(DecodedTerrainPatch());
+        patches.back().header = header;
+        DequantizePatch(patchData, patches.back().heightData);
+    }
 
-        patches.push_back(patch); ///\todo Can optimize out a copy of heavy struct by push_backing early in the loop.
+    InverseTransformPatches(patches, firstPatch, (int)patches.size(), jobSystem);
+}
+
+std::string BenchmarkTerrainDecoder(int numPatches, Foundation::JobSystem *jobSystem)
+{
+    TerrainPatchGroupHeader groupHeader;
+    groupHeader.stride = 264;
+    groupHeader.patchSize = 16;
+    groupHeader.layerType = TPLayerLand;
+
+    // Random coefficients that fall off towards the high frequencies, like in real terrain.
+    std::vector<TerrainPatchHeader> headers(numPatches);
+    std::vector<int> coefficients(numPatches * 16*16);
+    for(int i = 0; i < numPatches; ++i)
+    {
+        headers[i].quantWBits = 0x58;
+        headers[i].dcOffset = (float)(rand() % 50);
+        headers[i].range = (u16)(1 + rand() % 100);
+        headers[i].x = (u8)(i % 16);
+        headers[i].y = (u8)(i / 16 % 16);
+        headers[i].wordBits = (headers[i].quantWBits & 0x0f) + 2;
+        for(int n = 0; n < 16*16; ++n)
+            coefficients[i*16*16 + n] = (rand() % 201 - 100) / (1 + n / 8);
+    }
+
+    std::vector<std::vector<float> > reference(numPatches);
+    tick_t start = GetCurrentClockTime();
+    for(int i = 0; i < numPatches; ++i)
+        DecompressTerrainPatchReference(reference[i], &coefficients[i*16*16], headers[i], groupHeader);
+    const double referenceTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+
+    std::vector<DecodedTerrainPatch> patches(numPatches);
+    start = GetCurrentClockTime();
+    for(int i = 0; i < numPatches; ++i)
+    {
+        patches[i].header = headers[i];
+        DequantizePatch(&coefficients[i*16*16], patches[i].heightData);
+    }
+    InverseTransformPatches(patches, 0, numPatches, 0);
+    const double serialTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+
+    float maxError = 0.f;
+    for(int i = 0; i < numPatches; ++i)
+        for(int n = 0; n < 16*16; ++n)
+            maxError = std::max(maxError, fabsf(patches[i].heightData[n] - reference[i][n]));
+
+    std::stringstream ss;
+    ss << "Decompressed " << numPatches << " terrain patches. Reference: " << referenceTime * 1000.0 << " ms, current: " << serialTime * 1000.0
+        << " ms (" << referenceTime / std::max(serialTime, 1e-9) << "x)";
+
+    if (jobSystem)
+    {
+        start = GetCurrentClockTime();
+        for(int i = 0; i < numPatches; ++i)
+            DequantizePatch(&coefficients[i*16*16], patches[i].heightData);
+        InverseTransformPatches(patches, 0, numPatches, jobSystem);
+        const double parallelTime = (double)(GetCurrentClockTime() - start) / GetCurrentClockFreq();
+        ss << ", in " << jobSystem->NumWorkerThreads() << " worker threads: " << parallelTime * 1000.0 << " ms ("
+            << referenceTime / std::max(parallelTime, 1e-9) << "x)";
     }
+    ss << ". Largest height difference to the reference: " << maxError << ".";
+    return ss.str();
 }
 
 }
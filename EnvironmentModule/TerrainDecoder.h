@@ -11,6 +11,11 @@
 
 #include "BitStream.h"
 
+namespace Foundation
+{
+    class JobSystem;
+}
+
 namespace Environment
 {
     /// Code adapted from libopenmetaverse.org project, TerrainCompressor.cs / TerrainManager.cs
@@ -48,11 +53,17 @@ namespace Environment
         TerrainPatchHeader header;
     };
 
-    /// Decompresses a single patch of terrain height data from a LayerData packet.
-    /// @param patches [out] The resulting patch data will be output here.
+    /// Decompresses the patches of terrain height data in a LayerData packet.
+    /// @param patches [out] The resulting patch data will be appended here.
     /// @param bits [in] The LayerData packet, of which the Patch Group Header has already been read.
     /// @param groupHeader 
-    void DecompressLand(std::vector<DecodedTerrainPatch> &patches, ProtocolUtilities::BitStream &bits, const TerrainPatchGroupHeader &groupHeader);
+    /// @param jobSystem If specified, the IDCTs of the patches are run in parallel in its worker threads. The packet itself is always read in the calling thread.
+    void DecompressLand(std::vector<DecodedTerrainPatch> &patches, ProtocolUtilities::BitStream &bits, const TerrainPatchGroupHeader &groupHeader,
+        Foundation::JobSystem *jobSystem = 0);
+
+    /// Times the decompression of the given number of random patches with the original scalar decoder and with the current one, and returns a report.
+    /// @param jobSystem If specified, the decompression is also timed in parallel in its worker threads.
+    std::string BenchmarkTerrainDecoder(int numPatches, Foundation::JobSystem *jobSystem);
 }
 
 #endif
@@ -0,0 +1,142 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   TerrainIndexBuffers.cpp
+ *  @brief  Index buffers for drawing terrain tiles at different levels of detail, with the edges stitched to the neighboring tiles.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "TerrainIndexBuffers.h"
+
+#include <OgreHardwareBufferManager.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace Environment
+{
+
+namespace
+{
+    /// Returns the base 2 logarithm of the given power of two.
+    uint Log2(int value)
+    {
+        uint log = 0;
+        while(value > 1)
+        {
+            value >>= 1;
+            ++log;
+        }
+        return log;
+    }
+
+    /// Returns the index of the vertex that lies the given distance along the given side of the tile, and the given depth inwards from it.
+    int SideVertex(int side, int along, int depth, int gridSize)
+    {
+        const int width = gridSize + 1;
+        switch(side)
+        {
+        case TerrainIndexBuffers::SideSouth: return depth * width + along;
+        case TerrainIndexBuffers::SideEast: return along * width + gridSize - depth;
+        case TerrainIndexBuffers::SideNorth: return (gridSize - depth) * width + along;
+        default: return along * width + depth; // SideWest
+        }
+    }
+
+    /// Adds a triangle, wound counterclockwise when seen from above like the rest of the terrain geometry.
+    void AddTriangle(std::vector<u16> &indices, int a, int b, int c, int gridSize)
+    {
+        const int width = gridSize + 1;
+        const int cross = (b % width - a % width) * (c / width - a / width) - (b / width - a / width) * (c % width - a % width);
+        indices.push_back((u16)a);
+        indices.push_back((u16)(cross > 0 ? b : c));
+        indices.push_back((u16)(cross > 0 ? c : b));
+    }
+}
+
+TerrainIndexBuffers::TerrainIndexBuffers(int gridSize)
+:gridSize_(gridSize)
+{
+}
+
+uint TerrainIndexBuffers::Key(int step, const int edgeSteps[NumSides])
+{
+    uint key = Log2(step);
+    for(int i = 0; i < NumSides; ++i)
+        key |= Log2(edgeSteps[i]) << (3 * (i + 1));
+    return key;
+}
+
+Ogre::HardwareIndexBufferSharedPtr TerrainIndexBuffers::Get(int step, const int edgeSteps[NumSides], size_t &indexCount)
+{
+    const uint key = Key(step, edgeSteps);
+    std::map<uint, Buffer>::iterator iter = buffers_.find(key);
+    if (iter != buffers_.end())
+    {
+        indexCount = iter->second.indexCount;
+        return iter->second.buffer;
+    }
+
+    std::vector<u16> indices;
+    GenerateIndices(gridSize_, step, edgeSteps, indices);
+
+    // The index data is read back when raycasting against the terrain, so keep a shadow copy of it in system memory.
+    Buffer &buffer = buffers_[key];
+    buffer.indexCount = indices.size();
+    buffer.buffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+        indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    buffer.buffer->writeData(0, buffer.buffer->getSizeInBytes(), &indices[0], true);
+
+    indexCount = buffer.indexCount;
+    return buffer.buffer;
+}
+
+void TerrainIndexBuffers::GenerateIndices(int gridSize, int step, const int edgeSteps[NumSides], std::vector<u16> &indices)
+{
+    assert(step >= 1 && step <= gridSize / 2);
+    const int width = gridSize + 1;
+
+    indices.clear();
+
+    // The inside of the tile, one ring of quads in from the edges, is a regular grid.
+    for(int y = step; y < gridSize - step; y += step)
+        for(int x = step; x < gridSize - step; x += step)
+        {
+            const int i = y * width + x;
+            indices.push_back((u16)i);
+            indices.push_back((u16)(i + step));
+            indices.push_back((u16)(i + step * width));
+
+            indices.push_back((u16)(i + step));
+            indices.push_back((u16)(i + step * width + step));
+            indices.push_back((u16)(i + step * width));
+        }
+
+    // Each side fills the strip between the edge vertices and the inner ring of vertices. Walking along both rows at once and always
+    // advancing the row whose next vertex comes first triangulates the strip for any edge step without T-junctions. The strips of
+    // adjacent sides meet at the diagonals from the corners of the tile to the corners of the inner ring.
+    for(int side = 0; side < NumSides; ++side)
+    {
+        const int edgeStep = std::max(step, std::min(edgeSteps[side], gridSize));
+        int edge = 0;
+        int inner = step;
+        while(edge < gridSize || inner < gridSize - step)
+        {
+            const bool advanceInner = inner < gridSize - step && (edge >= gridSize || inner + step <= edge + edgeStep);
+            if (advanceInner)
+            {
+                AddTriangle(indices, SideVertex(side, edge, 0, gridSize), SideVertex(side, inner, step, gridSize),
+                    SideVertex(side, inner + step, step, gridSize), gridSize);
+                inner += step;
+            }
+            else
+            {
+                AddTriangle(indices, SideVertex(side, edge, 0, gridSize), SideVertex(side, edge + edgeStep, 0, gridSize),
+                    SideVertex(side, inner, step, gridSize), gridSize);
+                edge += edgeStep;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,69 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   TerrainIndexBuffers.h
+ *  @brief  Index buffers for drawing terrain tiles at different levels of detail, with the edges stitched to the neighboring tiles.
+ */
+
+#ifndef incl_Environment_TerrainIndexBuffers_h
+#define incl_Environment_TerrainIndexBuffers_h
+
+#include "CoreTypes.h"
+
+#include <OgreHardwareIndexBuffer.h>
+
+#include <map>
+#include <vector>
+
+namespace Environment
+{
+    /// Creates and caches the index buffers used to draw the terrain tiles.
+    /** A terrain tile is a square grid of (gridSize+1) x (gridSize+1) vertices. At a level of detail, the tile is drawn using only every
+        step'th vertex in both directions. Where a neighboring tile is drawn with a larger vertex spacing, the edge of the tile drops the
+        vertices the neighbor does not have, so that the tiles meet without cracks.
+
+        All the tiles use the same vertex layout, so one index buffer per level of detail and edge configuration is shared by all of them.
+    */
+    class TerrainIndexBuffers
+    {
+    public:
+        /// The sides of a tile, in the order the edge steps are passed in.
+        enum Side
+        {
+            SideSouth, ///< The edge at y == 0.
+            SideEast, ///< The edge at x == gridSize.
+            SideNorth, ///< The edge at y == gridSize.
+            SideWest, ///< The edge at x == 0.
+            NumSides
+        };
+
+        /// @param gridSize The number of quads on each side of a tile at the full level of detail. Must be a power of two.
+        explicit TerrainIndexBuffers(int gridSize);
+
+        /// Returns a key that identifies the given level of detail and edge configuration.
+        static uint Key(int step, const int edgeSteps[NumSides]);
+
+        /// Returns the index buffer for drawing a tile with every step'th vertex, and every edgeSteps[side]'th vertex on each of its edges.
+        /** The buffer is created on the first request.
+            @param step The vertex step inside the tile. A power of two, at most gridSize/2.
+            @param edgeSteps The vertex steps of the edges. Powers of two in the range [step, gridSize].
+            @param indexCount [out] The number of indices in the buffer.
+        */
+        Ogre::HardwareIndexBufferSharedPtr Get(int step, const int edgeSteps[NumSides], size_t &indexCount);
+
+        /// Generates the triangle list indices of the given configuration.
+        static void GenerateIndices(int gridSize, int step, const int edgeSteps[NumSides], std::vector<u16> &indices);
+
+    private:
+        struct Buffer
+        {
+            Ogre::HardwareIndexBufferSharedPtr buffer;
+            size_t indexCount;
+        };
+
+        int gridSize_;
+        std::map<uint, Buffer> buffers_;
+    };
+}
+
+#endif
@@ -0,0 +1,235 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+// This file replaces operator new when ALLOCATION_TRACKING is defined, so it must not include DebugOperatorNew.h or MemoryLeakCheck.h.
+#include "StableHeaders.h"
+
+#include "AllocationTracker.h"
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace Foundation
+{
+
+AllocationTracker *AllocationTracker::instance_ = 0;
+
+const char *AllocationTracker::TagName(int tag)
+{
+    static const char *names[NumAllocationTags] = { "Untagged", "Scene", "Sync", "Network", "Asset", "Script", "Physics", "Render", "Ui" };
+    return tag >= 0 && tag < NumAllocationTags ? names[tag] : "Unknown";
+}
+
+#if defined(ALLOCATION_TRACKING)
+
+AllocationTracker::AllocationTracker() :
+    numThreads_(0)
+{
+    memset(threads_, 0, sizeof(threads_));
+    memset(previousTotals_, 0, sizeof(previousTotals_));
+    memset(lastFrame_, 0, sizeof(lastFrame_));
+    pthread_key_create(&threadKey_, 0);
+}
+
+AllocationTracker::ThreadState *AllocationTracker::CurrentThreadState()
+{
+    ThreadState *state = static_cast<ThreadState *>(pthread_getspecific(threadKey_));
+    if (!state)
+    {
+        long index = ++numThreads_ - 1;
+        state = &threads_[index < cMaxThreads ? index : cMaxThreads - 1];
+        pthread_setspecific(threadKey_, state);
+    }
+    return state;
+}
+
+AllocationTag AllocationTracker::SetCurrentTag(AllocationTag tag)
+{
+    ThreadState *state = CurrentThreadState();
+    AllocationTag previous = (AllocationTag)state->tag;
+    state->tag = tag;
+    return previous;
+}
+
+AllocationTag AllocationTracker::CurrentTag()
+{
+    return (AllocationTag)CurrentThreadState()->tag;
+}
+
+int AllocationTracker::RecordAllocation(size_t size)
+{
+    ThreadState *state = CurrentThreadState();
+    AllocationCounters &counters = state->counters[state->tag];
+    ++counters.numAllocs;
+    counters.bytesAllocated += size;
+    return state->tag;
+}
+
+void AllocationTracker::RecordFree(int tag, size_t size)
+{
+    AllocationCounters &counters = CurrentThreadState()->counters[tag];
+    ++counters.numFrees;
+    counters.bytesFreed += size;
+}
+
+AllocationCounters AllocationTracker::Totals(int tag) const
+{
+    AllocationCounters totals = { 0, 0, 0, 0 };
+    const long numThreads = std::min<long>(numThreads_, cMaxThreads);
+    for(long i = 0; i < numThreads; ++i)
+    {
+        const AllocationCounters &counters = threads_[i].counters[tag];
+        totals.numAllocs += counters.numAllocs;
+        totals.numFrees += counters.numFrees;
+        totals.bytesAllocated += counters.bytesAllocated;
+        totals.bytesFreed += counters.bytesFreed;
+    }
+    return totals;
+}
+
+void AllocationTracker::EndFrame()
+{
+    for(int tag = 0; tag < NumAllocationTags; ++tag)
+    {
+        AllocationCounters totals = Totals(tag);
+        AllocationCounters &frame = lastFrame_[tag];
+        frame.numAllocs = totals.numAllocs - previousTotals_[tag].numAllocs;
+        frame.numFrees = totals.numFrees - previousTotals_[tag].numFrees;
+        frame.bytesAllocated = totals.bytesAllocated - previousTotals_[tag].bytesAllocated;
+        frame.bytesFreed = totals.bytesFreed - previousTotals_[tag].bytesFreed;
+        previousTotals_[tag] = totals;
+    }
+}
+
+#else
+
+// Without ALLOCATION_TRACKING nothing is counted, and Instance() stays 0, but the tracker still links for the code that uses it.
+
+AllocationTracker::AllocationTracker() :
+    numThreads_(0)
+{
+    memset(threads_, 0, sizeof(threads_));
+    memset(previousTotals_, 0, sizeof(previousTotals_));
+    memset(lastFrame_, 0, sizeof(lastFrame_));
+}
+
+AllocationTag AllocationTracker::SetCurrentTag(AllocationTag tag)
+{
+    return AllocUntagged;
+}
+
+AllocationTag AllocationTracker::CurrentTag()
+{
+    return AllocUntagged;
+}
+
+int AllocationTracker::RecordAllocation(size_t size)
+{
+    return AllocUntagged;
+}
+
+void AllocationTracker::RecordFree(int tag, size_t size)
+{
+}
+
+AllocationCounters AllocationTracker::Totals(int tag) const
+{
+    AllocationCounters totals = { 0, 0, 0, 0 };
+    return totals;
+}
+
+void AllocationTracker::EndFrame()
+{
+}
+
+#endif
+
+}
+
+#if defined(ALLOCATION_TRACKING)
+
+namespace
+{
+    //! Stored in front of each allocation. The size is kept a multiple of 16 bytes so that the allocations stay aligned.
+    union AllocationHeader
+    {
+        struct
+        {
+            size_t size;
+            //! Tag of the allocation, or -1 if it was made before the tracker existed.
+            int tag;
+        } info;
+        char padding[16];
+    };
+
+    void *TrackedAlloc(size_t size)
+    {
+        AllocationHeader *header = static_cast<AllocationHeader *>(malloc(sizeof(AllocationHeader) + size));
+        if (!header)
+            return 0;
+        Foundation::AllocationTracker *tracker = Foundation::AllocationTracker::Instance();
+        header->info.size = size;
+        header->info.tag = tracker ? tracker->RecordAllocation(size) : -1;
+        return header + 1;
+    }
+
+    void TrackedFree(void *ptr)
+    {
+        if (!ptr)
+            return;
+        AllocationHeader *header = static_cast<AllocationHeader *>(ptr) - 1;
+        Foundation::AllocationTracker *tracker = Foundation::AllocationTracker::Instance();
+        if (tracker && header->info.tag >= 0)
+            tracker->RecordFree(header->info.tag, header->info.size);
+        free(header);
+    }
+}
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+    void *ptr = TrackedAlloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) throw(std::bad_alloc)
+{
+    void *ptr = TrackedAlloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) throw()
+{
+    return TrackedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw()
+{
+    return TrackedAlloc(size);
+}
+
+void operator delete(void *ptr) throw()
+{
+    TrackedFree(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+    TrackedFree(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) throw()
+{
+    TrackedFree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) throw()
+{
+    TrackedFree(ptr);
+}
+
+#endif
@@ -0,0 +1,158 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Foundation_AllocationTracker_h
+#define incl_Foundation_AllocationTracker_h
+
+#include "CoreTypes.h"
+
+#include <boost/detail/atomic_count.hpp>
+
+#if defined(ALLOCATION_TRACKING)
+#if defined(_MSC_VER)
+#error "ALLOCATION_TRACKING replaces the global operator new of the whole process, which is not possible with the per-DLL runtimes of MSVC."
+#endif
+#include <pthread.h>
+
+//! Tags the allocations made in the rest of the enclosing scope, e.g. ALLOCATION_SCOPE(Sync). See Foundation::AllocationTag.
+#define ALLOCATION_SCOPE(tag) Foundation::AllocationScope tag ## __allocation_scope__(Foundation::Alloc ## tag);
+#else
+#define ALLOCATION_SCOPE(tag)
+#endif
+
+namespace Foundation
+{
+    //! Subsystems allocations are attributed to. Allocations made outside any ALLOCATION_SCOPE are untagged.
+    enum AllocationTag
+    {
+        AllocUntagged,
+        AllocScene,
+        AllocSync,
+        AllocNetwork,
+        AllocAsset,
+        AllocScript,
+        AllocPhysics,
+        AllocRender,
+        AllocUi,
+        NumAllocationTags
+    };
+
+    //! Allocation counts of a single tag.
+    struct AllocationCounters
+    {
+        u64 numAllocs;
+        u64 numFrees;
+        u64 bytesAllocated;
+        u64 bytesFreed;
+
+        //! Returns the number of allocations that have not been freed.
+        u64 LiveObjects() const { return numAllocs - numFrees; }
+        //! Returns the number of bytes that have not been freed.
+        u64 LiveBytes() const { return bytesAllocated - bytesFreed; }
+    };
+
+    //! Counts the allocations made with operator new per subsystem, when the build is configured with ALLOCATION_TRACKING.
+    /*! With ALLOCATION_TRACKING, the global operator new and delete are replaced with versions that store the size and tag of
+        each allocation in a small header in front of it, and count the allocations, frees and bytes of each tag. The tag of
+        an allocation is the tag of the innermost ALLOCATION_SCOPE of the allocating thread:
+        \code
+        void SyncManager::ProcessSyncState(...)
+        {
+            ALLOCATION_SCOPE(Sync);
+            ...
+        }
+        \endcode
+
+        Frees are counted against the tag of the allocation, in whatever thread they happen. Each thread counts into its own
+        counters, so counting takes no locks; Totals() sums up the counters of all threads. The framework calls EndFrame() once
+        per frame, so LastFrame() tells how much each subsystem allocated during the last frame. See the AllocStats console command.
+
+        The tracker is shared with the modules through the profiler, like the profiling blocks, so ALLOCATION_TRACKING requires
+        PROFILING. It is only supported with GCC on Linux, where the replaced operator new is used by all shared libraries.
+        Tracking adds 16 bytes to every allocation and some nanoseconds to each new and delete, so it is off by default.
+    */
+    class AllocationTracker
+    {
+    public:
+        AllocationTracker();
+
+        //! Returns the tracker of the process, or 0 if allocation tracking is not enabled.
+        static AllocationTracker *Instance() { return instance_; }
+
+        //! Sets the tracker of the process. Called when the profiler is set, see ProfilerSection::SetProfiler().
+        static void SetInstance(AllocationTracker *tracker) { instance_ = tracker; }
+
+        //! Returns the name of a tag.
+        static const char *TagName(int tag);
+
+        //! Sets the tag of the allocations of the calling thread. Returns the previous tag.
+        AllocationTag SetCurrentTag(AllocationTag tag);
+
+        //! Returns the tag of the allocations of the calling thread.
+        AllocationTag CurrentTag();
+
+        //! Counts an allocation of the calling thread. Returns the tag of the allocation. For internal use by operator new.
+        int RecordAllocation(size_t size);
+
+        //! Counts a free of the calling thread. For internal use by operator delete.
+        void RecordFree(int tag, size_t size);
+
+        //! Ends the current frame and stores the counts of the frame. Called from the main thread.
+        void EndFrame();
+
+        //! Returns the counts of a tag since the start of the process.
+        AllocationCounters Totals(int tag) const;
+
+        //! Returns the counts of a tag during the last frame.
+        const AllocationCounters &LastFrame(int tag) const { return lastFrame_[tag]; }
+
+    private:
+        //! Allocation state of a single thread. Only the owning thread writes to it.
+        struct ThreadState
+        {
+            int tag;
+            AllocationCounters counters[NumAllocationTags];
+        };
+
+        //! Maximum number of threads with their own counters. Threads beyond this share the last counters, and their counts
+        //! may be slightly off.
+        static const int cMaxThreads = 128;
+
+        //! Returns the state of the calling thread.
+        ThreadState *CurrentThreadState();
+
+        static AllocationTracker *instance_;
+
+        ThreadState threads_[cMaxThreads];
+        //! The number of ThreadStates taken by threads.
+        boost::detail::atomic_count numThreads_;
+#if defined(ALLOCATION_TRACKING)
+        //! Key of the ThreadState of each thread.
+        pthread_key_t threadKey_;
+#endif
+        AllocationCounters previousTotals_[NumAllocationTags];
+        AllocationCounters lastFrame_[NumAllocationTags];
+    };
+
+    //! Sets the allocation tag of the calling thread for its lifetime. Use through the ALLOCATION_SCOPE macro.
+    class AllocationScope
+    {
+    public:
+        explicit AllocationScope(AllocationTag tag) : tracker_(AllocationTracker::Instance()), previous_(AllocUntagged)
+        {
+            if (tracker_)
+                previous_ = tracker_->SetCurrentTag(tag);
+        }
+
+        ~AllocationScope()
+        {
+            if (tracker_)
+                tracker_->SetCurrentTag(previous_);
+        }
+
+    private:
+        AllocationTracker *tracker_;
+        AllocationTag previous_;
+    };
+}
+
+#endif
@@ -328,6 +328,10 @@ void Application::UpdateFrame()
     frameTimer_->start((int)(timeToWait + 0.5));
 
     RESETPROFILER
+#ifdef PROFILING
+    framework->GetProfiler().ProcessEvents();
+#endif
+    framework->EndFrame(lastPresentTime_);
 }
 
 void Application::SetTargetFps(float fps)
@@ -19,6 +19,7 @@ bool EventManager::AddSubscriber(T* subscriber, QList<U>& subscribers, int prior
         {
             subscribers[i].priority_ = priority;
             qSort(subscribers.begin(), subscribers.end());
+            InvalidateDispatchTables();
             return true;
         }
 
@@ -27,6 +28,7 @@ bool EventManager::AddSubscriber(T* subscriber, QList<U>& subscribers, int prior
     new_subscriber.priority_ = priority;
     subscribers.append(new_subscriber);
     qSort(subscribers.begin(), subscribers.end());
+    InvalidateDispatchTables();
 
     return true;
 }
@@ -58,6 +60,7 @@ bool EventManager::RemoveSubscriber(T* subscriber, QList<U>& subscribers )
         if (subscribers[i].subscriber_ == subscriber)
         {
             subscribers.erase(subscribers.begin() + i);
+            InvalidateDispatchTables();
             return true;
         }
 
@@ -104,6 +107,9 @@ bool EventManager::UnregisterEventSubscriber(T* subscriber)
                 ++iter;
         }
 
+        if (ret2)
+            InvalidateDispatchTables();
+
         return (ret || ret2);
     }
 
@@ -140,29 +146,105 @@ bool EventManager::HasEventSubscriber(T* subscriber)
     return false;
  }
 
+template <typename T, typename U>
+U* EventManager::FindSubscriber(T* subscriber, QList<U>& subscribers)
+{
+    for(int i = 0; i < subscribers.size(); ++i)
+        if (subscribers[i].subscriber_ == subscriber)
+            return &subscribers[i];
+
+    return 0;
+}
+
 template <typename T>
-bool EventManager::SendEvent(const EventSubscriber<T>& subs, event_category_id_t category_id, event_id_t event_id, IEventData* data) const
- {
-    T* subscriber = subs.subscriber_;
-    if (subscriber)
+bool EventManager::AddInterest(T* subscriber, event_category_id_t category_id, const event_id_t *event_id)
+{
+    if (!subscriber)
     {
-        try
-        {
-            return subscriber->HandleEvent(category_id, event_id, data);
-        }
-        catch(const std::exception &/*e*/)
-        {
-            //std::cout << "HandleEvent caught an exception inside module " << module->Name() << ": " << (e.what() ? e.what() : "(null)") << std::endl;
-            //RootLogCritical(std::string("HandleEvent caught an exception inside module " + module->Name() + ": " + (e.what() ? e.what() : "(null)")));
-            throw;
-        }
-        catch(...)
-        {
-            //std::cout << "HandleEvent caught an unknown exception inside module " << module->Name() << std::endl;
-            //RootLogCritical(std::string("HandleEvent caught an unknown exception inside module " + module->Name()));
-            throw;
-        }
+        RootLogError("Tried to register event interest for null subscriber");
+        return false;
+    }
+    if (category_id == IllegalEventCategory)
+    {
+        RootLogWarning("Tried to register interest in illegal event category");
+        return false;
     }
 
-    return false;
+    EventSubscriber<IModule> *module_subscriber = 0;
+    EventSubscriber<IComponent> *component_subscriber = 0;
+    IModule* module = dynamic_cast<IModule* >(subscriber);
+    if (module != 0)
+        module_subscriber = FindSubscriber(module, module_subscribers_);
+    IComponent* component = dynamic_cast<IComponent* >(subscriber);
+    if (component != 0)
+        component_subscriber = FindSubscriber(component, component_subscribers_);
+
+    if (!module_subscriber && !component_subscriber)
+    {
+        RootLogError("Tried to register event interest for a subscriber that is not registered");
+        return false;
+    }
+
+    if (module_subscriber)
+    {
+        if (event_id)
+            module_subscriber->events_.insert(std::make_pair(category_id, *event_id));
+        else
+            module_subscriber->categories_.insert(category_id);
+    }
+    if (component_subscriber)
+    {
+        if (event_id)
+            component_subscriber->events_.insert(std::make_pair(category_id, *event_id));
+        else
+            component_subscriber->categories_.insert(category_id);
+    }
+
+    InvalidateDispatchTables();
+    return true;
+}
+
+template <typename T>
+bool EventManager::RegisterEventInterest(T* subscriber, event_category_id_t category_id)
+{
+    return AddInterest(subscriber, category_id, 0);
+}
+
+template <typename T>
+bool EventManager::RegisterEventInterest(T* subscriber, event_category_id_t category_id, event_id_t event_id)
+{
+    return AddInterest(subscriber, category_id, &event_id);
+}
+
+template <typename T>
+bool EventManager::ClearEventInterests(T* subscriber)
+{
+    if (!subscriber)
+    {
+        RootLogError("Tried to clear event interests of null subscriber");
+        return false;
+    }
+
+    bool found = false;
+    IModule* module = dynamic_cast<IModule* >(subscriber);
+    EventSubscriber<IModule> *module_subscriber = module ? FindSubscriber(module, module_subscribers_) : 0;
+    if (module_subscriber)
+    {
+        module_subscriber->categories_.clear();
+        module_subscriber->events_.clear();
+        found = true;
+    }
+
+    IComponent* component = dynamic_cast<IComponent* >(subscriber);
+    EventSubscriber<IComponent> *component_subscriber = component ? FindSubscriber(component, component_subscribers_) : 0;
+    if (component_subscriber)
+    {
+        component_subscriber->categories_.clear();
+        component_subscriber->events_.clear();
+        found = true;
+    }
+
+    if (found)
+        InvalidateDispatchTables();
+    return found;
 }
@@ -24,7 +24,8 @@ EventManager::EventManager(Foundation::Framework *framework) :
     framework_(framework),
     next_category_id_(1),
 //    next_request_tag_(1),
-    main_thread_id_(QThread::currentThreadId())
+    main_thread_id_(QThread::currentThreadId()),
+    subscription_generation_(0)
 {
 }
 
@@ -116,35 +117,89 @@ bool EventManager::SendEvent(event_category_id_t category_id, event_id_t event_i
         return false;
     }
 
-    // Send event in priority order, until someone returns true
-    for (int i = 0; i < module_subscribers_.size(); ++i)
-        if (SendEvent(module_subscribers_[i], category_id, event_id, data))
-            return true;
+    if (dispatch_stats_.size() <= category_id)
+        dispatch_stats_.resize(category_id + 1);
+    EventDispatchStats &stats = dispatch_stats_[category_id];
+    ++stats.numSent;
+    stats.numSubscribers += GetNumSubscribers();
 
-    // After that send events to components
-    for (int i = 0; i < component_subscribers_.size(); ++i)
-        if (SendEvent(component_subscribers_[i], category_id, event_id, data))
+    // Send event in priority order to the interested modules, then components, until someone returns true
+    const EventHandlerVector *handlers = &GetEventHandlers(category_id, event_id);
+    for (int i = 0; i < (int)handlers->size(); ++i)
+    {
+        const EventHandler handler = (*handlers)[i];
+        const uint generation = subscription_generation_;
+        ++dispatch_stats_[category_id].numHandlerCalls;
+
+        if (handler.module_ ? handler.module_->HandleEvent(category_id, event_id, data) : handler.component_->HandleEvent(category_id, event_id, data))
             return true;
 
-    // Then go through 
-    QPair<event_category_id_t, event_id_t> group = qMakePair<event_category_id_t, event_id_t>(category_id, event_id);
-   
-    if ( specialEvents_.contains(group) )
-    {
-        QList<IComponent* >& lst = specialEvents_[group];
-        for ( int i = 0; i < lst.size(); ++i)
+        if (generation != subscription_generation_)
         {
-            EventSubscriber<IComponent> subs;
-            subs.subscriber_ = lst[i];
-
-            if (SendEvent(subs, category_id, event_id, data))
-                return true;
+            // The handler changed the subscribers. Continue after it in the rebuilt table, or at the same position if it
+            // unsubscribed itself.
+            handlers = &GetEventHandlers(category_id, event_id);
+            EventHandlerVector::const_iterator iter = std::find(handlers->begin(), handlers->end(), handler);
+            if (iter != handlers->end())
+                i = (int)(iter - handlers->begin());
+            else
+                --i;
         }
     }
 
     return false;
 }
 
+const EventManager::EventHandlerVector &EventManager::GetEventHandlers(event_category_id_t category_id, event_id_t event_id)
+{
+    std::pair<event_category_id_t, event_id_t> key = std::make_pair(category_id, event_id);
+    DispatchTableMap::iterator iter = dispatch_tables_.find(key);
+    if (iter != dispatch_tables_.end())
+        return iter->second;
+
+    EventHandlerVector &handlers = dispatch_tables_[key];
+    EventHandler handler;
+
+    handler.component_ = 0;
+    for (int i = 0; i < module_subscribers_.size(); ++i)
+        if (module_subscribers_[i].subscriber_ && module_subscribers_[i].Accepts(category_id, event_id))
+        {
+            handler.module_ = module_subscribers_[i].subscriber_;
+            handlers.push_back(handler);
+        }
+
+    handler.module_ = 0;
+    for (int i = 0; i < component_subscribers_.size(); ++i)
+        if (component_subscribers_[i].subscriber_ && component_subscribers_[i].Accepts(category_id, event_id))
+        {
+            handler.component_ = component_subscribers_[i].subscriber_;
+            handlers.push_back(handler);
+        }
+
+    // Then the components that registered for this event only
+    QMap<QPair<event_category_id_t, event_id_t>, QList<IComponent* > >::const_iterator special = specialEvents_.find(qMakePair(category_id, event_id));
+    if (special != specialEvents_.end())
+        for (int i = 0; i < special.value().size(); ++i)
+            if (special.value()[i])
+            {
+                handler.component_ = special.value()[i];
+                handlers.push_back(handler);
+            }
+
+    return handlers;
+}
+
+void EventManager::InvalidateDispatchTables()
+{
+    dispatch_tables_.clear();
+    ++subscription_generation_;
+}
+
+int EventManager::GetNumSubscribers() const
+{
+    return module_subscribers_.size() + component_subscribers_.size();
+}
+
 bool EventManager::SendEvent(const std::string& category, event_id_t event_id, IEventData* data)
 {
     return SendEvent(QueryEventCategory(category), event_id, data);
@@ -189,6 +244,7 @@ bool EventManager::RegisterEventSubscriber(IComponent* component, event_category
         specialEvents_.insert(group,lst);
     }
 
+    InvalidateDispatchTables();
     return true;
 }
 
@@ -207,6 +263,7 @@ bool EventManager::UnregisterEventSubscriber(IComponent* component, event_catego
         if (lst.empty())
             specialEvents_.remove(group);
         
+        InvalidateDispatchTables();
         return true;
    }
 
@@ -14,6 +14,8 @@
 #include <QMap>
 #include <QPair>
 
+#include <set>
+
 class EventManager
 {
 public:
@@ -23,6 +25,23 @@ public:
     typedef std::map<std::string, event_category_id_t> EventCategoryMap;
     typedef std::map<event_category_id_t, std::map<event_id_t, std::string > > EventMap;
 
+    /// Dispatch statistics of an event category.
+    struct EventDispatchStats
+    {
+        EventDispatchStats() : numSent(0), numHandlerCalls(0), numSubscribers(0) {}
+
+        /// The number of events sent.
+        u64 numSent;
+        /// The number of HandleEvent calls made for the events.
+        u64 numHandlerCalls;
+        /// Sum of the number of module and component subscribers at the time of each send, i.e. the number of
+        /// HandleEvent calls offering the events to every subscriber would have made at most.
+        u64 numSubscribers;
+    };
+
+    /// Dispatch statistics, indexed by event category ID.
+    typedef std::vector<EventDispatchStats> EventDispatchStatsVector;
+
     /// Registers an event category by name
     /** if event category already registered, will return the existing ID
         @param name New event category name
@@ -55,7 +74,9 @@ public:
     void QueryEventName(event_category_id_t category_id, event_id_t event_id) const;
 
     //! Sends an event
-    /*! \param category_id Event category ID
+    /*! The event is offered to the interested module subscribers in priority order, then to the interested component
+        subscribers, until one of them handles it. See RegisterEventInterest.
+        \param category_id Event category ID
         \param event_id Event ID
         \param data Pointer to event data structure (event-specific), can be 0 if not needed
         \return true if event was handled by some event handler
@@ -115,6 +136,35 @@ public:
     template <typename T>
     bool HasEventSubscriber(T* subscriber);
 
+    //! Registers interest of a module or component in all events of an event category
+    /*! By default a subscriber registered with RegisterEventSubscriber(T* subscriber, int priority) is offered every event.
+        Once interest in a category or an event has been registered, the subscriber is offered only the events it has
+        registered interest in, which saves the HandleEvent calls for events it would ignore. Interests are kept when the
+        priority of the subscriber is changed, and forgotten when the subscriber is unregistered.
+        \param subscriber Module or component, already registered with RegisterEventSubscriber
+        \param category_id Event category ID
+        \return true if successful
+    */
+    template <typename T>
+    bool RegisterEventInterest(T* subscriber, event_category_id_t category_id);
+
+    //! Registers interest of a module or component in a single event
+    /*! \param subscriber Module or component, already registered with RegisterEventSubscriber
+        \param category_id Event category ID
+        \param event_id Event ID
+        \return true if successful
+        \sa RegisterEventInterest(T* subscriber, event_category_id_t category_id)
+    */
+    template <typename T>
+    bool RegisterEventInterest(T* subscriber, event_category_id_t category_id, event_id_t event_id);
+
+    //! Forgets the registered interests of a module or component, so that it is offered every event again
+    /*! \param subscriber Module or component, already registered with RegisterEventSubscriber
+        \return true if successful
+    */
+    template <typename T>
+    bool ClearEventInterests(T* subscriber);
+
     //! Clears all delayed events. Called by the framework.
     /*! Called before unloading modules so that shared pointers left in the delayed event queue do not cause trouble
         (for example Ogre textures that would otherwise freed after Ogre uninit, leading to a crash)
@@ -132,6 +182,15 @@ public:
     //! Returns event map
     const EventMap &GetEventMap() const { return event_map_; }
 
+    //! Returns the dispatch statistics of the event categories since the last ResetDispatchStats call, indexed by category ID
+    const EventDispatchStatsVector &GetDispatchStats() const { return dispatch_stats_; }
+
+    //! Resets the dispatch statistics
+    void ResetDispatchStats() { dispatch_stats_.clear(); }
+
+    //! Returns the number of module and component event subscribers, not counting the subscribers of single component events
+    int GetNumSubscribers() const;
+
     //! Returns next unused non-zero request tag for asset/resource request events
     /*! By having a global source for the tags there is no risk for collisions between
         different modules/subsystems.
@@ -167,6 +226,19 @@ private:
        
        T* subscriber_;
        int priority_;
+
+       //! Categories the subscriber has registered interest in
+       std::set<event_category_id_t> categories_;
+       //! Single events the subscriber has registered interest in
+       std::set<std::pair<event_category_id_t, event_id_t> > events_;
+
+       //! Returns true if the event should be offered to the subscriber
+       bool Accepts(event_category_id_t category_id, event_id_t event_id) const
+       {
+           if (categories_.empty() && events_.empty())
+               return true;
+           return categories_.find(category_id) != categories_.end() || events_.find(std::make_pair(category_id, event_id)) != events_.end();
+       }
       
        bool operator<(const EventSubscriber& rhs) const
        {
@@ -175,6 +247,18 @@ private:
       
    };
 
+   //! Entry of a dispatch table: either a module or a component.
+   struct EventHandler
+   {
+       IModule *module_;
+       IComponent *component_;
+
+       bool operator==(const EventHandler &rhs) const { return module_ == rhs.module_ && component_ == rhs.component_; }
+   };
+
+   typedef std::vector<EventHandler> EventHandlerVector;
+   typedef std::map<std::pair<event_category_id_t, event_id_t>, EventHandlerVector> DispatchTableMap;
+
    //! Delayed event. Used internally by EventManager.
    struct DelayedEvent
    {
@@ -184,15 +268,11 @@ private:
         f64 delay_;
    };
 
-    /// Sends event to a module in the subscriber vector
-    /** @param subscriber Which subscriber to send to
-        @param category_id Event category ID
-        @param event_id Event ID
-        @param data Pointer to event data structure (event-specific)
-        @return true if event handled and further subscribers should not be processed
-    */
-   template <typename T>
-   bool SendEvent(const EventSubscriber<T>& subs, event_category_id_t category_id, event_id_t event_id, IEventData* data) const;
+    /// Returns the handlers an event is offered to in order, building the dispatch table of the event if necessary
+    const EventHandlerVector &GetEventHandlers(event_category_id_t category_id, event_id_t event_id);
+
+    /// Forgets the built dispatch tables. Called whenever the subscribers change.
+    void InvalidateDispatchTables();
 
    template <typename T, typename U>
    bool AddSubscriber(T* subscriber, QList<U>& subscribers, int priority);
@@ -203,6 +283,12 @@ private:
    template <typename T, typename U>
    bool EventSubscriberExist(T* subscriber, QList<U>& subscribers);
 
+   template <typename T, typename U>
+   U* FindSubscriber(T* subscriber, QList<U>& subscribers);
+
+   template <typename T>
+   bool AddInterest(T* subscriber, event_category_id_t category_id, const event_id_t *event_id);
+
     //! Next event category ID that will be assigned
     event_category_id_t next_category_id_;
 
@@ -236,6 +322,15 @@ private:
     Qt::HANDLE main_thread_id_;
 
     QMap<QPair<event_category_id_t, event_id_t>, QList<IComponent* > > specialEvents_;
+
+    /// Handlers of the events sent since the subscribers last changed, in the order the events are offered to them
+    DispatchTableMap dispatch_tables_;
+
+    /// Incremented whenever the subscribers change, so that an event being sent notices when its handlers changed
+    uint subscription_generation_;
+
+    /// Dispatch statistics, indexed by event category ID
+    EventDispatchStatsVector dispatch_stats_;
 };
 
 #include "EventManager-templates.h"
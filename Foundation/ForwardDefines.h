@@ -30,12 +30,14 @@ namespace Foundation
 {
     class Platform;
     class ThreadTaskManager;
+    class JobSystem;
     class Framework;
     class KeyBindings;
     class Profiler;
 
     typedef boost::shared_ptr<Platform> PlatformPtr;
     typedef boost::shared_ptr<ThreadTaskManager> ThreadTaskManagerPtr;
+    typedef boost::shared_ptr<JobSystem> JobSystemPtr;
 
     class RenderServiceInterface;
     typedef boost::shared_ptr<RenderServiceInterface> RendererPtr;
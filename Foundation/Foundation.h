@@ -43,6 +43,8 @@
 
     - ThreadTaskManager handles threaded background tasks. For usage information, see
       \ref ThreadTask "Threaded task system"
+
+    - JobSystem runs short background jobs and parallel loops in a pool of worker threads.
       
     - ConfigurationManager provides access to name-value pairs defined
       in an external file suitable for defining various settings.
@@ -0,0 +1,270 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "FrameScheduler.h"
+#include "Profiler.h"
+
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+#include "MemoryLeakCheck.h"
+
+namespace Foundation
+{
+
+namespace
+{
+    /// Returns true if the two updates cannot be run at the same time.
+    bool UpdatesConflict(const ModuleUpdateInfo &a, const ModuleUpdateInfo &b)
+    {
+        return (a.writes & (b.reads | b.writes)) != 0 || (b.writes & a.reads) != 0;
+    }
+
+    /// Orders module updates by stage. Used with std::stable_sort to keep the load order inside a stage.
+    struct StageLessThan
+    {
+        bool operator()(const std::pair<ModuleUpdateInfo, IModule *> &a, const std::pair<ModuleUpdateInfo, IModule *> &b) const
+        {
+            return a.first.stage < b.first.stage;
+        }
+    };
+}
+
+FrameScheduler::FrameScheduler(JobSystem *jobs) :
+    jobs_(jobs),
+    numUnfinishedTasks_(0),
+    numSubmittedWorkerTasks_(0),
+    failed_(false),
+    frametime_(0.0),
+    frameStart_(0)
+{
+}
+
+void FrameScheduler::UpdateModules(const std::vector<IModule *> &modules, f64 frametime)
+{
+    frametime_ = frametime;
+    frameStart_ = GetCurrentClockTime();
+    currentTimeline_.clear();
+
+    // Query the update descriptions and order the updates by stage.
+    std::vector<std::pair<ModuleUpdateInfo, IModule *> > updates;
+    updates.reserve(modules.size());
+    for(size_t i = 0; i < modules.size(); ++i)
+        updates.push_back(std::make_pair(modules[i]->UpdateInfo(), modules[i]));
+    std::stable_sort(updates.begin(), updates.end(), StageLessThan());
+
+    tasks_.resize(updates.size());
+    for(size_t i = 0; i < updates.size(); ++i)
+    {
+        tasks_[i].module = updates[i].second;
+        tasks_[i].info = updates[i].first;
+        tasks_[i].numPendingDependencies = 0;
+        tasks_[i].dependents.clear();
+    }
+
+    {
+        MutexLock lock(mutex_);
+        failed_ = false;
+        error_.clear();
+    }
+
+    size_t first = 0;
+    while(first < tasks_.size())
+    {
+        size_t last = first + 1;
+        bool parallel = !tasks_[first].info.mainThreadOnly;
+        while(last < tasks_.size() && tasks_[last].info.stage == tasks_[first].info.stage)
+        {
+            if (!tasks_[last].info.mainThreadOnly)
+                parallel = true;
+            ++last;
+        }
+
+        if (parallel && jobs_->NumWorkerThreads() > 0)
+        {
+            BuildStageDependencies(first, last);
+            if (!RunStage(first, last))
+                break;
+        }
+        else
+        {
+            // Nothing in this stage can leave the main thread, so just run the updates in order.
+            for(size_t i = first; i < last && !failed_; ++i)
+                RunTask(i, 0);
+            if (failed_)
+                break;
+        }
+        first = last;
+    }
+
+    lastTimeline_.swap(currentTimeline_);
+
+    if (failed_)
+        throw std::runtime_error(error_);
+}
+
+void FrameScheduler::BuildStageDependencies(size_t first, size_t last)
+{
+    for(size_t j = first; j < last; ++j)
+        for(size_t i = first; i < j; ++i)
+            if (UpdatesConflict(tasks_[i].info, tasks_[j].info))
+            {
+                tasks_[i].dependents.push_back(j);
+                ++tasks_[j].numPendingDependencies;
+            }
+}
+
+bool FrameScheduler::RunStage(size_t first, size_t last)
+{
+    std::vector<size_t> readyWorkerTasks;
+    {
+        MutexLock lock(mutex_);
+        numUnfinishedTasks_ = last - first;
+        numSubmittedWorkerTasks_ = 0;
+        for(size_t i = first; i < last; ++i)
+            if (tasks_[i].numPendingDependencies == 0)
+            {
+                if (tasks_[i].info.mainThreadOnly)
+                    readyMainTasks_.push_back(i);
+                else
+                    readyWorkerTasks.push_back(i);
+            }
+        numSubmittedWorkerTasks_ += readyWorkerTasks.size();
+    }
+    SubmitWorkerTasks(readyWorkerTasks);
+
+    // The main thread runs the pinned tasks as they become ready, and otherwise waits for the jobs.
+    for(;;)
+    {
+        size_t taskIndex = 0;
+        {
+            ScopedLock lock(mutex_);
+            while(readyMainTasks_.empty() && numUnfinishedTasks_ > 0 && !(failed_ && numSubmittedWorkerTasks_ == 0))
+                mainCondition_.wait(lock);
+
+            if (numUnfinishedTasks_ == 0 || (failed_ && numSubmittedWorkerTasks_ == 0))
+                break;
+            if (failed_)
+            {
+                // Don't start any new tasks after a failure, but wait until the submitted ones have returned.
+                readyMainTasks_.clear();
+                continue;
+            }
+            taskIndex = readyMainTasks_.front();
+            readyMainTasks_.pop_front();
+        }
+
+        bool success = RunTask(taskIndex, 0);
+
+        readyWorkerTasks.clear();
+        {
+            MutexLock lock(mutex_);
+            if (success)
+            {
+                FinishTask(taskIndex, readyWorkerTasks);
+                numSubmittedWorkerTasks_ += readyWorkerTasks.size();
+            }
+        }
+        SubmitWorkerTasks(readyWorkerTasks);
+    }
+
+    MutexLock lock(mutex_);
+    readyMainTasks_.clear();
+    return !failed_;
+}
+
+void FrameScheduler::RunWorkerTask(size_t taskIndex)
+{
+    bool skip = false;
+    {
+        MutexLock lock(mutex_);
+        skip = failed_;
+    }
+
+    bool success = !skip && RunTask(taskIndex, jobs_->CurrentWorkerIndex());
+
+    std::vector<size_t> readyWorkerTasks;
+    {
+        MutexLock lock(mutex_);
+        if (success)
+        {
+            FinishTask(taskIndex, readyWorkerTasks);
+            numSubmittedWorkerTasks_ += readyWorkerTasks.size();
+        }
+        --numSubmittedWorkerTasks_;
+    }
+    SubmitWorkerTasks(readyWorkerTasks);
+    mainCondition_.notify_all();
+}
+
+void FrameScheduler::SubmitWorkerTasks(const std::vector<size_t> &taskIndices)
+{
+    for(size_t i = 0; i < taskIndices.size(); ++i)
+        jobs_->Submit(boost::bind(&FrameScheduler::RunWorkerTask, this, taskIndices[i]));
+}
+
+bool FrameScheduler::RunTask(size_t taskIndex, int threadIndex)
+{
+    IModule *module = tasks_[taskIndex].module;
+    TimelineEntry entry;
+    entry.name = module->Name();
+    entry.thread = threadIndex;
+    entry.stage = tasks_[taskIndex].info.stage;
+    tick_t start = GetCurrentClockTime();
+
+    std::string error;
+    try
+    {
+        module->Update(frametime_);
+    }
+    catch(const std::exception &e)
+    {
+        error = "UpdateModules caught an exception while updating module " + module->Name() + ": " + (e.what() ? e.what() : "(null)");
+    }
+    catch(...)
+    {
+        error = "UpdateModules caught an unknown exception while updating module " + module->Name();
+    }
+
+    tick_t end = GetCurrentClockTime();
+    const double freq = (double)GetCurrentClockFreq();
+    entry.start = (double)(start - frameStart_) / freq;
+    entry.end = (double)(end - frameStart_) / freq;
+    {
+        MutexLock lock(timelineMutex_);
+        currentTimeline_.push_back(entry);
+    }
+
+    if (error.empty())
+        return true;
+
+    MutexLock lock(mutex_);
+    if (!failed_)
+    {
+        failed_ = true;
+        error_ = error;
+    }
+    return false;
+}
+
+void FrameScheduler::FinishTask(size_t taskIndex, std::vector<size_t> &readyWorkerTasks)
+{
+    --numUnfinishedTasks_;
+    const std::vector<size_t> &dependents = tasks_[taskIndex].dependents;
+    for(size_t i = 0; i < dependents.size(); ++i)
+    {
+        Task &dependent = tasks_[dependents[i]];
+        if (--dependent.numPendingDependencies == 0)
+        {
+            if (dependent.info.mainThreadOnly)
+                readyMainTasks_.push_back(dependents[i]);
+            else
+                readyWorkerTasks.push_back(dependents[i]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,126 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Foundation_FrameScheduler_h
+#define incl_Foundation_FrameScheduler_h
+
+#include "CoreTypes.h"
+#include "CoreThread.h"
+#include "HighPerfClock.h"
+#include "IModule.h"
+#include "JobSystem.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+
+namespace Foundation
+{
+    //! Runs the per-frame updates of the loaded modules as a task graph.
+    /*! Each module describes its update with IModule::UpdateInfo(). The updates are grouped by stage, and inside a stage an update
+        waits only for the earlier updates (in module load order) it conflicts with, i.e. where either one writes state the other
+        reads or writes. Independent updates that are not pinned to the main thread are submitted as jobs to the JobSystem while
+        the main thread runs the pinned updates.
+
+        Modules that do not override IModule::UpdateInfo() conflict with everything and are pinned to the main thread, so
+        unless modules opt in, the modules are updated serially in load order exactly like before.
+
+        The scheduler records a timeline of each frame, which can be inspected with LastFrameTimeline() or the FrameTimeline
+        console command.
+     */
+    class FrameScheduler
+    {
+    public:
+        //! One module update in the timeline of a frame.
+        struct TimelineEntry
+        {
+            //! Name of the module.
+            std::string name;
+            //! Index of the thread that ran the update. 0 is the main thread, job system workers are numbered from 1.
+            int thread;
+            //! Stage of the update.
+            int stage;
+            //! Start time of the update, in seconds since the start of the frame.
+            double start;
+            //! End time of the update, in seconds since the start of the frame.
+            double end;
+        };
+
+        typedef std::vector<TimelineEntry> Timeline;
+
+        //! Constructor.
+        /*! \param jobs Job system to run module updates in. If it has no worker threads, all updates are run on the main thread.
+         */
+        explicit FrameScheduler(JobSystem *jobs);
+
+        //! Runs the updates of the given modules for one frame, and returns when all of them have finished.
+        /*! Must be called from the main thread. If a module update throws, the remaining updates are skipped and a
+            std::runtime_error describing the failure is thrown after the updates already running have finished.
+         */
+        void UpdateModules(const std::vector<IModule *> &modules, f64 frametime);
+
+        //! Returns the timeline of the last completed frame.
+        const Timeline &LastFrameTimeline() const { return lastTimeline_; }
+
+        //! Returns the number of worker threads module updates can be run in.
+        uint NumWorkerThreads() const { return jobs_->NumWorkerThreads(); }
+
+    private:
+        //! A single module update in the task graph of the current frame.
+        struct Task
+        {
+            IModule *module;
+            ModuleUpdateInfo info;
+            //! The number of unfinished tasks this task waits for.
+            int numPendingDependencies;
+            //! Indices of the tasks that wait for this task.
+            std::vector<size_t> dependents;
+        };
+
+        //! Builds the dependency edges between the tasks [first, last) of a single stage.
+        void BuildStageDependencies(size_t first, size_t last);
+
+        //! Runs the tasks [first, last) of a single stage using the job system. Returns false if a task failed.
+        bool RunStage(size_t first, size_t last);
+
+        //! Job that runs a task outside the main thread.
+        void RunWorkerTask(size_t taskIndex);
+
+        //! Submits the given tasks to the job system.
+        void SubmitWorkerTasks(const std::vector<size_t> &taskIndices);
+
+        //! Runs the given task and records it in the timeline. Returns false if the update threw.
+        bool RunTask(size_t taskIndex, int threadIndex);
+
+        //! Marks the given task finished and makes its dependents ready. Called with mutex_ locked.
+        /*! The main thread dependents are queued to readyMainTasks_, the others are appended to readyWorkerTasks, to be submitted
+            after unlocking mutex_.
+         */
+        void FinishTask(size_t taskIndex, std::vector<size_t> &readyWorkerTasks);
+
+        JobSystem *jobs_;
+
+        //! Guards the task queue, the counters and the error state below.
+        Mutex mutex_;
+        //! Signaled when main thread tasks become ready, or when a task finishes.
+        Condition mainCondition_;
+
+        std::vector<Task> tasks_;
+        std::deque<size_t> readyMainTasks_;
+        //! The number of tasks of the current stage that have not finished.
+        size_t numUnfinishedTasks_;
+        //! The number of tasks submitted to the job system that have not returned yet.
+        size_t numSubmittedWorkerTasks_;
+        //! Set when a task fails, so that no new tasks are started.
+        bool failed_;
+        std::string error_;
+
+        f64 frametime_;
+        tick_t frameStart_;
+        //! Guards currentTimeline_, since worker threads append to it.
+        Mutex timelineMutex_;
+        Timeline currentTimeline_;
+        Timeline lastTimeline_;
+    };
+}
+
+#endif
@@ -0,0 +1,107 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "FrameStats.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace Foundation
+{
+
+namespace
+{
+    /// Upper bound of the first histogram bucket, in seconds.
+    const double cFirstBucketBound = 0.0001;
+    /// Ratio of the bounds of consecutive buckets.
+    const double cBucketGrowth = 1.05;
+}
+
+FrameTimeHistogram::FrameTimeHistogram()
+{
+    Reset();
+}
+
+void FrameTimeHistogram::Add(double seconds)
+{
+    ++buckets_[BucketIndex(seconds)];
+    ++numSamples_;
+    total_ += seconds;
+    max_ = std::max(max_, seconds);
+}
+
+void FrameTimeHistogram::Reset()
+{
+    std::fill(buckets_, buckets_ + cNumBuckets, 0);
+    numSamples_ = 0;
+    total_ = 0.0;
+    max_ = 0.0;
+}
+
+double FrameTimeHistogram::Percentile(double p) const
+{
+    if (numSamples_ == 0)
+        return 0.0;
+
+    const u64 rank = std::max<u64>(1, (u64)std::ceil(p / 100.0 * numSamples_));
+    u64 count = 0;
+    for(int i = 0; i < cNumBuckets; ++i)
+    {
+        count += buckets_[i];
+        if (count >= rank)
+            return std::min(BucketUpperBound(i), max_);
+    }
+    return max_;
+}
+
+int FrameTimeHistogram::BucketIndex(double seconds)
+{
+    if (seconds <= cFirstBucketBound)
+        return 0;
+    int index = (int)std::ceil(std::log(seconds / cFirstBucketBound) / std::log(cBucketGrowth));
+    return std::min(index, cNumBuckets - 1);
+}
+
+double FrameTimeHistogram::BucketUpperBound(int index)
+{
+    return cFirstBucketBound * std::pow(cBucketGrowth, index);
+}
+
+FrameStats::FrameStats() :
+    hitchThreshold_(0.0),
+    numHitches_(0),
+    lastFrameTime_(0.0),
+    lastUpdateTime_(0.0),
+    lastFrameEnd_(0)
+{
+}
+
+bool FrameStats::EndFrame(tick_t updateStart)
+{
+    const tick_t now = GetCurrentClockTime();
+    const double freq = (double)GetCurrentClockFreq();
+    lastUpdateTime_ = (double)(now - updateStart) / freq;
+    lastFrameTime_ = (double)(now - (lastFrameEnd_ != 0 ? lastFrameEnd_ : updateStart)) / freq;
+    lastFrameEnd_ = now;
+
+    frameTimes_.Add(lastFrameTime_);
+    updateTimes_.Add(lastUpdateTime_);
+
+    if (hitchThreshold_ <= 0.0 || lastFrameTime_ < hitchThreshold_)
+        return false;
+    ++numHitches_;
+    return true;
+}
+
+void FrameStats::Reset()
+{
+    frameTimes_.Reset();
+    updateTimes_.Reset();
+    numHitches_ = 0;
+}
+
+}
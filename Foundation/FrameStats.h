@@ -0,0 +1,107 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Foundation_FrameStats_h
+#define incl_Foundation_FrameStats_h
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+namespace Foundation
+{
+    //! Histogram of durations with logarithmically growing buckets.
+    /*! Each bucket is 5% wider than the previous one, from 0.1 ms to about 25 seconds, so percentiles are accurate to within 5%
+        regardless of the frame rate. Adding a sample is constant time and allocates nothing.
+    */
+    class FrameTimeHistogram
+    {
+    public:
+        FrameTimeHistogram();
+
+        //! Adds a duration, in seconds.
+        void Add(double seconds);
+
+        //! Removes all samples.
+        void Reset();
+
+        //! Returns the number of samples.
+        u64 NumSamples() const { return numSamples_; }
+
+        //! Returns the duration p percent of the samples are shorter than, in seconds. 0 if there are no samples.
+        /*! \param p Percentile in the range [0, 100].
+        */
+        double Percentile(double p) const;
+
+        //! Returns the longest duration, in seconds.
+        double Max() const { return max_; }
+
+        //! Returns the mean duration, in seconds.
+        double Mean() const { return numSamples_ > 0 ? total_ / numSamples_ : 0.0; }
+
+    private:
+        static const int cNumBuckets = 256;
+
+        //! Returns the bucket of the given duration.
+        static int BucketIndex(double seconds);
+
+        //! Returns the upper bound of a bucket, in seconds.
+        static double BucketUpperBound(int index);
+
+        u64 buckets_[cNumBuckets];
+        u64 numSamples_;
+        double total_;
+        double max_;
+    };
+
+    //! Collects frame time statistics and detects hitches, i.e. frames that take longer than a threshold.
+    /*! The application calls EndFrame() once per frame. The framework reports the hitches with the profiling blocks and module
+        updates that took the most time in the frame; see the FrameStats console command and the hitchthreshold option.
+    */
+    class FrameStats
+    {
+    public:
+        FrameStats();
+
+        //! Records the end of a frame.
+        /*! \param updateStart The time the frame update started, from GetCurrentClockTime().
+            \return True if the frame was a hitch.
+        */
+        bool EndFrame(tick_t updateStart);
+
+        //! Returns the histogram of frame times, measured from the end of the previous frame to the end of this one.
+        const FrameTimeHistogram &FrameTimes() const { return frameTimes_; }
+
+        //! Returns the histogram of the time spent in the frame updates. The rest of the frame time is spent processing Qt
+        //! events outside the update and waiting for the next frame.
+        const FrameTimeHistogram &UpdateTimes() const { return updateTimes_; }
+
+        //! Returns the duration of the last frame, in seconds.
+        double LastFrameTime() const { return lastFrameTime_; }
+
+        //! Returns the duration of the update of the last frame, in seconds.
+        double LastUpdateTime() const { return lastUpdateTime_; }
+
+        //! Sets the frame time above which a frame is a hitch, in seconds. 0 disables hitch detection.
+        void SetHitchThreshold(double seconds) { hitchThreshold_ = seconds; }
+
+        //! Returns the hitch threshold, in seconds.
+        double HitchThreshold() const { return hitchThreshold_; }
+
+        //! Returns the number of hitches.
+        u64 NumHitches() const { return numHitches_; }
+
+        //! Clears the statistics.
+        void Reset();
+
+    private:
+        FrameTimeHistogram frameTimes_;
+        FrameTimeHistogram updateTimes_;
+        double hitchThreshold_;
+        u64 numHitches_;
+        double lastFrameTime_;
+        double lastUpdateTime_;
+        //! End time of the previous frame, or 0 before the first frame.
+        tick_t lastFrameEnd_;
+    };
+}
+
+#endif
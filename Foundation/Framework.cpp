@@ -13,6 +13,7 @@
 #include "ComponentManager.h"
 #include "ServiceManager.h"
 #include "ThreadTaskManager.h"
+#include "JobSystem.h"
 #include "RenderServiceInterface.h"
 #include "CoreException.h"
 #include "InputAPI.h"
@@ -60,7 +61,64 @@ namespace Task
 
 namespace Foundation
 {
+    namespace
+    {
+        /// Returns the number of job system worker threads. Defaults to one less than the number of cores, leaving the main
+        /// thread its own core.
+        uint NumWorkerThreads(const boost::program_options::variables_map &options)
+        {
+            if (options.count("workerthreads") > 0)
+                return (uint)std::max(0, options["workerthreads"].as<int>());
+
+            uint numCores = boost::thread::hardware_concurrency();
+            return numCores > 1 ? numCores - 1 : 0;
+        }
+
+        /// Number of frames in a profiler capture, if not specified.
+        const int cDefaultCaptureFrames = 10;
+
+        /// Frame time above which a frame is reported as a hitch, if not specified, in seconds.
+        const double cDefaultHitchThreshold = 0.1;
+
+        /// Minimum time between two hitch reports, in seconds, so that a period of slow frames does not flood the log.
+        const double cHitchReportInterval = 5.0;
+
+        /// Number of profiling blocks and module updates listed in a hitch report.
+        const size_t cNumHitchOffenders = 5;
+
+        /// Orders (time, name) pairs by descending time.
+        struct TimeGreaterThan
+        {
+            bool operator()(const std::pair<double, std::string> &a, const std::pair<double, std::string> &b) const
+            {
+                return a.first > b.first;
+            }
+        };
+
+#ifdef PROFILING
+        /// Collects the time spent in each profiling block in the last processed frame, excluding the time spent in its child blocks.
+        void CollectBlockSelfTimes(const ProfilerNodeTree *node, const std::string &thread, std::vector<std::pair<double, std::string> > &times)
+        {
+            const ProfilerNodeTree::NodeList &children = node->GetChildren();
+            double childTime = 0.0;
+            for(ProfilerNodeTree::NodeList::const_iterator it = children.begin(); it != children.end(); ++it)
+            {
+                const ProfilerNode *child = dynamic_cast<const ProfilerNode *>(it->get());
+                if (child)
+                    childTime += child->elapsed_frame_;
+                CollectBlockSelfTimes(it->get(), thread, times);
+            }
+
+            const ProfilerNode *block = dynamic_cast<const ProfilerNode *>(node);
+            if (block && block->num_called_frame_ > 0)
+                times.push_back(std::make_pair(block->elapsed_frame_ - childTime, node->Name() + " (" + thread + ", " + ToString(block->num_called_frame_) + " calls)"));
+        }
+#endif
+
+    }
+
     Framework::Framework(int argc, char** argv) :
+        last_hitch_report_(0),
         exit_signal_(false),
         argc_(argc),
         argv_(argv),
@@ -149,7 +207,16 @@ namespace Foundation
             
             CreateLoggingSystem(); // depends on config and platform
 
+            frame_stats_.SetHitchThreshold(commandLineVariables.count("hitchthreshold") > 0 ? 
+                commandLineVariables["hitchthreshold"].as<float>() / 1000.0 : cDefaultHitchThreshold);
+
+#ifdef PROFILING
+            if (commandLineVariables.count("hitchcapture") > 0)
+                profiler_.StartHitchCapture(commandLineVariables["hitchcapture"].as<float>() / 1000.0, cDefaultCaptureFrames, DefaultProfilerCaptureFile());
+#endif
+
             // create managers
+            job_system_ = JobSystemPtr(new JobSystem(NumWorkerThreads(commandLineVariables)));
             module_manager_ = ModuleManagerPtr(new ModuleManager(this));
             component_manager_ = ComponentManagerPtr(new ComponentManager(this));
             service_manager_ = ServiceManagerPtr(new ServiceManager());
@@ -194,11 +261,18 @@ namespace Foundation
 
     Framework::~Framework()
     {
+        // Finish the jobs before the managers they may use are destroyed.
+        if (job_system_)
+        {
+            job_system_->WaitForAll();
+            job_system_->ClearMainThreadJobs();
+        }
         thread_task_manager_.reset();
         event_manager_.reset();
         service_manager_.reset();
         component_manager_.reset();
         module_manager_.reset();
+        job_system_.reset();
         config_manager_.reset();
         platform_.reset();
 
@@ -322,9 +396,15 @@ namespace Foundation
             ("startserver", po::value<int>(0), "Start server automatically in specified port") // TundraLogicModule
             ("protocol", po::value<std::string>(), "Spesifies which transport layer to use. Used when starting a server and when client connects. Options: '--protocol tcp' and '--protocol udp'. Defaults to tcp if no protocol is spesified.") // KristalliProtocolModule
             ("fpslimit", po::value<float>(0), "Specifies the fps cap to use in rendering. Default: 60. Pass in 0 to disable") // OgreRenderingModule
+            ("processstatsfile", po::value<std::string>(), "Appends the CPU, memory, I/O and context switch metrics of the process to the given file as comma-separated values once a second. Linux only") // DebugStatsModule
+            ("hitchthreshold", po::value<float>(), "Specifies the frame time in milliseconds above which a frame is reported as a hitch, with the profiling blocks and module updates that took the most time. Default: 100. Pass in 0 to disable") // Framework
+            ("hitchcapture", po::value<float>(), "Writes a profiler capture of the last frames to profilercapture.json in the application data directory when a frame takes longer than the given number of milliseconds. Open the capture with chrome://tracing. Requires a build with profiling enabled") // Framework
+            ("physicsthread", "Simulates the physics of each scene in a thread of its own, in parallel with the rest of the frame. The physics results lag one frame behind") // PhysicsModule
+            ("workerthreads", po::value<int>(), "Specifies the number of worker threads in the job system, which runs background jobs and the module updates that can be run outside the main thread. Default: number of cores - 1. Pass in 0 to run all jobs on the thread that submits them") // Framework
             ("run", po::value<std::vector<std::string> >(), "Run script on startup") // JavaScriptModule
             ("file", po::value<std::string>(), "Load scene on startup. Accepts absolute and relative paths, local:// and http:// are accepted and fetched via the AssetAPI.") // TundraLogicModule & AssetModule
               ("storage", po::value<std::vector<std::string> >(), "Adds the given directory as a local storage directory on startup") // AssetModule
+            ("assetmemorybudget", po::value<int>(), "Specifies the amount of memory, in megabytes, loaded assets may take up before unreferenced assets are unloaded. Default: 0 (unlimited)") // AssetModule
             ("login", po::value<std::string>(), "Automatically login to server using provided data. Url syntax: {tundra|http|https}://host[:port]/?username=x[&password=y&avatarurl=z&protocol={udp|tcp}]. Minimum information needed to try a connection in the url are host and username")
             ///\todo The following options seem to be unused in the system. These should be removed or reimplemented. -jj.
             ("user", po::value<std::string>(), "OpenSim login name")
@@ -379,6 +459,62 @@ namespace Foundation
         return frametime;
     }
 
+    void Framework::EndFrame(tick_t updateStart)
+    {
+        AllocationTracker *allocations = AllocationTracker::Instance();
+        if (allocations)
+            allocations->EndFrame();
+
+        if (!frame_stats_.EndFrame(updateStart))
+            return;
+
+        const tick_t now = GetCurrentClockTime();
+        if (last_hitch_report_ != 0 && (double)(now - last_hitch_report_) / GetCurrentClockFreq() < cHitchReportInterval)
+            return;
+        last_hitch_report_ = now;
+        ReportHitch();
+    }
+
+    void Framework::ReportHitch()
+    {
+        PROFILE(FW_ReportHitch);
+
+        char str[256];
+        sprintf(str, "Hitch: frame took %.1f ms, of which %.1f ms in the frame update (%llu hitches over %.0f ms so far).",
+            frame_stats_.LastFrameTime() * 1000.0, frame_stats_.LastUpdateTime() * 1000.0, (unsigned long long)frame_stats_.NumHitches(),
+            frame_stats_.HitchThreshold() * 1000.0);
+        RootLogWarning(str);
+
+        std::vector<std::pair<double, std::string> > times;
+#ifdef PROFILING
+        {
+            ProfilerNodeTree *root = profiler_.Lock();
+            const ProfilerNodeTree::NodeList &threads = root->GetChildren();
+            for(ProfilerNodeTree::NodeList::const_iterator it = threads.begin(); it != threads.end(); ++it)
+                CollectBlockSelfTimes(it->get(), (*it)->Name(), times);
+            profiler_.Release();
+        }
+
+        std::sort(times.begin(), times.end(), TimeGreaterThan());
+        for(size_t i = 0; i < times.size() && i < cNumHitchOffenders && times[i].first > 0.0; ++i)
+        {
+            sprintf(str, "  %8.2f ms in block ", times[i].first * 1000.0);
+            RootLogWarning(str + times[i].second);
+        }
+#endif
+
+        times.clear();
+        const FrameScheduler::Timeline &timeline = module_manager_->GetFrameScheduler().LastFrameTimeline();
+        for(size_t i = 0; i < timeline.size(); ++i)
+            times.push_back(std::make_pair(timeline[i].end - timeline[i].start, timeline[i].name + " (thread " + ToString(timeline[i].thread) + ")"));
+        std::sort(times.begin(), times.end(), TimeGreaterThan());
+        for(size_t i = 0; i < times.size() && i < cNumHitchOffenders; ++i)
+        {
+            sprintf(str, "  %8.2f ms in module update ", times[i].first * 1000.0);
+            RootLogWarning(str + times[i].second);
+        }
+    }
+
     void Framework::UpdateModules(double frametime)
     {
         if (exit_signal_)
@@ -396,6 +532,12 @@ namespace Foundation
             thread_task_manager_->SendResultEvents();
         }
 
+        // Run the continuations of finished jobs
+        {
+            PROFILE(Update_JobContinuations);
+            job_system_->ProcessMainThreadJobs();
+        }
+
         // Process delayed events
         {
             PROFILE(Update_DelayedEvents);
@@ -433,6 +575,8 @@ namespace Foundation
         // information after for example network updates, that have been performed by the modules.
         {
             PROFILE(Update_FrameAPI);
+            // The entity components update on the frame tick. The frame handlers of the scripts are counted along with them.
+            ALLOCATION_SCOPE(Scene);
             frame->Update(frametime);
         }
     }
@@ -516,9 +660,18 @@ namespace Foundation
     void Framework::UnloadModules()
     {
         event_manager_->ClearDelayedEvents();
+
+        // Finish the jobs of the modules, and run their continuations, while the modules are still initialized.
+        job_system_->WaitForAll();
+        job_system_->ProcessMainThreadJobs();
+
         module_manager_->UninitializeModules();
         ///\todo Horrible uninit call here now due to console refactoring
         console->Uninitialize();
+
+        // The jobs and continuations left over run and destroy code of the modules, so get rid of them before the modules are unloaded.
+        job_system_->WaitForAll();
+        job_system_->ClearMainThreadJobs();
         module_manager_->UnloadModules();
     }
 
@@ -684,6 +837,166 @@ namespace Foundation
         return ConsoleResultSuccess();
     }
 
+    std::string Framework::DefaultProfilerCaptureFile() const
+    {
+        return platform_->GetApplicationDataDirectory() + "/profilercapture.json";
+    }
+
+    ConsoleCommandResult Framework::ConsoleProfilerCapture(const StringVector &params)
+    {
+#ifdef PROFILING
+        const int numFrames = params.size() > 0 ? ParseString<int>(params[0], 0) : cDefaultCaptureFrames;
+        if (numFrames <= 0)
+            return ConsoleResultFailure("Invalid number of frames. Usage: ProfilerCapture(frames, filename)");
+        const std::string filename = params.size() > 1 ? params[1] : DefaultProfilerCaptureFile();
+
+        profiler_.StartCapture(numFrames, filename);
+        return ConsoleResultSuccess("Capturing " + ToString(numFrames) + " frames to " + filename);
+#else
+        return ConsoleResultFailure("Profiling is not enabled in this build.");
+#endif
+    }
+
+    ConsoleCommandResult Framework::ConsoleProfilerCaptureHitch(const StringVector &params)
+    {
+#ifdef PROFILING
+        if (params.empty())
+            return ConsoleResultFailure("Usage: ProfilerCaptureHitch(milliseconds, frames, filename) or ProfilerCaptureHitch(off)");
+        if (params[0] == "off")
+        {
+            profiler_.StopCapture();
+            return ConsoleResultSuccess("Hitch capture stopped.");
+        }
+
+        const float threshold = ParseString<float>(params[0], 0.f);
+        const int numFrames = params.size() > 1 ? ParseString<int>(params[1], 0) : cDefaultCaptureFrames;
+        if (threshold <= 0.f || numFrames <= 0)
+            return ConsoleResultFailure("Invalid threshold or number of frames. Usage: ProfilerCaptureHitch(milliseconds, frames, filename)");
+        const std::string filename = params.size() > 2 ? params[2] : DefaultProfilerCaptureFile();
+
+        profiler_.StartHitchCapture(threshold / 1000.0, numFrames, filename);
+        return ConsoleResultSuccess("Writing the last " + ToString(numFrames) + " frames to " + filename + " when a frame takes longer than " +
+            ToString(threshold) + " ms");
+#else
+        return ConsoleResultFailure("Profiling is not enabled in this build.");
+#endif
+    }
+
+    ConsoleCommandResult Framework::ConsoleFrameTimeline(const StringVector &params)
+    {
+        if (!console)
+            return ConsoleResultSuccess();
+
+        const FrameScheduler &scheduler = module_manager_->GetFrameScheduler();
+        const FrameScheduler::Timeline &timeline = scheduler.LastFrameTimeline();
+        console->Print(QString("Module updates of the last frame (%1 worker threads):").arg(scheduler.NumWorkerThreads()));
+        for(size_t i = 0; i < timeline.size(); ++i)
+        {
+            const FrameScheduler::TimelineEntry &entry = timeline[i];
+            char str[256];
+            sprintf(str, "%-32s stage %d, thread %d: %s - %s (%s)", entry.name.c_str(), entry.stage, entry.thread,
+                FormatTime(entry.start).c_str(), FormatTime(entry.end).c_str(), FormatTime(entry.end - entry.start).c_str());
+            console->Print(str);
+        }
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult Framework::ConsoleEventStats(const StringVector &params)
+    {
+        if (params.size() > 0 && params[0] == "reset")
+        {
+            event_manager_->ResetDispatchStats();
+            return ConsoleResultSuccess("Event dispatch statistics reset.");
+        }
+        if (!console)
+            return ConsoleResultSuccess();
+
+        const EventManager::EventDispatchStatsVector &stats = event_manager_->GetDispatchStats();
+        console->Print(QString("Event dispatch statistics (%1 module and component subscribers):").arg(event_manager_->GetNumSubscribers()));
+        u64 totalSent = 0;
+        u64 totalHandlerCalls = 0;
+        u64 totalSubscribers = 0;
+        for(size_t i = 0; i < stats.size(); ++i)
+        {
+            if (stats[i].numSent == 0)
+                continue;
+
+            char str[256];
+            sprintf(str, "%-24s %10llu events, %6.2f handlers/event (%6.2f subscribers/event)", event_manager_->QueryEventCategoryName((event_category_id_t)i).c_str(),
+                (unsigned long long)stats[i].numSent, (double)stats[i].numHandlerCalls / stats[i].numSent, (double)stats[i].numSubscribers / stats[i].numSent);
+            console->Print(str);
+
+            totalSent += stats[i].numSent;
+            totalHandlerCalls += stats[i].numHandlerCalls;
+            totalSubscribers += stats[i].numSubscribers;
+        }
+        if (totalSent > 0)
+            console->Print(QString("Total: %1 events, %2 handler calls, %3 calls saved by event interests.").arg((qulonglong)totalSent)
+                .arg((qulonglong)totalHandlerCalls).arg((qulonglong)(totalSubscribers >= totalHandlerCalls ? totalSubscribers - totalHandlerCalls : 0)));
+
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult Framework::ConsoleFrameStats(const StringVector &params)
+    {
+        if (params.size() > 0 && params[0] == "reset")
+        {
+            frame_stats_.Reset();
+            return ConsoleResultSuccess("Frame time statistics reset.");
+        }
+        if (!console)
+            return ConsoleResultSuccess();
+
+        const FrameTimeHistogram *histograms[] = { &frame_stats_.FrameTimes(), &frame_stats_.UpdateTimes() };
+        const char *names[] = { "Frame time", "Update time" };
+        console->Print(QString("Statistics of %1 frames:").arg((qulonglong)frame_stats_.FrameTimes().NumSamples()));
+        for(int i = 0; i < 2; ++i)
+        {
+            char str[256];
+            sprintf(str, "%-12s p50 %s, p95 %s, p99 %s, max %s, mean %s", names[i], FormatTime(histograms[i]->Percentile(50)).c_str(),
+                FormatTime(histograms[i]->Percentile(95)).c_str(), FormatTime(histograms[i]->Percentile(99)).c_str(),
+                FormatTime(histograms[i]->Max()).c_str(), FormatTime(histograms[i]->Mean()).c_str());
+            console->Print(str);
+        }
+        if (frame_stats_.HitchThreshold() > 0.0)
+            console->Print(QString("%1 hitches over %2 ms.").arg((qulonglong)frame_stats_.NumHitches()).arg(frame_stats_.HitchThreshold() * 1000.0));
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult Framework::ConsoleAllocStats(const StringVector &params)
+    {
+        AllocationTracker *allocations = AllocationTracker::Instance();
+        if (!allocations)
+            return ConsoleResultFailure("Allocation tracking is not enabled in this build. Configure the build with ALLOCATION_TRACKING.");
+        if (!console)
+            return ConsoleResultSuccess();
+
+        console->Print("Allocations per tag during the last frame, and live allocations:");
+        for(int tag = 0; tag < NumAllocationTags; ++tag)
+        {
+            const AllocationCounters &frame = allocations->LastFrame(tag);
+            const AllocationCounters totals = allocations->Totals(tag);
+            char str[256];
+            sprintf(str, "%-10s %8llu allocs/frame %10llu bytes/frame %8llu frees/frame, %10llu live objects %12llu live bytes",
+                AllocationTracker::TagName(tag), (unsigned long long)frame.numAllocs, (unsigned long long)frame.bytesAllocated,
+                (unsigned long long)frame.numFrees, (unsigned long long)totals.LiveObjects(), (unsigned long long)totals.LiveBytes());
+            console->Print(str);
+        }
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult Framework::ConsoleHitchThreshold(const StringVector &params)
+    {
+        if (params.empty())
+            return ConsoleResultSuccess("Hitch threshold is " + ToString(frame_stats_.HitchThreshold() * 1000.0) + " ms.");
+
+        const double threshold = ParseString<double>(params[0], -1.0);
+        if (threshold < 0.0)
+            return ConsoleResultFailure("Invalid threshold. Usage: HitchThreshold(milliseconds)");
+        frame_stats_.SetHitchThreshold(threshold / 1000.0);
+        return ConsoleResultSuccess(threshold > 0.0 ? "Hitch threshold set to " + params[0] + " ms." : std::string("Hitch detection disabled."));
+    }
+
     void Framework::RegisterConsoleCommands()
     {
         console->RegisterCommand(CreateConsoleCommand("LoadModule",
@@ -702,11 +1015,43 @@ namespace Foundation
             "Sends an internal event. Only for events that contain no data. Usage: SendEvent(event category name, event id)",
             ConsoleBind(this, &Framework::ConsoleSendEvent)));
 
+        console->RegisterCommand(CreateConsoleCommand("FrameTimeline",
+            "Outputs the timeline of the module updates of the last frame, showing which thread ran each update and when.",
+            ConsoleBind(this, &Framework::ConsoleFrameTimeline)));
+
+        console->RegisterCommand(CreateConsoleCommand("FrameStats",
+            "Outputs the 50th, 95th and 99th percentile and maximum of the frame times and frame update times. Usage: FrameStats() to output, FrameStats(reset) to reset.",
+            ConsoleBind(this, &Framework::ConsoleFrameStats)));
+
+        console->RegisterCommand(CreateConsoleCommand("HitchThreshold",
+            "Sets the frame time above which a frame is reported to the log as a hitch, with the profiling blocks and module updates that took the most time. "
+            "Usage: HitchThreshold(milliseconds), 0 to disable.",
+            ConsoleBind(this, &Framework::ConsoleHitchThreshold)));
+
+        console->RegisterCommand(CreateConsoleCommand("AllocStats",
+            "Outputs the number of allocations and bytes allocated per subsystem during the last frame, and the live allocations. "
+            "Requires a build configured with ALLOCATION_TRACKING.",
+            ConsoleBind(this, &Framework::ConsoleAllocStats)));
+
+        console->RegisterCommand(CreateConsoleCommand("EventStats",
+            "Outputs the number of events sent per category and how many event handlers each was offered to. Usage: EventStats() to output, EventStats(reset) to reset.",
+            ConsoleBind(this, &Framework::ConsoleEventStats)));
+
 #ifdef PROFILING
         console->RegisterCommand(CreateConsoleCommand("Profile", 
             "Outputs profiling data. Usage: Profile() for full, or Profile(name) for specific profiling block",
             ConsoleBind(this, &Framework::ConsoleProfile)));
 #endif
+
+        console->RegisterCommand(CreateConsoleCommand("ProfilerCapture",
+            "Captures the profiling blocks of all threads for a number of frames to a Chrome trace file, which can be opened with chrome://tracing. "
+            "Usage: ProfilerCapture(frames, filename). Defaults: 10 frames, profilercapture.json in the application data directory.",
+            ConsoleBind(this, &Framework::ConsoleProfilerCapture)));
+
+        console->RegisterCommand(CreateConsoleCommand("ProfilerCaptureHitch",
+            "Captures the profiling blocks of the last frames to a Chrome trace file when a frame takes longer than the given time. "
+            "Usage: ProfilerCaptureHitch(milliseconds, frames, filename), or ProfilerCaptureHitch(off) to stop.",
+            ConsoleBind(this, &Framework::ConsoleProfilerCaptureHitch)));
     }
 
 #ifdef PROFILING
@@ -751,6 +1096,11 @@ namespace Foundation
         return thread_task_manager_;
     }
 
+    JobSystemPtr Framework::GetJobSystem() const
+    {
+        return job_system_;
+    }
+
     ConfigurationManager &Framework::GetDefaultConfig()
     {
         return *(config_manager_.get());
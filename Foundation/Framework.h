@@ -7,6 +7,7 @@
 #define APPLICATION_NAME "realXtend"
 
 #include "Profiler.h"
+#include "FrameStats.h"
 #include "ModuleManager.h"
 #include "ServiceManager.h"
 
@@ -107,6 +108,14 @@ namespace Foundation
         /// \param double Frametime
         void UpdateRendering(double frametime);
 
+        /// Records the frame time statistics at the end of a frame, and reports the frame to the log if it was a hitch.
+        /// Call after the profiler has processed the events of the frame.
+        /// \param updateStart Time the frame update started.
+        void EndFrame(tick_t updateStart);
+
+        /// Returns the frame time statistics.
+        const FrameStats &GetFrameStats() const { return frame_stats_; }
+
         /// Returns component manager.
         ComponentManagerPtr GetComponentManager() const;
 
@@ -128,6 +137,9 @@ namespace Foundation
         /// Returns thread task manager.
         ThreadTaskManagerPtr GetThreadTaskManager();
 
+        /// Returns the system-wide job system.
+        JobSystemPtr GetJobSystem() const;
+
         /// Cancel a pending exit
         void CancelExit();
 
@@ -182,6 +194,27 @@ namespace Foundation
         /// limit frames
         ConsoleCommandResult ConsoleLimitFrames(const StringVector &params);
 
+        /// Start a profiler capture of the next frames
+        ConsoleCommandResult ConsoleProfilerCapture(const StringVector &params);
+
+        /// Start or stop a profiler capture of the frames before a hitch
+        ConsoleCommandResult ConsoleProfilerCaptureHitch(const StringVector &params);
+
+        /// Output the module update timeline of the last frame
+        ConsoleCommandResult ConsoleFrameTimeline(const StringVector &params);
+
+        /// Output the event dispatch statistics
+        ConsoleCommandResult ConsoleEventStats(const StringVector &params);
+
+        /// Output the frame time statistics
+        ConsoleCommandResult ConsoleFrameStats(const StringVector &params);
+
+        /// Set the hitch threshold
+        ConsoleCommandResult ConsoleHitchThreshold(const StringVector &params);
+
+        /// Output the allocation statistics
+        ConsoleCommandResult ConsoleAllocStats(const StringVector &params);
+
         /// Returns name of the configuration group used by the framework
         /*! The group name is used with ConfigurationManager, for framework specific
             settings. Alternatively a class may use it's own name as the name of the
@@ -291,12 +324,21 @@ namespace Foundation
 
         /// Creates logging system.
         void CreateLoggingSystem();
+
+        /// Returns the file profiler captures are written to, if not specified.
+        std::string DefaultProfilerCaptureFile() const;
+
+        /// Logs the profiling blocks and module updates that took the most time in the last frame.
+        void ReportHitch();
         ModuleManagerPtr module_manager_; ///< Module manager.
         ComponentManagerPtr component_manager_; ///< Component manager.
         ServiceManagerPtr service_manager_; ///< Service manager.
         EventManagerPtr event_manager_; ///< Event manager.
         PlatformPtr platform_; ///< Platform.
         ThreadTaskManagerPtr thread_task_manager_; ///< Thread task manager.
+        JobSystemPtr job_system_; ///< Job system.
+        FrameStats frame_stats_; ///< Frame time statistics.
+        tick_t last_hitch_report_; ///< Time of the last hitch report.
         ConfigurationManagerPtr config_manager_; ///< Default configuration
         bool exit_signal_; ///< If true, exit application.
         std::vector<Poco::Channel*> log_channels_; ///< Logger channels
@@ -36,6 +36,42 @@ enum ModuleState
     MS_Unknown ///< Module state is unkown
 };
 
+/// Shared state that module updates may access. Used by the frame scheduler to find out which module updates can run concurrently.
+/** @ingroup Module_group
+*/
+enum ModuleUpdateAccess
+{
+    MUA_None = 0,
+    MUA_Scene = 1 << 0, ///< Scenes, entities and components
+    MUA_Physics = 1 << 1, ///< Physics worlds
+    MUA_Network = 1 << 2, ///< Network connections and replication state
+    MUA_Assets = 1 << 3, ///< The Asset API and loaded assets
+    MUA_Script = 1 << 4, ///< Script engines
+    MUA_Audio = 1 << 5, ///< The Audio API and sound channels
+    MUA_Events = 1 << 6, ///< Sending events through the event manager
+    MUA_Ui = 1 << 7, ///< The UI API and Qt widgets
+    MUA_All = 0xFFFFFFFF ///< Everything. The default for modules that do not declare their accesses.
+};
+
+/// Describes how the frame scheduler may run the Update() of a module. See Foundation::FrameScheduler.
+/** The default description runs the update on the main thread and marks it as accessing everything, so modules that
+    do not override IModule::UpdateInfo() are updated serially in load order, as before.
+    @ingroup Module_group
+*/
+struct ModuleUpdateInfo
+{
+    ModuleUpdateInfo() : stage(0), reads(MUA_All), writes(MUA_All), mainThreadOnly(true) {}
+
+    /// All updates of a lower stage are finished before any update of a higher stage begins.
+    int stage;
+    /// Combination of ModuleUpdateAccess flags this update reads.
+    u32 reads;
+    /// Combination of ModuleUpdateAccess flags this update writes.
+    u32 writes;
+    /// If true, the update is always run on the main thread. Updates that touch Qt or Ogre must keep this set.
+    bool mainThreadOnly;
+};
+
 /// Interface for modules. When creating new modules, inherit from this class.
 /** See @ref ModuleArchitecture for details.
     @ingroup Foundation_group
@@ -87,6 +123,12 @@ public:
     */
     virtual void Update(f64 frametime) {}
 
+    /// Returns how the frame scheduler may run the Update() of this module.
+    /** Override in your own module to allow the update to run on a worker thread concurrently with other module updates.
+        The returned description is queried once per frame.
+    */
+    virtual ModuleUpdateInfo UpdateInfo() const { return ModuleUpdateInfo(); }
+
     /// Receives an event.
     /** Should return true if the event was handled and is not to be propagated further
         Override in your own module if you want to receive events. Do not call.
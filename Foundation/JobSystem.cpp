@@ -0,0 +1,360 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "JobSystem.h"
+#include "LoggingFunctions.h"
+DEFINE_POCO_LOGGING_FUNCTIONS("JobSystem")
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace Foundation
+{
+
+bool JobHandle::IsFinished() const
+{
+    if (!state_)
+        return true;
+    MutexLock lock(state_->mutex);
+    return state_->numPendingJobs == 0;
+}
+
+bool JobHandle::Failed() const
+{
+    if (!state_)
+        return false;
+    MutexLock lock(state_->mutex);
+    return state_->failed;
+}
+
+std::string JobHandle::Error() const
+{
+    if (!state_)
+        return std::string();
+    MutexLock lock(state_->mutex);
+    return state_->error;
+}
+
+void JobHandle::Wait() const
+{
+    if (state_)
+        state_->owner->Wait(state_);
+}
+
+void JobHandle::Then(const Job &continuation) const
+{
+    if (!state_)
+        return;
+
+    {
+        MutexLock lock(state_->mutex);
+        if (state_->numPendingJobs > 0)
+        {
+            state_->continuations.push_back(continuation);
+            return;
+        }
+    }
+    state_->owner->RunOnMainThread(continuation);
+}
+
+JobSystem::JobSystem(uint numWorkerThreads) :
+    numQueuedJobs_(0),
+    numUnfinishedJobs_(0),
+    nextQueue_(0),
+    numSleepingWorkers_(0),
+    quit_(false)
+{
+    for(uint i = 0; i < numWorkerThreads; ++i)
+        queues_.push_back(new WorkerQueue);
+    for(uint i = 0; i < numWorkerThreads; ++i)
+        workers_.push_back(new Thread(boost::bind(&JobSystem::WorkerMain, this, (int)i + 1)));
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        MutexLock lock(sleepMutex_);
+        quit_ = true;
+    }
+    workAvailable_.notify_all();
+
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+        workers_[i]->join();
+        delete workers_[i];
+    }
+    workers_.clear();
+
+    for(size_t i = 0; i < queues_.size(); ++i)
+        delete queues_[i];
+    queues_.clear();
+}
+
+int JobSystem::CurrentWorkerIndex() const
+{
+    int *index = workerIndex_.get();
+    return index ? *index : 0;
+}
+
+JobHandle JobSystem::Submit(const Job &job)
+{
+    QueuedJob queued;
+    queued.job = job;
+    queued.state = JobStatePtr(new JobState(this, 1));
+
+    if (workers_.empty())
+        Run(queued);
+    else
+        Push(queued);
+
+    return JobHandle(queued.state);
+}
+
+void JobSystem::ParallelFor(int begin, int end, const RangeJob &body, int grainSize)
+{
+    if (end <= begin)
+        return;
+
+    const int count = end - begin;
+    if (grainSize <= 0)
+        grainSize = std::max(1, count / ((int)workers_.size() * 4 + 1));
+    const int numChunks = (count + grainSize - 1) / grainSize;
+    if (workers_.empty() || numChunks == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    JobStatePtr state(new JobState(this, numChunks));
+    QueuedJob queued;
+    queued.state = state;
+    for(int i = 1; i < numChunks; ++i)
+    {
+        const int chunkBegin = begin + i * grainSize;
+        queued.job = boost::bind(body, chunkBegin, std::min(end, chunkBegin + grainSize));
+        Push(queued);
+    }
+
+    // Run the first chunk here, then help with the rest.
+    queued.job = boost::bind(body, begin, begin + grainSize);
+    Run(queued);
+    Wait(state);
+
+    if (state->failed)
+        throw std::runtime_error(state->error);
+}
+
+void JobSystem::RunOnMainThread(const Job &job)
+{
+    MutexLock lock(mainThreadMutex_);
+    mainThreadJobs_.push_back(job);
+}
+
+void JobSystem::ProcessMainThreadJobs()
+{
+    std::vector<Job> jobs;
+    {
+        MutexLock lock(mainThreadMutex_);
+        jobs.swap(mainThreadJobs_);
+    }
+
+    for(size_t i = 0; i < jobs.size(); ++i)
+    {
+        try
+        {
+            jobs[i]();
+        }
+        catch(const std::exception &e)
+        {
+            LogError(std::string("ProcessMainThreadJobs caught an exception from a main thread job: ") + (e.what() ? e.what() : "(null)"));
+        }
+        catch(...)
+        {
+            LogError("ProcessMainThreadJobs caught an unknown exception from a main thread job.");
+        }
+    }
+}
+
+uint JobSystem::NumQueuedJobs() const
+{
+    return (uint)std::max(0L, (long)numQueuedJobs_);
+}
+
+void JobSystem::WaitForAll()
+{
+    const int workerIndex = CurrentWorkerIndex();
+    while((long)numUnfinishedJobs_ > 0)
+    {
+        QueuedJob job;
+        if (Take(workerIndex, job))
+        {
+            Run(job);
+            --numUnfinishedJobs_;
+        }
+        else
+            boost::this_thread::yield(); // The remaining jobs are being run by the workers.
+    }
+}
+
+void JobSystem::ClearMainThreadJobs()
+{
+    std::vector<Job> jobs;
+    {
+        MutexLock lock(mainThreadMutex_);
+        jobs.swap(mainThreadJobs_);
+    }
+}
+
+void JobSystem::WorkerMain(int workerIndex)
+{
+    workerIndex_.reset(new int(workerIndex));
+
+    for(;;)
+    {
+        QueuedJob job;
+        if (Take(workerIndex, job))
+        {
+            Run(job);
+            --numUnfinishedJobs_;
+            continue;
+        }
+
+        ScopedLock lock(sleepMutex_);
+        ++numSleepingWorkers_;
+        while((long)numQueuedJobs_ <= 0 && !quit_)
+            workAvailable_.wait(lock);
+        --numSleepingWorkers_;
+        if (quit_ && (long)numQueuedJobs_ <= 0)
+            return;
+    }
+}
+
+void JobSystem::Wait(const JobStatePtr &state)
+{
+    const int workerIndex = CurrentWorkerIndex();
+    for(;;)
+    {
+        {
+            MutexLock lock(state->mutex);
+            if (state->numPendingJobs == 0)
+                return;
+        }
+
+        QueuedJob job;
+        if (Take(workerIndex, job))
+        {
+            Run(job);
+            --numUnfinishedJobs_;
+            continue;
+        }
+
+        // None of the remaining jobs of the state are queued, so they are being run by other threads. Jobs they submit go to
+        // the queues of those threads, which finish them without our help.
+        ScopedLock lock(state->mutex);
+        while(state->numPendingJobs > 0)
+            state->finished.wait(lock);
+        return;
+    }
+}
+
+void JobSystem::QueueContinuations(std::vector<Job> &continuations)
+{
+    if (continuations.empty())
+        return;
+
+    MutexLock lock(mainThreadMutex_);
+    mainThreadJobs_.insert(mainThreadJobs_.end(), continuations.begin(), continuations.end());
+}
+
+void JobSystem::Push(const QueuedJob &job)
+{
+    int workerIndex = CurrentWorkerIndex();
+    WorkerQueue *queue = workerIndex > 0 ? queues_[workerIndex - 1] : queues_[(size_t)(++nextQueue_) % queues_.size()];
+    ++numUnfinishedJobs_;
+    {
+        MutexLock lock(queue->mutex);
+        queue->jobs.push_back(job);
+    }
+    ++numQueuedJobs_;
+
+    // A worker that went to sleep checks numQueuedJobs_ with sleepMutex_ locked, so taking the lock here cannot miss it.
+    MutexLock lock(sleepMutex_);
+    if (numSleepingWorkers_ > 0)
+        workAvailable_.notify_one();
+}
+
+bool JobSystem::Take(int workerIndex, QueuedJob &job)
+{
+    if (queues_.empty())
+        return false;
+
+    if (workerIndex > 0)
+    {
+        WorkerQueue *own = queues_[workerIndex - 1];
+        MutexLock lock(own->mutex);
+        if (!own->jobs.empty())
+        {
+            job = own->jobs.back();
+            own->jobs.pop_back();
+            --numQueuedJobs_;
+            return true;
+        }
+    }
+
+    // Steal the oldest job of another worker, starting from the next worker to spread the thieves out.
+    const size_t numQueues = queues_.size();
+    for(size_t i = 0; i < numQueues; ++i)
+    {
+        WorkerQueue *victim = queues_[((size_t)std::max(workerIndex, 0) + i) % numQueues];
+        MutexLock lock(victim->mutex);
+        if (!victim->jobs.empty())
+        {
+            job = victim->jobs.front();
+            victim->jobs.pop_front();
+            --numQueuedJobs_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::Run(QueuedJob &job)
+{
+    std::string error;
+    try
+    {
+        job.job();
+    }
+    catch(const std::exception &e)
+    {
+        error = std::string("Job threw an exception: ") + (e.what() ? e.what() : "(null)");
+    }
+    catch(...)
+    {
+        error = "Job threw an unknown exception.";
+    }
+    job.job.clear();
+    if (!error.empty())
+        LogError(error);
+
+    std::vector<Job> continuations;
+    {
+        MutexLock lock(job.state->mutex);
+        if (!error.empty() && !job.state->failed)
+        {
+            job.state->failed = true;
+            job.state->error = error;
+        }
+        if (--job.state->numPendingJobs == 0)
+        {
+            continuations.swap(job.state->continuations);
+            job.state->finished.notify_all();
+        }
+    }
+    QueueContinuations(continuations);
+}
+
+}
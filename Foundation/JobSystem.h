@@ -0,0 +1,282 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Foundation_JobSystem_h
+#define incl_Foundation_JobSystem_h
+
+#include "CoreTypes.h"
+#include "CoreThread.h"
+
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/detail/atomic_count.hpp>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <stdexcept>
+
+namespace Foundation
+{
+    class JobSystem;
+
+    //! A unit of work run by the JobSystem.
+    typedef boost::function<void()> Job;
+
+    //! Completion state shared by a submitted job, its JobHandle and the JobFutures referring to it. For internal use.
+    struct JobState
+    {
+        JobState(JobSystem *owner_, int numPendingJobs_) : owner(owner_), numPendingJobs(numPendingJobs_), failed(false) {}
+
+        JobSystem *owner;
+        //! Guards the fields below.
+        Mutex mutex;
+        //! Signaled when the job finishes.
+        Condition finished;
+        //! The number of jobs that have not finished yet. ParallelFor runs several jobs under a single state.
+        int numPendingJobs;
+        //! Set if the job threw.
+        bool failed;
+        //! Description of the exception the job threw.
+        std::string error;
+        //! Continuations to run on the main thread once the job has finished.
+        std::vector<Job> continuations;
+    };
+
+    typedef boost::shared_ptr<JobState> JobStatePtr;
+
+    //! Refers to a job submitted to the JobSystem.
+    /*! Handles are cheap to copy. A default-constructed handle refers to no job and is always finished.
+     */
+    class JobHandle
+    {
+    public:
+        JobHandle() {}
+        explicit JobHandle(const JobStatePtr &state) : state_(state) {}
+
+        //! Returns true if the job has finished (or the handle refers to no job).
+        bool IsFinished() const;
+
+        //! Returns true if the job finished by throwing an exception.
+        bool Failed() const;
+
+        //! Returns the description of the exception the job threw, or an empty string.
+        std::string Error() const;
+
+        //! Waits until the job has finished. While waiting, the calling thread runs other queued jobs.
+        void Wait() const;
+
+        //! Runs the given function on the main thread, in JobSystem::ProcessMainThreadJobs(), after the job has finished.
+        /*! If the job has already finished, the continuation is queued for the next ProcessMainThreadJobs() call. The continuation is
+            run even if the job failed, so check Failed() in it if that matters.
+         */
+        void Then(const Job &continuation) const;
+
+        //! Returns the internal state. For internal use.
+        const JobStatePtr &State() const { return state_; }
+
+    private:
+        JobStatePtr state_;
+    };
+
+    //! Refers to a job submitted with JobSystem::Async() that produces a value of type T.
+    template<typename T>
+    class JobFuture
+    {
+    public:
+        //! Storage of the value produced by the job. For internal use.
+        struct Value
+        {
+            boost::scoped_ptr<T> value;
+        };
+
+        JobFuture() {}
+        JobFuture(const JobHandle &handle, const boost::shared_ptr<Value> &value) : handle_(handle), value_(value) {}
+
+        //! Returns the handle of the job.
+        const JobHandle &Handle() const { return handle_; }
+
+        //! Returns true if the job has finished.
+        bool IsReady() const { return handle_.IsFinished(); }
+
+        //! Waits for the job to finish and returns the value it produced.
+        /*! Throws std::runtime_error if the job threw or the future refers to no job.
+         */
+        const T &Get() const
+        {
+            handle_.Wait();
+            if (!value_ || !value_->value)
+                throw std::runtime_error(handle_.Failed() ? handle_.Error() : std::string("JobFuture::Get: the future refers to no job."));
+            return *value_->value;
+        }
+
+        //! Runs the given function with the produced value on the main thread after the job has finished.
+        /*! The continuation is not run if the job failed.
+         */
+        void Then(const boost::function<void(const T &)> &continuation) const
+        {
+            handle_.Then(boost::bind(&JobFuture<T>::RunContinuation, continuation, value_));
+        }
+
+    private:
+        static void RunContinuation(const boost::function<void(const T &)> &continuation, const boost::shared_ptr<Value> &value)
+        {
+            if (value && value->value)
+                continuation(*value->value);
+        }
+
+        JobHandle handle_;
+        boost::shared_ptr<Value> value_;
+    };
+
+    //! Runs jobs in a fixed pool of worker threads.
+    /*! The job system is a general replacement for dedicated worker threads: submit a function with Submit(), or a function that
+        produces a value with Async(), and it is run by one of the worker threads. Each worker thread has its own queue of jobs;
+        jobs submitted from inside a job go to the queue of the worker that submits them, and a worker that runs out of jobs
+        steals the oldest job from the queue of another worker. This keeps related work on the same thread and balances the load
+        without a central queue.
+
+        Results are delivered back to the main thread with continuations (JobHandle::Then(), JobFuture::Then()), which are run
+        by ProcessMainThreadJobs(). The framework calls it once per frame for the system-wide job system, which can be acquired
+        with Framework::GetJobSystem(). For data-parallel loops, use ParallelFor().
+
+        Jobs should not block for long periods (e.g. wait for network input), as that takes a worker away from everybody else.
+        Use ThreadTask for such long-running work.
+
+        If the job system has no worker threads, submitted jobs are run immediately by the submitting thread.
+     */
+    class JobSystem
+    {
+    public:
+        //! Body of a ParallelFor() loop. Called with a subrange [begin, end) of the loop range.
+        typedef boost::function<void(int, int)> RangeJob;
+
+        //! Constructor. Starts the worker threads.
+        /*! \param numWorkerThreads Number of worker threads. Pass 0 to run all jobs in the submitting thread.
+         */
+        explicit JobSystem(uint numWorkerThreads);
+
+        //! Destructor. Finishes the queued jobs and stops the worker threads.
+        ~JobSystem();
+
+        //! Returns the number of worker threads.
+        uint NumWorkerThreads() const { return (uint)workers_.size(); }
+
+        //! Returns the index of the worker thread the caller runs in, numbered from 1, or 0 if the caller is not a worker thread.
+        int CurrentWorkerIndex() const;
+
+        //! Submits a job. Thread-safe.
+        JobHandle Submit(const Job &job);
+
+        //! Submits a job that produces a value of type T. Thread-safe.
+        /*! T must be copy-constructible. Example:
+            \code
+            JobFuture<HeightmapPtr> future = jobs->Async<HeightmapPtr>(boost::bind(&DecodeHeightmap, data));
+            future.Then(boost::bind(&EC_Terrain::OnHeightmapDecoded, this, _1));
+            \endcode
+         */
+        template<typename T>
+        JobFuture<T> Async(const boost::function<T()> &func)
+        {
+            boost::shared_ptr<typename JobFuture<T>::Value> value(new typename JobFuture<T>::Value);
+            JobHandle handle = Submit(boost::bind(&JobSystem::RunAsync<T>, func, value));
+            return JobFuture<T>(handle, value);
+        }
+
+        //! Runs body over the range [begin, end), split into chunks of at most grainSize iterations run in parallel.
+        /*! Returns when all iterations have finished; the calling thread runs chunks as well. Can be called from inside a job.
+            If the body throws, the first exception is rethrown as std::runtime_error after all chunks have finished.
+            \param grainSize Maximum number of iterations in a chunk. If 0, the range is split into a few chunks per thread.
+         */
+        void ParallelFor(int begin, int end, const RangeJob &body, int grainSize = 0);
+
+        //! Queues a function to be run on the main thread by the next ProcessMainThreadJobs() call. Thread-safe.
+        void RunOnMainThread(const Job &job);
+
+        //! Runs the functions queued with RunOnMainThread() and the continuations of finished jobs. Call from the main thread.
+        void ProcessMainThreadJobs();
+
+        //! Returns the number of jobs queued and not yet started.
+        uint NumQueuedJobs() const;
+
+        //! Waits until all the submitted jobs, and the jobs they submit, have finished. The calling thread runs queued jobs meanwhile.
+        /*! Does not run the continuations; call ProcessMainThreadJobs() or ClearMainThreadJobs() after. Call from the main thread.
+            The framework calls this before uninitializing and unloading the modules, so that no job runs the code of an unloaded module.
+         */
+        void WaitForAll();
+
+        //! Discards the functions queued with RunOnMainThread() and the continuations of finished jobs without running them.
+        void ClearMainThreadJobs();
+
+        //! Worker thread entry point. For internal use.
+        void WorkerMain(int workerIndex);
+
+        //! Waits for the given job state to finish, running other jobs meanwhile. For internal use, see JobHandle::Wait().
+        void Wait(const JobStatePtr &state);
+
+        //! Called when a job state finishes. Queues its continuations. For internal use.
+        void QueueContinuations(std::vector<Job> &continuations);
+
+    private:
+        //! A job in a worker queue.
+        struct QueuedJob
+        {
+            Job job;
+            JobStatePtr state;
+        };
+
+        //! Job queue of a single worker thread. The owner pushes and pops at the back, other threads steal from the front.
+        struct WorkerQueue
+        {
+            Mutex mutex;
+            std::deque<QueuedJob> jobs;
+        };
+
+        //! Pushes a job to the queue of the calling worker, or to the worker queues in turn if called from another thread.
+        void Push(const QueuedJob &job);
+
+        //! Takes a job to run: the newest job from the queue of the given worker, or the oldest job of another worker.
+        /*! \param workerIndex Index of the calling worker, numbered from 1, or 0 if the caller is not a worker.
+         */
+        bool Take(int workerIndex, QueuedJob &job);
+
+        //! Runs a job and finishes its state.
+        void Run(QueuedJob &job);
+
+        //! Helper for Async().
+        template<typename T>
+        static void RunAsync(const boost::function<T()> &func, const boost::shared_ptr<typename JobFuture<T>::Value> &value)
+        {
+            value->value.reset(new T(func()));
+        }
+
+        std::vector<Thread *> workers_;
+        std::vector<WorkerQueue *> queues_;
+        //! Index of the worker the current thread is, if any.
+        boost::thread_specific_ptr<int> workerIndex_;
+
+        //! The number of jobs queued and not yet started.
+        boost::detail::atomic_count numQueuedJobs_;
+        //! The number of queued jobs that have not finished. Incremented before a job is queued and decremented after it has run,
+        //! so a job that queues others keeps it above zero until they have all been queued.
+        boost::detail::atomic_count numUnfinishedJobs_;
+        //! Round-robin counter of the queue to push to when submitting from outside the worker threads.
+        boost::detail::atomic_count nextQueue_;
+
+        //! Guards the fields below, which are used to put the workers to sleep when there is no work.
+        Mutex sleepMutex_;
+        //! Signaled when jobs are submitted or the workers should quit.
+        Condition workAvailable_;
+        //! The number of workers waiting for workAvailable_.
+        uint numSleepingWorkers_;
+        bool quit_;
+
+        //! Guards mainThreadJobs_.
+        Mutex mainThreadMutex_;
+        std::vector<Job> mainThreadJobs_;
+    };
+}
+
+#endif
@@ -56,7 +56,8 @@ namespace Module
 
 ModuleManager::ModuleManager(Foundation::Framework *framework) :
     framework_(framework),
-    DEFAULT_MODULES_PATH(framework->GetDefaultConfig().DeclareSetting<std::string>("ModuleManager", "Default_Modules_Path", "./modules"))
+    DEFAULT_MODULES_PATH(framework->GetDefaultConfig().DeclareSetting<std::string>("ModuleManager", "Default_Modules_Path", "./modules")),
+    scheduler_(framework->GetJobSystem().get())
 {
 }
 
@@ -336,26 +337,21 @@ void ModuleManager::UninitializeModules()
 
 void ModuleManager::UpdateModules(f64 frametime)
 {
+    std::vector<IModule *> modules;
+    modules.reserve(modules_.size());
     for(size_t i = 0; i < modules_.size(); ++i)
+        modules.push_back(modules_[i].module_.get());
+
+    try
     {
-        try
-        {
-            modules_[i].module_->Update(frametime);
-        }
-        catch(const std::exception &e)
-        {
-            std::cout << "UpdateModules caught an exception while updating module " << modules_[i].module_->Name()
-                << ": " << (e.what() ? e.what() : "(null)") << std::endl;
-            LogCritical(std::string("UpdateModules caught an exception while updating module " + modules_[i].module_->Name()
-                + ": " + (e.what() ? e.what() : "(null)")));
-            throw;
-        }
-        catch(...)
-        {
-            std::cout << "UpdateModules caught an unknown exception while updating module " << modules_[i].module_->Name() << std::endl;
-            LogCritical(std::string("UpdateModules caught an unknown exception while updating module " + modules_[i].module_->Name()));
-            throw;
-        }
+        scheduler_.UpdateModules(modules, frametime);
+    }
+    catch(const std::exception &e)
+    {
+        // The scheduler describes which module failed in the exception message.
+        std::cout << (e.what() ? e.what() : "(null)") << std::endl;
+        LogCritical(e.what() ? e.what() : "UpdateModules caught an exception while updating modules.");
+        throw;
     }
 }
 
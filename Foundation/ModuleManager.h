@@ -9,6 +9,7 @@
 
 #include "IModule.h"
 #include "ModuleReference.h"
+#include "FrameScheduler.h"
 
 namespace fs = boost::filesystem;
 
@@ -162,6 +163,9 @@ public:
         return boost::weak_ptr<T>();
     }
 
+    //! Returns the scheduler that runs the module updates.
+    Foundation::FrameScheduler &GetFrameScheduler() { return scheduler_; }
+
     //! @return A list of all modules in the system, for reflection purposes. If you need non-const access to
     //!         a module, call GetModule with the proper name or type.
     const ModuleVector &GetModuleList() const { return modules_; }
@@ -260,6 +264,9 @@ private:
     //! list of modules managed by this manager
     ModuleVector modules_;
 
+    //! Runs the module updates each frame.
+    Foundation::FrameScheduler scheduler_;
+
     //! List of modules that should be excluded
     ModuleTypeSet exclude_list_;
 
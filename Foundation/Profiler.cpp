@@ -9,6 +9,15 @@
 #include "CoreStringUtils.h"
 #include "HighPerfClock.h"
 
+#include <algorithm>
+#include <fstream>
+
+#if defined(_MSC_VER)
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#endif
+
 namespace Foundation
 {
     bool ProfilerBlock::supported_ = false;
@@ -18,7 +27,7 @@ namespace Foundation
     {
         if (supported_)
             return true;
-        
+
 #if defined(_WINDOWS)
         LARGE_INTEGER frequency;
         BOOL result = QueryPerformanceFrequency(&frequency);
@@ -32,178 +41,423 @@ namespace Foundation
 
     boost::int64_t ProfilerBlock::frequency_;
     boost::int64_t ProfilerBlock::api_overhead_;
-    
-    void Profiler::StartBlock(const std::string &name)
-    {
-#ifdef PROFILING
-        // Get the current topmost profiling node in the stack, or 
-        // if none exists, get the root node or create a new root node.
-        // This will be the parent node of the new block we're starting.
-        ProfilerNodeTree *parent = current_node_.get();
-        if (!parent)
-        {
-            parent = GetOrCreateThreadRootBlock();
-            current_node_.reset(parent);
-        }
-        assert(parent);
 
-        // If parent name == new block name, we assume that we're
-        // recursively re-entering the same function (with a single
-        // profiling block).
-        ProfilerNodeTree *node = (name != parent->Name()) ? parent->GetChild(name) : parent;
+    namespace
+    {
+        //! Event buffer of the current thread. Cached here so that recording an event does not need a thread_specific_ptr lookup.
+        PROFILER_THREAD_LOCAL ProfilerThreadBuffer *currentThreadBuffer = 0;
 
-        // We're entering this PROFILE() block for the first time,
-        // need to allocate the memory for it.
-        if (!node)
+        //! Makes sure the event written to a ring buffer is visible before the write index is advanced.
+        inline void PublishBarrier()
         {
-            node = new ProfilerNode(name);
-            parent->AddChild(boost::shared_ptr<ProfilerNodeTree>(node));
+#if defined(_MSC_VER)
+            _ReadWriteBarrier(); // x86 and x64 do not reorder stores with other stores.
+#elif defined(__i386__) || defined(__x86_64__)
+            __asm__ __volatile__("" ::: "memory");
+#else
+            __sync_synchronize();
+#endif
         }
 
-        assert (parent->recursion_ >= 0);
-
-        // If a recursive call, just increment recursion count, the timer has already
-        // been started so no need to touch it. Otherwise, start the timer for the current
-        // block.
-        if (parent == node)
-            parent->recursion_++; // handle recursion
-        else
+        //! Cleanup function of Profiler::threadBuffer_, called when a profiled thread exits.
+        void ThreadBufferExited(ProfilerThreadBufferPtr *buffer)
         {
-            current_node_.release();
-            current_node_.reset(node);
-
-            checked_static_cast<ProfilerNode*>(node)->block_.Start();
+            (*buffer)->exited = true;
+            delete buffer;
         }
-#endif
     }
 
-    void Profiler::EndBlock(const std::string &name)
+    Profiler::Profiler() :
+        root_("Root"),
+        threadBuffer_(&ThreadBufferExited),
+        numDroppedEvents_(0),
+        captureFrames_(0),
+        hitchThreshold_(0.0),
+        lastFrameTime_(0),
+        allocationTracker_(0)
     {
-#ifdef PROFILING
-        using namespace std;
+#ifdef ALLOCATION_TRACKING
+        allocationTracker_ = new AllocationTracker;
+        AllocationTracker::SetInstance(allocationTracker_);
+#endif
+    }
 
-        ProfilerNodeTree *treeNode = current_node_.get();
-        assert (treeNode->Name() == name && "New profiling block started before old one ended!");
+    Profiler::~Profiler()
+    {
+        // Threads that outlive the profiler keep their buffers alive through threadBuffer_, but must no longer record into them.
+        currentThreadBuffer = 0;
+    }
 
-        ProfilerNode* node = checked_static_cast<ProfilerNode*>(treeNode);
-        node->block_.Stop();
-        node->num_called_total_++;
-        node->num_called_current_++;
+    ProfilerBlockId Profiler::RegisterBlock(const std::string &name)
+    {
+        boost::mutex::scoped_lock lock(registryMutex_);
+        std::map<std::string, ProfilerBlockId>::const_iterator iter = blockIds_.find(name);
+        if (iter != blockIds_.end())
+            return iter->second;
 
-        double elapsed = node->block_.ElapsedTimeSeconds();
+        ProfilerBlockId id = (ProfilerBlockId)blockNames_.size();
+        blockNames_.push_back(name);
+        blockIds_[name] = id;
+        return id;
+    }
 
-        node->elapsed_current_ += elapsed;
-        node->elapsed_min_current_ = (equals(node->elapsed_min_current_, 0.0) ? elapsed : (elapsed < node->elapsed_min_current_ ? elapsed : node->elapsed_min_current_));
-        node->elapsed_max_current_ = elapsed > node->elapsed_max_current_ ? elapsed : node->elapsed_max_current_;
-        node->total_ += elapsed;
+    std::string Profiler::BlockName(ProfilerBlockId id)
+    {
+        boost::mutex::scoped_lock lock(registryMutex_);
+        return id < blockNames_.size() ? blockNames_[id] : std::string();
+    }
 
-        node->num_called_custom_++;
-        node->total_custom_ += elapsed;
-        node->custom_elapsed_min_ = std::min(node->custom_elapsed_min_, elapsed);
-        node->custom_elapsed_max_ = std::max(node->custom_elapsed_max_, elapsed);
+    ProfilerThreadBuffer *Profiler::ThreadBuffer()
+    {
+        ProfilerThreadBuffer *buffer = currentThreadBuffer;
+        return buffer ? buffer : CreateThreadBuffer();
+    }
 
-        assert (node->recursion_ >= 0);
+    ProfilerThreadBuffer *Profiler::CreateThreadBuffer()
+    {
+        ProfilerBlock::QueryCapability();
 
-        // need to handle recursion
-        if (node->recursion_ > 0)
-            --node->recursion_;
-        else
+        ProfilerThreadBufferPtr buffer(new ProfilerThreadBuffer);
+        buffer->name = GetThisThreadRootBlockName();
+        // The thread_specific_ptr owns a reference to the buffer, and marks it exited when the thread exits.
+        threadBuffer_.reset(new ProfilerThreadBufferPtr(buffer));
         {
-            current_node_.release();
-            current_node_.reset(node->Parent());
+            boost::mutex::scoped_lock lock(registryMutex_);
+            threadBuffers_.push_back(buffer);
         }
-#endif
+        currentThreadBuffer = buffer.get();
+        return buffer.get();
     }
 
-    ProfilerNodeTree *Profiler::GetThreadRootBlock()
-    { 
-        return thread_specific_root_.get();
+    void Profiler::RecordEvent(ProfilerEvent::Type type, ProfilerBlockId id)
+    {
+        ProfilerThreadBuffer *buffer = ThreadBuffer();
+        const unsigned int index = buffer->writeIndex;
+        ProfilerEvent &event = buffer->events[index & (ProfilerThreadBuffer::cSize - 1)];
+        event.time = GetCurrentClockTime();
+        event.block = id;
+        event.type = type;
+        PublishBarrier();
+        buffer->writeIndex = index + 1;
     }
 
-    ProfilerNodeTree *Profiler::GetOrCreateThreadRootBlock()
-    { 
-#ifdef PROFILING // If not profiling, never create the root block so the getter will always return 0.
-        if (!thread_specific_root_.get())
-            return CreateThreadRootBlock();
+    void Profiler::StartBlock(ProfilerBlockId id)
+    {
+#ifdef PROFILING
+        RecordEvent(ProfilerEvent::BlockBegin, id);
 #endif
-        return thread_specific_root_.get();
     }
 
-    std::string Profiler::GetThisThreadRootBlockName()
+    void Profiler::EndBlock(ProfilerBlockId id)
     {
-        return std::string("Thread" + ToString(boost::this_thread::get_id()));
+#ifdef PROFILING
+        RecordEvent(ProfilerEvent::BlockEnd, id);
+#endif
     }
 
-    ProfilerNodeTree *Profiler::CreateThreadRootBlock()
+    void Profiler::ThreadedReset()
     {
 #ifdef PROFILING
-        ProfilerBlock::QueryCapability();
-        
-        std::string rootObjectName = GetThisThreadRootBlockName();
-
-        ProfilerNodeTree *root = new ProfilerNodeTree(rootObjectName);
-        thread_specific_root_.reset(root);
-
-        // Each thread root block is added as a child of a dummy node root_ owned by
-        // this Profiler. The root_ object doesn't own the memory of its children,
-        // but just weakly refers to them an allows easy access for printing the
-        // profiling data in each thread.
-        mutex_.lock();
-        root_.AddChild(boost::shared_ptr<ProfilerNodeTree>(root, &EmptyDeletor));
-        root->MarkAsRootBlock(this);
-        thread_root_nodes_.push_back(root);
-        mutex_.unlock();
-        return root;
-#else
-        return 0;
+        ThreadBuffer()->marksFrames = true;
+        RecordEvent(ProfilerEvent::FrameEnd, 0);
 #endif
     }
 
-    void Profiler::RemoveThreadRootBlock(ProfilerNodeTree *rootBlock)
+    void Profiler::ProcessEvents()
     {
 #ifdef PROFILING
-        mutex_.lock();
-        for(std::list<ProfilerNodeTree*>::iterator iter = thread_root_nodes_.begin(); iter != thread_root_nodes_.end(); ++iter)
-            if (*iter == rootBlock)
+        std::vector<ProfilerThreadBufferPtr> buffers;
+        {
+            boost::mutex::scoped_lock lock(registryMutex_);
+            buffers = threadBuffers_;
+        }
+
+        const double frequency = (double)GetCurrentClockFreq();
+        boost::mutex::scoped_lock lock(mutex_);
+        root_.ResetFrameValues();
+        for(size_t i = 0; i < buffers.size(); ++i)
+        {
+            ProfilerThreadBuffer &buffer = *buffers[i];
+            if (!buffer.root)
             {
-                thread_root_nodes_.erase(iter);
-                mutex_.unlock();
-                return;
+                ProfilerNodeTreePtr root(new ProfilerNodeTree(buffer.name));
+                root_.AddChild(root);
+                buffer.root = root.get();
+                buffer.traceThreadId = (unsigned int)traceThreadNames_.size();
+                traceThreadNames_.push_back(buffer.name);
+            }
+
+            const bool exited = buffer.exited;
+            ProcessThreadEvents(buffer, frequency);
+
+            // Threads that don't mark their own frames get a new frame with the main thread.
+            if (!buffer.marksFrames)
+                buffer.root->ResetValues();
+
+            if (exited)
+            {
+                root_.RemoveChild(buffer.root);
+                buffer.root = 0;
+                boost::mutex::scoped_lock registryLock(registryMutex_);
+                threadBuffers_.erase(std::find(threadBuffers_.begin(), threadBuffers_.end(), buffers[i]));
             }
+        }
 
-        std::cout << "Warning: Tried to delete a nonexisting thread root block!" << std::endl;
-        mutex_.unlock();
+        if (captureFrames_ > 0)
+            EndCaptureFrame();
+        lastFrameTime_ = GetCurrentClockTime();
 #endif
     }
 
-    void Profiler::ThreadedReset()
+    void Profiler::ProcessThreadEvents(ProfilerThreadBuffer &buffer, double frequency)
+    {
+        const unsigned int writeIndex = buffer.writeIndex;
+        PublishBarrier();
+        unsigned int readIndex = buffer.readIndex;
+
+        if (writeIndex - readIndex > ProfilerThreadBuffer::cSize)
+        {
+            // The thread overran its buffer, so the unread events are lost. The blocks that were open can't be matched any more either.
+            buffer.numDroppedEvents += writeIndex - readIndex;
+            numDroppedEvents_ += writeIndex - readIndex;
+            buffer.readIndex = writeIndex;
+            buffer.stack.clear();
+            return;
+        }
+
+        std::vector<std::pair<ProfilerNodeTree *, tick_t> > &stack = buffer.stack;
+        for(; readIndex != writeIndex; ++readIndex)
+        {
+            const ProfilerEvent &event = buffer.events[readIndex & (ProfilerThreadBuffer::cSize - 1)];
+            ProfilerNodeTree *parent = stack.empty() ? buffer.root : stack.back().first;
+
+            if (captureFrames_ > 0 && event.type != ProfilerEvent::FrameEnd)
+            {
+                TraceEvent traceEvent = { event.time, event.block, event.type, buffer.traceThreadId, 0.0 };
+                traceFrame_.push_back(traceEvent);
+            }
+
+            switch(event.type)
+            {
+            case ProfilerEvent::BlockBegin:
+            {
+                // A block started inside itself is a recursive call, which is timed by the outermost call.
+                if (parent->Id() == event.block)
+                {
+                    stack.push_back(std::make_pair(parent, (tick_t)0));
+                    break;
+                }
+
+                ProfilerNodeTree *node = parent->GetChild(event.block);
+                // We're entering this PROFILE() block for the first time, need to allocate the memory for it.
+                if (!node)
+                {
+                    node = new ProfilerNode(BlockName(event.block), event.block);
+                    parent->AddChild(ProfilerNodeTreePtr(node));
+                }
+                stack.push_back(std::make_pair(node, event.time));
+                break;
+            }
+            case ProfilerEvent::BlockEnd:
+            {
+                if (stack.empty() || stack.back().first->Id() != event.block)
+                    break; // The begin event was lost in an overrun.
+
+                ProfilerNode *node = checked_static_cast<ProfilerNode *>(stack.back().first);
+                const tick_t start = stack.back().second;
+                stack.pop_back();
+                if (start == 0)
+                    break; // Recursive call
+
+                double elapsed = (double)(event.time - start) / frequency;
+                if (elapsed < 0.0)
+                    elapsed = 0.0;
+
+                node->num_called_total_++;
+                node->num_called_current_++;
+                node->elapsed_current_ += elapsed;
+                node->elapsed_min_current_ = (equals(node->elapsed_min_current_, 0.0) ? elapsed : (elapsed < node->elapsed_min_current_ ? elapsed : node->elapsed_min_current_));
+                node->elapsed_max_current_ = elapsed > node->elapsed_max_current_ ? elapsed : node->elapsed_max_current_;
+                node->total_ += elapsed;
+                node->num_called_frame_++;
+                node->elapsed_frame_ += elapsed;
+
+                node->num_called_custom_++;
+                node->total_custom_ += elapsed;
+                node->custom_elapsed_min_ = std::min(node->custom_elapsed_min_, elapsed);
+                node->custom_elapsed_max_ = std::max(node->custom_elapsed_max_, elapsed);
+                break;
+            }
+            case ProfilerEvent::FrameEnd:
+                buffer.root->ResetValues();
+                break;
+            }
+        }
+
+        // If the thread lapped us while we were reading, some of the events may have been overwritten mid-read.
+        const unsigned int newWriteIndex = buffer.writeIndex;
+        if (newWriteIndex - buffer.readIndex > ProfilerThreadBuffer::cSize)
+        {
+            buffer.numDroppedEvents += newWriteIndex - writeIndex;
+            numDroppedEvents_ += newWriteIndex - writeIndex;
+            buffer.readIndex = newWriteIndex;
+            stack.clear();
+            return;
+        }
+        buffer.readIndex = writeIndex;
+    }
+
+    void Profiler::StartCapture(int numFrames, const std::string &filename)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        captureFrames_ = std::max(numFrames, 0);
+        hitchThreshold_ = 0.0;
+        captureFile_ = filename;
+        traceFrames_.clear();
+        traceFrame_.clear();
+    }
+
+    void Profiler::StartHitchCapture(double threshold, int numFrames, const std::string &filename)
     {
-        ProfilerNodeTree *root = GetThreadRootBlock();
-        if (!root)
+        boost::mutex::scoped_lock lock(mutex_);
+        captureFrames_ = threshold > 0.0 ? std::max(numFrames, 1) : 0;
+        hitchThreshold_ = threshold;
+        captureFile_ = filename;
+        traceFrames_.clear();
+        traceFrame_.clear();
+    }
+
+    void Profiler::StopCapture()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        captureFrames_ = 0;
+        traceFrames_.clear();
+        traceFrame_.clear();
+    }
+
+    void Profiler::RecordCounter(const std::string &name, double value)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (captureFrames_ <= 0)
             return;
 
-        mutex_.lock();
-        root->ResetValues();
-        mutex_.unlock();
+        TraceEvent traceEvent = { GetCurrentClockTime(), RegisterBlock(name), ProfilerEvent::CounterValue, 0, value };
+        traceFrame_.push_back(traceEvent);
     }
 
-    void ProfilerNodeTree::RemoveThreadRootBlock()
+    void Profiler::EndCaptureFrame()
     {
-#ifdef PROFILING
-        assert(owner_);
-#endif
-        if (owner_)
-            owner_->RemoveThreadRootBlock(this);
+        traceFrames_.push_back(TraceFrame());
+        traceFrames_.back().swap(traceFrame_);
+
+        if (hitchThreshold_ > 0.0)
+        {
+            while((int)traceFrames_.size() > captureFrames_)
+                traceFrames_.pop_front();
+
+            const double frameTime = (double)(GetCurrentClockTime() - lastFrameTime_) / (double)GetCurrentClockFreq();
+            if (lastFrameTime_ == 0 || frameTime < hitchThreshold_)
+                return;
+
+            RootLogWarning("Frame took " + ToString(frameTime * 1000.0) + " ms, writing profiler capture of the last " +
+                ToString(traceFrames_.size()) + " frames to " + captureFile_);
+        }
+        else if ((int)traceFrames_.size() < captureFrames_)
+            return;
+
+        WriteCapture();
+        captureFrames_ = 0;
+        traceFrames_.clear();
     }
 
-    Profiler::~Profiler()
+    namespace
     {
-        // We are going down.. tell all root blocks that they don't need to notify back to the Profiler that they've been deleted.
-        // i.e. 'detach' all the (thread specific) root blocks so that they delete themselves at their leisure when their threads die.
-        mutex_.lock();
-        for(std::list<ProfilerNodeTree*>::iterator iter = thread_root_nodes_.begin(); iter != thread_root_nodes_.end(); ++iter)
-            (*iter)->MarkAsRootBlock(0);
-        mutex_.unlock();
+        //! Escapes a string for a JSON string literal.
+        std::string JsonEscape(const std::string &str)
+        {
+            std::string escaped;
+            escaped.reserve(str.size());
+            for(size_t i = 0; i < str.size(); ++i)
+            {
+                if (str[i] == '"' || str[i] == '\\')
+                    escaped += '\\';
+                if ((unsigned char)str[i] >= 0x20)
+                    escaped += str[i];
+            }
+            return escaped;
+        }
     }
-}
 
+    bool Profiler::WriteCapture()
+    {
+        std::ofstream file(captureFile_.c_str(), std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+        {
+            RootLogError("Could not open " + captureFile_ + " for writing the profiler capture.");
+            return false;
+        }
+
+        std::vector<std::string> blockNames;
+        {
+            boost::mutex::scoped_lock lock(registryMutex_);
+            blockNames = blockNames_;
+        }
+
+        tick_t start = 0;
+        for(std::list<TraceFrame>::const_iterator frame = traceFrames_.begin(); frame != traceFrames_.end() && start == 0; ++frame)
+            if (!frame->empty())
+                start = frame->front().time;
+        for(std::list<TraceFrame>::const_iterator frame = traceFrames_.begin(); frame != traceFrames_.end(); ++frame)
+            for(TraceFrame::const_iterator event = frame->begin(); event != frame->end(); ++event)
+                start = std::min(start, event->time);
+
+        const double toMicroseconds = 1000000.0 / (double)GetCurrentClockFreq();
+        file << "{\"traceEvents\":[\n";
+        for(size_t i = 0; i < traceThreadNames_.size(); ++i)
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << JsonEscape(traceThreadNames_[i]) << "\"}},\n";
+
+        file.setf(std::ios::fixed);
+        file.precision(3);
+        size_t numEvents = 0;
+        for(std::list<TraceFrame>::const_iterator frame = traceFrames_.begin(); frame != traceFrames_.end(); ++frame)
+        {
+            for(TraceFrame::const_iterator event = frame->begin(); event != frame->end(); ++event)
+            {
+                const std::string name = event->block < blockNames.size() ? JsonEscape(blockNames[event->block]) : std::string("Unknown");
+                const double ts = (double)(event->time - start) * toMicroseconds;
+                if (event->type == ProfilerEvent::CounterValue)
+                    file << "{\"name\":\"" << name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << ts << ",\"args\":{\"value\":" << event->value << "}},\n";
+                else
+                    file << "{\"name\":\"" << name << "\",\"ph\":\"" << (event->type == ProfilerEvent::BlockBegin ? "B" : "E") << "\",\"pid\":1,\"tid\":" << event->thread
+                         << ",\"ts\":" << ts << "},\n";
+                ++numEvents;
+            }
+
+            // Mark the frame boundaries, at the last event of each frame.
+            if (!frame->empty())
+                file << "{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":" << (double)(frame->back().time - start) * toMicroseconds << "},\n";
+        }
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Naali\"}}\n";
+        file << "],\"displayTimeUnit\":\"ms\"}\n";
+
+        if (!file.good())
+        {
+            RootLogError("Failed to write the profiler capture to " + captureFile_);
+            return false;
+        }
+
+        RootLogInfo("Wrote " + ToString(numEvents) + " profiler events of " + ToString(traceFrames_.size()) + " frames to " + captureFile_);
+        return true;
+    }
+
+    ProfilerNodeTree *Profiler::GetThreadRootBlock()
+    {
+        ProfilerThreadBuffer *buffer = currentThreadBuffer;
+        return buffer ? buffer->root : 0;
+    }
+
+    std::string Profiler::GetThisThreadRootBlockName()
+    {
+        return std::string("Thread" + ToString(boost::this_thread::get_id()));
+    }
+}
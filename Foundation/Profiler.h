@@ -9,6 +9,12 @@
 #endif
 
 #include "HighPerfClock.h"
+#include "AllocationTracker.h"
+
+#include <list>
+#include <map>
+#include <vector>
+#include <string>
 
 // Disable warning C4244 coming from boost
 #pragma warning ( push )
@@ -21,16 +27,21 @@
 /*! Name of the profiling block must be unique in the scope, so do not use the name of the function
     as the name of the profiling block!
 
+    The block name is registered with the profiler once, the first time the block is run, and after that
+    only the static ID of the block is recorded.
+
     \param x Unique name for the profiling block, use without quotes, f.ex. PROFILE(name_of_the_block)
 */
-#   define PROFILE(x) Foundation::ProfilerSection x ## __profiler__(#x);
+#   define PROFILE(x) static const Foundation::ProfilerBlockId x ## __profiler_id__ = Foundation::ProfilerSection::RegisterBlock(#x); \
+        Foundation::ProfilerSection x ## __profiler__(x ## __profiler_id__);
 
 //! Optionally ends the current profiling block
 /*! Use when you wish to end a profiling block before it goes out of scope
 */
 #   define ELIFORP(x) x ## __profiler__.Destruct();
 
-//! Resets profiling data per frame. Must be called at end of each frame in each thread, otherwise profiling data may be inaccurate or unavailable.
+//! Marks the end of a frame in the current thread, which starts a new set of per-frame profiling data for the thread.
+//! Threads that never call this get a new frame each time the main thread ends one.
 //! \todo Currently RESETPROFILER is called in modules at end of Update(), but that will probably cause mismatched timing data if things are profiled
 //!       after the Update() call but still in the same frame, f.ex. when handling events. All profiling data in the main thread should be reset
 //!       at the same time, at the end of the main loop. Threads are free to reset whenever they choose, as they have their own frame. -cm
@@ -46,6 +57,9 @@ namespace Foundation
 {
     class ProfilerNodeTree;
 
+    //! Identifies a registered profiling block name. See Profiler::RegisterBlock().
+    typedef unsigned int ProfilerBlockId;
+
     //! Profiles a block of code
     class ProfilerBlock
     {
@@ -139,17 +153,11 @@ namespace Foundation
     public:
         typedef std::list<boost::shared_ptr<ProfilerNodeTree> > NodeList;
 
-        //! constructor that takes a name for the node
-        explicit ProfilerNodeTree(const std::string &name) : name_(name), parent_(0), recursion_(0), owner_(0) {}
+        //! constructor that takes a name for the node, and the ID of the block if the node is a profiling block
+        explicit ProfilerNodeTree(const std::string &name, ProfilerBlockId id = (ProfilerBlockId)-1) : parent_(0), name_(name), id_(id) {}
 
         //! destructor
-        virtual ~ProfilerNodeTree()
-        {
-            if (owner_)
-                RemoveThreadRootBlock();
-        }
-        
-        void RemoveThreadRootBlock();
+        virtual ~ProfilerNodeTree() {}
 
         //! Resets this node and all child nodes
         virtual void ResetValues()
@@ -158,6 +166,13 @@ namespace Foundation
                 (*it)->ResetValues();
         }
 
+        //! Resets the values of the processed frame of this node and all child nodes
+        virtual void ResetFrameValues()
+        {
+            for (NodeList::iterator it = children_.begin() ; it != children_.end() ; ++it)
+                (*it)->ResetFrameValues();
+        }
+
         //! Add a child for this node
         void AddChild(boost::shared_ptr<ProfilerNodeTree> node)
         {
@@ -184,35 +199,42 @@ namespace Foundation
         */
         ProfilerNodeTree* GetChild(const std::string &name)
         {
-            assert (name != name_);
             for (NodeList::iterator it = children_.begin() ; it != children_.end() ; ++it)
                 if ((*it)->name_ == name)
                     return (*it).get();
             return 0;
         }
+
+        //! Returns a child node by block ID, or 0 if there is no such child
+        ProfilerNodeTree* GetChild(ProfilerBlockId id)
+        {
+            for (NodeList::iterator it = children_.begin() ; it != children_.end() ; ++it)
+                if ((*it)->id_ == id)
+                    return (*it).get();
+            return 0;
+        }
+
         //! Returns the name of this node
         const std::string &Name() const { return name_; }
 
+        //! Returns the block ID of this node
+        ProfilerBlockId Id() const { return id_; }
+
         //! Returns the parent of this node
         ProfilerNodeTree *Parent() { return parent_; }
 
         //! Returns list of children for introspection
         const NodeList &GetChildren() const { return children_; }
 
-        void MarkAsRootBlock(Profiler *owner) { owner_ = owner; }
-
     private:
         //! list of all children for this node
         NodeList children_;
         //! cached parent node for easy access
         ProfilerNodeTree *parent_;
-        //! If non-null, this node is a root block owned by the given profiler.
-        Profiler *owner_;
         //! Name of this node
         const std::string name_;
-
-        //! helper counter for recursion
-        int recursion_;
+        //! Block ID of this node
+        const ProfilerBlockId id_;
     };
     typedef boost::shared_ptr<ProfilerNodeTree> ProfilerNodeTreePtr;
 
@@ -223,9 +245,9 @@ namespace Foundation
         ProfilerNode(); // N/I
         ProfilerNode(const ProfilerNode &rhs); // N/I
     public:
-        //! constructor that takes a name for the node
-        explicit ProfilerNode(const std::string &name) : 
-        ProfilerNodeTree(name),
+        //! constructor that takes a name and the ID of the block
+        ProfilerNode(const std::string &name, ProfilerBlockId id) : 
+        ProfilerNodeTree(name, id),
             num_called_total_(0),
             num_called_(0),
             num_called_current_(0),
@@ -239,7 +261,9 @@ namespace Foundation
             num_called_custom_(0),
             total_custom_(0),
             custom_elapsed_min_(0),
-            custom_elapsed_max_(0)
+            custom_elapsed_max_(0),
+            num_called_frame_(0),
+            elapsed_frame_(0.0)
             {
             }
 
@@ -264,6 +288,14 @@ namespace Foundation
             ProfilerNodeTree::ResetValues();
         }
 
+        void ResetFrameValues()
+        {
+            num_called_frame_ = 0;
+            elapsed_frame_ = 0.0;
+
+            ProfilerNodeTree::ResetFrameValues();
+        }
+
         //! Number of times this profile has been called during the execution of the program
         unsigned long num_called_total_;
 
@@ -290,92 +322,139 @@ namespace Foundation
         mutable double custom_elapsed_min_;
         mutable double custom_elapsed_max_;
 
+        //! Number of times this profile was called between the last two Profiler::ProcessEvents() calls
+        /*! Unlike num_called_, not affected by the RESETPROFILER calls of the modules in the middle of the frame.
+        */
+        unsigned long num_called_frame_;
+
+        //! Time spent in this profile between the last two Profiler::ProcessEvents() calls
+        double elapsed_frame_;
+
     private:
         unsigned long num_called_current_;
         double elapsed_current_;
         double elapsed_min_current_;
         double elapsed_max_current_;
+    };
 
-        ProfilerBlock block_;
+    //! A single sample recorded by a profiled thread.
+    struct ProfilerEvent
+    {
+        enum Type
+        {
+            BlockBegin,
+            BlockEnd,
+            FrameEnd,
+            //! Value of a counter. Only recorded in trace captures, see Profiler::RecordCounter().
+            CounterValue
+        };
+
+        //! Time of the event, from GetCurrentClockTime().
+        tick_t time;
+        //! Block the event refers to, unused for FrameEnd events.
+        ProfilerBlockId block;
+        //! Type of the event.
+        unsigned int type;
     };
 
-    namespace
+    //! Ring buffer of the profiling events of a single thread.
+    /*! Only the owning thread writes events, and only Profiler::ProcessEvents() reads them, so neither side takes locks.
+        If the owning thread records more events than fit in the buffer between two ProcessEvents() calls, the oldest
+        events are lost.
+     */
+    struct ProfilerThreadBuffer
     {
-        //! For boost::thread_specific_ptr, we don't want it doing automatic deletion
-        void EmptyDeletor(ProfilerNodeTree *node) { }
-/*        void TSPNodeDeletor(ProfilerNodeTree *node)
-          { 
-          delete node;
-          }*/
-    }
+        //! Number of events in the ring buffer. Must be a power of two.
+        static const unsigned int cSize = 1 << 15;
+
+        ProfilerThreadBuffer() : writeIndex(0), readIndex(0), exited(false), marksFrames(false), root(0), numDroppedEvents(0), traceThreadId(0) {}
+
+        ProfilerEvent events[cSize];
+        //! Number of events written. Written only by the owning thread.
+        volatile unsigned int writeIndex;
+        //! Number of events processed. Used only by Profiler::ProcessEvents().
+        unsigned int readIndex;
+        //! Set when the owning thread has exited.
+        volatile bool exited;
+        //! Set when the owning thread has marked the end of a frame itself.
+        volatile bool marksFrames;
+
+        //! Name of the root node of the thread.
+        std::string name;
+        //! Root node of the thread in the profiling tree. The fields below are used only by Profiler::ProcessEvents().
+        ProfilerNodeTree *root;
+        //! Blocks open in the thread, innermost last.
+        std::vector<std::pair<ProfilerNodeTree *, tick_t> > stack;
+        //! Number of events lost to overruns.
+        unsigned long numDroppedEvents;
+        //! ID of the thread in captured traces.
+        unsigned int traceThreadId;
+    };
+    typedef boost::shared_ptr<ProfilerThreadBuffer> ProfilerThreadBufferPtr;
 
     //! Profiler can be used to measure execution time of a block of code.
     /*!
       Do not use this class directly for profiling, use instead PROFILE
       and ELIFORP macros.
 
-      Threadsafety: all profiling related functions are re-entrant so can
-      be safely used from any thread. Profiling data needs to be reset
-      per frame, so ThreadedReset() should be called from within the 
-      profiled thread. The profiling data won't show up otherwise.
-
-      Lock() and Release() functions should not be used, they are for
-      reporting profiling data. They are threadsafe because the
-      variables that are accessed during reporting are ones that are only
-      written to during Reset() or ResetThread and that is protected by a lock.
-      Otherwise for thread safety boost::thread_specific_ptr is used to store
-      thread specific profiling data. 
-              
-      Locks are not used when dealing with profiling blocks, as they might skew
-      the data too much.
-
-      \todo A memory leak around here somewhere of several kilobytes.
+      Each profiling block is registered once with RegisterBlock(), which gives it a static ID. Profiled threads
+      record begin and end events of the blocks with timestamps into a ring buffer of their own, without locks
+      or memory allocation. ProcessEvents() reads the ring buffers of all threads and aggregates them into the
+      ProfilerNodeTree that is used for reporting; the framework calls it once per frame from the main thread.
+
+      Lock() and Release() guard the profiling tree against ProcessEvents() when reading it from other threads
+      than the main thread.
     */
     class Profiler
     {
         friend class Framework;
     public://private:
-    Profiler()
-        :current_node_(&EmptyDeletor),
-            root_("Root")
-            {
-            }
+        Profiler();
     public:
         ~Profiler();
 
-        //! Start a profiling block.
-        /*!
-          Normally you don't use this directly, instead you use the macro PROFILE.
-          However if you want profiling that lasts out of scope, you can use this directly,
-          you also need to call matching Profiler::EndBlock()
+        //! Registers a profiling block name, and returns its ID. Registering the same name again returns the same ID. Thread-safe.
+        ProfilerBlockId RegisterBlock(const std::string &name);
 
-          Can be called multiple times with the same name without calling EndBlock() for
-          recursion support.
+        //! Returns the name of a registered block. Thread-safe.
+        std::string BlockName(ProfilerBlockId id);
 
-          Re-entrant.
+        //! Start a profiling block.
+        /*! Normally you don't use this directly, instead you use the macro PROFILE.
+            Can be called multiple times with the same block without calling EndBlock() for recursion support.
+            Re-entrant, lock-free and allocation-free after the first call in a thread.
         */
-        void StartBlock(const std::string &name);
+        void StartBlock(ProfilerBlockId id);
 
         //! End the profiling block
         /*! Each StartBlock() should have a matching EndBlock(). Recursion is supported.
-            
-          Re-entrant.
         */
-        void EndBlock(const std::string &name);
+        void EndBlock(ProfilerBlockId id);
+
+        //! Start a profiling block by name.
+        /*! If you want profiling that lasts out of scope, you can use this directly,
+            you also need to call matching Profiler::EndBlock(). Slower than the ID version, as the name is looked up.
+        */
+        void StartBlock(const std::string &name) { StartBlock(RegisterBlock(name)); }
+
+        //! End the profiling block by name.
+        void EndBlock(const std::string &name) { EndBlock(RegisterBlock(name)); }
 
-        //! Reset profiling data for the current thread. Don't call directly, use RESETPROFILER macro instead.
+        //! Marks the end of a frame in the current thread. Don't call directly, use RESETPROFILER macro instead.
         void ThreadedReset();
 
-        ProfilerNodeTree *CreateThreadRootBlock();
-        void RemoveThreadRootBlock(ProfilerNodeTree *rootBlock);
+        //! Aggregates the events recorded by all threads since the last call into the profiling tree.
+        /*! Call from the main thread, once per frame.
+        */
+        void ProcessEvents();
 
+        //! Returns the root profiling node of the current thread, or 0 if the thread has not been profiled yet.
+        /*! The events of the thread show up in the node after the next ProcessEvents() call.
+        */
         ProfilerNodeTree *GetThreadRootBlock();
 
         std::string GetThisThreadRootBlockName();
 
-        //! Returns root profiling node for the current thread only, re-entrant
-        ProfilerNodeTree *GetOrCreateThreadRootBlock();
-
         //! Returns root profiling node for all threads.
         ProfilerNodeTree *Lock()
         {
@@ -390,23 +469,104 @@ namespace Foundation
 
         ProfilerNodeTree *GetRoot() { return &root_; }
 
+        //! Returns the number of events that were lost because a thread filled its ring buffer.
+        unsigned long NumDroppedEvents() const { return numDroppedEvents_; }
+
+        //! Returns the allocation tracker of the process, or 0 if the build is not configured with ALLOCATION_TRACKING.
+        AllocationTracker *GetAllocationTracker() const { return allocationTracker_; }
+
+        //! Starts capturing the block events of all threads for the given number of frames.
+        /*! When the frames have been captured, the events are written to the given file in the Chrome trace event format,
+            which can be opened with chrome://tracing and other trace viewers. Replaces a capture in progress.
+        */
+        void StartCapture(int numFrames, const std::string &filename);
+
+        //! Keeps the events of the last numFrames frames, and writes them to the given file when a frame takes longer than the threshold.
+        /*! The capture is written once, after which hitch capture is turned off until it is started again.
+            \param threshold Frame time threshold in seconds. Pass 0 to turn hitch capture off.
+        */
+        void StartHitchCapture(double threshold, int numFrames, const std::string &filename);
+
+        //! Stops a capture in progress without writing it.
+        void StopCapture();
+
+        //! Returns true if a capture or a hitch capture is in progress.
+        bool IsCapturing() const { return captureFrames_ > 0; }
+
+        //! Records the current value of a counter, such as memory usage, to the capture in progress.
+        /*! Counters are shown as graphs above the thread timelines of the trace. Does nothing if not capturing.
+        */
+        void RecordCounter(const std::string &name, double value);
+
     private:
+        //! Returns the event buffer of the current thread, creating it if necessary.
+        ProfilerThreadBuffer *ThreadBuffer();
+
+        //! Creates and registers the event buffer of the current thread.
+        ProfilerThreadBuffer *CreateThreadBuffer();
+
+        //! Appends an event to the event buffer of the current thread.
+        void RecordEvent(ProfilerEvent::Type type, ProfilerBlockId id);
+
+        //! Aggregates the new events of a single thread. Called with mutex_ locked.
+        void ProcessThreadEvents(ProfilerThreadBuffer &buffer, double frequency);
+
+        //! An event kept for a trace capture.
+        struct TraceEvent
+        {
+            tick_t time;
+            ProfilerBlockId block;
+            unsigned int type;
+            unsigned int thread;
+            //! Value of a CounterValue event.
+            double value;
+        };
+        typedef std::vector<TraceEvent> TraceFrame;
+
+        //! Ends the current frame of the capture in progress, and writes the capture if it is complete. Called with mutex_ locked.
+        void EndCaptureFrame();
+
+        //! Writes the captured frames to captureFile_ in the Chrome trace event format.
+        bool WriteCapture();
+
         //! The single global root node object. This is a dummy root node that doesn't track any
         //! timing statistics, but just contains all the root blocks of each thread as its children.
-        //! This root_ node doesn't own any of the memory of any of its children, those are owned 
-        //! and freed by each thread separately Namely, freeing all instances inside the 
-        //! thread_specific_root_ will cause all blocks to be freed.
         ProfilerNodeTree root_;
 
-        //! Contains the root profile block for each thread.
-        boost::thread_specific_ptr<ProfilerNodeTree> thread_specific_root_;
-        //! Points to the current topmost profile block in the stack for each thread.
-        boost::thread_specific_ptr<ProfilerNodeTree> current_node_;
-
-        //! container for all the root profile nodes for each thread.
-        std::list<ProfilerNodeTree*> thread_root_nodes_;
-
+        //! Guards the profiling tree.
         boost::mutex mutex_;
+
+        //! Guards the thread buffer list and the block registry.
+        boost::mutex registryMutex_;
+        //! Event buffers of all profiled threads.
+        std::vector<ProfilerThreadBufferPtr> threadBuffers_;
+        //! Registered block names, indexed by block ID.
+        std::vector<std::string> blockNames_;
+        //! Registered block IDs by name.
+        std::map<std::string, ProfilerBlockId> blockIds_;
+
+        //! Keeps a reference to the event buffer of each thread, and marks the buffer exited when the thread exits.
+        boost::thread_specific_ptr<ProfilerThreadBufferPtr> threadBuffer_;
+
+        unsigned long numDroppedEvents_;
+
+        //! Number of frames to capture, or 0 if not capturing.
+        int captureFrames_;
+        //! Frame time threshold of hitch capture in seconds, or 0 for a capture of consecutive frames.
+        double hitchThreshold_;
+        //! File to write the capture to.
+        std::string captureFile_;
+        //! Captured frames, oldest first.
+        std::list<TraceFrame> traceFrames_;
+        //! Events of the frame being captured.
+        TraceFrame traceFrame_;
+        //! Names of the threads in captured traces, indexed by the trace thread ID.
+        std::vector<std::string> traceThreadNames_;
+        //! Time of the previous ProcessEvents() call.
+        tick_t lastFrameTime_;
+
+        //! Allocation tracker, handed to the modules with the profiler. Never deleted, since memory is freed until the very end.
+        AllocationTracker *allocationTracker_;
     };
 
     //! Used by PROFILE - macro to automatically stop profiling clock when going out of scope
@@ -416,10 +576,17 @@ namespace Foundation
         ProfilerSection(); // N/I
         ProfilerSection(const ProfilerSection &rhs);
     public:
-        explicit ProfilerSection(const std::string &name) : name_(name), destroyed_(false)
+        explicit ProfilerSection(ProfilerBlockId id) : id_(id), destroyed_(false)
         {
             assert (profiler_ && "Trying to profile before profiler initialized.");
-            GetProfiler()->StartBlock(name);
+            GetProfiler()->StartBlock(id);
+        }
+
+        explicit ProfilerSection(const std::string &name) : destroyed_(false)
+        {
+            assert (profiler_ && "Trying to profile before profiler initialized.");
+            id_ = GetProfiler()->RegisterBlock(name);
+            GetProfiler()->StartBlock(id_);
         }
 
         ~ProfilerSection()
@@ -435,19 +602,33 @@ namespace Foundation
         {
             assert (profiler_ && "Trying to profile before profiler initialized.");
 
-            GetProfiler()->EndBlock(name_);
+            GetProfiler()->EndBlock(id_);
             destroyed_ = true;
         }
         static Profiler *GetProfiler() { return profiler_; }
         //! This should only be called once per translation unit. it contains some side-effects too
-        static void SetProfiler(Profiler *profiler) { profiler_ = profiler; }
+        /*! Also shares the allocation tracker of the profiler with the code the profiler is set for.
+        */
+        static void SetProfiler(Profiler *profiler)
+        {
+            profiler_ = profiler;
+            if (profiler)
+                AllocationTracker::SetInstance(profiler->GetAllocationTracker());
+        }
+
+        //! Registers a block name with the profiler. Used by the PROFILE macro.
+        static ProfilerBlockId RegisterBlock(const char *name)
+        {
+            assert (profiler_ && "Trying to profile before profiler initialized.");
+            return profiler_->RegisterBlock(name);
+        }
 
     private:
         //! Parent profiler used by this section
         static Profiler *profiler_;
 
-        //! Name of this profiling section
-        const std::string name_;
+        //! ID of the profiling block of this section
+        ProfilerBlockId id_;
 
         //! True if this section has explicitly been destroyed before it run out of scope
         bool destroyed_;
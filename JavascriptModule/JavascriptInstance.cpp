@@ -189,7 +189,11 @@ void JavascriptInstance::Run()
 	}
 #endif
 
-    QScriptValue result = engine_->evaluate(scriptContent, scriptSourceFilename);
+    QScriptValue result;
+    {
+        ALLOCATION_SCOPE(Script);
+        result = engine_->evaluate(scriptContent, scriptSourceFilename);
+    }
 
 #ifndef QT_NO_SCRIPTTOOLS
 	if (attachedToDebugger)
@@ -271,7 +275,11 @@ void JavascriptInstance::IncludeFile(const QString &path)
         return;
     }
 
-    QScriptValue result = engine_->evaluate(script);
+    QScriptValue result;
+    {
+        ALLOCATION_SCOPE(Script);
+        result = engine_->evaluate(script);
+    }
 
     included_files_.push_back(path);
     
@@ -333,6 +341,7 @@ void JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
 
 void JavascriptInstance::CreateEngine()
 {
+    ALLOCATION_SCOPE(Script);
     if (engine_)
         DeleteEngine();
     engine_ = new QScriptEngine;
@@ -193,6 +193,16 @@ void JavascriptModule::Update(f64 frametime)
     RESETPROFILER;
 }
 
+ModuleUpdateInfo JavascriptModule::UpdateInfo() const
+{
+    // The scripts are run from the frame update of the FrameAPI and from Qt signals, not from the module update.
+    ModuleUpdateInfo info;
+    info.reads = MUA_None;
+    info.writes = MUA_None;
+    info.mainThreadOnly = false;
+    return info;
+}
+
 ConsoleCommandResult JavascriptModule::ConsoleRunString(const StringVector &params)
 {
     if (params.size() != 1)
@@ -241,7 +251,10 @@ void JavascriptModule::RunString(const QString &codestr, const QVariantMap &cont
 	}
 #endif
 
-	engine->evaluate(codestr);
+	{
+		ALLOCATION_SCOPE(Script);
+		engine->evaluate(codestr);
+	}
 
 #ifndef QT_NO_SCRIPTTOOLS
 	if(attachedToDebugger)
@@ -262,7 +275,10 @@ void JavascriptModule::RunScript(const QString &scriptFileName)
 	}
 #endif
 
-	engine->evaluate(scriptFile.readAll(), scriptFileName);
+	{
+		ALLOCATION_SCOPE(Script);
+		engine->evaluate(scriptFile.readAll(), scriptFileName);
+	}
 
 #ifndef QT_NO_SCRIPTTOOLS
 	if(attachedToDebugger)
@@ -284,6 +300,7 @@ void JavascriptModule::SceneAdded(const QString &name)
 void JavascriptModule::ScriptAssetChanged(ScriptAssetPtr newScript)
 {
     PROFILE(JSModule_ScriptAssetChanged);
+    ALLOCATION_SCOPE(Script);
 
     EC_Script *sender = dynamic_cast<EC_Script*>(this->sender());
     assert(sender && "JavascriptModule::ScriptAssetChanged needs to be invoked from EC_Script!");
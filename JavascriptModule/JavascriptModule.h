@@ -51,6 +51,9 @@ public:
     /// IModule override.
     void Update(f64 frametime);
 
+    /// IModule override. The update does not touch any shared state, so it may run on any thread.
+    ModuleUpdateInfo UpdateInfo() const;
+
     MODULE_LOGGING_FUNCTIONS
 
     /// Returns name of this module. Needed for logging.
@@ -141,6 +141,26 @@ QScriptValue setPixmapToLabel(QScriptContext *ctx, QScriptEngine *eng)
     return QScriptValue();
 }
 
+QScriptValue toScriptValueRaycastResultList(QScriptEngine *engine, const QList<RaycastResult*> &results)
+{
+    QScriptValue obj = engine->newArray(results.size());
+    for(int i = 0; i < results.size(); ++i)
+        obj.setProperty(i, engine->newQObject(results.at(i)));
+    return obj;
+}
+
+void fromScriptValueRaycastResultList(const QScriptValue &obj, QList<RaycastResult*> &results)
+{
+    results.clear();
+    const int length = obj.property("length").toInt32();
+    for(int i = 0; i < length; ++i)
+    {
+        RaycastResult *result = qobject_cast<RaycastResult*>(obj.property(i).toQObject());
+        if (result)
+            results.append(result);
+    }
+}
+
 void ExposeQtMetaTypes(QScriptEngine *engine)
 {
     assert(engine);
@@ -283,6 +303,11 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
 
     // Renderer metatypes
     qScriptRegisterQObjectMetaType<RaycastResult*>(engine);
+    int id = qRegisterMetaType< QList<RaycastResult*> >("QList<RaycastResult*>");
+    qScriptRegisterMetaType_helper(
+        engine, id, reinterpret_cast<QScriptEngine::MarshalFunction>(toScriptValueRaycastResultList),
+        reinterpret_cast<QScriptEngine::DemarshalFunction>(fromScriptValueRaycastResultList),
+        QScriptValue());
 
     // Communications metatypes
     qScriptRegisterQObjectMetaType<Communications::InWorldVoice::SessionInterface*>(engine);
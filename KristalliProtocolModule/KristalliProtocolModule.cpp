@@ -174,8 +174,21 @@ ConsoleCommandResult KristalliProtocolModule::OpenKNetLogWindow(const StringVect
 }
 #endif
 
+ModuleUpdateInfo KristalliProtocolModule::UpdateInfo() const
+{
+    // The inbound message handlers are Qt signals connected to the sync manager, which apply the changes to the scene,
+    // so processing the connections must stay on the main thread.
+    ModuleUpdateInfo info;
+    info.reads = MUA_Network | MUA_Scene;
+    info.writes = MUA_Network | MUA_Scene | MUA_Events;
+    info.mainThreadOnly = true;
+    return info;
+}
+
 void KristalliProtocolModule::Update(f64 frametime)
 {
+    ALLOCATION_SCOPE(Network);
+
     // Pulls all new inbound network messages and calls the message handler we've registered
     // for each of them.
     if (serverConnection)
@@ -30,6 +30,7 @@ namespace KristalliProtocol
         void PostInitialize();
         void Uninitialize();
         void Update(f64 frametime);
+        ModuleUpdateInfo UpdateInfo() const;
 
         MODULE_LOGGING_FUNCTIONS;
 
@@ -11,6 +11,7 @@
 #include "OgreSkeletonAsset.h"
 #include "OgreMeshAsset.h"
 #include "OgreMaterialAsset.h"
+#include "MeshInstancer.h"
 #include "IAssetTransfer.h"
 #include "AssetAPI.h"
 
@@ -33,6 +34,7 @@ EC_Mesh::EC_Mesh(IModule* module) :
     meshMaterial(this, "Mesh materials"),
     drawDistance(this, "Draw distance", 0.0f),
     castShadows(this, "Cast shadows", false),
+    lodBias(this, "LOD bias", 1.0f),
     renderer_(checked_static_cast<OgreRenderingModule*>(module)->GetRenderer()),
     entity_(0),
     bone_tagpoint_(0),
@@ -44,6 +46,9 @@ EC_Mesh::EC_Mesh(IModule* module) :
     static AttributeMetadata drawDistanceData("", "0", "10000");
     drawDistance.SetMetadata(&drawDistanceData);
 
+    static AttributeMetadata lodBiasData("", "0.01", "100");
+    lodBias.SetMetadata(&lodBiasData);
+
     static AttributeMetadata materialMetadata;
     materialMetadata.elementType = "assetreference";
     meshMaterial.SetMetadata(&materialMetadata);
@@ -260,6 +265,7 @@ bool EC_Mesh::SetMesh(QString meshResourceName, bool clone)
         
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        entity_->setMeshLodBias(std::max(lodBias.Get(), 0.01f));
         entity_->setUserAny(Ogre::Any(GetParentEntity()));
         // Set UserAny also on subentities
         for (uint i = 0; i < entity_->getNumSubEntities(); ++i)
@@ -354,6 +360,7 @@ bool EC_Mesh::SetMeshWithSkeleton(const std::string& mesh_name, const std::strin
         
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        entity_->setMeshLodBias(std::max(lodBias.Get(), 0.01f));
         entity_->setUserAny(Ogre::Any(GetParentEntity()));
         // Set UserAny also on subentities
         for (uint i = 0; i < entity_->getNumSubEntities(); ++i)
@@ -397,6 +404,9 @@ void EC_Mesh::RemoveMesh()
         if (bone_attached_mesh_)
             bone_attached_mesh_->DetachMeshFromBone();
         
+        if (renderer->GetMeshInstancer())
+            renderer->GetMeshInstancer()->Remove(entity_);
+
         Ogre::SceneManager* scene_mgr = renderer->GetSceneManager();
         scene_mgr->destroyEntity(entity_);
         
@@ -487,6 +497,7 @@ bool EC_Mesh::SetAttachmentMesh(uint index, const std::string& mesh_name, const
 
         attachment_entities_[index]->setRenderingDistance(drawDistance.Get());
         attachment_entities_[index]->setCastShadows(castShadows.Get());
+        attachment_entities_[index]->setMeshLodBias(std::max(lodBias.Get(), 0.01f));
         attachment_entities_[index]->setUserAny(entity_->getUserAny());
         // Set UserAny also on subentities
         for (uint i = 0; i < attachment_entities_[index]->getNumSubEntities(); ++i)
@@ -596,6 +607,8 @@ bool EC_Mesh::SetMaterial(uint index, const std::string& material_name)
     try
     {
         entity_->getSubEntity(index)->setMaterialName(SanitateAssetIdForOgre(material_name));
+        // The material is a part of the batch key, so the entity moves to another batch.
+        UpdateInstancing();
         emit MaterialChanged(index, QString(material_name.c_str()));
     }
     catch (Ogre::Exception& e)
@@ -788,10 +801,14 @@ void EC_Mesh::DetachEntity()
         return;
     
     EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    disconnect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*, AttributeChange::Type)));
+    disconnect(placeable, SIGNAL(ParentChanged()), this, SLOT(OnPlaceableParentChanged()));
     Ogre::SceneNode* node = placeable->GetSceneNode();
     adjustment_node_->detachObject(entity_);
     node->removeChild(adjustment_node_);
     attached_ = false;
+
+    UpdateInstancing();
 }
 
 void EC_Mesh::AttachEntity()
@@ -811,6 +828,56 @@ void EC_Mesh::AttachEntity()
     adjustment_node_->setVisible(placeable->visible.Get());
 
     attached_ = true;
+
+    connect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this,
+        SLOT(OnPlaceableAttributeChanged(IAttribute*, AttributeChange::Type)), Qt::UniqueConnection);
+    connect(placeable, SIGNAL(ParentChanged()), this, SLOT(OnPlaceableParentChanged()), Qt::UniqueConnection);
+    UpdateInstancing();
+}
+
+void EC_Mesh::UpdateInstancing()
+{
+    if (renderer_.expired() || !entity_)
+        return;
+    MeshInstancer* instancer = renderer_.lock()->GetMeshInstancer();
+    if (!instancer)
+        return;
+
+    // Only static entities are batched: the batches are rebuilt when an instance changes, and they can not be animated.
+    // The batches use the LOD distances of the mesh as is, so entities with a LOD bias are drawn individually.
+    bool isStatic = attached_ && !attached_to_bone_ && placeable_ && cloned_mesh_name_.empty() && !entity_->hasSkeleton() &&
+        !entity_->getMesh()->hasVertexAnimation() && entity_->getNumAttachedObjects() == 0 && lodBias.Get() == 1.0f;
+    if (isStatic)
+    {
+        // The batches do not follow a parent placeable.
+        EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+        isStatic = !placeable->GetParent();
+    }
+
+    if (isStatic)
+        instancer->Add(entity_, GetParentScene());
+    else
+        instancer->Remove(entity_);
+}
+
+void EC_Mesh::OnPlaceableAttributeChanged(IAttribute *attribute, AttributeChange::Type change)
+{
+    if (renderer_.expired() || !entity_ || !placeable_)
+        return;
+    MeshInstancer* instancer = renderer_.lock()->GetMeshInstancer();
+    if (!instancer || !instancer->Contains(entity_))
+        return;
+
+    EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    if (attribute == &placeable->transform)
+        instancer->Move(entity_);
+    else if (attribute == &placeable->visible)
+        instancer->Add(entity_);
+}
+
+void EC_Mesh::OnPlaceableParentChanged()
+{
+    UpdateInstancing();
 }
 
 Ogre::Mesh* EC_Mesh::PrepareMesh(const std::string& mesh_name, bool clone)
@@ -889,7 +956,10 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
     if (attribute == &drawDistance)
     {
         if(entity_)
+        {
             entity_->setRenderingDistance(drawDistance.Get());
+            UpdateInstancing();
+        }
     }
     else if (attribute == &castShadows)
     {
@@ -897,6 +967,7 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
         {
             if (entity_)
                 entity_->setCastShadows(castShadows.Get());
+            UpdateInstancing();
             //! \todo might want to disable shadows for some attachments
             for (uint i = 0; i < attachment_entities_.size(); ++i)
             {
@@ -905,6 +976,21 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
             }
         }
     }
+    else if (attribute == &lodBias)
+    {
+        // Ogre requires a positive bias
+        const float bias = std::max(lodBias.Get(), 0.01f);
+        if (entity_)
+        {
+            entity_->setMeshLodBias(bias);
+            UpdateInstancing();
+        }
+        for (uint i = 0; i < attachment_entities_.size(); ++i)
+        {
+            if (attachment_entities_[i])
+                attachment_entities_[i]->setMeshLodBias(bias);
+        }
+    }
     else if (attribute == &nodeTransformation)
     {
         Ogre::Node* adjustmentTarget = adjustment_node_;
@@ -932,6 +1018,9 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
             
             adjustmentTarget->setScale(newTransform.scale.x, newTransform.scale.y, newTransform.scale.z);
         }
+
+        if (entity_ && !renderer_.expired() && renderer_.lock()->GetMeshInstancer())
+            renderer_.lock()->GetMeshInstancer()->Move(entity_);
     }
     else if (attribute == &meshRef)
     {
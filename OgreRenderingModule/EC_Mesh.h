@@ -41,6 +41,8 @@ Registered by OgreRenderer::OgreRenderingModule.
 <div>Distance where the mesh is shown from the camera.</div> 
 <li>bool: castShadows
 <div>Will the mesh cast shadows.</div> 
+<li>float: lodBias
+<div>Scales the distances where the mesh switches to a lower level of detail. Larger values keep the detail further away.</div> 
 </ul>
 
 <b>Exposes the following scriptable functions:</b>
@@ -168,6 +170,10 @@ public:
     Q_PROPERTY(bool castShadows READ getcastShadows WRITE setcastShadows);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, castShadows);
 
+    //! Mesh level of detail bias. 1.0 uses the LOD distances of the mesh as is.
+    Q_PROPERTY(float lodBias READ getlodBias WRITE setlodBias);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodBias);
+
     //! Set component as serializable.
     /*! Note that despite this, in OpenSim worlds, the network sync will be disabled from the component,
         as mesh attributes are being transmitted through RexPrimData instead.
@@ -407,6 +413,12 @@ private slots:
     /// Called when material asset has been downloaded.
     void OnMaterialAssetLoaded(AssetPtr material);
 
+    //! Called when an attribute of the placeable has been changed. Keeps the instanced batches up to date.
+    void OnPlaceableAttributeChanged(IAttribute *attribute, AttributeChange::Type change);
+
+    //! Called when the parent of the placeable has been set. Meshes under a parent placeable are not batched.
+    void OnPlaceableParentChanged();
+
 private:
     //! constructor
     /*! \param module renderer module
@@ -426,6 +438,9 @@ private:
     //! detaches entity from placeable
     void DetachEntity();
 
+    //! adds the entity to the instanced batches of the renderer if it is static, or removes it from them if it is not
+    void UpdateInstancing();
+
     bool HasMaterialsChanged() const;
     
     //! placeable component 
@@ -108,6 +108,7 @@ void EC_Placeable::SetParent(ComponentPtr placeable)
     DetachNode();
     parent_ = placeable;
     AttachNode();
+    emit ParentChanged();
 }
 
 Vector3df EC_Placeable::GetPosition() const
@@ -198,17 +199,21 @@ void EC_Placeable::LookAt(const Vector3df& look_at)
 
 void EC_Placeable::SetYaw(float radians)
 {
+    // Store the rotated orientation in the transform attribute, so that the listeners of the transform see the change
     link_scene_node_->yaw(Ogre::Radian(radians), Ogre::Node::TS_WORLD);
+    SetOrientation(GetOrientation());
 }
 
 void EC_Placeable::SetPitch(float radians)
 {
     link_scene_node_->pitch(Ogre::Radian(radians));
+    SetOrientation(GetOrientation());
 }
 
 void EC_Placeable::SetRoll(float radians)
 {
     link_scene_node_->roll(Ogre::Radian(radians));
+    SetOrientation(GetOrientation());
 } 
 
 float EC_Placeable::GetYaw() const
@@ -267,6 +267,9 @@ signals:
     //! emmitted when scale has changed.
     void ScaleChanged(const QVector3D &scale);
 
+    //! emitted when the parent placeable has been set.
+    void ParentChanged();
+
 private slots:
     //! Handle attributechange
     /*! \param attribute Attribute that changed.
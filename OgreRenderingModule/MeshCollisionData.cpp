@@ -0,0 +1,354 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "MeshCollisionData.h"
+
+#include <Ogre.h>
+
+#include <map>
+
+#include "MemoryLeakCheck.h"
+
+namespace OgreRenderer
+{
+
+namespace
+{
+    //! The maximum number of triangles in a leaf of the hierarchy.
+    const uint cMaxTrianglesPerLeaf = 4;
+
+    //! The registered collision data of the meshes loaded from assets.
+    std::map<const Ogre::Mesh *, MeshCollisionDataPtr> registeredMeshes;
+
+    //! Orders triangles by their centroid along one axis.
+    struct CentroidLess
+    {
+        CentroidLess(const std::vector<Ogre::Vector3> &centroids, int axis) : centroids_(centroids), axis_(axis) {}
+
+        bool operator()(uint a, uint b) const { return centroids_[a / 3][axis_] < centroids_[b / 3][axis_]; }
+
+        const std::vector<Ogre::Vector3> &centroids_;
+        int axis_;
+    };
+
+    //! Returns the distance along the ray to where it enters the box, or a negative value if it misses the box.
+    //! A zero direction component is handled separately, as the slab distances would be 0 * inf = NaN for an origin on the slab plane.
+    float RayBoxEntry(const Ogre::Vector3 &origin, const Ogre::Vector3 &direction, const Ogre::Vector3 &invDirection,
+        const Ogre::Vector3 &min, const Ogre::Vector3 &max)
+    {
+        float tmin = 0.f;
+        float tmax = std::numeric_limits<float>::max();
+        for(int i = 0; i < 3; ++i)
+        {
+            if (direction[i] == 0.f)
+            {
+                // Parallel to the slab: either always inside it or never
+                if (origin[i] < min[i] || origin[i] > max[i])
+                    return -1.f;
+                continue;
+            }
+            float t0 = (min[i] - origin[i]) * invDirection[i];
+            float t1 = (max[i] - origin[i]) * invDirection[i];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+            if (tmin > tmax)
+                return -1.f;
+        }
+        return tmin;
+    }
+}
+
+// Adapted from http://www.ogre3d.org/wiki/index.php/Raycasting_to_the_polygon_level
+void MeshCollisionData::ReadGeometry(Ogre::Mesh *mesh, Ogre::Entity *skinnedEntity, std::vector<Ogre::Vector3> &vertices,
+    std::vector<Ogre::Vector2> &texcoords, std::vector<uint> &indices, std::vector<uint> &submeshStartIndex)
+{
+    bool added_shared = false;
+    size_t current_offset = 0;
+    size_t shared_offset = 0;
+    size_t next_offset = 0;
+    size_t index_offset = 0;
+    size_t vertex_count = 0;
+    size_t index_count = 0;
+
+    submeshStartIndex.resize(mesh->getNumSubMeshes());
+
+    // Calculate how many vertices and indices we're going to need
+    for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh* submesh = mesh->getSubMesh( i );
+        // We only need to add the shared vertices once
+        if (submesh->useSharedVertices)
+        {
+            if (!added_shared)
+            {
+                vertex_count += mesh->sharedVertexData->vertexCount;
+                added_shared = true;
+            }
+        }
+        else
+        {
+            vertex_count += submesh->vertexData->vertexCount;
+        }
+
+        // Add the indices
+        submeshStartIndex[i] = index_count;
+        index_count += submesh->indexData->indexCount;
+    }
+
+    // Allocate space for the vertices and indices
+    vertices.resize(vertex_count);
+    texcoords.resize(vertex_count);
+    indices.resize(index_count);
+
+    added_shared = false;
+
+    // Run through the submeshes again, adding the data into the arrays
+    for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh* submesh = mesh->getSubMesh(i);
+
+        // Get vertex data
+        Ogre::VertexData* vertex_data;
+
+        //When there is animation:
+        if (skinnedEntity)
+            vertex_data = submesh->useSharedVertices ? skinnedEntity->_getSkelAnimVertexData() : skinnedEntity->getSubEntity(i)->_getSkelAnimVertexData();
+        else
+            vertex_data = submesh->useSharedVertices ? mesh->sharedVertexData : submesh->vertexData;
+
+        if ((!submesh->useSharedVertices)||(submesh->useSharedVertices && !added_shared))
+        {
+            if(submesh->useSharedVertices)
+            {
+                added_shared = true;
+                shared_offset = current_offset;
+            }
+
+            const Ogre::VertexElement* posElem =
+                vertex_data->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
+            const Ogre::VertexElement *texElem =
+                vertex_data->vertexDeclaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES);
+
+            Ogre::HardwareVertexBufferSharedPtr vbuf =
+                vertex_data->vertexBufferBinding->getBuffer(posElem->getSource());
+
+            unsigned char* vertex =
+                static_cast<unsigned char*>(vbuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+
+            // There is _no_ baseVertexPointerToElement() which takes an Ogre::Real or a double
+            //  as second argument. So make it float, to avoid trouble when Ogre::Real will
+            //  be comiled/typedefed as double:
+            //      Ogre::Real* pReal;
+            float* pReal = 0;
+
+            for(size_t j = 0; j < vertex_data->vertexCount; ++j, vertex += vbuf->getVertexSize())
+            {
+                posElem->baseVertexPointerToElement(vertex, &pReal);
+
+                vertices[current_offset + j] = Ogre::Vector3(pReal[0], pReal[1], pReal[2]);
+                if (texElem)
+                {
+                    texElem->baseVertexPointerToElement(vertex, &pReal);
+                    texcoords[current_offset + j] = Ogre::Vector2(pReal[0], pReal[1]);
+                }
+                else
+                    texcoords[current_offset + j] = Ogre::Vector2(0.0f, 0.0f);
+            }
+
+            vbuf->unlock();
+            next_offset += vertex_data->vertexCount;
+        }
+
+        Ogre::IndexData* index_data = submesh->indexData;
+        size_t numTris = index_data->indexCount / 3;
+        Ogre::HardwareIndexBufferSharedPtr ibuf = index_data->indexBuffer;
+
+        unsigned long*  pLong = static_cast<unsigned long*>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+        unsigned short* pShort = reinterpret_cast<unsigned short*>(pLong);
+        size_t offset = (submesh->useSharedVertices)? shared_offset : current_offset;
+
+        bool use32bitindexes = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
+        if (use32bitindexes)
+            for(size_t k = 0; k < numTris*3; ++k)
+                indices[index_offset++] = pLong[k] + static_cast<uint>(offset);
+        else
+            for(size_t k = 0; k < numTris*3; ++k)
+                indices[index_offset++] = static_cast<uint>(pShort[k]) + static_cast<unsigned long>(offset);
+
+        ibuf->unlock();
+        current_offset = next_offset;
+    }
+}
+
+MeshCollisionDataPtr MeshCollisionData::Register(Ogre::Mesh *mesh)
+{
+    PROFILE(MeshCollisionData_Register);
+
+    MeshCollisionDataPtr data(new MeshCollisionData());
+    ReadGeometry(mesh, 0, data->vertices_, data->texcoords_, data->indices_, data->submeshStartIndex_);
+
+    // Only whole triangles are picked, so a trailing partial triangle is left out.
+    const uint numTriangles = (uint)data->indices_.size() / 3;
+    data->triangles_.resize(numTriangles);
+    std::vector<Ogre::Vector3> centroids(numTriangles);
+    for(uint i = 0; i < numTriangles; ++i)
+    {
+        data->triangles_[i] = i * 3;
+        centroids[i] = (data->vertices_[data->indices_[i*3]] + data->vertices_[data->indices_[i*3+1]] + data->vertices_[data->indices_[i*3+2]]) / 3.f;
+    }
+
+    if (numTriangles > 0)
+    {
+        // Median splits leave at least two triangles in each leaf, so there are fewer nodes than triangles.
+        data->nodes_.reserve(numTriangles);
+        data->BuildNode(0, numTriangles, centroids);
+    }
+
+    registeredMeshes[mesh] = data;
+    return data;
+}
+
+void MeshCollisionData::Unregister(Ogre::Mesh *mesh)
+{
+    registeredMeshes.erase(mesh);
+}
+
+MeshCollisionDataPtr MeshCollisionData::Find(const Ogre::Mesh *mesh)
+{
+    std::map<const Ogre::Mesh *, MeshCollisionDataPtr>::const_iterator iter = registeredMeshes.find(mesh);
+    return iter != registeredMeshes.end() ? iter->second : MeshCollisionDataPtr();
+}
+
+void MeshCollisionData::BuildNode(uint begin, uint end, const std::vector<Ogre::Vector3> &centroids)
+{
+    const uint nodeIndex = (uint)nodes_.size();
+    nodes_.push_back(Node());
+
+    Ogre::Vector3 min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Ogre::Vector3 max = -min;
+    Ogre::Vector3 centroidMin = min;
+    Ogre::Vector3 centroidMax = max;
+    for(uint i = begin; i < end; ++i)
+    {
+        for(uint j = 0; j < 3; ++j)
+        {
+            const Ogre::Vector3 &v = vertices_[indices_[triangles_[i] + j]];
+            min.makeFloor(v);
+            max.makeCeil(v);
+        }
+        centroidMin.makeFloor(centroids[triangles_[i] / 3]);
+        centroidMax.makeCeil(centroids[triangles_[i] / 3]);
+    }
+    nodes_[nodeIndex].min = min;
+    nodes_[nodeIndex].max = max;
+
+    if (end - begin <= cMaxTrianglesPerLeaf)
+    {
+        nodes_[nodeIndex].first = begin;
+        nodes_[nodeIndex].count = end - begin;
+        return;
+    }
+
+    // Split at the median triangle along the longest axis of the centroids, which keeps the tree balanced.
+    const Ogre::Vector3 extent = centroidMax - centroidMin;
+    const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const uint middle = begin + (end - begin) / 2;
+    std::nth_element(triangles_.begin() + begin, triangles_.begin() + middle, triangles_.begin() + end, CentroidLess(centroids, axis));
+
+    BuildNode(begin, middle, centroids);
+    nodes_[nodeIndex].first = (uint)nodes_.size();
+    nodes_[nodeIndex].count = 0;
+    BuildNode(middle, end, centroids);
+}
+
+bool MeshCollisionData::Raycast(const Ogre::Ray &ray, float &distance, uint &firstIndex) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const Ogre::Vector3 &origin = ray.getOrigin();
+    const Ogre::Vector3 &direction = ray.getDirection();
+    const Ogre::Vector3 invDirection(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+
+    float closest = std::numeric_limits<float>::max();
+    bool hit = false;
+
+    // The nodes to visit, with the distances at which the ray enters them. A tree split at the median is at most 32 levels deep,
+    // and each level leaves at most one node on the stack.
+    struct StackEntry
+    {
+        uint node;
+        float entry;
+    };
+    StackEntry stack[64];
+    int stackSize = 0;
+
+    const float rootEntry = RayBoxEntry(origin, direction, invDirection, nodes_[0].min, nodes_[0].max);
+    if (rootEntry < 0.f)
+        return false;
+    stack[stackSize].node = 0;
+    stack[stackSize++].entry = rootEntry;
+
+    while(stackSize > 0)
+    {
+        const StackEntry current = stack[--stackSize];
+        if (current.entry > closest)
+            continue;
+
+        const Node &node = nodes_[current.node];
+        if (node.count > 0)
+        {
+            for(uint i = node.first; i < node.first + node.count; ++i)
+            {
+                const uint j = triangles_[i];
+                std::pair<bool, Ogre::Real> result = Ogre::Math::intersects(ray, vertices_[indices_[j]], vertices_[indices_[j+1]],
+                    vertices_[indices_[j+2]], true, false);
+                if (result.first && result.second < closest)
+                {
+                    closest = result.second;
+                    firstIndex = j;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        // Push the nearer child last, so that it is visited first, and the hit found there prunes the farther one.
+        StackEntry children[2];
+        children[0].node = current.node + 1;
+        children[0].entry = RayBoxEntry(origin, direction, invDirection, nodes_[children[0].node].min, nodes_[children[0].node].max);
+        children[1].node = node.first;
+        children[1].entry = RayBoxEntry(origin, direction, invDirection, nodes_[children[1].node].min, nodes_[children[1].node].max);
+        if (children[0].entry < children[1].entry)
+            std::swap(children[0], children[1]);
+        for(int i = 0; i < 2; ++i)
+            if (children[i].entry >= 0.f)
+            {
+                assert(stackSize < (int)(sizeof(stack) / sizeof(stack[0])));
+                stack[stackSize++] = children[i];
+            }
+    }
+
+    if (hit)
+        distance = closest;
+    return hit;
+}
+
+uint MeshCollisionData::SubmeshForIndex(uint index) const
+{
+    for(uint i = (uint)submeshStartIndex_.size(); i > 0; --i)
+        if (index >= submeshStartIndex_[i-1])
+            return i-1;
+    return 0;
+}
+
+size_t MeshCollisionData::MemoryUsage() const
+{
+    return vertices_.capacity() * sizeof(Ogre::Vector3) + texcoords_.capacity() * sizeof(Ogre::Vector2) +
+        (indices_.capacity() + submeshStartIndex_.capacity() + triangles_.capacity()) * sizeof(uint) + nodes_.capacity() * sizeof(Node);
+}
+
+}
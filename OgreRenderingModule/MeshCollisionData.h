@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_OgreRenderer_MeshCollisionData_h
+#define incl_OgreRenderer_MeshCollisionData_h
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "CoreTypes.h"
+
+#include <OgreVector2.h>
+#include <OgreVector3.h>
+#include <OgreRay.h>
+
+#include <vector>
+
+namespace OgreRenderer
+{
+    //! CPU-side copy of the triangles of a mesh, with a bounding volume hierarchy for raycasting against them.
+    /*! Reading the geometry back from the hardware buffers of a mesh is slow, so OgreMeshAsset builds this once when the mesh is loaded,
+        and registers it for the mesh. All the entities using the mesh share it. The data is in the local space of the mesh,
+        so rays are transformed to the local space of an entity to test against it.
+        \ingroup OgreRenderingModuleClient
+    */
+    class OGRE_MODULE_API MeshCollisionData
+    {
+    public:
+        //! Reads the geometry of a mesh back from its hardware buffers.
+        /*! \param mesh The mesh to read.
+            \param skinnedEntity If not null, the software-skinned vertices of this entity are read instead of the vertices of the mesh.
+            \param vertices [out] The vertex positions of all the submeshes.
+            \param texcoords [out] The first texture coordinates of the vertices, or zero if there are none.
+            \param indices [out] The triangle list indices of all the submeshes, to the vertices array.
+            \param submeshStartIndex [out] The index of the first index of each submesh in the indices array.
+         */
+        static void ReadGeometry(Ogre::Mesh *mesh, Ogre::Entity *skinnedEntity, std::vector<Ogre::Vector3> &vertices,
+            std::vector<Ogre::Vector2> &texcoords, std::vector<uint> &indices, std::vector<uint> &submeshStartIndex);
+
+        //! Creates the collision data of a mesh and registers it for the mesh.
+        static MeshCollisionDataPtr Register(Ogre::Mesh *mesh);
+
+        //! Forgets the collision data of a mesh. Call when the mesh is unloaded.
+        static void Unregister(Ogre::Mesh *mesh);
+
+        //! Returns the collision data registered for a mesh, or null if there is none.
+        static MeshCollisionDataPtr Find(const Ogre::Mesh *mesh);
+
+        //! Finds the nearest triangle hit by a ray in the local space of the mesh.
+        /*! Like the rest of the picking, only the front faces of the triangles are hit.
+            \param ray The ray. The direction need not be normalized; the distance is given in units of its length.
+            \param distance [out] The distance along the ray to the hit.
+            \param firstIndex [out] The index of the first index of the hit triangle in Indices().
+            \return True if the ray hit a triangle.
+         */
+        bool Raycast(const Ogre::Ray &ray, float &distance, uint &firstIndex) const;
+
+        //! Returns the submesh the triangle starting at the given index belongs to.
+        uint SubmeshForIndex(uint index) const;
+
+        const std::vector<Ogre::Vector3> &Vertices() const { return vertices_; }
+        const std::vector<Ogre::Vector2> &TexCoords() const { return texcoords_; }
+        const std::vector<uint> &Indices() const { return indices_; }
+
+        //! Returns the number of bytes used by the data.
+        size_t MemoryUsage() const;
+
+    private:
+        //! A node of the bounding volume hierarchy. Inner nodes have their first child right after them.
+        struct Node
+        {
+            Ogre::Vector3 min;
+            Ogre::Vector3 max;
+            //! For leaves, the first triangle in triangles_. For inner nodes, the index of the second child.
+            uint first;
+            //! The number of triangles in a leaf, or 0 for inner nodes.
+            uint count;
+        };
+
+        MeshCollisionData() {}
+
+        //! Builds the node for the triangles [begin, end) of triangles_, and its children.
+        void BuildNode(uint begin, uint end, const std::vector<Ogre::Vector3> &centroids);
+
+        std::vector<Ogre::Vector3> vertices_;
+        std::vector<Ogre::Vector2> texcoords_;
+        std::vector<uint> indices_;
+        std::vector<uint> submeshStartIndex_;
+
+        //! The first indices of the triangles, ordered so that each leaf has its triangles in a contiguous range.
+        std::vector<uint> triangles_;
+        std::vector<Node> nodes_;
+    };
+}
+
+#endif
@@ -0,0 +1,331 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "MeshInstancer.h"
+#include "OgreRenderingModule.h"
+
+#include <Ogre.h>
+
+#include <sstream>
+
+#include "MemoryLeakCheck.h"
+
+namespace OgreRenderer
+{
+
+MeshInstancer::MeshInstancer(Ogre::SceneManager* sceneManager) :
+    sceneManager_(sceneManager),
+    enabled_(true),
+    minInstances_(2),
+    cellSize_(64.0f),
+    settleTime_(GetCurrentClockFreq()),
+    geometryId_(0)
+{
+}
+
+MeshInstancer::~MeshInstancer()
+{
+    Clear();
+}
+
+void MeshInstancer::Add(Ogre::Entity* entity, Scene::SceneManager* scene)
+{
+    if (!entity)
+        return;
+    InstanceMap::iterator iter = instances_.find(entity);
+    if (iter != instances_.end())
+        Unbatch(entity, iter->second);
+    else
+    {
+        Instance& instance = instances_[entity];
+        instance.name = entity->getName();
+        instance.scene = scene;
+        waiting_.insert(entity);
+    }
+}
+
+void MeshInstancer::Move(Ogre::Entity* entity)
+{
+    InstanceMap::iterator iter = instances_.find(entity);
+    if (iter == instances_.end())
+        return;
+    Unbatch(entity, iter->second);
+    iter->second.lastMoved = GetCurrentClockTime();
+}
+
+void MeshInstancer::Remove(Ogre::Entity* entity)
+{
+    InstanceMap::iterator iter = instances_.find(entity);
+    if (iter == instances_.end())
+        return;
+    Unbatch(entity, iter->second);
+    waiting_.erase(entity);
+    instances_.erase(iter);
+}
+
+void MeshInstancer::Clear()
+{
+    for(BatchMap::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+    {
+        // Unlike Release(), do not touch the members, which may be gone already.
+        if (iter->second.geometry)
+            sceneManager_->destroyStaticGeometry(iter->second.geometry);
+    }
+    batches_.clear();
+
+    for(InstanceMap::iterator iter = instances_.begin(); iter != instances_.end(); ++iter)
+        if (Exists(iter->first, iter->second))
+            Show(iter->first, iter->second);
+    instances_.clear();
+    waiting_.clear();
+}
+
+void MeshInstancer::RemoveScene(Scene::SceneManager* scene)
+{
+    for(InstanceMap::iterator iter = instances_.begin(); iter != instances_.end();)
+    {
+        Instance& instance = iter->second;
+        if (instance.scene != scene)
+        {
+            ++iter;
+            continue;
+        }
+        // The batch is rebuilt from its remaining members, which are all alive.
+        if (instance.batch)
+        {
+            instance.batch->members.erase(iter->first);
+            instance.batch->dirty = true;
+        }
+        if (Exists(iter->first, instance))
+            Show(iter->first, instance);
+        waiting_.erase(iter->first);
+        instances_.erase(iter++);
+    }
+}
+
+void MeshInstancer::Update()
+{
+    if (!enabled_ || (waiting_.empty() && batches_.empty()))
+        return;
+
+    PROFILE(MeshInstancer_Update);
+
+    const tick_t now = GetCurrentClockTime();
+    for(std::set<Ogre::Entity*>::iterator iter = waiting_.begin(); iter != waiting_.end();)
+    {
+        Ogre::Entity* entity = *iter;
+        Instance& instance = instances_[entity];
+        if (instance.lastMoved && now - instance.lastMoved < settleTime_)
+        {
+            ++iter;
+            continue;
+        }
+        // Hidden entities are left out. Add() is called again when they are shown.
+        if (!entity->getVisible() || !entity->isInScene())
+        {
+            waiting_.erase(iter++);
+            continue;
+        }
+
+        Ogre::Vector3 cellOrigin;
+        const std::string key = BatchKey(entity, cellOrigin);
+        Batch& batch = batches_[key];
+        if (batch.key.empty())
+        {
+            batch.key = key;
+            batch.cellOrigin = cellOrigin;
+        }
+        batch.members.insert(entity);
+        batch.dirty = true;
+        instance.batch = &batch;
+        instance.lastMoved = 0;
+        waiting_.erase(iter++);
+    }
+
+    for(BatchMap::iterator iter = batches_.begin(); iter != batches_.end();)
+    {
+        Batch& batch = iter->second;
+        if (batch.dirty)
+            Rebuild(batch);
+        if (batch.members.empty())
+        {
+            Release(batch);
+            batches_.erase(iter++);
+        }
+        else
+            ++iter;
+    }
+}
+
+void MeshInstancer::SetEnabled(bool enabled)
+{
+    if (enabled == enabled_)
+        return;
+    enabled_ = enabled;
+    if (!enabled_)
+        Reset();
+}
+
+void MeshInstancer::SetMinInstances(uint count)
+{
+    minInstances_ = std::max(count, 1u);
+    for(BatchMap::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        iter->second.dirty = true;
+}
+
+void MeshInstancer::SetCellSize(float size)
+{
+    if (size <= 0.0f || size == cellSize_)
+        return;
+    cellSize_ = size;
+    Reset();
+}
+
+uint MeshInstancer::GetNumInstanced() const
+{
+    uint count = 0;
+    for(BatchMap::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.built)
+            count += (uint)iter->second.members.size();
+    return count;
+}
+
+uint MeshInstancer::GetNumBatches() const
+{
+    uint count = 0;
+    for(BatchMap::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.built)
+            ++count;
+    return count;
+}
+
+std::string MeshInstancer::BatchKey(Ogre::Entity* entity, Ogre::Vector3& cellOrigin) const
+{
+    const Ogre::Vector3 position = entity->getParentSceneNode()->_getDerivedPosition();
+    const int cellX = (int)floor(position.x / cellSize_);
+    const int cellY = (int)floor(position.y / cellSize_);
+    const int cellZ = (int)floor(position.z / cellSize_);
+    cellOrigin = Ogre::Vector3(cellX * cellSize_, cellY * cellSize_, cellZ * cellSize_);
+
+    std::ostringstream key;
+    key << entity->getMesh()->getName();
+    for(uint i = 0; i < entity->getNumSubEntities(); ++i)
+        key << '|' << entity->getSubEntity(i)->getMaterialName();
+    key << '|' << entity->getCastShadows() << '|' << entity->getRenderingDistance() << '|' << cellX << ',' << cellY << ',' << cellZ;
+    return key.str();
+}
+
+void MeshInstancer::Unbatch(Ogre::Entity* entity, Instance& instance)
+{
+    if (instance.batch)
+    {
+        instance.batch->members.erase(entity);
+        instance.batch->dirty = true;
+        instance.batch = 0;
+    }
+    Show(entity, instance);
+    waiting_.insert(entity);
+}
+
+void MeshInstancer::Rebuild(Batch& batch)
+{
+    batch.dirty = false;
+    if (batch.members.size() < minInstances_)
+    {
+        Release(batch);
+        return;
+    }
+
+    PROFILE(MeshInstancer_Rebuild);
+
+    try
+    {
+        if (!batch.geometry)
+        {
+            std::ostringstream name;
+            name << "MeshInstancer_batch" << geometryId_++;
+            batch.geometry = sceneManager_->createStaticGeometry(name.str());
+            // Make the whole cell one region, with room for the members that extend over its sides.
+            batch.geometry->setRegionDimensions(Ogre::Vector3(cellSize_ * 4.0f));
+            batch.geometry->setOrigin(batch.cellOrigin - Ogre::Vector3(cellSize_ * 1.5f));
+        }
+        else
+            batch.geometry->reset();
+
+        Ogre::Entity* first = *batch.members.begin();
+        batch.geometry->setCastShadows(first->getCastShadows());
+        batch.geometry->setRenderingDistance(first->getRenderingDistance());
+        for(std::set<Ogre::Entity*>::iterator iter = batch.members.begin(); iter != batch.members.end(); ++iter)
+        {
+            Ogre::SceneNode* node = (*iter)->getParentSceneNode();
+            batch.geometry->addEntity(*iter, node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+        }
+        batch.geometry->build();
+    }
+    catch (Ogre::Exception& e)
+    {
+        OgreRenderingModule::LogWarning("MeshInstancer: could not build a batch, drawing its entities individually: " + std::string(e.what()));
+        Release(batch);
+        return;
+    }
+
+    // Picking hits the individual entities, so leave the batches out of the scene queries.
+    Ogre::StaticGeometry::RegionIterator regions = batch.geometry->getRegionIterator();
+    while(regions.hasMoreElements())
+        regions.getNext()->setQueryFlags(0);
+
+    for(std::set<Ogre::Entity*>::iterator iter = batch.members.begin(); iter != batch.members.end(); ++iter)
+        Hide(*iter, instances_[*iter]);
+    batch.built = true;
+}
+
+void MeshInstancer::Release(Batch& batch)
+{
+    for(std::set<Ogre::Entity*>::iterator iter = batch.members.begin(); iter != batch.members.end(); ++iter)
+        Show(*iter, instances_[*iter]);
+    if (batch.geometry)
+    {
+        sceneManager_->destroyStaticGeometry(batch.geometry);
+        batch.geometry = 0;
+    }
+    batch.built = false;
+}
+
+void MeshInstancer::Reset()
+{
+    for(BatchMap::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        Release(iter->second);
+    batches_.clear();
+    for(InstanceMap::iterator iter = instances_.begin(); iter != instances_.end(); ++iter)
+    {
+        iter->second.batch = 0;
+        waiting_.insert(iter->first);
+    }
+}
+
+bool MeshInstancer::Exists(Ogre::Entity* entity, const Instance& instance) const
+{
+    // Compare the pointers without dereferencing a destroyed entity.
+    return sceneManager_->hasEntity(instance.name) && sceneManager_->getEntity(instance.name) == entity;
+}
+
+void MeshInstancer::Hide(Ogre::Entity* entity, Instance& instance)
+{
+    if (instance.hidden)
+        return;
+    // A zero visibility mask leaves the entity out of the rendering, but not out of the scene queries.
+    instance.visibilityFlags = entity->getVisibilityFlags();
+    entity->setVisibilityFlags(0);
+    instance.hidden = true;
+}
+
+void MeshInstancer::Show(Ogre::Entity* entity, Instance& instance)
+{
+    if (!instance.hidden)
+        return;
+    entity->setVisibilityFlags(instance.visibilityFlags);
+    instance.hidden = false;
+}
+
+}
@@ -0,0 +1,184 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_OgreRenderer_MeshInstancer_h
+#define incl_OgreRenderer_MeshInstancer_h
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+#include "SceneFwd.h"
+
+#include <OgreVector3.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace Ogre
+{
+    class Entity;
+    class SceneManager;
+    class StaticGeometry;
+}
+
+namespace OgreRenderer
+{
+    //! Draws repeated static meshes in batches, instead of one draw call per entity and submesh.
+    /*! EC_Mesh adds its Ogre entity here when the entity is static: it has no skeleton or vertex animation, no LOD bias,
+        nothing attached to it, and its placeable has no parent. The entities that share a mesh, the materials, the shadow casting and the draw distance,
+        and lie in the same cell of a world-space grid, are merged into a batch. The entities in a batch are hidden from the viewports
+        with their visibility flags, but stay in the scene for picking.
+
+        When an instance changes, only the batch of its cell is rebuilt, on the next Update(). An instance that was moved is drawn
+        individually until it has not moved for a while, so that moving objects do not cause a rebuild every frame.
+
+        Ogre 1.7 has no hardware instancing that works with the existing materials, so the batches are Ogre::StaticGeometry.
+        \ingroup OgreRenderingModuleClient
+    */
+    class OGRE_MODULE_API MeshInstancer
+    {
+    public:
+        explicit MeshInstancer(Ogre::SceneManager* sceneManager);
+
+        //! Destroys the batches, and shows the instanced entities that still exist individually again
+        ~MeshInstancer();
+
+        //! Adds an entity, or updates it after its mesh, materials, shadow casting, draw distance or visibility changed
+        /*! \param scene The scene the entity belongs to, see RemoveScene(). Only used when the entity is added for the first time
+         */
+        void Add(Ogre::Entity* entity, Scene::SceneManager* scene = 0);
+
+        //! Updates an entity after it moved. It is drawn individually until it has stayed still for a while
+        void Move(Ogre::Entity* entity);
+
+        //! Removes an entity. Call before destroying the entity, or when it can no longer be batched
+        void Remove(Ogre::Entity* entity);
+
+        //! Removes the entities of a scene that is being torn down. The batches of the other scenes are rebuilt without them on the next Update()
+        /*! The entities may have been destroyed without Remove(). The ones that still exist in the scene manager are shown individually again.
+         */
+        void RemoveScene(Scene::SceneManager* scene);
+
+        //! Returns true if the entity has been added
+        bool Contains(Ogre::Entity* entity) const { return instances_.find(entity) != instances_.end(); }
+
+        //! Destroys the batches and forgets all the entities
+        /*! The entities may have been destroyed without Remove(). The ones that still exist in the scene manager are shown individually again.
+         */
+        void Clear();
+
+        //! Puts the changed instances into batches, and rebuilds the changed batches. Call once per frame before rendering
+        void Update();
+
+        //! Enables or disables the batching. When disabled, all the entities are drawn individually
+        void SetEnabled(bool enabled);
+
+        bool IsEnabled() const { return enabled_; }
+
+        //! Sets the least number of instances in a batch. Smaller groups are drawn individually. Default is 2
+        void SetMinInstances(uint count);
+
+        //! Sets the size of the cells that the batches are divided into. Default is 64
+        void SetCellSize(float size);
+
+        //! Returns the number of entities that are drawn in batches
+        uint GetNumInstanced() const;
+
+        //! Returns the number of entities that are drawn individually
+        uint GetNumIndividual() const { return (uint)instances_.size() - GetNumInstanced(); }
+
+        //! Returns the number of batches that are drawn
+        uint GetNumBatches() const;
+
+    private:
+        struct Batch;
+
+        struct Instance
+        {
+            Instance() : batch(0), lastMoved(0), visibilityFlags(0), hidden(false), scene(0) {}
+
+            //! The batch the instance is in, or null if it is waiting to be put into one
+            Batch* batch;
+
+            //! Time of the last move
+            tick_t lastMoved;
+
+            //! The visibility flags of the entity before it was hidden
+            uint visibilityFlags;
+
+            //! True if the entity is hidden, because its batch draws it
+            bool hidden;
+
+            //! Name of the entity, for checking that it still exists
+            std::string name;
+
+            //! The scene the entity belongs to, or null if not known
+            Scene::SceneManager* scene;
+        };
+
+        struct Batch
+        {
+            Batch() : geometry(0), built(false), dirty(false) {}
+
+            std::string key;
+
+            //! The minimum corner of the cell of the batch
+            Ogre::Vector3 cellOrigin;
+
+            Ogre::StaticGeometry* geometry;
+            std::set<Ogre::Entity*> members;
+
+            //! True if the members are drawn by the geometry
+            bool built;
+
+            //! True if the members changed since the last build
+            bool dirty;
+        };
+
+        typedef std::map<Ogre::Entity*, Instance> InstanceMap;
+        typedef std::map<std::string, Batch> BatchMap;
+
+        //! Returns the key of the batch an entity belongs to, and the minimum corner of its cell
+        std::string BatchKey(Ogre::Entity* entity, Ogre::Vector3& cellOrigin) const;
+
+        //! Takes an instance out of its batch, and marks it waiting
+        void Unbatch(Ogre::Entity* entity, Instance& instance);
+
+        //! Rebuilds a batch, or shows its members individually if there are too few of them
+        void Rebuild(Batch& batch);
+
+        //! Destroys the geometry of a batch and shows its members individually
+        void Release(Batch& batch);
+
+        //! Destroys all the batches, and puts all the instances waiting
+        void Reset();
+
+        //! Returns true if the entity of an instance still exists in the scene manager. Does not dereference the entity
+        bool Exists(Ogre::Entity* entity, const Instance& instance) const;
+
+        //! Hides the entity, which is drawn by a batch
+        void Hide(Ogre::Entity* entity, Instance& instance);
+
+        //! Shows the entity individually
+        void Show(Ogre::Entity* entity, Instance& instance);
+
+        Ogre::SceneManager* sceneManager_;
+        InstanceMap instances_;
+        BatchMap batches_;
+
+        //! The instances that are not in a batch
+        std::set<Ogre::Entity*> waiting_;
+
+        bool enabled_;
+        uint minInstances_;
+        float cellSize_;
+
+        //! How long a moved instance is drawn individually, in clock ticks
+        tick_t settleTime_;
+
+        //! Counter for unique geometry names
+        uint geometryId_;
+    };
+}
+
+#endif
@@ -235,6 +235,17 @@ bool OgreMaterialAsset::IsLoaded() const
     return ogreMaterial.get() != 0;
 }
 
+size_t OgreMaterialAsset::MemoryUsage() const
+{
+    return ogreMaterial.isNull() ? 0 : ogreMaterial->getSize();
+}
+
+bool OgreMaterialAsset::HasExternalReferences() const
+{
+    // The Ogre resource system holds its own references to the material, and we hold one.
+    return !ogreMaterial.isNull() && ogreMaterial.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
+
 void OgreMaterialAsset::DoUnload()
 {
     if (ogreMaterial.isNull())
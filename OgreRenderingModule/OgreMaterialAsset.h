@@ -33,6 +33,12 @@ public:
 
     bool IsLoaded() const;
 
+    /// Returns the size of the Ogre material. The textures it uses are accounted for by their own assets.
+    virtual size_t MemoryUsage() const;
+
+    /// Returns true if some Ogre entity is still using the Ogre material.
+    virtual bool HasExternalReferences() const;
+
     /// Material ptr to the asset in ogre
     Ogre::MaterialPtr ogreMaterial;
 
@@ -4,7 +4,10 @@
 #include "OgreMeshAsset.h"
 #include "OgreConversionUtils.h"
 #include "OgreRenderingModule.h"
+#include "MeshCollisionData.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
+#include "HighPerfClock.h"
 
 #include <QFile>
 #include <Ogre.h>
@@ -12,6 +15,50 @@
 #include "LoggingFunctions.h"
 DEFINE_POCO_LOGGING_FUNCTIONS("OgreMeshAsset")
 
+namespace
+{
+    /// The version of the post-processing done in OgreMeshAsset::PostProcessMesh.
+    const int ProcessedMeshVersion = 2;
+
+    /// Meshes with fewer vertices are not worth simplifying.
+    const size_t cMinLodVertices = 500;
+
+    /// The distances of the generated LOD levels, in multiples of the bounding radius of the mesh.
+    const Ogre::Real cLodDistances[] = { 10.0f, 25.0f, 60.0f };
+
+    /// The proportion of the vertices removed at each generated LOD level.
+    const Ogre::Real cLodReduction = 0.5f;
+
+    /// Whether OgreMeshAsset::PostProcessMesh generates LOD levels.
+    bool generateLods = true;
+
+    /// Returns the number of vertices in a mesh, or 0 if the mesh can not be simplified.
+    size_t SimplifiableVertexCount(Ogre::Mesh *mesh)
+    {
+        size_t count = mesh->sharedVertexData ? mesh->sharedVertexData->vertexCount : 0;
+        for(uint i = 0; i < mesh->getNumSubMeshes(); ++i)
+        {
+            Ogre::SubMesh *submesh = mesh->getSubMesh(i);
+            // The edge collapse works on triangle lists only.
+            if (submesh->operationType != Ogre::RenderOperation::OT_TRIANGLE_LIST || !submesh->indexData || submesh->indexData->indexCount == 0)
+                return 0;
+            if (!submesh->useSharedVertices && submesh->vertexData)
+                count += submesh->vertexData->vertexCount;
+        }
+        return count;
+    }
+
+    /// Creates an empty mesh to import the data into.
+    Ogre::MeshPtr CreateEmptyMesh(const QString &assetName)
+    {
+        Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(
+            OgreRenderer::SanitateAssetIdForOgre(assetName.toStdString()), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+        if (!mesh.isNull())
+            mesh->setAutoBuildEdgeLists(false);
+        return mesh;
+    }
+}
+
 OgreMeshAsset::~OgreMeshAsset()
 {
     Unload();
@@ -29,45 +76,71 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes)
 
     if (ogreMesh.isNull())
     {   
-        ogreMesh = Ogre::MeshManager::getSingleton().createManual(
-            OgreRenderer::SanitateAssetIdForOgre(this->Name().toStdString()), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+        ogreMesh = CreateEmptyMesh(Name());
         if (ogreMesh.isNull())
         {
             LogError("Failed to create mesh " + Name().toStdString());
             return false; 
         }
-        ogreMesh->setAutoBuildEdgeLists(false);
     }
 
-    std::vector<u8> tempData(data_, data_ + numBytes);
-#include "DisableMemoryLeakCheck.h"
-    Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&tempData[0], numBytes, false));
-#include "EnableMemoryLeakCheck.h"
-    Ogre::MeshSerializer serializer;
-    serializer.importMesh(stream, ogreMesh.getPointer()); // Note: importMesh *adds* submeshes to an existing mesh. It doesn't replace old ones.
-    
-    // Generate tangents to mesh
-    try
+    const tick_t startTime = GetCurrentClockTime();
+
+    // Building the tangents is slow for large meshes, so the post-processed mesh is kept in the asset cache, keyed by the content hash
+    // of the source data. A change in the source data changes the hash, so a stale processed mesh is never used.
+    AssetCache *cache = assetAPI ? assetAPI->GetAssetCache() : 0;
+    const QString hash = ContentHash();
+    bool loadedProcessed = false;
+    if (cache && !hash.isEmpty())
     {
-        unsigned short src, dest;
-        ///\bug Crashes if called for a mesh that has null or zero vertices in the vertex buffer, or null or zero indices in the index buffer.
-        if (!ogreMesh->suggestTangentVectorBuildParams(Ogre::VES_TANGENT, src, dest))
-            ogreMesh->buildTangentVectors(Ogre::VES_TANGENT, src, dest);
+        std::vector<u8> processedData;
+        if (cache->LoadDerivedData(hash, ProcessedMeshCacheType(), processedData))
+        {
+            try
+            {
+                ImportMesh(ogreMesh.get(), &processedData[0], processedData.size());
+                loadedProcessed = true;
+            }
+            catch (Ogre::Exception &e)
+            {
+                LogWarning("Failed to load the cached processed mesh for " + Name().toStdString() + ", processing it again: " + std::string(e.what()));
+                cache->DeleteDerivedData(hash, ProcessedMeshCacheType());
+                // Start over from an empty mesh.
+                DoUnload();
+                ogreMesh = CreateEmptyMesh(Name());
+                if (ogreMesh.isNull())
+                {
+                    LogError("Failed to create mesh " + Name().toStdString());
+                    return false;
+                }
+            }
+        }
     }
-    catch (...) {}
-    
-    // Generate extremity points to submeshes, 1 should be enough
-    try
+
+    if (!loadedProcessed)
     {
-        for(uint i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+        try
         {
-            Ogre::SubMesh *smesh = ogreMesh->getSubMesh(i);
-            if (smesh)
-                smesh->generateExtremes(1);
+            ImportMesh(ogreMesh.get(), data_, numBytes);
+        }
+        catch (Ogre::Exception &e)
+        {
+            LogError("Failed to import mesh " + Name().toStdString() + ": " + std::string(e.what()));
+            Unload();
+            return false;
         }
+        PostProcessMesh(ogreMesh.get());
+
+        // Store the processed mesh before the default materials are set, so that it keeps the material names of the source.
+        std::vector<u8> processedData;
+        if (cache && !hash.isEmpty() && SerializeTo(processedData, ""))
+            cache->StoreDerivedData(hash, ProcessedMeshCacheType(), processedData);
     }
-    catch (...) {}
-        
+
+    const double msecs = (GetCurrentClockTime() - startTime) * 1000.0 / GetCurrentClockFreq();
+    LogDebug("Mesh " + Name().toStdString() + (loadedProcessed ? " loaded from the processed mesh cache in " : " imported and processed in ") +
+        QString::number(msecs).toStdString() + " msecs");
+
     try
     {
         // Assign default materials that won't complain
@@ -82,12 +155,88 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes)
         return false;
     }
 
+    // Cache the triangles for picking, so that raycasts need not read them back from the hardware buffers.
+    try
+    {
+        OgreRenderer::MeshCollisionData::Register(ogreMesh.get());
+    }
+    catch (Ogre::Exception &e)
+    {
+        LogWarning("Failed to read the geometry of mesh " + this->Name().toStdString() + " for picking: " + std::string(e.what()));
+    }
+
     //internal_name_ = SanitateAssetIdForOgre(id_);
     
     LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
     return true;
 }
 
+void OgreMeshAsset::ImportMesh(Ogre::Mesh *mesh, const u8 *data, size_t numBytes)
+{
+    std::vector<u8> tempData(data, data + numBytes);
+#include "DisableMemoryLeakCheck.h"
+    Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&tempData[0], numBytes, false));
+#include "EnableMemoryLeakCheck.h"
+    Ogre::MeshSerializer serializer;
+    serializer.importMesh(stream, mesh); // Note: importMesh *adds* submeshes to an existing mesh. It doesn't replace old ones.
+}
+
+void OgreMeshAsset::PostProcessMesh(Ogre::Mesh *mesh)
+{
+    PROFILE(OgreMeshAsset_PostProcessMesh);
+
+    // Generate tangents to mesh
+    try
+    {
+        unsigned short src, dest;
+        ///\bug Crashes if called for a mesh that has null or zero vertices in the vertex buffer, or null or zero indices in the index buffer.
+        if (!mesh->suggestTangentVectorBuildParams(Ogre::VES_TANGENT, src, dest))
+            mesh->buildTangentVectors(Ogre::VES_TANGENT, src, dest);
+    }
+    catch (...) {}
+    
+    // Generate extremity points to submeshes, 1 should be enough
+    try
+    {
+        for(uint i = 0; i < mesh->getNumSubMeshes(); ++i)
+        {
+            Ogre::SubMesh *smesh = mesh->getSubMesh(i);
+            if (smesh)
+                smesh->generateExtremes(1);
+        }
+    }
+    catch (...) {}
+
+    // Generate distance LOD levels by edge collapse, unless the mesh has its own
+    if (generateLods && mesh->getNumLodLevels() == 1 && SimplifiableVertexCount(mesh) >= cMinLodVertices)
+    {
+        PROFILE(OgreMeshAsset_GenerateLodLevels);
+        try
+        {
+            const Ogre::Real radius = mesh->getBoundingSphereRadius();
+            Ogre::Mesh::LodValueList distances;
+            for(uint i = 0; i < sizeof(cLodDistances) / sizeof(cLodDistances[0]); ++i)
+                distances.push_back(radius * cLodDistances[i]);
+            mesh->generateLodLevels(distances, Ogre::ProgressiveMesh::VRQ_PROPORTIONAL, cLodReduction);
+        }
+        catch (Ogre::Exception &e)
+        {
+            LogWarning("Failed to generate LOD levels for mesh " + mesh->getName() + ": " + std::string(e.what()));
+            mesh->removeLodLevels();
+        }
+    }
+}
+
+void OgreMeshAsset::SetGenerateLods(bool enabled)
+{
+    generateLods = enabled;
+}
+
+QString OgreMeshAsset::ProcessedMeshCacheType()
+{
+    return QString("processedmesh.v%1.ogre%2%3").arg(ProcessedMeshVersion).arg(OGRE_VERSION, 0, 16).arg(generateLods ? ".lod" : "");
+}
+
 void OgreMeshAsset::HandleLoadError(const QString &loadError)
 {
     LogDebug(loadError.toStdString());
@@ -99,6 +248,7 @@ void OgreMeshAsset::DoUnload()
         return;
 
     std::string meshName = ogreMesh->getName();
+    OgreRenderer::MeshCollisionData::Unregister(ogreMesh.get());
     ogreMesh.setNull();
     try
     {
@@ -129,6 +279,20 @@ bool OgreMeshAsset::IsLoaded() const
     return ogreMesh.get() != 0;
 }
 
+size_t OgreMeshAsset::MemoryUsage() const
+{
+    if (ogreMesh.isNull())
+        return 0;
+    OgreRenderer::MeshCollisionDataPtr collisionData = OgreRenderer::MeshCollisionData::Find(ogreMesh.get());
+    return ogreMesh->getSize() + (collisionData ? collisionData->MemoryUsage() : 0);
+}
+
+bool OgreMeshAsset::HasExternalReferences() const
+{
+    // The Ogre resource system holds its own references to the mesh, and we hold one.
+    return !ogreMesh.isNull() && ogreMesh.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
+
 bool OgreMeshAsset::SerializeTo(std::vector<u8> &data, const QString &serializationParameters) const
 {
     if (ogreMesh.isNull())
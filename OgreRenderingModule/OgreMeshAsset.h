@@ -37,8 +37,29 @@ public:
 
     void SetDefaultMaterial();
 
+    /// Generates the tangents and the submesh extremity points of a mesh that was imported from the source data.
+    /** If enabled with SetGenerateLods, also generates distance LOD levels for large meshes that have none. */
+    static void PostProcessMesh(Ogre::Mesh *mesh);
+
+    /// Sets whether PostProcessMesh generates LOD levels. The meshes that are already loaded are not affected.
+    static void SetGenerateLods(bool enabled);
+
+    /// Imports a mesh from serialized data. Note that the submeshes are added to the existing ones of the mesh.
+    static void ImportMesh(Ogre::Mesh *mesh, const u8 *data, size_t numBytes);
+
+    /// Returns the type of the post-processed meshes in the derived data of the asset cache.
+    /** The type contains a version of the post-processing and the version of Ogre, so that the cached meshes are not used after
+        either changes. Bump ProcessedMeshVersion in OgreMeshAsset.cpp when changing PostProcessMesh. */
+    static QString ProcessedMeshCacheType();
+
     bool IsLoaded() const;
 
+    /// Returns the size of the Ogre mesh, including its vertex and index buffers.
+    virtual size_t MemoryUsage() const;
+
+    /// Returns true if some Ogre entity is still using the Ogre mesh.
+    virtual bool HasExternalReferences() const;
+
     /// This points to the loaded mesh asset, if it is present.
     Ogre::MeshPtr ogreMesh;
 
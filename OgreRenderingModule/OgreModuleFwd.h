@@ -47,6 +47,8 @@ namespace OgreRenderer
     class StereoController;
     class CompositionHandler;
     class GaussianListener;
+    class MeshCollisionData;
+    typedef boost::shared_ptr<MeshCollisionData> MeshCollisionDataPtr;
 
     typedef boost::shared_ptr<Ogre::Root> OgreRootPtr;
     typedef boost::shared_ptr<LogListener> OgreLogListenerPtr;
@@ -5,6 +5,7 @@
 
 #include "OgreRenderingModule.h"
 #include "Renderer.h"
+#include "MeshInstancer.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
 #include "EC_OgreSky.h"
@@ -35,6 +36,8 @@
 #include "ConsoleAPI.h"
 #include "ConsoleCommandUtils.h"
 #include "VersionInfo.h"
+#include "AssetCache.h"
+#include "HighPerfClock.h"
 
 #include "MemoryLeakCheck.h"
 
@@ -76,6 +79,8 @@ namespace OgreRenderer
         framework_->Asset()->RegisterAssetTypeFactory(AssetTypeFactoryPtr(new GenericAssetFactory<OgreParticleAsset>("OgreParticle")));
         framework_->Asset()->RegisterAssetTypeFactory(AssetTypeFactoryPtr(new GenericAssetFactory<OgreSkeletonAsset>("OgreSkeleton")));
         framework_->Asset()->RegisterAssetTypeFactory(AssetTypeFactoryPtr(new GenericAssetFactory<OgreMaterialAsset>("OgreMaterial")));
+
+        OgreMeshAsset::SetGenerateLods(framework_->GetDefaultConfig().DeclareSetting("OgreRenderer", "generate_mesh_lods", true));
     }
 
     void OgreRenderingModule::PreInitialize()
@@ -118,6 +123,12 @@ namespace OgreRenderer
         framework_->Console()->RegisterCommand(CreateConsoleCommand(
                 "RenderStats", "Prints out render statistics.", 
                 ConsoleBind(this, &OgreRenderingModule::ConsoleStats)));
+        framework_->Console()->RegisterCommand(CreateConsoleCommand(
+                "MeshInstancing", "Enables or disables drawing repeated static meshes in batches. Usage: MeshInstancing(on|off)",
+                ConsoleBind(this, &OgreRenderingModule::ConsoleMeshInstancing)));
+        framework_->Console()->RegisterCommand(CreateConsoleCommand(
+                "BenchmarkMeshLoad", "Compares the load times of a mesh from its source data and from the processed mesh cache. Usage: BenchmarkMeshLoad(assetRef,iterations)",
+                ConsoleBind(this, &OgreRenderingModule::ConsoleBenchmarkMeshLoad)));
         renderer_settings_ = RendererSettingsPtr(new RendererSettings(framework_));
     }
 
@@ -204,11 +215,91 @@ namespace OgreRenderer
             c->Print("Best FPS: " + QString::number(stats.bestFPS));
             c->Print("Triangles: " + QString::number(stats.triangleCount));
             c->Print("Batches: " + QString::number(stats.batchCount));
+            MeshInstancer *instancer = renderer_->GetMeshInstancer();
+            if (instancer)
+            {
+                c->Print("Instanced meshes: " + QString::number(instancer->GetNumInstanced()) + " in " +
+                    QString::number(instancer->GetNumBatches()) + " batches");
+                c->Print("Individual meshes: " + QString::number(instancer->GetNumIndividual()));
+            }
             return ConsoleResultSuccess();
         }
 
         return ConsoleResultFailure("No renderer found.");
     }
+
+    ConsoleCommandResult OgreRenderingModule::ConsoleMeshInstancing(const StringVector &params)
+    {
+        if (!renderer_ || !renderer_->GetMeshInstancer())
+            return ConsoleResultFailure("No renderer found.");
+        if (params.empty() || (params[0] != "on" && params[0] != "off"))
+            return ConsoleResultFailure("Usage: MeshInstancing(on|off)");
+        renderer_->GetMeshInstancer()->SetEnabled(params[0] == "on");
+        return ConsoleResultSuccess();
+    }
+
+    ConsoleCommandResult OgreRenderingModule::ConsoleBenchmarkMeshLoad(const StringVector &params)
+    {
+        if (params.empty())
+            return ConsoleResultFailure("Usage: BenchmarkMeshLoad(assetRef,iterations)");
+        int iterations = 10;
+        if (params.size() > 1)
+            iterations = std::max(1, ParseString<int>(params[1], iterations));
+
+        AssetAPI *assetAPI = framework_->Asset();
+        AssetPtr asset = assetAPI->GetAsset(params[0].c_str());
+        if (!asset || asset->DiskSource().isEmpty())
+            return ConsoleResultFailure("Mesh asset " + params[0] + " is not loaded from a disk source.");
+        AssetCache *cache = assetAPI->GetAssetCache();
+        if (!cache)
+            return ConsoleResultFailure("No asset cache.");
+
+        std::vector<u8> sourceData;
+        if (!LoadFileToVector(asset->DiskSource().toStdString().c_str(), sourceData) || sourceData.empty())
+            return ConsoleResultFailure("Could not read " + asset->DiskSource().toStdString());
+        // The processed mesh is stored when the asset is loaded the first time.
+        std::vector<u8> processedData;
+        if (!cache->LoadDerivedData(asset->ContentHash(), OgreMeshAsset::ProcessedMeshCacheType(), processedData))
+            return ConsoleResultFailure("No processed mesh in the asset cache for " + params[0] + ".");
+
+        Ogre::MeshManager &meshManager = Ogre::MeshManager::getSingleton();
+        tick_t sourceTicks = 0;
+        tick_t processedTicks = 0;
+        try
+        {
+            for(int i = 0; i < iterations; ++i)
+            {
+                tick_t start = GetCurrentClockTime();
+                Ogre::MeshPtr mesh = meshManager.createManual("BenchmarkMeshLoad_source", Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+                OgreMeshAsset::ImportMesh(mesh.get(), &sourceData[0], sourceData.size());
+                OgreMeshAsset::PostProcessMesh(mesh.get());
+                sourceTicks += GetCurrentClockTime() - start;
+                mesh.setNull();
+                meshManager.remove("BenchmarkMeshLoad_source");
+
+                start = GetCurrentClockTime();
+                mesh = meshManager.createManual("BenchmarkMeshLoad_processed", Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+                OgreMeshAsset::ImportMesh(mesh.get(), &processedData[0], processedData.size());
+                processedTicks += GetCurrentClockTime() - start;
+                mesh.setNull();
+                meshManager.remove("BenchmarkMeshLoad_processed");
+            }
+        }
+        catch (Ogre::Exception &e)
+        {
+            meshManager.remove("BenchmarkMeshLoad_source");
+            meshManager.remove("BenchmarkMeshLoad_processed");
+            return ConsoleResultFailure("Failed to load the mesh: " + std::string(e.what()));
+        }
+
+        const double msecsPerTick = 1000.0 / GetCurrentClockFreq() / iterations;
+        ConsoleAPI *c = framework_->Console();
+        c->Print("Source data: " + QString::number(sourceData.size()) + " bytes, import and processing " +
+            QString::number(sourceTicks * msecsPerTick) + " msecs");
+        c->Print("Processed data: " + QString::number(processedData.size()) + " bytes, import " +
+            QString::number(processedTicks * msecsPerTick) + " msecs");
+        return ConsoleResultSuccess();
+    }
 }
 
 extern "C" void POCO_LIBRARY_API SetProfiler(Foundation::Profiler *profiler);
@@ -57,6 +57,12 @@ namespace OgreRenderer
         //! callback for console command
         ConsoleCommandResult ConsoleStats(const StringVector &params);
 
+        //! callback for console command. Enables or disables the mesh instancing
+        ConsoleCommandResult ConsoleMeshInstancing(const StringVector &params);
+
+        //! callback for console command. Compares the load times of a mesh from its source data and from the processed mesh cache.
+        ConsoleCommandResult ConsoleBenchmarkMeshLoad(const StringVector &params);
+
     public slots:
         //! returns settings widget 
         QWidget *GetRendererSettingsWidget();
@@ -108,3 +108,14 @@ bool OgreSkeletonAsset::IsLoaded() const
 {
     return ogreSkeleton.get() != 0;
 }
+
+size_t OgreSkeletonAsset::MemoryUsage() const
+{
+    return ogreSkeleton.isNull() ? 0 : ogreSkeleton->getSize();
+}
+
+bool OgreSkeletonAsset::HasExternalReferences() const
+{
+    // The Ogre resource system holds its own references to the skeleton, and we hold one.
+    return !ogreSkeleton.isNull() && ogreSkeleton.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
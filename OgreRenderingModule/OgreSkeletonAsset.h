@@ -28,6 +28,10 @@ public:
 
     bool IsLoaded() const;
 
+    virtual size_t MemoryUsage() const;
+
+    virtual bool HasExternalReferences() const;
+
     Ogre::SkeletonPtr ogreSkeleton;
 
     std::string internal_name_;
@@ -0,0 +1,309 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "RaycastQuery.h"
+#include "Renderer.h"
+#include "RenderWindow.h"
+#include "MeshCollisionData.h"
+#include "Entity.h"
+
+#include <Ogre.h>
+#include <QRect>
+
+#include "MemoryLeakCheck.h"
+
+namespace OgreRenderer
+{
+
+namespace
+{
+    uint GetSubmeshFromIndexRange(uint index, const std::vector<uint>& submeshstartindex)
+    {
+        for(uint i = 0; i < submeshstartindex.size(); ++i)
+        {
+            uint start = submeshstartindex[i];
+            uint end;
+            if (i < submeshstartindex.size() - 1)
+                end = submeshstartindex[i+1];
+            else
+                end = 0x7fffffff;
+            if ((index >= start) && (index < end))
+                return i;
+        }
+        return 0; // should never happen
+    }
+
+    // Get the mesh information for the given mesh. Version which supports animation
+    void GetMeshInformation(
+        Ogre::Entity *entity,
+        std::vector<Ogre::Vector3>& vertices,
+        std::vector<Ogre::Vector2>& texcoords,
+        std::vector<uint>& indices,
+        std::vector<uint>& submeshstartindex,
+        const Ogre::Vector3 &position,
+        const Ogre::Quaternion &orient,
+        const Ogre::Vector3 &scale)
+    {
+        PROFILE(Renderer_GetMeshInformation);
+
+        bool useSoftwareBlendingVertices = entity->hasSkeleton();
+        if (useSoftwareBlendingVertices)
+            entity->_updateAnimation();
+
+        MeshCollisionData::ReadGeometry(entity->getMesh().get(), useSoftwareBlendingVertices ? entity : 0, vertices, texcoords, indices, submeshstartindex);
+
+        for(size_t i = 0; i < vertices.size(); ++i)
+            vertices[i] = (orient * (vertices[i] * scale)) + position;
+    }
+
+    Ogre::Vector2 FindUVs(
+        const Ogre::Ray& ray,
+        float distance,
+        const std::vector<Ogre::Vector3>& vertices,
+        const std::vector<Ogre::Vector2>& texcoords,
+        const std::vector<uint>& indices, uint foundindex)
+    {
+        Ogre::Vector3 point = ray.getPoint(distance);
+
+        Ogre::Vector3 t1 = vertices[indices[foundindex]];
+        Ogre::Vector3 t2 = vertices[indices[foundindex+1]];
+        Ogre::Vector3 t3 = vertices[indices[foundindex+2]];
+
+        Ogre::Vector3 v1 = point - t1;
+        Ogre::Vector3 v2 = point - t2;
+        Ogre::Vector3 v3 = point - t3;
+
+        float area1 = (v2.crossProduct(v3)).length() / 2.0f;
+        float area2 = (v1.crossProduct(v3)).length() / 2.0f;
+        float area3 = (v1.crossProduct(v2)).length() / 2.0f;
+        float sum_area = area1 + area2 + area3;
+        if (sum_area == 0.0)
+            return Ogre::Vector2(0.0f, 0.0f);
+
+        Ogre::Vector3 bary(area1 / sum_area, area2 / sum_area, area3 / sum_area);
+        Ogre::Vector2 t = texcoords[indices[foundindex]] * bary.x + texcoords[indices[foundindex+1]] * bary.y + texcoords[indices[foundindex+2]] * bary.z;
+
+        return t;
+    }
+
+    //! Orders hits nearest first.
+    bool NearerHit(const RaycastHit &a, const RaycastHit &b)
+    {
+        return a.distance < b.distance;
+    }
+
+    void FillHit(RaycastHit &hit, const Ogre::Ray &ray, float distance, const Ogre::Vector3 &normal, uint submesh, const Ogre::Vector2 &uv)
+    {
+        Ogre::Vector3 point = ray.getPoint(distance);
+        Ogre::Vector3 unitNormal = normal.normalisedCopy();
+        hit.distance = distance;
+        hit.pos = Vector3df(point.x, point.y, point.z);
+        hit.normal = Vector3df(unitNormal.x, unitNormal.y, unitNormal.z);
+        hit.submesh = submesh;
+        hit.u = uv.x;
+        hit.v = uv.y;
+    }
+}
+
+RaycastQuery::RaycastQuery(Renderer* renderer) :
+    renderer_(renderer),
+    rayQuery_(0),
+    volumeQuery_(0),
+    queryMask_(0xffffffff),
+    maxDistance_(std::numeric_limits<float>::max())
+{
+    assert(renderer_ && renderer_->GetSceneManager());
+    rayQuery_ = renderer_->GetSceneManager()->createRayQuery(Ogre::Ray());
+    rayQuery_->setSortByDistance(true);
+    volumeQuery_ = renderer_->GetSceneManager()->createPlaneBoundedVolumeQuery(Ogre::PlaneBoundedVolumeList());
+}
+
+RaycastQuery::~RaycastQuery()
+{
+    Ogre::SceneManager* sceneManager = renderer_->GetSceneManager();
+    if (sceneManager)
+    {
+        sceneManager->destroyQuery(rayQuery_);
+        sceneManager->destroyQuery(volumeQuery_);
+    }
+}
+
+const std::vector<RaycastHit>& RaycastQuery::Cast(const Vector3df& origin, const Vector3df& direction)
+{
+    Ogre::Vector3 dir(direction.x, direction.y, direction.z);
+    if (dir.normalise() == 0.0f)
+    {
+        hits_.clear();
+        return hits_;
+    }
+    Execute(Ogre::Ray(Ogre::Vector3(origin.x, origin.y, origin.z), dir));
+    return hits_;
+}
+
+const std::vector<RaycastHit>& RaycastQuery::CastFromScreen(int x, int y)
+{
+    RenderWindow* window = renderer_->GetRenderWindow();
+    Ogre::Camera* camera = renderer_->GetCurrentCamera();
+    if (!window || !camera)
+    {
+        hits_.clear();
+        return hits_;
+    }
+
+    float screenx = x / (float)window->OgreRenderWindow()->getWidth();
+    float screeny = y / (float)window->OgreRenderWindow()->getHeight();
+    Execute(camera->getCameraToViewportRay(screenx, screeny));
+    return hits_;
+}
+
+const std::vector<Scene::Entity*>& RaycastQuery::QueryRegion(const QRect& rect)
+{
+    entities_.clear();
+
+    RenderWindow* window = renderer_->GetRenderWindow();
+    Ogre::Camera* camera = renderer_->GetCurrentCamera();
+    if (!window || !camera)
+        return entities_;
+
+    float w = (float)window->OgreRenderWindow()->getWidth();
+    float h = (float)window->OgreRenderWindow()->getHeight();
+    float left = (float)(rect.left()) / w, right = (float)(rect.right()) / w;
+    float top = (float)(rect.top()) / h, bottom = (float)(rect.bottom()) / h;
+
+    if (left > right) std::swap(left, right);
+    if (top > bottom) std::swap(top, bottom);
+    // don't do selection box is too small
+    if ((right - left) * (bottom - top) < 0.0001)
+        return entities_;
+
+    Ogre::PlaneBoundedVolumeList volumes;
+    volumes.push_back(camera->getCameraToViewportBoxVolume(left, top, right, bottom, true));
+    volumeQuery_->setVolumes(volumes);
+    volumeQuery_->setQueryMask(queryMask_);
+
+    Ogre::SceneQueryResult &results = volumeQuery_->execute();
+    for(Ogre::SceneQueryResultMovableList::iterator iter = results.movables.begin(); iter != results.movables.end(); ++iter)
+    {
+        Scene::Entity* entity = EntityOf(*iter);
+        if (entity)
+            entities_.push_back(entity);
+    }
+    return entities_;
+}
+
+Scene::Entity* RaycastQuery::EntityOf(Ogre::MovableObject* object)
+{
+    const Ogre::Any& any = object->getUserAny();
+    if (any.isEmpty())
+        return 0;
+    try
+    {
+        return Ogre::any_cast<Scene::Entity*>(any);
+    }
+    catch (Ogre::InvalidParametersException &/*e*/)
+    {
+        return 0;
+    }
+}
+
+bool RaycastQuery::IntersectObject(Ogre::MovableObject* object, const Ogre::Ray& ray, float boundsDistance, RaycastHit& hit)
+{
+    if (object->getMovableType().compare("Entity") != 0)
+    {
+        // Not an entity, fall back to just using the bounding box - ray intersection
+        FillHit(hit, ray, boundsDistance, -ray.getDirection(), 0, Ogre::Vector2(0.0f, 0.0f));
+        return true;
+    }
+
+    Ogre::Entity* ogre_entity = static_cast<Ogre::Entity*>(object);
+    Ogre::Node* node = ogre_entity->getParentNode();
+
+    // Static meshes loaded from assets have their geometry cached, so test the ray against it in the local space of the entity.
+    MeshCollisionDataPtr collisionData;
+    if (!ogre_entity->hasSkeleton() && !ogre_entity->hasVertexAnimation())
+        collisionData = MeshCollisionData::Find(ogre_entity->getMesh().get());
+    if (collisionData)
+    {
+        const Ogre::Quaternion& orient = node->_getDerivedOrientation();
+        const Ogre::Vector3& scale = node->_getDerivedScale();
+        // The direction is not normalized, so that distances along the local ray are the same as along the world ray.
+        Ogre::Ray localRay((orient.Inverse() * (ray.getOrigin() - node->_getDerivedPosition())) / scale,
+            (orient.Inverse() * ray.getDirection()) / scale);
+
+        float distance;
+        uint j;
+        if (!collisionData->Raycast(localRay, distance, j))
+            return false;
+
+        const std::vector<Ogre::Vector3>& vertices = collisionData->Vertices();
+        const std::vector<uint>& indices = collisionData->Indices();
+        Ogre::Vector3 localNormal = (vertices[indices[j+1]] - vertices[indices[j]]).crossProduct(vertices[indices[j+2]] - vertices[indices[j]]);
+        Ogre::Vector2 uv = FindUVs(localRay, distance, vertices, collisionData->TexCoords(), indices, j);
+        FillHit(hit, ray, distance, orient * (localNormal / scale), collisionData->SubmeshForIndex(j), uv);
+        return true;
+    }
+
+    // Skinned and procedural meshes are read back from the hardware buffers.
+    std::vector<Ogre::Vector3> vertices;
+    std::vector<Ogre::Vector2> texcoords;
+    std::vector<uint> indices;
+    std::vector<uint> submeshstartindex;
+    GetMeshInformation(ogre_entity, vertices, texcoords, indices, submeshstartindex,
+        node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+
+    // test for hitting individual triangles on the mesh
+    float closest_distance = -1.0f;
+    int closest_index = 0;
+    for (int j = 0; j < ((int)indices.size())-2; j += 3)
+    {
+        std::pair<bool, Ogre::Real> result = Ogre::Math::intersects(ray, vertices[indices[j]],
+            vertices[indices[j+1]], vertices[indices[j+2]], true, false);
+        if (result.first && (closest_distance < 0.0f || result.second < closest_distance))
+        {
+            closest_distance = result.second;
+            closest_index = j;
+        }
+    }
+    if (closest_distance < 0.0f)
+        return false;
+
+    const int j = closest_index;
+    Ogre::Vector3 normal = (vertices[indices[j+1]] - vertices[indices[j]]).crossProduct(vertices[indices[j+2]] - vertices[indices[j]]);
+    Ogre::Vector2 uv = FindUVs(ray, closest_distance, vertices, texcoords, indices, j);
+    FillHit(hit, ray, closest_distance, normal, GetSubmeshFromIndexRange(j, submeshstartindex), uv);
+    return true;
+}
+
+void RaycastQuery::Execute(const Ogre::Ray& ray)
+{
+    hits_.clear();
+
+    rayQuery_->setRay(ray);
+    rayQuery_->setQueryMask(queryMask_);
+    Ogre::RaySceneQueryResult &results = rayQuery_->execute();
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        Ogre::RaySceneQueryResultEntry &entry = results[i];
+        // The results are sorted by the distance to the bounds, so the rest are all too far
+        if (entry.distance > maxDistance_)
+            break;
+        if (!entry.movable || !entry.movable->isVisible())
+            continue;
+
+        Scene::Entity* entity = EntityOf(entry.movable);
+        if (!entity)
+            continue;
+
+        RaycastHit hit;
+        if (IntersectObject(entry.movable, ray, entry.distance, hit) && hit.distance <= maxDistance_)
+        {
+            hit.entity = entity;
+            hits_.push_back(hit);
+        }
+    }
+
+    std::sort(hits_.begin(), hits_.end(), NearerHit);
+}
+
+}
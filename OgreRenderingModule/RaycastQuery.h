@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_OgreRenderer_RaycastQuery_h
+#define incl_OgreRenderer_RaycastQuery_h
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "SceneFwd.h"
+#include "Vector3D.h"
+
+#include <OgreRay.h>
+
+#include <vector>
+
+class QRect;
+
+namespace Ogre
+{
+    class MovableObject;
+    class RaySceneQuery;
+    class PlaneBoundedVolumeListSceneQuery;
+}
+
+namespace OgreRenderer
+{
+    //! A hit of a RaycastQuery.
+    struct OGRE_MODULE_API RaycastHit
+    {
+        RaycastHit() : entity(0), distance(0.0f), submesh(0), u(0.0f), v(0.0f) {}
+
+        //! The entity that was hit
+        Scene::Entity* entity;
+
+        //! World coordinates of the hit position
+        Vector3df pos;
+
+        //! World normal of the hit triangle. For objects that are tested by their bounds only, points back along the ray
+        Vector3df normal;
+
+        //! Distance from the origin of the ray to the hit
+        float distance;
+
+        //! Submesh index in the entity, starting from 0
+        unsigned submesh;
+
+        //! U coord in the entity. 0 if no texture mapping
+        float u;
+
+        //! V coord in the entity. 0 if no texture mapping
+        float v;
+    };
+
+    //! A reusable query for all the entities hit by a ray, or inside a region of the screen.
+    /*! Unlike Renderer::Raycast(), which returns only the best hit in a shared result, each query object owns its results,
+        so several can be used at the same time. Create one and keep it around for repeated queries, e.g. hover picking
+        in an editor tool, to avoid creating Ogre scene queries each time.
+
+        World-space rays can be cast also when running headless, against the bounds and the mesh geometry of the scene.
+        Queries from screen coordinates need the render window and the current camera.
+
+        Destroy the query before the renderer.
+        \ingroup OgreRenderingModuleClient
+    */
+    class OGRE_MODULE_API RaycastQuery
+    {
+    public:
+        //! Creates a query against the scene of the given renderer
+        explicit RaycastQuery(Renderer* renderer);
+
+        ~RaycastQuery();
+
+        //! Sets the mask that is matched against the query flags of the Ogre objects. Only the objects with a common bit are hit. Default is all bits set
+        void SetQueryMask(uint mask) { queryMask_ = mask; }
+
+        //! Returns the query mask
+        uint GetQueryMask() const { return queryMask_; }
+
+        //! Sets the maximum distance of hits. Default is unlimited
+        void SetMaxDistance(float distance) { maxDistance_ = distance; }
+
+        //! Returns the maximum distance of hits
+        float GetMaxDistance() const { return maxDistance_; }
+
+        //! Casts a ray in world space
+        /*! \param origin Origin of the ray
+            \param direction Direction of the ray. Will be normalized automatically
+            \return All the hits, nearest first. Valid until the next query with this object
+         */
+        const std::vector<RaycastHit>& Cast(const Vector3df& origin, const Vector3df& direction);
+
+        //! Casts a ray from the current camera through a position in the render window, not scaled to [0,1]
+        /*! \return All the hits, nearest first. Valid until the next query with this object. Empty if there is no render window
+         */
+        const std::vector<RaycastHit>& CastFromScreen(int x, int y);
+
+        //! Returns the entities whose bounds are inside the part of the camera frustum covered by a rectangle of the render window
+        /*! \return The entities. Valid until the next query with this object. Empty if there is no render window
+         */
+        const std::vector<Scene::Entity*>& QueryRegion(const QRect& rect);
+
+        //! Returns the hits of the last Cast() or CastFromScreen()
+        const std::vector<RaycastHit>& Hits() const { return hits_; }
+
+        //! Returns the entity an Ogre object belongs to, or null if it does not belong to one
+        static Scene::Entity* EntityOf(Ogre::MovableObject* object);
+
+        //! Tests a ray against an Ogre object
+        /*! Entities are tested against their triangles, and other objects against their bounds.
+            \param object The object
+            \param ray The ray in world space, with a normalized direction
+            \param boundsDistance Distance to the bounds of the object along the ray
+            \param hit [out] The hit. Only entity is not set
+            \return True if the ray hit the object
+         */
+        static bool IntersectObject(Ogre::MovableObject* object, const Ogre::Ray& ray, float boundsDistance, RaycastHit& hit);
+
+    private:
+        //! Runs the ray query and fills hits_
+        void Execute(const Ogre::Ray& ray);
+
+        Renderer* renderer_;
+        Ogre::RaySceneQuery* rayQuery_;
+        Ogre::PlaneBoundedVolumeListSceneQuery* volumeQuery_;
+        uint queryMask_;
+        float maxDistance_;
+        std::vector<RaycastHit> hits_;
+        std::vector<Scene::Entity*> entities_;
+    };
+}
+
+#endif
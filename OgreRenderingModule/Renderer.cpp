@@ -16,6 +16,8 @@
 
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "CompositionHandler.h"
+#include "RaycastQuery.h"
+#include "MeshInstancer.h"
 #include "OgreDefaultHardwareBufferManager.h"
 
 #include "Framework.h"
@@ -60,6 +62,29 @@
 
 using namespace Foundation;
 
+namespace
+{
+    //! Copies raycast hits to the results given to scripts. Allocates more results to the pool when needed
+    QList<RaycastResult*> ToScriptResults(const std::vector<OgreRenderer::RaycastHit> &hits, std::vector<RaycastResult*> &pool)
+    {
+        while(pool.size() < hits.size())
+            pool.push_back(new RaycastResult());
+
+        QList<RaycastResult*> results;
+        for(size_t i = 0; i < hits.size(); ++i)
+        {
+            RaycastResult *result = pool[i];
+            result->entity_ = hits[i].entity;
+            result->pos_ = hits[i].pos;
+            result->submesh_ = hits[i].submesh;
+            result->u_ = hits[i].u;
+            result->v_ = hits[i].v;
+            results << result;
+        }
+        return results;
+    }
+}
+
 namespace OgreRenderer
 {
     Renderer::Renderer(Framework* framework, const std::string& config, const std::string& plugins, const std::string& window_title) :
@@ -75,6 +100,9 @@ namespace OgreRenderer
         config_filename_(config),
         plugins_filename_(plugins),
         ray_query_(0),
+        region_query_(0),
+        script_query_(0),
+        mesh_instancer_(0),
         window_title_(window_title),
         renderWindow(0),
         last_width_(0),
@@ -98,6 +126,13 @@ namespace OgreRenderer
         if ((scenemanager_) && (scenemanager_->getRenderQueue()))
             scenemanager_->getRenderQueue()->setRenderableListener(0);
 
+        SAFE_DELETE(region_query_);
+        SAFE_DELETE(script_query_);
+        for(size_t i = 0; i < script_results_.size(); ++i)
+            delete script_results_[i];
+        script_results_.clear();
+        SAFE_DELETE(mesh_instancer_);
+
         if (ray_query_)
             if (scenemanager_) {
                 scenemanager_->destroyQuery(ray_query_);
@@ -351,6 +386,9 @@ namespace OgreRenderer
     void Renderer::SetupScene()
     {
         scenemanager_ = root_->createSceneManager(Ogre::ST_GENERIC, "SceneManager");
+        // World-space queries work also headless, against the mesh collision data. The screen-space ones need a window and a camera.
+        region_query_ = new RaycastQuery(this);
+        script_query_ = new RaycastQuery(this);
         if (framework_->IsHeadless())
             return;
 
@@ -368,6 +406,11 @@ namespace OgreRenderer
 
         ray_query_ = scenemanager_->createRayQuery(Ogre::Ray());
         ray_query_->setSortByDistance(true); 
+        mesh_instancer_ = new MeshInstancer(scenemanager_);
+        connect(framework_->Scene(), SIGNAL(SceneAdded(const QString&)), this, SLOT(OnSceneAdded(const QString&)));
+        const SceneMap &scenes = framework_->Scene()->GetSceneMap();
+        for(SceneMap::const_iterator iter = scenes.begin(); iter != scenes.end(); ++iter)
+            OnSceneAdded(iter->first);
 
         renderable_listener_ = RenderableListenerPtr(new RenderableListener(this));
         scenemanager_->getRenderQueue()->setRenderableListener(renderable_listener_.get());
@@ -494,6 +537,7 @@ namespace OgreRenderer
             return;
             
         PROFILE(Renderer_Render_QtBlit);
+        ALLOCATION_SCOPE(Ui);
 
         UiGraphicsView *view = framework_->Ui()->GraphicsView();
 
@@ -534,6 +578,7 @@ namespace OgreRenderer
         }
 
         PROFILE(Renderer_Render);
+        ALLOCATION_SCOPE(Render);
 
         // If fog is FOG_NONE, force it to some default ineffective settings, because otherwise SuperShader shows just white
         if (scenemanager_->getFogMode() == Ogre::FOG_NONE)
@@ -578,6 +623,7 @@ namespace OgreRenderer
 
             {
                 PROFILE(QPainter_Render);
+                ALLOCATION_SCOPE(Ui);
 
                 // Paint ui view into buffer
                 QPainter painter(view->BackBuffer());
@@ -701,6 +747,10 @@ namespace OgreRenderer
         // The RenderableListener will fill in visible entities for this frame
         visible_entities_.clear();
 
+        // Rebuild the mesh batches whose instances changed since the last frame
+        if (mesh_instancer_)
+            mesh_instancer_->Update();
+
 #ifdef PROFILING
         // Performance debugging: Toggle the UI overlay visibility based on a debug key.
         // Allows testing whether the GPU is majorly fill rate bound.
@@ -724,195 +774,9 @@ namespace OgreRenderer
         view->MarkViewUndirty();
     }
 
-    uint GetSubmeshFromIndexRange(uint index, const std::vector<uint>& submeshstartindex)
-    {
-        for(uint i = 0; i < submeshstartindex.size(); ++i)
-        {
-            uint start = submeshstartindex[i];
-            uint end;
-            if (i < submeshstartindex.size() - 1)
-                end = submeshstartindex[i+1];
-            else
-                end = 0x7fffffff;
-            if ((index >= start) && (index < end))
-                return i;
-        }
-        return 0; // should never happen
-    }
-
-    // Get the mesh information for the given mesh. Version which supports animation
-    // Adapted from http://www.ogre3d.org/wiki/index.php/Raycasting_to_the_polygon_level
-    void GetMeshInformation(
-        Ogre::Entity *entity,
-        std::vector<Ogre::Vector3>& vertices,
-        std::vector<Ogre::Vector2>& texcoords,
-        std::vector<uint>& indices,
-        std::vector<uint>& submeshstartindex,
-        const Ogre::Vector3 &position,
-        const Ogre::Quaternion &orient,
-        const Ogre::Vector3 &scale)
-    {
-        PROFILE(Renderer_GetMeshInformation);
-
-        bool added_shared = false;
-        size_t current_offset = 0;
-        size_t shared_offset = 0;
-        size_t next_offset = 0;
-        size_t index_offset = 0;
-        size_t vertex_count = 0;
-        size_t index_count = 0;
-        Ogre::MeshPtr mesh = entity->getMesh();
-
-        bool useSoftwareBlendingVertices = entity->hasSkeleton();
-        if (useSoftwareBlendingVertices)
-            entity->_updateAnimation();
-
-        submeshstartindex.resize(mesh->getNumSubMeshes());
-
-        // Calculate how many vertices and indices we're going to need
-        for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
-        {
-            Ogre::SubMesh* submesh = mesh->getSubMesh( i );
-            // We only need to add the shared vertices once
-            if (submesh->useSharedVertices)
-            {
-                if (!added_shared)
-                {
-                    vertex_count += mesh->sharedVertexData->vertexCount;
-                    added_shared = true;
-                }
-            }
-            else
-            {
-                vertex_count += submesh->vertexData->vertexCount;
-            }
-
-            // Add the indices
-            submeshstartindex[i] = index_count;
-            index_count += submesh->indexData->indexCount;
-        }
-
-        // Allocate space for the vertices and indices
-        vertices.resize(vertex_count);
-        texcoords.resize(vertex_count);
-        indices.resize(index_count);
-
-        added_shared = false;
-
-        // Run through the submeshes again, adding the data into the arrays
-        for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
-        {
-            Ogre::SubMesh* submesh = mesh->getSubMesh(i);
-
-            // Get vertex data
-            //Ogre::VertexData* vertex_data = submesh->useSharedVertices ? mesh->sharedVertexData : submesh->vertexData;
-            Ogre::VertexData* vertex_data;
-
-            //When there is animation:
-            if (useSoftwareBlendingVertices)
-                vertex_data = submesh->useSharedVertices ? entity->_getSkelAnimVertexData() : entity->getSubEntity(i)->_getSkelAnimVertexData();
-            else
-                vertex_data = submesh->useSharedVertices ? mesh->sharedVertexData : submesh->vertexData;
-
-            if ((!submesh->useSharedVertices)||(submesh->useSharedVertices && !added_shared))
-            {
-                if(submesh->useSharedVertices)
-                {
-                    added_shared = true;
-                    shared_offset = current_offset;
-                }
-
-                const Ogre::VertexElement* posElem =
-                    vertex_data->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
-                const Ogre::VertexElement *texElem = 
-                    vertex_data->vertexDeclaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES);
-
-                Ogre::HardwareVertexBufferSharedPtr vbuf =
-                    vertex_data->vertexBufferBinding->getBuffer(posElem->getSource());
-
-                unsigned char* vertex =
-                    static_cast<unsigned char*>(vbuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
-
-                // There is _no_ baseVertexPointerToElement() which takes an Ogre::Real or a double
-                //  as second argument. So make it float, to avoid trouble when Ogre::Real will
-                //  be comiled/typedefed as double:
-                //      Ogre::Real* pReal;
-                float* pReal = 0;
-
-                for(size_t j = 0; j < vertex_data->vertexCount; ++j, vertex += vbuf->getVertexSize())
-                {
-                    posElem->baseVertexPointerToElement(vertex, &pReal);
-
-                    Ogre::Vector3 pt(pReal[0], pReal[1], pReal[2]);
-
-                    vertices[current_offset + j] = (orient * (pt * scale)) + position;
-                    if (texElem)
-                    {
-                        texElem->baseVertexPointerToElement(vertex, &pReal);
-                        texcoords[current_offset + j] = Ogre::Vector2(pReal[0], pReal[1]);
-                    }
-                    else
-                        texcoords[current_offset + j] = Ogre::Vector2(0.0f, 0.0f);
-                }
-
-                vbuf->unlock();
-                next_offset += vertex_data->vertexCount;
-            }
-
-            Ogre::IndexData* index_data = submesh->indexData;
-            size_t numTris = index_data->indexCount / 3;
-            Ogre::HardwareIndexBufferSharedPtr ibuf = index_data->indexBuffer;
-
-            unsigned long*  pLong = static_cast<unsigned long*>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
-            unsigned short* pShort = reinterpret_cast<unsigned short*>(pLong);
-            size_t offset = (submesh->useSharedVertices)? shared_offset : current_offset;
-
-            bool use32bitindexes = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
-            if (use32bitindexes)
-                for(size_t k = 0; k < numTris*3; ++k)
-                    indices[index_offset++] = pLong[k] + static_cast<uint>(offset);
-            else
-                for(size_t k = 0; k < numTris*3; ++k)
-                    indices[index_offset++] = static_cast<uint>(pShort[k]) + static_cast<unsigned long>(offset);
-
-            ibuf->unlock();
-            current_offset = next_offset;
-        }
-    }
-
-    Ogre::Vector2 FindUVs(
-        const Ogre::Ray& ray,
-        float distance,
-        const std::vector<Ogre::Vector3>& vertices,
-        const std::vector<Ogre::Vector2>& texcoords,
-        const std::vector<uint> indices, uint foundindex)
-    {
-        Ogre::Vector3 point = ray.getPoint(distance);
-
-        Ogre::Vector3 t1 = vertices[indices[foundindex]];
-        Ogre::Vector3 t2 = vertices[indices[foundindex+1]];
-        Ogre::Vector3 t3 = vertices[indices[foundindex+2]];
-
-        Ogre::Vector3 v1 = point - t1;
-        Ogre::Vector3 v2 = point - t2;
-        Ogre::Vector3 v3 = point - t3;
-
-        float area1 = (v2.crossProduct(v3)).length() / 2.0f;
-        float area2 = (v1.crossProduct(v3)).length() / 2.0f;
-        float area3 = (v1.crossProduct(v2)).length() / 2.0f;
-        float sum_area = area1 + area2 + area3;
-        if (sum_area == 0.0)
-            return Ogre::Vector2(0.0f, 0.0f);
-
-        Ogre::Vector3 bary(area1 / sum_area, area2 / sum_area, area3 / sum_area);
-        Ogre::Vector2 t = texcoords[indices[foundindex]] * bary.x + texcoords[indices[foundindex+1]] * bary.y + texcoords[indices[foundindex+2]] * bary.z;
-
-        return t;
-    }
-
     RaycastResult* Renderer::Raycast(int x, int y)
     {
-        static RaycastResult result;
+        RaycastResult &result = raycast_result_;
         
         result.entity_ = 0; 
         if (!initialized_)
@@ -942,19 +806,9 @@ namespace OgreRenderer
             if (!entry.movable->isVisible())
                 continue;
             
-            Ogre::Any any = entry.movable->getUserAny();
-            if (any.isEmpty())
-                continue;
-            
-            Scene::Entity *entity = 0;
-            try
-            {
-                entity = Ogre::any_cast<Scene::Entity*>(any);
-            }
-            catch (Ogre::InvalidParametersException &/*e*/)
-            {
+            Scene::Entity *entity = RaycastQuery::EntityOf(entry.movable);
+            if (!entity)
                 continue;
-            }
 
             EC_Placeable *placeable = entity->GetComponent<EC_Placeable>().get();
             if (!placeable)
@@ -968,16 +822,6 @@ namespace OgreRenderer
         // Now do the real pass
         Ogre::Real closest_distance = -1.0f;
         int closest_priority = minimum_priority;
-        Ogre::Vector2 closest_uv;
-
-        static std::vector<Ogre::Vector3> vertices;
-        static std::vector<Ogre::Vector2> texcoords;
-        static std::vector<uint> indices;
-        static std::vector<uint> submeshstartindex;
-        vertices.clear();
-        texcoords.clear();
-        indices.clear();
-        submeshstartindex.clear();
 
         for (size_t i = 0; i < results.size(); ++i)
         {
@@ -994,19 +838,9 @@ namespace OgreRenderer
             if (!entry.movable->isVisible())
                 continue;
             
-            Ogre::Any any = entry.movable->getUserAny();
-            if (any.isEmpty())
-                continue;
-
-            Scene::Entity *entity = 0;
-            try
-            {
-                entity = Ogre::any_cast<Scene::Entity*>(any);
-            }
-            catch (Ogre::InvalidParametersException &/*e*/)
-            {
+            Scene::Entity *entity = RaycastQuery::EntityOf(entry.movable);
+            if (!entity)
                 continue;
-            }
 
             int current_priority = minimum_priority;
             {
@@ -1019,66 +853,24 @@ namespace OgreRenderer
                 }
             }
 
-            // Mesh entity check: triangle intersection
-            if (entry.movable->getMovableType().compare("Entity") == 0)
-            {
-                Ogre::Entity* ogre_entity = static_cast<Ogre::Entity*>(entry.movable);
-                assert(ogre_entity != 0);
-
-                // get the mesh information
-                GetMeshInformation(ogre_entity, vertices, texcoords, indices, submeshstartindex,
-                    ogre_entity->getParentNode()->_getDerivedPosition(),
-                    ogre_entity->getParentNode()->_getDerivedOrientation(),
-                    ogre_entity->getParentNode()->_getDerivedScale());
+            // Triangle intersection for meshes, bounding box intersection for other objects
+            RaycastHit hit;
+            if (!RaycastQuery::IntersectObject(entry.movable, ray, entry.distance, hit))
+                continue;
 
-                // test for hitting individual triangles on the mesh
-                for (int j = 0; j < ((int)indices.size())-2; j += 3)
-                {
-                    // check for a hit against this triangle
-                    std::pair<bool, Ogre::Real> hit = Ogre::Math::intersects(ray, vertices[indices[j]],
-                        vertices[indices[j+1]], vertices[indices[j+2]], true, false);
-                    if (hit.first)
-                    {
-                        if ((closest_distance < 0.0f) || (hit.second < closest_distance) || (current_priority > closest_priority))
-                        {
-                            if (current_priority >= closest_priority)
-                            {
-                                // this is the closest/best so far, save it
-                                closest_distance = hit.second;
-                                closest_priority = current_priority;
-
-                                Ogre::Vector2 uv = FindUVs(ray, hit.second, vertices, texcoords, indices, j); 
-                                Ogre::Vector3 point = ray.getPoint(closest_distance);
-
-                                result.entity_ = entity;
-                                result.pos_ = Vector3df(point.x, point.y, point.z);
-                                result.submesh_ = GetSubmeshFromIndexRange(j, submeshstartindex);
-                                result.u_ = uv.x;
-                                result.v_ = uv.y;
-                            }
-                        }
-                    }
-                }
-            }
-            else
+            if ((closest_distance < 0.0f) || (hit.distance < closest_distance) || (current_priority > closest_priority))
             {
-                // Not an entity, fall back to just using the bounding box - ray intersection
-                if ((closest_distance < 0.0f) || (entry.distance < closest_distance) || (current_priority > closest_priority))
+                if (current_priority >= closest_priority)
                 {
-                    if (current_priority >= closest_priority)
-                    {
-                        // this is the closest/best so far, save it
-                        closest_distance = entry.distance;
-                        closest_priority = current_priority;
-
-                        Ogre::Vector3 point = ray.getPoint(closest_distance);
-
-                        result.entity_ = entity;
-                        result.pos_ = Vector3df(point.x, point.y, point.z);
-                        result.submesh_ = 0;
-                        result.u_ = 0.0f;
-                        result.v_ = 0.0f;
-                    }
+                    // this is the closest/best so far, save it
+                    closest_distance = hit.distance;
+                    closest_priority = current_priority;
+
+                    result.entity_ = entity;
+                    result.pos_ = hit.pos;
+                    result.submesh_ = hit.submesh;
+                    result.u_ = hit.u;
+                    result.v_ = hit.v;
                 }
             }
         }
@@ -1086,46 +878,49 @@ namespace OgreRenderer
         return &result;
     }
     
-    //qt wrapper / upcoming replacement for the one above
-    QList<Scene::Entity*> Renderer::FrustumQuery(QRect &viewrect)
+    void Renderer::OnSceneAdded(const QString &name)
     {
-        QList<Scene::Entity*>l;
-        float w= (float)renderWindow->OgreRenderWindow()->getWidth();
-        float h= (float)renderWindow->OgreRenderWindow()->getHeight();
-        float left = (float)(viewrect.left()) / w, right = (float)(viewrect.right()) / w;
-        float top = (float)(viewrect.top()) / h, bottom = (float)(viewrect.bottom()) / h;
-        
-        if(left > right) std::swap<float>(left, right);
-        if(top > bottom) std::swap<float>(top, bottom);
-        // don't do selection box is too small
-        if((right - left) * (bottom-top) < 0.0001) return l;
-        
-        Ogre::PlaneBoundedVolumeList volumes;
-        Ogre::PlaneBoundedVolume p = camera_->getCameraToViewportBoxVolume(left, top, right, bottom, true);
-        volumes.push_back(p);
+        Scene::ScenePtr scene = framework_->Scene()->GetScene(name);
+        if (scene)
+            connect(scene.get(), SIGNAL(Removed(Scene::SceneManager*)), this, SLOT(OnSceneRemoved(Scene::SceneManager*)), Qt::UniqueConnection);
+    }
 
-        Ogre::PlaneBoundedVolumeListSceneQuery *query = scenemanager_->createPlaneBoundedVolumeQuery(volumes);
-        assert(query);
+    void Renderer::OnSceneRemoved(Scene::SceneManager *scene)
+    {
+        if (mesh_instancer_)
+            mesh_instancer_->RemoveScene(scene);
+    }
 
-        Ogre::SceneQueryResult results = query->execute();
-        for(Ogre::SceneQueryResultMovableList::iterator iter = results.movables.begin(); iter != results.movables.end(); ++iter)
-        {
-            Ogre::MovableObject *m = *iter;
-            Scene::Entity *entity = 0;
-            try
-            {
-                entity = Ogre::any_cast<Scene::Entity*>(m->getUserAny());
-            }
-            catch (Ogre::InvalidParametersException &/*e*/)
-            {
-                continue;
-            }
-            if(entity)
-                l << entity;//->GetId();//std::cout << "Hit MovableObject:" << m << std::endl;
-        }
+    QList<RaycastResult*> Renderer::RaycastAll(const Vector3df &origin, const Vector3df &direction, uint queryMask, float maxDistance)
+    {
+        if (!script_query_)
+            return QList<RaycastResult*>();
+
+        script_query_->SetQueryMask(queryMask);
+        script_query_->SetMaxDistance(maxDistance > 0.0f ? maxDistance : std::numeric_limits<float>::max());
+        return ToScriptResults(script_query_->Cast(origin, direction), script_results_);
+    }
 
-        scenemanager_->destroyQuery(query);
+    QList<RaycastResult*> Renderer::RaycastAllFromScreen(int x, int y, uint queryMask, float maxDistance)
+    {
+        if (!script_query_)
+            return QList<RaycastResult*>();
+
+        script_query_->SetQueryMask(queryMask);
+        script_query_->SetMaxDistance(maxDistance > 0.0f ? maxDistance : std::numeric_limits<float>::max());
+        return ToScriptResults(script_query_->CastFromScreen(x, y), script_results_);
+    }
+
+    //qt wrapper / upcoming replacement for the one above
+    QList<Scene::Entity*> Renderer::FrustumQuery(QRect &viewrect)
+    {
+        QList<Scene::Entity*>l;
+        if (!region_query_)
+            return l; // Headless
 
+        const std::vector<Scene::Entity*> &entities = region_query_->QueryRegion(viewrect);
+        for(size_t i = 0; i < entities.size(); ++i)
+            l << entities[i];
         return l;
     }
 
@@ -47,6 +47,8 @@ namespace OgreRenderer
     class CompositionHandler;
     class GaussianListener;
     class CompositionHandler;
+    class RaycastQuery;
+    class MeshInstancer;
 
     typedef boost::shared_ptr<Ogre::Root> OgreRootPtr;
     typedef boost::shared_ptr<LogListener> OgreLogListenerPtr;
@@ -74,10 +76,13 @@ namespace OgreRenderer
         bool IsEntityVisible(uint ent_id);
 
         //! Do a frustum query to the world from viewport coordinates.
+        /*! For repeated queries with a query mask, use a RaycastQuery.
+         */
         virtual QList<Scene::Entity*> FrustumQuery(QRect &viewrect);
 
         //! Do raycast into the world from viewport coordinates.
         /*! The coordinates are a position in the render window, not scaled to [0,1].
+            Only the best hit is returned, by select priority and distance. For all the hits, or for rays in world space, use a RaycastQuery.
             \todo Returns raw pointer to entity. Returning smart pointer may take some thinking/design. Maybe just return entity id?
 
             \param x Horizontal position for the origin of the ray
@@ -86,6 +91,20 @@ namespace OgreRenderer
         */
         virtual RaycastResult* Raycast(int x, int y);
 
+        //! Casts a ray in world space, and returns all the hits, nearest first.
+        /*! For scripts. In C++, keep a RaycastQuery of your own. Works also headless. The results are valid until the next RaycastAll() or RaycastAllFromScreen() call.
+            \param origin Origin of the ray
+            \param direction Direction of the ray. Will be normalized automatically
+            \param queryMask Only the objects whose Ogre query flags have a bit in common with the mask are hit
+            \param maxDistance Maximum distance of the hits, or 0 for unlimited
+        */
+        QList<RaycastResult*> RaycastAll(const Vector3df &origin, const Vector3df &direction, uint queryMask = 0xffffffff, float maxDistance = 0.0f);
+
+        //! Casts a ray from the current camera through a position in the render window, not scaled to [0,1], and returns all the hits, nearest first.
+        /*! For scripts. See RaycastAll(). Returns no hits if there is no render window.
+        */
+        QList<RaycastResult*> RaycastAllFromScreen(int x, int y, uint queryMask = 0xffffffff, float maxDistance = 0.0f);
+
         //! Returns window width, or 0 if no render window
         virtual int GetWindowWidth() const;
 
@@ -192,6 +211,9 @@ namespace OgreRenderer
         /// Perhaps would be nicer to just have a GetUniqueName(string prefix)?
         std::string GetUniqueObjectName(const std::string &prefix);
 
+        //! Returns the batcher of repeated static meshes, or null if running headless
+        MeshInstancer* GetMeshInstancer() const { return mesh_instancer_; }
+
         //! Removes log listener
         void RemoveLogListener();
 
@@ -242,6 +264,13 @@ namespace OgreRenderer
 signals:
 		void resizeWindow();
 
+    private slots:
+        //! Connects to the Removed signal of a new scene
+        void OnSceneAdded(const QString &name);
+
+        //! Removes the entities of a scene that is being torn down from the instanced batches
+        void OnSceneRemoved(Scene::SceneManager *scene);
+
     private:
         
         //! Sleeps the main thread to throttle the main loop execution speed.
@@ -317,6 +346,21 @@ signals:
         //! ray for raycasting, reusable
         Ogre::RaySceneQuery *ray_query_;
 
+        //! query for FrustumQuery, reusable
+        RaycastQuery *region_query_;
+
+        //! result of the last Raycast
+        RaycastResult raycast_result_;
+
+        //! query for RaycastAll and RaycastAllFromScreen, reusable
+        RaycastQuery *script_query_;
+
+        //! results of the last RaycastAll or RaycastAllFromScreen. Kept between the calls so that they are allocated only once
+        std::vector<RaycastResult*> script_results_;
+
+        //! batcher of repeated static meshes
+        MeshInstancer *mesh_instancer_;
+
         //! window title to be used when creating renderwindow
         std::string window_title_;
 
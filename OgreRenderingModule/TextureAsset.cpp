@@ -170,3 +170,14 @@ bool TextureAsset::IsLoaded() const
 {
     return ogreTexture.get() != 0;
 }
+
+size_t TextureAsset::MemoryUsage() const
+{
+    return ogreTexture.isNull() ? 0 : ogreTexture->getSize();
+}
+
+bool TextureAsset::HasExternalReferences() const
+{
+    // The Ogre resource system holds its own references to the texture, and we hold one.
+    return !ogreTexture.isNull() && ogreTexture.useCount() > Ogre::ResourceGroupManager::RESOURCE_SYSTEM_NUM_REFERENCE_COUNTS + 1;
+}
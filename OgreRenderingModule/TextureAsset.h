@@ -29,6 +29,12 @@ public:
 
     bool IsLoaded() const;
 
+    /// Returns the size of the Ogre texture, including all its mip levels.
+    virtual size_t MemoryUsage() const;
+
+    /// Returns true if some Ogre object, e.g. a material, is still using the Ogre texture.
+    virtual bool HasExternalReferences() const;
+
     //void RegenerateAllMipLevels();
 
     /// This points to the loaded texture asset, if it is present.
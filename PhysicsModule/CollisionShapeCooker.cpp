@@ -0,0 +1,362 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "CollisionShapeCooker.h"
+#include "CollisionShapeUtils.h"
+#include "ConvexHull.h"
+#include "PhysicsUtils.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "btBulletDynamicsCommon.h"
+
+#include <QDir>
+#include <QFile>
+#include <QByteArray>
+#include <QCryptographicHash>
+
+#include <cstring>
+
+DEFINE_POCO_LOGGING_FUNCTIONS("CollisionShapeCooker")
+
+namespace Physics
+{
+
+namespace
+{
+    //! Version of the cache files. Bump when the cooking or the file format changes, so that old files are not used.
+    const u32 cCacheVersion = 1;
+
+    const char cTriangleMeshSuffix[] = ".trimesh";
+    const char cConvexHullSetSuffix[] = ".hulls";
+
+    //! Returns the hash of a triangle list, used as the name of its cache files.
+    QString ContentHash(const std::vector<Vector3df>& triangles)
+    {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(reinterpret_cast<const char*>(&cCacheVersion), sizeof(cCacheVersion));
+        if (!triangles.empty())
+            hash.addData(reinterpret_cast<const char*>(&triangles[0]), triangles.size() * sizeof(Vector3df));
+        return QString(hash.result().toHex());
+    }
+
+    template<typename T>
+    void Append(QByteArray& data, const T& value)
+    {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    //! Reads values from the contents of a cache file. Fails all later reads after one goes past the end.
+    class CacheReader
+    {
+    public:
+        explicit CacheReader(const QByteArray& data) : data_(data), pos_(0), ok_(true) {}
+
+        template<typename T>
+        T Read()
+        {
+            T value = T();
+            Read(&value, sizeof(T));
+            return value;
+        }
+
+        void Read(void* dest, int numBytes)
+        {
+            if (!ok_ || numBytes < 0 || pos_ + numBytes > data_.size())
+            {
+                ok_ = false;
+                return;
+            }
+            memcpy(dest, data_.constData() + pos_, numBytes);
+            pos_ += numBytes;
+        }
+
+        bool IsOk() const { return ok_; }
+
+    private:
+        const QByteArray& data_;
+        int pos_;
+        bool ok_;
+    };
+
+    //! Reads a cache file. Returns an empty array if it does not exist, or was written by another version.
+    QByteArray ReadCacheFile(const QString& filename)
+    {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly))
+            return QByteArray();
+        QByteArray data = file.readAll();
+        CacheReader reader(data);
+        if (reader.Read<u32>() != cCacheVersion)
+            return QByteArray();
+        return data.mid(sizeof(u32));
+    }
+
+    //! Writes a cache file. A temporary file is written first and renamed, so that a partially written file is never read.
+    void WriteCacheFile(const QString& filename, const QByteArray& contents)
+    {
+        QString tempFilename = filename + ".tmp";
+        QFile file(tempFilename);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            LogWarning("Could not write collision shape cache file " + tempFilename.toStdString());
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&cCacheVersion), sizeof(cCacheVersion));
+        file.write(contents);
+        file.close();
+        // If another process cooked the same mesh at the same time, keep its file
+        if (!QFile::rename(tempFilename, filename))
+            QFile::remove(tempFilename);
+    }
+
+    //! Creates a triangle mesh from a triangle list.
+    btTriangleMesh* CreateTriangleMesh(const std::vector<Vector3df>& triangles)
+    {
+        btTriangleMesh* mesh = new btTriangleMesh();
+        for (uint i = 0; i + 2 < triangles.size(); i += 3)
+            mesh->addTriangle(ToBtVector3(triangles[i]), ToBtVector3(triangles[i+1]), ToBtVector3(triangles[i+2]));
+        return mesh;
+    }
+
+    //! Loads the BVH of a triangle mesh from the contents of a cache file. Returns null if the contents are not valid for the mesh.
+    CookedTriangleMeshPtr LoadTriangleMesh(const QByteArray& contents, const std::vector<Vector3df>& triangles)
+    {
+        CacheReader reader(contents);
+        u32 numTriangles = reader.Read<u32>();
+        u32 bvhSize = reader.Read<u32>();
+        if (!reader.IsOk() || numTriangles != triangles.size() / 3 || !bvhSize)
+            return CookedTriangleMeshPtr();
+
+        // The BVH is used in place, so it needs a buffer of its own that lives as long as the shape
+        void* buffer = btAlignedAlloc(bvhSize, 16);
+        reader.Read(buffer, bvhSize);
+        btOptimizedBvh* bvh = reader.IsOk() ? (btOptimizedBvh*)btOptimizedBvh::deSerializeInPlace(buffer, bvhSize, false) : 0;
+        if (!bvh)
+        {
+            btAlignedFree(buffer);
+            return CookedTriangleMeshPtr();
+        }
+
+        CookedTriangleMeshPtr cooked(new CookedTriangleMesh());
+        cooked->bvhBuffer_ = buffer;
+        cooked->loadedBvh_ = bvh;
+        cooked->mesh_ = CreateTriangleMesh(triangles);
+        cooked->shape_ = new btBvhTriangleMeshShape(cooked->mesh_, true, false);
+        cooked->shape_->setOptimizedBvh(bvh);
+        return cooked;
+    }
+
+    //! Returns the cache file contents of a cooked triangle mesh.
+    QByteArray SaveTriangleMesh(const CookedTriangleMesh& cooked, uint numTriangles)
+    {
+        QByteArray contents;
+        const btQuantizedBvh* bvh = cooked.shape_->getOptimizedBvh();
+        if (!bvh)
+            return contents;
+
+        u32 bvhSize = bvh->calculateSerializeBufferSize();
+        void* buffer = btAlignedAlloc(bvhSize, 16);
+        if (bvh->serialize(buffer, bvhSize, false))
+        {
+            Append<u32>(contents, numTriangles);
+            Append<u32>(contents, bvhSize);
+            contents.append(static_cast<const char*>(buffer), bvhSize);
+        }
+        btAlignedFree(buffer);
+        return contents;
+    }
+
+    //! Loads a convex hull set from the contents of a cache file. Returns null if the contents are not valid.
+    boost::shared_ptr<ConvexHullSet> LoadConvexHullSet(const QByteArray& contents)
+    {
+        CacheReader reader(contents);
+        u32 numHulls = reader.Read<u32>();
+        boost::shared_ptr<ConvexHullSet> hulls(new ConvexHullSet());
+        for(u32 i = 0; i < numHulls && reader.IsOk(); ++i)
+        {
+            ConvexHull hull;
+            hull.position_.x = reader.Read<float>();
+            hull.position_.y = reader.Read<float>();
+            hull.position_.z = reader.Read<float>();
+            u32 numPoints = reader.Read<u32>();
+            btAlignedObjectArray<btVector3> points;
+            for(u32 j = 0; j < numPoints && reader.IsOk(); ++j)
+            {
+                float x = reader.Read<float>();
+                float y = reader.Read<float>();
+                float z = reader.Read<float>();
+                points.push_back(btVector3(x, y, z));
+            }
+            if (!reader.IsOk() || !points.size())
+                return boost::shared_ptr<ConvexHullSet>();
+            hull.hull_ = boost::shared_ptr<btConvexHullShape>(new btConvexHullShape((const btScalar*)&points[0], points.size(), sizeof(btVector3)));
+            hulls->hulls_.push_back(hull);
+        }
+        if (!reader.IsOk())
+            return boost::shared_ptr<ConvexHullSet>();
+        return hulls;
+    }
+
+    //! Returns the cache file contents of a convex hull set.
+    QByteArray SaveConvexHullSet(const ConvexHullSet& hulls)
+    {
+        QByteArray contents;
+        Append<u32>(contents, hulls.hulls_.size());
+        for(uint i = 0; i < hulls.hulls_.size(); ++i)
+        {
+            const ConvexHull& hull = hulls.hulls_[i];
+            Append<float>(contents, hull.position_.x);
+            Append<float>(contents, hull.position_.y);
+            Append<float>(contents, hull.position_.z);
+            const btVector3* points = hull.hull_->getUnscaledPoints();
+            Append<u32>(contents, hull.hull_->getNumPoints());
+            for(int j = 0; j < hull.hull_->getNumPoints(); ++j)
+            {
+                Append<float>(contents, points[j].x());
+                Append<float>(contents, points[j].y());
+                Append<float>(contents, points[j].z());
+            }
+        }
+        return contents;
+    }
+}
+
+CookedTriangleMesh::CookedTriangleMesh() :
+    mesh_(0),
+    shape_(0),
+    loadedBvh_(0),
+    bvhBuffer_(0)
+{
+}
+
+CookedTriangleMesh::~CookedTriangleMesh()
+{
+    // The shape does not own a loaded BVH, so destroy it separately, and only after the shape
+    delete shape_;
+    if (loadedBvh_)
+        loadedBvh_->~btOptimizedBvh();
+    if (bvhBuffer_)
+        btAlignedFree(bvhBuffer_);
+    delete mesh_;
+}
+
+CollisionShapeCooker::CollisionShapeCooker(Foundation::JobSystem* jobs) :
+    jobs_(jobs),
+    queue_(new ResultQueue())
+{
+}
+
+void CollisionShapeCooker::SetCacheDirectory(const QString& directory)
+{
+    cacheDirectory_ = directory;
+    if (!cacheDirectory_.isEmpty() && !QDir().mkpath(cacheDirectory_))
+    {
+        LogWarning("Could not create collision shape cache directory " + cacheDirectory_.toStdString());
+        cacheDirectory_.clear();
+    }
+}
+
+void CollisionShapeCooker::CookTriangleMesh(Ogre::Mesh* mesh)
+{
+    PROFILE(CollisionShapeCooker_CookTriangleMesh);
+
+    // Reading the mesh needs to happen in the main thread, as it locks the Ogre buffers
+    TriangleListPtr triangles(new std::vector<Vector3df>());
+    GetTrianglesFromMesh(mesh, *triangles, true);
+    Submit(boost::bind(&CollisionShapeCooker::CookTriangleMeshJob, queue_, mesh->getName(), triangles, cacheDirectory_));
+}
+
+void CollisionShapeCooker::CookConvexHullSet(Ogre::Mesh* mesh)
+{
+    PROFILE(CollisionShapeCooker_CookConvexHullSet);
+
+    TriangleListPtr triangles(new std::vector<Vector3df>());
+    GetTrianglesFromMesh(mesh, *triangles, true);
+    Submit(boost::bind(&CollisionShapeCooker::CookConvexHullSetJob, queue_, mesh->getName(), triangles, cacheDirectory_));
+}
+
+void CollisionShapeCooker::TakeResults(std::vector<Result>& results)
+{
+    MutexLock lock(queue_->mutex);
+    results.swap(queue_->results);
+    queue_->results.clear();
+}
+
+void CollisionShapeCooker::Submit(const boost::function<void()>& job)
+{
+    if (jobs_)
+        jobs_->Submit(job);
+    else
+        job();
+}
+
+void CollisionShapeCooker::CookTriangleMeshJob(const ResultQueuePtr& queue, const std::string& meshName, const TriangleListPtr& triangles, const QString& cacheDirectory)
+{
+    PROFILE(CollisionShapeCooker_CookTriangleMeshJob);
+
+    Result result;
+    result.meshName = meshName;
+
+    QString cacheFile;
+    if (!cacheDirectory.isEmpty())
+    {
+        cacheFile = QDir(cacheDirectory).absoluteFilePath(ContentHash(*triangles) + cTriangleMeshSuffix);
+        QByteArray contents = ReadCacheFile(cacheFile);
+        if (!contents.isEmpty())
+        {
+            result.triangleMesh = LoadTriangleMesh(contents, *triangles);
+            result.fromCache = (result.triangleMesh.get() != 0);
+        }
+    }
+
+    if (!result.triangleMesh)
+    {
+        result.triangleMesh = CookedTriangleMeshPtr(new CookedTriangleMesh());
+        result.triangleMesh->mesh_ = CreateTriangleMesh(*triangles);
+        // Bullet can not build a BVH of an empty mesh
+        if (triangles->size() >= 3)
+        {
+            result.triangleMesh->shape_ = new btBvhTriangleMeshShape(result.triangleMesh->mesh_, true, true);
+            if (!cacheFile.isEmpty())
+                WriteCacheFile(cacheFile, SaveTriangleMesh(*result.triangleMesh, triangles->size() / 3));
+        }
+    }
+
+    MutexLock lock(queue->mutex);
+    queue->results.push_back(result);
+}
+
+void CollisionShapeCooker::CookConvexHullSetJob(const ResultQueuePtr& queue, const std::string& meshName, const TriangleListPtr& triangles, const QString& cacheDirectory)
+{
+    PROFILE(CollisionShapeCooker_CookConvexHullSetJob);
+
+    Result result;
+    result.meshName = meshName;
+
+    QString cacheFile;
+    if (!cacheDirectory.isEmpty())
+    {
+        cacheFile = QDir(cacheDirectory).absoluteFilePath(ContentHash(*triangles) + cConvexHullSetSuffix);
+        QByteArray contents = ReadCacheFile(cacheFile);
+        if (!contents.isEmpty())
+        {
+            result.convexHullSet = LoadConvexHullSet(contents);
+            result.fromCache = (result.convexHullSet.get() != 0);
+        }
+    }
+
+    if (!result.convexHullSet)
+    {
+        result.convexHullSet = boost::shared_ptr<ConvexHullSet>(new ConvexHullSet());
+        GenerateConvexHullSet(*triangles, result.convexHullSet.get());
+        if (!cacheFile.isEmpty())
+            WriteCacheFile(cacheFile, SaveConvexHullSet(*result.convexHullSet));
+    }
+
+    MutexLock lock(queue->mutex);
+    queue->results.push_back(result);
+}
+
+}
@@ -0,0 +1,128 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Physics_CollisionShapeCooker_h
+#define incl_Physics_CollisionShapeCooker_h
+
+#include "Core.h"
+#include "CoreThread.h"
+#include "PhysicsModuleApi.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+
+#include <QString>
+
+class btTriangleMesh;
+class btBvhTriangleMeshShape;
+class btOptimizedBvh;
+
+namespace Ogre
+{
+    class Mesh;
+}
+
+namespace Foundation
+{
+    class JobSystem;
+}
+
+namespace Physics
+{
+
+struct ConvexHullSet;
+
+//! A triangle mesh collision shape with its bounding volume hierarchy, cooked by CollisionShapeCooker.
+/*! The shape is shared by all the rigid bodies that use the mesh. Each body wraps it in a btScaledBvhTriangleMeshShape of its own,
+    so that scaling a body does not rebuild the BVH.
+ */
+struct CookedTriangleMesh : boost::noncopyable
+{
+    CookedTriangleMesh();
+    ~CookedTriangleMesh();
+
+    //! The triangles of the mesh
+    btTriangleMesh* mesh_;
+
+    //! The shape, without scaling
+    btBvhTriangleMeshShape* shape_;
+
+    //! The BVH loaded from the disk cache into bvhBuffer_, or 0 if the shape built and owns its BVH
+    btOptimizedBvh* loadedBvh_;
+
+    //! 16-byte aligned buffer the loaded BVH lives in
+    void* bvhBuffer_;
+};
+
+typedef boost::shared_ptr<CookedTriangleMesh> CookedTriangleMeshPtr;
+
+//! Cooks the collision shapes of meshes in the worker threads of the job system, and caches them on disk.
+/*! Building the BVH of a triangle mesh, and especially the convex decomposition of a mesh, can take hundreds of milliseconds. The cooker
+    only reads the triangles of the mesh in the main thread, and does the rest in a job. The cooked shapes are stored in the given
+    cache directory, named by the hash of the triangles, so that later loads of the same mesh content, even under a different name or
+    after a restart, only need to read the file.
+
+    The cooked shapes are returned to the main thread with TakeResults(), which PhysicsModule calls each frame.
+ */
+class CollisionShapeCooker
+{
+public:
+    //! A cooked shape of a mesh. Only one of the shapes is set.
+    struct Result
+    {
+        Result() : fromCache(false) {}
+
+        std::string meshName;
+        CookedTriangleMeshPtr triangleMesh;
+        boost::shared_ptr<ConvexHullSet> convexHullSet;
+        //! Whether the shape was read from the disk cache.
+        bool fromCache;
+    };
+
+    //! Constructor.
+    /*! \param jobs Job system to cook in. If null, cooks immediately in the calling thread.
+     */
+    explicit CollisionShapeCooker(Foundation::JobSystem* jobs);
+
+    //! Sets the directory of the disk cache. If empty, the shapes are not cached on disk. Created if it does not exist.
+    void SetCacheDirectory(const QString& directory);
+
+    //! Returns the directory of the disk cache.
+    const QString& GetCacheDirectory() const { return cacheDirectory_; }
+
+    //! Starts cooking the triangle mesh shape of a mesh. Call from the main thread.
+    void CookTriangleMesh(Ogre::Mesh* mesh);
+
+    //! Starts cooking the convex hull set of a mesh. Call from the main thread.
+    void CookConvexHullSet(Ogre::Mesh* mesh);
+
+    //! Moves the shapes cooked since the last call to results. Thread-safe.
+    void TakeResults(std::vector<Result>& results);
+
+private:
+    //! Cooked shapes waiting for TakeResults(). Shared with the jobs, so that they can finish after the cooker is gone.
+    struct ResultQueue
+    {
+        Mutex mutex;
+        std::vector<Result> results;
+    };
+
+    typedef boost::shared_ptr<ResultQueue> ResultQueuePtr;
+    typedef boost::shared_ptr<std::vector<Vector3df> > TriangleListPtr;
+
+    //! Runs the given job in the job system, or immediately if there is none.
+    void Submit(const boost::function<void()>& job);
+
+    //! Job that loads or cooks a triangle mesh shape.
+    static void CookTriangleMeshJob(const ResultQueuePtr& queue, const std::string& meshName, const TriangleListPtr& triangles, const QString& cacheDirectory);
+
+    //! Job that loads or cooks a convex hull set.
+    static void CookConvexHullSetJob(const ResultQueuePtr& queue, const std::string& meshName, const TriangleListPtr& triangles, const QString& cacheDirectory);
+
+    Foundation::JobSystem* jobs_;
+    ResultQueuePtr queue_;
+    QString cacheDirectory_;
+};
+
+}
+
+#endif
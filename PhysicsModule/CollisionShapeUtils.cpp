@@ -25,6 +25,13 @@ void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr, bool flipAxes)
 }
 
 void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr, bool flipAxes)
+{
+    std::vector<Vector3df> triangles;
+    GetTrianglesFromMesh(mesh, triangles, flipAxes);
+    GenerateConvexHullSet(triangles, ptr);
+}
+
+void GenerateConvexHullSet(const std::vector<Vector3df>& triangles, ConvexHullSet* ptr)
 {
     class ConvexResultReceiver : public ConvexDecomposition::ConvexDecompInterface
     {
@@ -62,9 +69,9 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr, bool flipAxes)
         ConvexHullSet* dest_;
     };
     
-    std::vector<Vector3df> triangles;
-    GetTrianglesFromMesh(mesh, triangles, flipAxes);
-
+    if (triangles.empty())
+        return;
+    
     std::vector<float> vertexData;
     std::vector<uint> indexData;
     
@@ -21,6 +21,8 @@ namespace Physics
     void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr, bool flipAxes);
     void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<Vector3df>& dest, bool flipAxes);
     void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr, bool flipAxes);
+    //! Runs the convex decomposition for a triangle list, such as returned by GetTrianglesFromMesh. Thread-safe.
+    void GenerateConvexHullSet(const std::vector<Vector3df>& triangles, ConvexHullSet* ptr);
 }
 
 
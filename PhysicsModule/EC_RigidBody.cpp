@@ -6,6 +6,8 @@
 #include "MemoryLeakCheck.h"
 #include "EC_RigidBody.h"
 #include "ConvexHull.h"
+#include "CollisionShapeCooker.h"
+#include "TerrainHeightField.h"
 #include "PhysicsModule.h"
 #include "PhysicsUtils.h"
 #include "PhysicsWorld.h"
@@ -22,7 +24,7 @@
 
 DEFINE_POCO_LOGGING_FUNCTIONS("EC_RigidBody");
 
-#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+#include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <BulletCollision/Gimpact/btGImpactShape.h>
 #include <BulletCollision/Gimpact/btGImpactCollisionAlgorithm.h>
 
@@ -52,7 +54,9 @@ EC_RigidBody::EC_RigidBody(IModule* module) :
     body_(0),
     world_(0),
     shape_(0),
-    heightField_(0),
+    listenersCheckedStep_(0),
+    hasCollisionListeners_(false),
+    stateOverridePending_(false),
     disconnected_(false),
     owner_(checked_static_cast<PhysicsModule*>(module)),
     cachedShapeType_(-1)
@@ -137,6 +141,9 @@ void EC_RigidBody::ApplyForce(const Vector3df& force, const Vector3df& position)
     if (force.getLength() < cForceThreshold)
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ApplyForce, this, force, position), false))
+        return;
+    
     if (!body_)
         CreateBody();
     if (body_)
@@ -158,6 +165,9 @@ void EC_RigidBody::ApplyTorque(const Vector3df& torque)
     // If torque is very small, do not wake up the body and apply
     if (torque.getLength() < cTorqueThreshold)
         return;
+    
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ApplyTorque, this, torque), false))
+        return;
         
     if (!body_)
         CreateBody();
@@ -178,6 +188,9 @@ void EC_RigidBody::ApplyImpulse(const Vector3df& impulse, const Vector3df& posit
     if (impulse.getLength() < cImpulseThreshold)
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ApplyImpulse, this, impulse, position), false))
+        return;
+    
     if (!body_)
         CreateBody();
     if (body_)
@@ -199,6 +212,9 @@ void EC_RigidBody::ApplyTorqueImpulse(const Vector3df& torqueImpulse)
     // If impulse is very small, do not wake up the body and apply
     if (torqueImpulse.getLength() < cTorqueThreshold)
         return;
+    
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ApplyTorqueImpulse, this, torqueImpulse), false))
+        return;
         
     if (!body_)
         CreateBody();
@@ -214,6 +230,9 @@ void EC_RigidBody::ApplyGravity(const Vector3df& gravity)
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
+    
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ApplyGravity, this, gravity), false))
+        return;
             
     if (!body_)
         CreateBody();
@@ -230,6 +249,9 @@ void EC_RigidBody::Activate()
     if (!HasAuthority())
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::Activate, this), false))
+        return;
+    
     if (!body_)
         CreateBody();
     if (body_)
@@ -238,6 +260,7 @@ void EC_RigidBody::Activate()
 
 bool EC_RigidBody::IsActive()
 {
+    WaitForPhysicsStep();
     if (body_)
         return body_->isActive();
     else
@@ -250,6 +273,9 @@ void EC_RigidBody::ResetForces()
     if (!HasAuthority())
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::ResetForces, this), false))
+        return;
+    
     if (!body_)
         CreateBody();
     if (body_)
@@ -297,6 +323,7 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
 
 void EC_RigidBody::CreateCollisionShape()
 {
+    // Also waits for the physics step
     RemoveCollisionShape();
     
     Vector3df sizeVec = size.Get();
@@ -324,9 +351,10 @@ void EC_RigidBody::CreateCollisionShape()
         shape_ = new btCapsuleShapeZ(sizeVec.x * 0.5f, sizeVec.z * 0.5f);
         break;
     case Shape_TriMesh:
-		if (triangleMesh_){
-			shape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, true);
-		}
+        // The cooked shape and its BVH are shared by all the bodies of the mesh, and only scaled per body
+        if ((triangleMesh_) && (triangleMesh_->shape_))
+            shape_ = new btScaledBvhTriangleMeshShape(triangleMesh_->shape_, btVector3(1.0f, 1.0f, 1.0f));
+        break;
     case Shape_HeightField:
         CreateHeightFieldFromTerrain();
         break;
@@ -343,6 +371,7 @@ void EC_RigidBody::CreateCollisionShape()
 
 void EC_RigidBody::RemoveCollisionShape()
 {
+    WaitForPhysicsStep();
     if (shape_)
     {
         if (body_)
@@ -350,11 +379,7 @@ void EC_RigidBody::RemoveCollisionShape()
         delete shape_;
         shape_ = 0;
     }
-    if (heightField_)
-    {
-        delete heightField_;
-        heightField_ = 0;
-    }
+    heightField_.reset();
 }
 
 void EC_RigidBody::CreateBody()
@@ -362,6 +387,7 @@ void EC_RigidBody::CreateBody()
     if ((!world_) || (!GetParentEntity()) || (body_))
         return;
     
+    WaitForPhysicsStep();
     CheckForPlaceableAndTerrain();
     
     CreateCollisionShape();
@@ -385,6 +411,8 @@ void EC_RigidBody::ReaddBody()
     if ((!world_) || (!GetParentEntity()) || (!body_))
         return;
     
+    WaitForPhysicsStep();
+    
     btVector3 localInertia;
     float m;
     int collisionFlags;
@@ -409,6 +437,8 @@ void EC_RigidBody::RemoveBody()
 {
     if ((body_) && (world_))
     {
+        world_->WaitForStep();
+        world_->ForgetObject(body_);
         world_->GetWorld()->removeRigidBody(body_);
         delete body_;
         body_ = 0;
@@ -417,6 +447,13 @@ void EC_RigidBody::RemoveBody()
 
 void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 {
+    // In threaded physics this may be called from the physics thread, so do not read the placeable. Teleports are set directly to the body
+    if ((world_) && (world_->IsThreaded()) && (body_))
+    {
+        worldTrans = body_->getWorldTransform();
+        return;
+    }
+    
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable)
         return;
@@ -430,6 +467,18 @@ void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 }
 
 void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
+{
+    if (!body_)
+        return;
+    
+    // In threaded physics this is called from the physics thread. Store the transform to be applied after the step
+    if ((world_) && (world_->IsThreaded()))
+        world_->StoreBodyState(body_, worldTrans);
+    else
+        ApplyWorldTransform(ToVector3(worldTrans.getOrigin()), ToQuaternion(worldTrans.getRotation()), ToVector3(body_->getLinearVelocity()), ToVector3(body_->getAngularVelocity()));
+}
+
+void EC_RigidBody::ApplyWorldTransform(const Vector3df& position, const Quaternion& orientation, const Vector3df& linearVel, const Vector3df& angularVel)
 {
     // Cannot modify server-authoritative physics object, rather get the transform changes through placeable attributes
     if (!HasAuthority())
@@ -443,8 +492,6 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
     disconnected_ = true;
     
     // Set transform
-    Vector3df position = ToVector3(worldTrans.getOrigin());
-    Quaternion orientation = ToQuaternion(worldTrans.getRotation());
     Transform newTrans = placeable->transform.Get();
     Vector3df euler;
     orientation.toEuler(euler);
@@ -453,22 +500,32 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
     placeable->transform.Set(newTrans, AttributeChange::Default);
     
     // Set linear & angular velocity
-    if (body_)
-    {
-        linearVelocity.Set(ToVector3(body_->getLinearVelocity()), AttributeChange::Default);
-        const btVector3& angular = body_->getAngularVelocity();
-        angularVelocity.Set(Vector3df(angular.x() * RADTODEG, angular.y() * RADTODEG, angular.z() * RADTODEG), AttributeChange::Default);
-    }
+    linearVelocity.Set(linearVel, AttributeChange::Default);
+    angularVelocity.Set(angularVel * RADTODEG, AttributeChange::Default);
     
     disconnected_ = false;
 }
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+    
+    // If the terrain was resized, a new heightfield is needed. Otherwise PhysicsModule updates the shared heightfield once for all the bodies,
+    // see OnTerrainHeightFieldUpdated()
+    if ((!heightField_) || (!heightField_->MatchesTerrainSize()))
         CreateCollisionShape();
 }
 
+void EC_RigidBody::OnTerrainHeightFieldUpdated(Physics::TerrainHeightField* heightField)
+{
+    if ((shapeType.Get() != Shape_HeightField) || (heightField != heightField_.get()))
+        return;
+    
+    // The height range, and so the center of the heightfield, may have changed
+    UpdateHeightFieldTransform();
+}
+
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
@@ -479,27 +536,60 @@ void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 
     if (mesh)
     {
+        // If the shape has not been cooked yet, it is cooked in the background, and the shape is created in OnCollisionMeshCooked()
+        pendingCollisionMesh_.clear();
         if (shapeType.Get() == Shape_TriMesh)
         {
             triangleMesh_ = owner_->GetTriangleMeshFromOgreMesh(mesh);
-            CreateCollisionShape();
+            if (triangleMesh_)
+                CreateCollisionShape();
+            else
+                pendingCollisionMesh_ = mesh->getName();
         }
         if (shapeType.Get() == Shape_ConvexHull)
         {
             convexHullSet_ = owner_->GetConvexHullSetFromOgreMesh(mesh);
-            CreateCollisionShape();
+            if (convexHullSet_)
+                CreateCollisionShape();
+            else
+                pendingCollisionMesh_ = mesh->getName();
         }
+        if (!pendingCollisionMesh_.empty())
+            connect(owner_, SIGNAL(CollisionMeshCooked(const QString&)), this, SLOT(OnCollisionMeshCooked(const QString&)), Qt::UniqueConnection);
 
         cachedShapeType_ = shapeType.Get();
         cachedSize_ = size.Get();
     }
 }
 
+void EC_RigidBody::OnCollisionMeshCooked(const QString& meshName)
+{
+    if (pendingCollisionMesh_.empty() || (meshName.toStdString() != pendingCollisionMesh_))
+        return;
+    
+    if (shapeType.Get() == Shape_TriMesh)
+        triangleMesh_ = owner_->GetTriangleMesh(pendingCollisionMesh_);
+    if (shapeType.Get() == Shape_ConvexHull)
+        convexHullSet_ = owner_->GetConvexHullSet(pendingCollisionMesh_);
+    // Both shapes of the mesh may be cooking, if the shape type was changed meanwhile. Wait for the one this body uses
+    if ((shapeType.Get() == Shape_TriMesh && !triangleMesh_) || (shapeType.Get() == Shape_ConvexHull && !convexHullSet_))
+        return;
+    
+    pendingCollisionMesh_.clear();
+    disconnect(owner_, SIGNAL(CollisionMeshCooked(const QString&)), this, SLOT(OnCollisionMeshCooked(const QString&)));
+    CreateCollisionShape();
+}
+
 void EC_RigidBody::OnAttributeUpdated(IAttribute* attribute)
 {
     if (disconnected_)
         return;
     
+    // A velocity set while the physics thread steps overrides the velocity the step ends with
+    bool setsVelocity = (attribute == &linearVelocity) || (attribute == &angularVelocity);
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::OnAttributeUpdated, this, attribute), setsVelocity))
+        return;
+    
     // Create body now if does not exist yet
     if (!body_)
         CreateBody();
@@ -580,25 +670,34 @@ void EC_RigidBody::PlaceableUpdated(IAttribute* attribute)
     
     EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(sender());
     if (attribute == &placeable->transform)
-    {
-        const Transform& trans = placeable->transform.Get();
-        const Vector3df& position = trans.position;
-        Quaternion orientation(DEGTORAD * trans.rotation.x, DEGTORAD * trans.rotation.y, DEGTORAD * trans.rotation.z);
-        
-        btTransform& worldTrans = body_->getWorldTransform();
-        worldTrans.setOrigin(ToBtVector3(position));
-        worldTrans.setRotation(ToBtQuaternion(orientation));
-        
-        // When we forcibly set the physics transform, also set the interpolation transform to prevent jerky motion
-        btTransform interpTrans = body_->getInterpolationWorldTransform();
-        interpTrans.setOrigin(worldTrans.getOrigin());
-        interpTrans.setRotation(worldTrans.getRotation());
-        body_->setInterpolationWorldTransform(interpTrans);
-        
-        body_->activate();
-        
-        UpdateScale();
-    }
+        SetBodyTransform(placeable->transform.Get());
+}
+
+void EC_RigidBody::SetBodyTransform(const Transform& trans)
+{
+    if (!body_)
+        return;
+    
+    // A teleport while the physics thread steps overrides the transform the step ends with
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::SetBodyTransform, this, trans), true))
+        return;
+    
+    const Vector3df& position = trans.position;
+    Quaternion orientation(DEGTORAD * trans.rotation.x, DEGTORAD * trans.rotation.y, DEGTORAD * trans.rotation.z);
+    
+    btTransform& worldTrans = body_->getWorldTransform();
+    worldTrans.setOrigin(ToBtVector3(position));
+    worldTrans.setRotation(ToBtQuaternion(orientation));
+    
+    // When we forcibly set the physics transform, also set the interpolation transform to prevent jerky motion
+    btTransform interpTrans = body_->getInterpolationWorldTransform();
+    interpTrans.setOrigin(worldTrans.getOrigin());
+    interpTrans.setRotation(worldTrans.getRotation());
+    body_->setInterpolationWorldTransform(interpTrans);
+    
+    body_->activate();
+    
+    UpdateScale();
 }
 
 void EC_RigidBody::SetRotation(const Vector3df& rotation)
@@ -607,6 +706,9 @@ void EC_RigidBody::SetRotation(const Vector3df& rotation)
     if (!HasAuthority())
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::SetRotation, this, rotation), true))
+        return;
+    
     disconnected_ = true;
     
     EC_Placeable* placeable = placeable_.lock().get();
@@ -637,6 +739,9 @@ void EC_RigidBody::Rotate(const Vector3df& rotation)
     if (!HasAuthority())
         return;
     
+    if (DeferWhileStepping(boost::bind(&EC_RigidBody::Rotate, this, rotation), true))
+        return;
+    
     disconnected_ = true;
     
     EC_Placeable* placeable = placeable_.lock().get();
@@ -663,7 +768,8 @@ void EC_RigidBody::Rotate(const Vector3df& rotation)
 
 Vector3df EC_RigidBody::GetLinearVelocity()
 {
-    if (body_)
+    // While the physics thread steps, return the velocity of the previous step
+    if ((body_) && (!IsPhysicsStepping()))
         return ToVector3(body_->getLinearVelocity());
     else 
         return linearVelocity.Get();
@@ -671,7 +777,7 @@ Vector3df EC_RigidBody::GetLinearVelocity()
 
 Vector3df EC_RigidBody::GetAngularVelocity()
 {
-    if (body_)
+    if ((body_) && (!IsPhysicsStepping()))
         return ToVector3(body_->getAngularVelocity()) * RADTODEG;
     else
         return angularVelocity.Get();
@@ -679,6 +785,7 @@ Vector3df EC_RigidBody::GetAngularVelocity()
 
 void EC_RigidBody::GetAabbox(Vector3df &outAabbMin, Vector3df &outAabbMax)
 {
+    WaitForPhysicsStep();
     btVector3 aabbMin, aabbMax;
     body_->getAabb(aabbMin, aabbMax);
     outAabbMin.set(aabbMin.x(), aabbMin.y(), aabbMin.z());
@@ -698,9 +805,8 @@ void EC_RigidBody::TerrainUpdated(IAttribute* attribute)
     Environment::EC_Terrain* terrain = terrain_.lock().get();
     if (!terrain)
         return;
-    //! \todo It is suboptimal to regenerate the whole heightfield when just the terrain's transform changes
     if ((attribute == &terrain->nodeTransformation) && (shapeType.Get() == Shape_HeightField))
-        CreateCollisionShape();
+        UpdateHeightFieldTransform();
 }
 
 void EC_RigidBody::RequestMesh()
@@ -727,6 +833,8 @@ void EC_RigidBody::RequestMesh()
 
 void EC_RigidBody::UpdateScale()
 {
+    WaitForPhysicsStep();
+    
    Vector3df sizeVec = size.Get();
     // Sanitize the size
     if (sizeVec.x < 0)
@@ -736,6 +844,13 @@ void EC_RigidBody::UpdateScale()
     if (sizeVec.z < 0)
         sizeVec.z = 0;
     
+    // The heightfield is scaled by both the terrain and the placeable, and the compound shape around it is left unscaled
+    if ((heightField_) && (shapeType.Get() == Shape_HeightField))
+    {
+        UpdateHeightFieldTransform();
+        return;
+    }
+    
     // If placeable exists, set local scaling from its scale
     /*! \todo Evil hack: we currently have an adjustment node for Ogre->OpenSim coordinate space conversion,
         but Ogre scaling of child nodes disregards the rotation,
@@ -757,55 +872,53 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
 {
     CheckForPlaceableAndTerrain();
     
-    Environment::EC_Terrain* terrain = terrain_.lock().get();
+    boost::shared_ptr<Environment::EC_Terrain> terrain = terrain_.lock();
     if (!terrain)
         return;
     
-    int width = terrain->PatchWidth() * Environment::EC_Terrain::cPatchSize;
-    int height = terrain->PatchHeight() * Environment::EC_Terrain::cPatchSize;
+    heightField_ = owner_->GetTerrainHeightField(terrain);
+    if (!heightField_)
+        return;
+    connect(owner_, SIGNAL(TerrainHeightFieldUpdated(Physics::TerrainHeightField*)), this, SLOT(OnTerrainHeightFieldUpdated(Physics::TerrainHeightField*)), Qt::UniqueConnection);
     
-    if ((!width) || (!height))
+    /*! \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
+        the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
+        the heightfield on its own. Also, Bullet's collisionshapes generally do not support arbitrary transforms, so we must construct a "compound shape"
+        and add the heightfield as its child, to be able to specify the transform. The transform is set in UpdateHeightFieldTransform().
+     */
+    btCompoundShape* compound = new btCompoundShape();
+    shape_ = compound;
+    compound->addChildShape(btTransform::getIdentity(), heightField_.get());
+}
+
+void EC_RigidBody::UpdateHeightFieldTransform()
+{
+    Environment::EC_Terrain* terrain = terrain_.lock().get();
+    btCompoundShape* compound = dynamic_cast<btCompoundShape*>(shape_);
+    if ((!terrain) || (!heightField_) || (!compound) || (!compound->getNumChildShapes()))
         return;
     
-    heightValues_.resize(width * height);
+    WaitForPhysicsStep();
     
-    float xySpacing = 1.0f;
-    float zSpacing = 1.0f;
-    float minZ = 1000000000;
-    float maxZ = -1000000000;
-    for (uint y = 0; y < height; ++y)
+    // The heightfield is shared by all the bodies of the terrain, which are in the same entity, so they all set the same scaling here.
+    // See UpdateScale() for the swap of the placeable's y & z axes
+    Vector3df placeableScale(1.0f, 1.0f, 1.0f);
+    EC_Placeable* placeable = placeable_.lock().get();
+    if (placeable)
     {
-        for (uint x = 0; x < width; ++x)
-        {
-            float value = terrain->GetPoint(x, y);
-            if (value < minZ)
-                minZ = value;
-            if (value > maxZ)
-                maxZ = value;
-            heightValues_[y * width + x] = value;
-        }
+        const Vector3df& scale = placeable->transform.Get().scale;
+        placeableScale = Vector3df(scale.x, scale.z, scale.y);
     }
     
-    Vector3df scale = terrain->nodeTransformation.Get().scale;
-    Vector3df bbMin(0, 0, minZ);
-    Vector3df bbMax(xySpacing * (width - 1), xySpacing * (height - 1), maxZ);
-    Vector3df bbCenter = scale * (bbMin + bbMax) * 0.5f;
+    const Transform& terrainTrans = terrain->nodeTransformation.Get();
+    heightField_->setLocalScaling(ToBtVector3(terrainTrans.scale * placeableScale));
     
-    heightField_ = new btHeightfieldTerrainShape(width, height, &heightValues_[0], zSpacing, minZ, maxZ, 2, PHY_FLOAT, false);
+    Vector3df positionAdjust = (terrainTrans.position + terrainTrans.scale * heightField_->GetCenter()) * placeableScale;
+    compound->updateChildTransform(0, btTransform(btQuaternion(0,0,0,1), ToBtVector3(positionAdjust)));
     
-    /*! \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
-        the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
-        the heightfield on its own. Also, Bullet's collisionshapes generally do not support arbitrary transforms, so we must construct a "compound shape"
-        and add the heightfield as its child, to be able to specify the transform.
-     */
-    heightField_->setLocalScaling(ToBtVector3(scale));
-    
-    Vector3df positionAdjust = terrain->nodeTransformation.Get().position;
-    positionAdjust += bbCenter;
-    
-    btCompoundShape* compound = new btCompoundShape();
-    shape_ = compound;
-    compound->addChildShape(btTransform(btQuaternion(0,0,0,1), ToBtVector3(positionAdjust)), heightField_);
+    // The body may not have the shape yet, if it is being created
+    if ((body_) && (world_) && (body_->getCollisionShape() == shape_))
+        world_->GetWorld()->updateSingleAabb(body_);
 }
 
 void EC_RigidBody::CreateConvexHullSetShape()
@@ -852,3 +965,42 @@ void EC_RigidBody::EmitPhysicsCollision(Scene::Entity* otherEntity, const Vector
     emit PhysicsCollision(otherEntity, position, normal, distance, impulse, newCollision);
 }
 
+void EC_RigidBody::EmitPhysicsCollisionEnded(Scene::Entity* otherEntity)
+{
+    emit PhysicsCollisionEnded(otherEntity);
+}
+
+bool EC_RigidBody::DeferWhileStepping(const boost::function<void()>& call, bool overridesState)
+{
+    if (!IsPhysicsStepping())
+        return false;
+    
+    if (overridesState)
+        stateOverridePending_ = true;
+    world_->DeferCall(shared_from_this(), call);
+    return true;
+}
+
+bool EC_RigidBody::IsPhysicsStepping() const
+{
+    return (world_) && (world_->IsStepping());
+}
+
+void EC_RigidBody::WaitForPhysicsStep()
+{
+    if (world_)
+        world_->WaitForStep();
+}
+
+bool EC_RigidBody::HasCollisionListeners(uint stepNumber)
+{
+    // receivers() also counts the connections made from scripts, but has to normalize the signature, so check only once per step
+    if (listenersCheckedStep_ != stepNumber)
+    {
+        listenersCheckedStep_ = stepNumber;
+        hasCollisionListeners_ = receivers(SIGNAL(PhysicsCollision(Scene::Entity*, const Vector3df&, const Vector3df&, float, float, bool))) > 0 ||
+            receivers(SIGNAL(PhysicsCollisionEnded(Scene::Entity*))) > 0;
+    }
+    return hasCollisionListeners_;
+}
+
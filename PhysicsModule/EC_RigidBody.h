@@ -14,10 +14,10 @@
 
 #include <QVector>
 
+#include <boost/function.hpp>
+
 class btRigidBody;
 class btCollisionShape;
-class btTriangleMesh;
-class btHeightfieldTerrainShape;
 class EC_Placeable;
 
 namespace Environment
@@ -30,6 +30,8 @@ namespace Physics
     class PhysicsModule;
     class PhysicsWorld;
     struct ConvexHullSet;
+    struct CookedTriangleMesh;
+    class TerrainHeightField;
 }
 
 //! Physics rigid body entity component
@@ -215,17 +217,22 @@ public:
 
 signals:
     //! A physics collision has happened between this rigid body and another entity
-    /*! If there are several contact points, the signal will be sent multiple times for each contact.
+    /*! Sent once per physics step for each colliding entity, with a summary of the contact points: the position, normal and
+        distance of the deepest contact, and the total impulse. Not sent while both bodies are sleeping.
         \param otherEntity The second entity
         \param position World position of collision
         \param normal World normal of collision
         \param distance Contact distance
         \param impulse Impulse applied to the objects to separate them
-        \param newCollision True if same collision did not happen on the previous frame.
-        If collision has multiple contact points, newCollision can only be true for the first of them.
+        \param newCollision True if same collision did not happen on the previous step
      */
     void PhysicsCollision(Scene::Entity* otherEntity, const Vector3df& position, const Vector3df& normal, float distance, float impulse, bool newCollision);
     
+    //! A physics collision between this rigid body and another entity has ended
+    /*! \param otherEntity The second entity
+     */
+    void PhysicsCollisionEnded(Scene::Entity* otherEntity);
+    
 public slots:
     //! Set collision mesh from visible mesh. Also sets mass 0 (static) because trimeshes cannot move in Bullet
     /*! \return true if successful (EC_Mesh could be found and contained a mesh reference)
@@ -330,11 +337,17 @@ private slots:
     //! Check for placeable & terrain components and connect to their signals
     void CheckForPlaceableAndTerrain();
     
-    //! Called when EC_Terrain has been regenerated
+    //! Called when EC_Terrain has been regenerated. Creates a new heightfield if the terrain was resized
     void OnTerrainRegenerated();
 
+    //! Called when PhysicsModule has updated the heights of a terrain heightfield. Updates the transform if it is the heightfield of this body
+    void OnTerrainHeightFieldUpdated(Physics::TerrainHeightField* heightField);
+
     //! Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
+    
+    //! Called when the collision shape of a mesh has been cooked in the background.
+    void OnCollisionMeshCooked(const QString& meshName);
 
 private:
     //! constructor
@@ -351,6 +364,9 @@ private:
     //! Create a heightfield collisionshape from EC_Terrain
     void CreateHeightFieldFromTerrain();
     
+    //! Update the scaling and position of the heightfield from the terrain & placeable transforms, and the bounding box of the body
+    void UpdateHeightFieldTransform();
+    
     //! Create a convex hull set collisionshape
     void CreateConvexHullSetShape();
     
@@ -377,6 +393,29 @@ private:
     //! Emit a physics collision. Called from PhysicsWorld
     void EmitPhysicsCollision(Scene::Entity* otherEntity, const Vector3df& position, const Vector3df& normal, float distance, float impulse, bool newCollision);
     
+    //! Emit the end of a physics collision. Called from PhysicsWorld
+    void EmitPhysicsCollisionEnded(Scene::Entity* otherEntity);
+    
+    //! Return whether anything is connected to the collision signals. Checked once per physics step, given by stepNumber. Called from PhysicsWorld
+    bool HasCollisionListeners(uint stepNumber);
+    
+    //! Set the placeable transform and velocities from the simulation. Called from setWorldTransform, or from PhysicsWorld after a threaded step
+    void ApplyWorldTransform(const Vector3df& position, const Quaternion& orientation, const Vector3df& linearVel, const Vector3df& angularVel);
+    
+    //! Set the transform of the body, when the placeable was moved
+    void SetBodyTransform(const Transform& trans);
+    
+    //! If the physics thread is stepping the world, queue a call to be made after the step and return true. Otherwise return false
+    /*! \param overridesState Whether the call sets the transform or velocity, so that the results of the step should not be applied to this body
+     */
+    bool DeferWhileStepping(const boost::function<void()>& call, bool overridesState);
+    
+    //! Return whether the physics thread is stepping the world
+    bool IsPhysicsStepping() const;
+    
+    //! Wait until the physics thread has finished stepping the world, so that the body and shape can be modified
+    void WaitForPhysicsStep();
+    
     //! Placeable pointer
     boost::weak_ptr<EC_Placeable> placeable_;
     
@@ -404,17 +443,26 @@ private:
     //! Cached shapesize (last created)
     Vector3df cachedSize_;
 
-    //! Bullet triangle mesh
-    boost::shared_ptr<btTriangleMesh> triangleMesh_;
+    //! Bullet triangle mesh shape, shared with the other bodies of the mesh
+    boost::shared_ptr<Physics::CookedTriangleMesh> triangleMesh_;
+    
+    //! Name of the mesh whose collision shape is being cooked, or empty if none
+    std::string pendingCollisionMesh_;
     
     //! Convex hull set
     boost::shared_ptr<Physics::ConvexHullSet> convexHullSet_;
     
-    //! Bullet heightfield shape. Note: this is always put inside a compound shape (shape_)
-    btHeightfieldTerrainShape* heightField_;
+    //! Bullet heightfield shape, shared by all the bodies of the terrain. Note: this is always put inside a compound shape (shape_)
+    boost::shared_ptr<Physics::TerrainHeightField> heightField_;
+    
+    //! Physics step on which the collision signal listeners were last checked
+    uint listenersCheckedStep_;
+    
+    //! Whether the collision signals had listeners on that step
+    bool hasCollisionListeners_;
     
-    //! Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues_;
+    //! Whether a teleport or velocity change has been deferred during the threaded step. The results of the step are then not applied
+    bool stateOverridePending_;
 };
 
 
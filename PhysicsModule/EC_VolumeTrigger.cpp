@@ -292,14 +292,11 @@ void EC_VolumeTrigger::OnPhysicsCollision(Scene::Entity* otherEntity, const Vect
         }
     } else
     {
-        if (newCollision)
+        // Not only on newCollision: the collisions of sleeping bodies are not signalled, so an entity that was left may still be colliding when it wakes up
+        if (entities_.find(entity) == entities_.end())
         {
-            // make sure the entity isn't already inside the volume
-            if (entities_.find(entity) == entities_.end())
-            {
-                emit EntityEnter(otherEntity);
-                connect(otherEntity, SIGNAL(EntityRemoved(Scene::Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Scene::Entity*)));
-            }
+            emit EntityEnter(otherEntity);
+            connect(otherEntity, SIGNAL(EntityRemoved(Scene::Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Scene::Entity*)));
         }
         entities_.insert(entity, true);
     }
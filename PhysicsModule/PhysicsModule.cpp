@@ -7,6 +7,8 @@
 #include "PhysicsWorld.h"
 #include "CollisionShapeUtils.h"
 #include "ConvexHull.h"
+#include "CollisionShapeCooker.h"
+#include "TerrainHeightField.h"
 #include "EC_RigidBody.h"
 #include "EC_VolumeTrigger.h"
 #include "OgreBulletCollisionsDebugLines.h"
@@ -23,10 +25,13 @@
 #include "Renderer.h"
 #include "ConsoleAPI.h"
 #include "ConsoleCommandUtils.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
 
 #include <btBulletDynamicsCommon.h>
 
 #include <QtScript>
+#include <QDir>
 
 #include <Ogre.h>
 
@@ -71,6 +76,7 @@ PhysicsModule::PhysicsModule() :
     IModule(NameStatic()),
     drawDebugGeometry_(false),
     runPhysics_(true),
+    threadedPhysics_(false),
     debugGeometryObject_(0),
     debugDrawMode_(0)
 {
@@ -89,6 +95,12 @@ void PhysicsModule::Load()
 void PhysicsModule::Initialize()
 {
     framework_->RegisterDynamicObject("physics", this);
+    
+    cooker_ = boost::shared_ptr<CollisionShapeCooker>(new CollisionShapeCooker(framework_->GetJobSystem().get()));
+    
+    threadedPhysics_ = framework_->ProgramOptions().count("physicsthread") > 0;
+    if (threadedPhysics_)
+        LogInfo("Simulating physics in a separate thread");
 }
 
 void PhysicsModule::PostInitialize()
@@ -105,6 +117,11 @@ void PhysicsModule::PostInitialize()
     framework_->Console()->RegisterCommand(CreateConsoleCommand("autocollisionmesh",
         "Auto-assigns static rigid bodies with collision mesh to all visible meshes.",
         ConsoleBind(this, &PhysicsModule::ConsoleAutoCollisionMesh)));
+    
+    // Store the cooked collision shapes alongside the asset cache, so that they survive restarts
+    AssetCache* assetCache = framework_->Asset()->GetAssetCache();
+    if (assetCache)
+        cooker_->SetCacheDirectory(QDir(assetCache->cacheDirectory()).absoluteFilePath("collision"));
 }
 
 void PhysicsModule::Uninitialize()
@@ -162,6 +179,8 @@ ConsoleCommandResult PhysicsModule::ConsoleAutoCollisionMesh(const StringVector&
 
 void PhysicsModule::Update(f64 frametime)
 {
+    ProcessCookedCollisionShapes();
+    
     if (runPhysics_)
     {
         PROFILE(PhysicsModule_Update);
@@ -180,6 +199,18 @@ void PhysicsModule::Update(f64 frametime)
     RESETPROFILER;
 }
 
+ModuleUpdateInfo PhysicsModule::UpdateInfo() const
+{
+    // The simulation writes the transforms of the rigid bodies to their placeables, which moves Ogre scene nodes and emits Qt signals,
+    // and the collision signals run script handlers, so the update must stay on the main thread. With --physicsthread the Bullet
+    // step itself runs in its own thread. The declared accesses let updates that touch neither the scene nor the physics run alongside.
+    ModuleUpdateInfo info;
+    info.reads = MUA_Scene | MUA_Physics | MUA_Assets;
+    info.writes = MUA_Scene | MUA_Physics | MUA_Events | MUA_Script;
+    info.mainThreadOnly = true;
+    return info;
+}
+
 Physics::PhysicsWorld* PhysicsModule::CreatePhysicsWorldForScene(Scene::ScenePtr scene, bool isClient)
 {
     if (!scene)
@@ -195,6 +226,7 @@ Physics::PhysicsWorld* PhysicsModule::CreatePhysicsWorldForScene(Scene::ScenePtr
     Scene::SceneManager* ptr = scene.get();
     boost::shared_ptr<PhysicsWorld> new_world(new PhysicsWorld(this, isClient));
     new_world->SetGravity(Vector3df(0.0f,0.0f,-9.81f));
+    new_world->SetThreaded(threadedPhysics_);
     
     physicsWorlds_[ptr] = new_world;
     QObject::connect(ptr, SIGNAL(Removed(Scene::SceneManager*)), this, SLOT(OnSceneRemoved(Scene::SceneManager*)));
@@ -295,7 +327,8 @@ void PhysicsModule::UpdateDebugGeometry()
     if (!world)
         return;
     
-    // Get all lines of the physics world
+    // Get all lines of the physics world. In threaded mode, this has to wait for the step started this frame
+    world->WaitForStep();
     world->GetWorld()->debugDrawWorld();
     
     // Build the debug vertex buffer
@@ -313,9 +346,9 @@ void PhysicsModule::drawLine(const btVector3& from, const btVector3& to, const b
         debugGeometryObject_->addLine(from, to, color);
 }
 
-boost::shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh)
+boost::shared_ptr<CookedTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh)
 {
-    boost::shared_ptr<btTriangleMesh> ptr;
+    boost::shared_ptr<CookedTriangleMesh> ptr;
     if (!mesh)
         return ptr;
     
@@ -324,13 +357,9 @@ boost::shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogr
     if (iter != triangleMeshes_.end())
         return iter->second;
     
-    // Create new, then interrogate the Ogre mesh
-#include "DisableMemoryLeakCheck.h"
-    ptr = boost::shared_ptr<btTriangleMesh>(new btTriangleMesh());
-#include "EnableMemoryLeakCheck.h"
-    GenerateTriangleMesh(mesh, ptr.get(), true);
-    
-    triangleMeshes_[mesh->getName()] = ptr;
+    // Start cooking, unless already cooking
+    if (pendingTriangleMeshes_.insert(mesh->getName()).second)
+        cooker_->CookTriangleMesh(mesh);
     
     return ptr;
 }
@@ -346,15 +375,135 @@ boost::shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromOgreMesh(Ogr
     if (iter != convexHullSets_.end())
         return iter->second;
     
-    // Create new, then interrogate the Ogre mesh
-    ptr = boost::shared_ptr<ConvexHullSet>(new ConvexHullSet());
-    GenerateConvexHullSet(mesh, ptr.get(), true);
+    // Start cooking, unless already cooking
+    if (pendingConvexHullSets_.insert(mesh->getName()).second)
+        cooker_->CookConvexHullSet(mesh);
+    
+    return ptr;
+}
+
+boost::shared_ptr<CookedTriangleMesh> PhysicsModule::GetTriangleMesh(const std::string& meshName) const
+{
+    TriangleMeshMap::const_iterator iter = triangleMeshes_.find(meshName);
+    return iter != triangleMeshes_.end() ? iter->second : boost::shared_ptr<CookedTriangleMesh>();
+}
+
+boost::shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSet(const std::string& meshName) const
+{
+    ConvexHullSetMap::const_iterator iter = convexHullSets_.find(meshName);
+    return iter != convexHullSets_.end() ? iter->second : boost::shared_ptr<ConvexHullSet>();
+}
+
+void PhysicsModule::ProcessCookedCollisionShapes()
+{
+    std::vector<CollisionShapeCooker::Result> results;
+    cooker_->TakeResults(results);
+    
+    for(uint i = 0; i < results.size(); ++i)
+    {
+        const CollisionShapeCooker::Result& result = results[i];
+        if (result.triangleMesh)
+        {
+            triangleMeshes_[result.meshName] = result.triangleMesh;
+            pendingTriangleMeshes_.erase(result.meshName);
+        }
+        if (result.convexHullSet)
+        {
+            convexHullSets_[result.meshName] = result.convexHullSet;
+            pendingConvexHullSets_.erase(result.meshName);
+        }
+        LogDebug("Collision shape for mesh " + result.meshName + (result.fromCache ? " loaded from cache" : " cooked"));
+        emit CollisionMeshCooked(QString::fromStdString(result.meshName));
+    }
+}
+
+boost::shared_ptr<TerrainHeightField> PhysicsModule::GetTerrainHeightField(const boost::shared_ptr<Environment::EC_Terrain> &terrain)
+{
+    boost::shared_ptr<TerrainHeightField> ptr;
+    if (!terrain || !terrain->PatchWidth() || !terrain->PatchHeight())
+        return ptr;
+    
+    // Check if the terrain already has a shape of the right size. The terrain is compared as well, in case a new terrain got the address of a destroyed one
+    TerrainHeightFieldMap::const_iterator iter = terrainHeightFields_.find(terrain.get());
+    if (iter != terrainHeightFields_.end())
+    {
+        ptr = iter->second.lock();
+        if (ptr && ptr->GetTerrain() == terrain && ptr->MatchesTerrainSize())
+            return ptr;
+    }
+    
+    // Forget the shapes of destroyed terrains
+    for(TerrainHeightFieldMap::iterator i = terrainHeightFields_.begin(); i != terrainHeightFields_.end();)
+    {
+        if (i->second.expired())
+            terrainHeightFields_.erase(i++);
+        else
+            ++i;
+    }
+    
+#include "DisableMemoryLeakCheck.h"
+    // Only the physics thread needs a copy of the heights, that the main thread can not modify during a step
+    ptr = boost::shared_ptr<TerrainHeightField>(new TerrainHeightField(terrain, threadedPhysics_));
+#include "EnableMemoryLeakCheck.h"
+    terrainHeightFields_[terrain.get()] = ptr;
+    updatedTerrains_.erase(terrain.get());
+    
+    connect(terrain.get(), SIGNAL(PatchesRegenerated(int, int, int, int)), this, SLOT(OnTerrainPatchesRegenerated(int, int, int, int)), Qt::UniqueConnection);
+    connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()), Qt::UniqueConnection);
+    
+    return ptr;
+}
 
-    convexHullSets_[mesh->getName()] = ptr;
+boost::shared_ptr<TerrainHeightField> PhysicsModule::GetSenderTerrainHeightField()
+{
+    boost::shared_ptr<TerrainHeightField> ptr;
+    Environment::EC_Terrain* terrain = dynamic_cast<Environment::EC_Terrain*>(sender());
+    TerrainHeightFieldMap::const_iterator iter = terrainHeightFields_.find(terrain);
+    if (!terrain || iter == terrainHeightFields_.end())
+        return ptr;
     
+    ptr = iter->second.lock();
+    if (!ptr || ptr->GetTerrain().get() != terrain || !ptr->MatchesTerrainSize())
+        ptr.reset();
     return ptr;
 }
 
+void PhysicsModule::WaitForPhysicsSteps()
+{
+    for(PhysicsWorldMap::iterator i = physicsWorlds_.begin(); i != physicsWorlds_.end(); ++i)
+        i->second->WaitForStep();
+}
+
+void PhysicsModule::OnTerrainPatchesRegenerated(int minPatchX, int minPatchY, int maxPatchX, int maxPatchY)
+{
+    boost::shared_ptr<TerrainHeightField> heightField = GetSenderTerrainHeightField();
+    if (!heightField)
+        return;
+    
+    WaitForPhysicsSteps();
+    heightField->UpdatePatches(minPatchX, minPatchY, maxPatchX, maxPatchY);
+    updatedTerrains_.insert(heightField->GetTerrain().get());
+}
+
+void PhysicsModule::OnTerrainRegenerated()
+{
+    // If the terrain was resized, the rigid bodies create new shapes themselves
+    boost::shared_ptr<TerrainHeightField> heightField = GetSenderTerrainHeightField();
+    if (!heightField)
+        return;
+    
+    // If the changed patches were not reported, go through all of them
+    Environment::EC_Terrain* terrain = heightField->GetTerrain().get();
+    if (updatedTerrains_.find(terrain) == updatedTerrains_.end())
+    {
+        WaitForPhysicsSteps();
+        heightField->UpdateAllPatches();
+    }
+    updatedTerrains_.erase(terrain);
+    
+    emit TerrainHeightFieldUpdated(heightField.get());
+}
+
 }
 
 extern "C" void POCO_LIBRARY_API SetProfiler(Foundation::Profiler *profiler);
@@ -22,10 +22,18 @@ class btVector3;
 class btTriangleMesh;
 class QScriptEngine;
 
+namespace Environment
+{
+    class EC_Terrain;
+}
+
 namespace Physics
 {
 
 struct ConvexHullSet;
+struct CookedTriangleMesh;
+class CollisionShapeCooker;
+class TerrainHeightField;
 class PhysicsWorld;
 class DebugLines;
 
@@ -51,6 +59,9 @@ public:
     //! IModule override.
     void Update(f64 frametime);
 
+    //! IModule override. The update stays on the main thread, see the implementation.
+    ModuleUpdateInfo UpdateInfo() const;
+
     //! IModule override.
     void Uninitialize();
 
@@ -90,15 +101,29 @@ public:
     //! IDebugDraw override
     virtual int getDebugMode() const { return debugDrawMode_; }
     
-    //! Get a Bullet triangle mesh corresponding to an Ogre mesh.
-    /*! If already has been generated, returns the previously created one
+    //! Get a Bullet triangle mesh shape corresponding to an Ogre mesh.
+    /*! If already has been generated, returns the previously created one. Otherwise starts cooking it in the background and returns null;
+        CollisionMeshCooked is emitted when it is ready, after which GetTriangleMesh() returns it.
      */
-    boost::shared_ptr<btTriangleMesh> GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh);
+    boost::shared_ptr<CookedTriangleMesh> GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh);
 
     //! Get a Bullet convex hull set (using minimum recursion, not very accurate but fast) corresponding to an Ogre mesh.
-    /*! If already has been generated, returns the previously created one
+    /*! If already has been generated, returns the previously created one. Otherwise starts cooking it in the background and returns null;
+        CollisionMeshCooked is emitted when it is ready, after which GetConvexHullSet() returns it.
      */
     boost::shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
+
+    //! Return the cooked triangle mesh shape of an Ogre mesh by name, or null if it has not been cooked
+    boost::shared_ptr<CookedTriangleMesh> GetTriangleMesh(const std::string& meshName) const;
+
+    //! Return the cooked convex hull set of an Ogre mesh by name, or null if it has not been cooked
+    boost::shared_ptr<ConvexHullSet> GetConvexHullSet(const std::string& meshName) const;
+
+    //! Get the Bullet heightfield shape of a terrain, shared by all the rigid bodies of the terrain.
+    /*! If the shape exists and still matches the size of the terrain, returns it. Otherwise creates a new one.
+        The module updates the shape once when the terrain is regenerated, and then emits TerrainHeightFieldUpdated.
+     */
+    boost::shared_ptr<TerrainHeightField> GetTerrainHeightField(const boost::shared_ptr<Environment::EC_Terrain> &terrain);
     
     //! Create a physics world for a scene
     /*! \param scene Scene into which to create
@@ -132,25 +157,63 @@ public slots:
     //! Initialize physics datatypes for a script engine
     void OnScriptEngineCreated(QScriptEngine* engine);
     
+signals:
+    //! A collision shape of an Ogre mesh has been cooked in the background
+    void CollisionMeshCooked(const QString& meshName);
+    
+    //! The heights of a terrain heightfield shape have been updated. The rigid bodies of the terrain update their transform from it
+    void TerrainHeightFieldUpdated(Physics::TerrainHeightField* heightField);
+    
 private slots:
     //! Scene has been removed, so delete also the physics world (if exists)
     void OnSceneRemoved(Scene::SceneManager* scene);
     
+    //! Called when patches of a terrain have been regenerated. Updates the heightfield shape of the terrain in place
+    void OnTerrainPatchesRegenerated(int minPatchX, int minPatchY, int maxPatchX, int maxPatchY);
+    
+    //! Called when a terrain has been regenerated. Updates the heightfield shape of the terrain if the patches were not reported
+    void OnTerrainRegenerated();
+    
 private:
+    //! Store the collision shapes cooked in the background, and notify the rigid bodies waiting for them
+    void ProcessCookedCollisionShapes();
+    
     //! Update debug geometry manual object, if physics debug drawing is on
     void UpdateDebugGeometry();
     
+    //! Return the heightfield shape of the terrain that sent the signal being handled, or null if it has none of the right size
+    boost::shared_ptr<TerrainHeightField> GetSenderTerrainHeightField();
+    
+    //! Wait for the steps running in the physics threads, so that the shapes can be modified
+    void WaitForPhysicsSteps();
+    
     typedef std::map<Scene::SceneManager*, boost::shared_ptr<Physics::PhysicsWorld> > PhysicsWorldMap;
     //! Map of physics worlds assigned to scenes
     PhysicsWorldMap physicsWorlds_;
     
-    typedef std::map<std::string, boost::shared_ptr<btTriangleMesh> > TriangleMeshMap;
+    typedef std::map<std::string, boost::shared_ptr<CookedTriangleMesh> > TriangleMeshMap;
     //! Bullet triangle meshes generated from Ogre meshes
     TriangleMeshMap triangleMeshes_;
 
     typedef std::map<std::string, boost::shared_ptr<ConvexHullSet> > ConvexHullSetMap;
     //! Bullet convex hull sets generated from Ogre meshes
     ConvexHullSetMap convexHullSets_;
+
+    typedef std::map<Environment::EC_Terrain*, boost::weak_ptr<TerrainHeightField> > TerrainHeightFieldMap;
+    //! Heightfield shapes of terrains. The rigid bodies own the shapes, so a shape is freed along with the last body of the terrain
+    TerrainHeightFieldMap terrainHeightFields_;
+    
+    //! Terrains whose heightfield was updated from the regenerated patches since their last TerrainRegenerated signal
+    std::set<Environment::EC_Terrain*> updatedTerrains_;
+    
+    //! Cooks triangle meshes and convex hull sets in the background
+    boost::shared_ptr<CollisionShapeCooker> cooker_;
+    
+    //! Names of the meshes whose triangle mesh is being cooked
+    std::set<std::string> pendingTriangleMeshes_;
+    
+    //! Names of the meshes whose convex hull set is being cooked
+    std::set<std::string> pendingConvexHullSets_;
     
     //! Debug geometry enabled flag
     bool drawDebugGeometry_;
@@ -161,6 +224,9 @@ private:
     //! Whether should run physics. Default true
     bool runPhysics_;
     
+    //! Whether the physics worlds are simulated in threads of their own. Set with the --physicsthread command line option
+    bool threadedPhysics_;
+    
     //! Bullet debug draw / debug behaviour flags
     int debugDrawMode_;
 };
@@ -0,0 +1,356 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "btBulletDynamicsCommon.h"
+#include <BulletCollision/BroadphaseCollision/btDbvtBroadphase.h>
+#include <BulletCollision/CollisionShapes/btTriangleShape.h>
+#include <BulletCollision/CollisionShapes/btTriangleCallback.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btPointCollector.h>
+#include "MemoryLeakCheck.h"
+#include "PhysicsQuery.h"
+#include "PhysicsUtils.h"
+#include "EC_RigidBody.h"
+
+#include <algorithm>
+
+namespace Physics
+{
+
+namespace
+{
+    //! Collects the collision objects of the broadphase leaves that pass the collision filter of a query
+    struct CandidateCollector : btDbvt::ICollide
+    {
+        CandidateCollector(short group, short mask, std::vector<btCollisionObject*>& candidates) :
+            group_(group),
+            mask_(mask),
+            candidates_(candidates)
+        {
+        }
+
+        void Process(const btDbvtNode* leaf)
+        {
+            btBroadphaseProxy* proxy = static_cast<btBroadphaseProxy*>(leaf->data);
+            if ((proxy->m_collisionFilterGroup & mask_) && (group_ & proxy->m_collisionFilterMask))
+                candidates_.push_back(static_cast<btCollisionObject*>(proxy->m_clientObject));
+        }
+
+        short group_;
+        short mask_;
+        std::vector<btCollisionObject*>& candidates_;
+    };
+
+    //! Records the closest ray hit of a single object
+    struct ClosestRayHit : btCollisionWorld::RayResultCallback
+    {
+        virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult& rayResult, bool normalInWorldSpace)
+        {
+            m_closestHitFraction = rayResult.m_hitFraction;
+            m_collisionObject = rayResult.m_collisionObject;
+            normal_ = normalInWorldSpace ? rayResult.m_hitNormalLocal :
+                m_collisionObject->getWorldTransform().getBasis() * rayResult.m_hitNormalLocal;
+            return rayResult.m_hitFraction;
+        }
+
+        btVector3 normal_;
+    };
+
+    //! Records the closest sweep hit of a single object
+    struct ClosestSweepHit : btCollisionWorld::ConvexResultCallback
+    {
+        ClosestSweepHit() : hitObject_(0) {}
+
+        virtual btScalar addSingleResult(btCollisionWorld::LocalConvexResult& convexResult, bool normalInWorldSpace)
+        {
+            m_closestHitFraction = convexResult.m_hitFraction;
+            hitObject_ = convexResult.m_hitCollisionObject;
+            position_ = convexResult.m_hitPointLocal;
+            normal_ = normalInWorldSpace ? convexResult.m_hitNormalLocal :
+                hitObject_->getWorldTransform().getBasis() * convexResult.m_hitNormalLocal;
+            return convexResult.m_hitFraction;
+        }
+
+        btCollisionObject* hitObject_;
+        btVector3 position_;
+        btVector3 normal_;
+    };
+
+    //! Returns whether two convex shapes overlap
+    bool ConvexShapesOverlap(const btConvexShape* shapeA, const btTransform& transA, const btConvexShape* shapeB, const btTransform& transB)
+    {
+        btVoronoiSimplexSolver simplexSolver;
+        btGjkEpaPenetrationDepthSolver penetrationSolver;
+        btGjkPairDetector detector(shapeA, shapeB, &simplexSolver, &penetrationSolver);
+        btGjkPairDetector::ClosestPointInput input;
+        input.m_transformA = transA;
+        input.m_transformB = transB;
+        btPointCollector collector;
+        detector.getClosestPoints(input, collector, 0);
+        return collector.m_hasResult && collector.m_distance <= btScalar(0);
+    }
+
+    //! Tests the triangles of a concave shape against a convex shape, until one overlaps it
+    struct TriangleOverlapTest : btTriangleCallback
+    {
+        TriangleOverlapTest(const btConvexShape* shape, const btTransform& shapeTrans, const btTransform& concaveTrans) :
+            shape_(shape),
+            shapeTrans_(shapeTrans),
+            concaveTrans_(concaveTrans),
+            overlap_(false)
+        {
+        }
+
+        virtual void processTriangle(btVector3* triangle, int partId, int triangleIndex)
+        {
+            if (overlap_)
+                return;
+            btTriangleShape triangleShape(triangle[0], triangle[1], triangle[2]);
+            overlap_ = ConvexShapesOverlap(shape_, shapeTrans_, &triangleShape, concaveTrans_);
+        }
+
+        const btConvexShape* shape_;
+        btTransform shapeTrans_;
+        btTransform concaveTrans_;
+        bool overlap_;
+    };
+
+    //! Returns whether a convex shape overlaps any kind of collision shape
+    bool ShapesOverlap(const btConvexShape* shape, const btTransform& shapeTrans, const btCollisionShape* other, const btTransform& otherTrans)
+    {
+        if (other->isConvex())
+            return ConvexShapesOverlap(shape, shapeTrans, static_cast<const btConvexShape*>(other), otherTrans);
+
+        if (other->isCompound())
+        {
+            const btCompoundShape* compound = static_cast<const btCompoundShape*>(other);
+            for(int i = 0; i < compound->getNumChildShapes(); ++i)
+                if (ShapesOverlap(shape, shapeTrans, compound->getChildShape(i), otherTrans * compound->getChildTransform(i)))
+                    return true;
+            return false;
+        }
+
+        if (other->isConcave())
+        {
+            // Only go through the triangles inside the bounding box of the shape, in the local space of the concave shape
+            btVector3 aabbMin, aabbMax;
+            shape->getAabb(otherTrans.inverse() * shapeTrans, aabbMin, aabbMax);
+            TriangleOverlapTest test(shape, shapeTrans, otherTrans);
+            static_cast<const btConcaveShape*>(other)->processAllTriangles(&test, aabbMin, aabbMax);
+            return test.overlap_;
+        }
+
+        return false;
+    }
+
+    //! Fills a hit from a collision object. Returns false if the object is not an EC_RigidBody
+    bool SetHitBody(PhysicsQueryHit& hit, const btCollisionObject* object)
+    {
+        hit.body = static_cast<EC_RigidBody*>(object->getUserPointer());
+        if (!hit.body)
+            return false;
+        hit.entity = hit.body->GetParentEntity();
+        return true;
+    }
+
+    bool HitDistanceLess(const PhysicsQueryHit& a, const PhysicsQueryHit& b)
+    {
+        return a.distance < b.distance;
+    }
+
+    void RunRay(const btDbvt* sets, const PhysicsQuery& query, std::vector<btCollisionObject*>& candidates, PhysicsQueryResult& result)
+    {
+        btVector3 from = ToBtVector3(query.from);
+        btVector3 to = ToBtVector3(query.to);
+        for(int i = 0; i < 2; ++i)
+            if (sets[i].m_root)
+            {
+                CandidateCollector collector(query.collisionGroup, query.collisionMask, candidates);
+                btDbvt::rayTest(sets[i].m_root, from, to, collector);
+            }
+
+        btTransform fromTrans(btQuaternion::getIdentity(), from);
+        btTransform toTrans(btQuaternion::getIdentity(), to);
+        float length = query.from.getDistanceFrom(query.to);
+        for(uint i = 0; i < candidates.size(); ++i)
+        {
+            ClosestRayHit callback;
+            btCollisionWorld::rayTestSingle(fromTrans, toTrans, candidates[i], candidates[i]->getCollisionShape(), candidates[i]->getWorldTransform(), callback);
+            PhysicsQueryHit hit;
+            if (!callback.hasHit() || !SetHitBody(hit, candidates[i]))
+                continue;
+            hit.distance = callback.m_closestHitFraction * length;
+            hit.position = ToVector3(from.lerp(to, callback.m_closestHitFraction));
+            hit.normal = ToVector3(callback.normal_.normalized());
+            result.hits.push_back(hit);
+        }
+    }
+
+    void RunSweep(btDbvt* sets, const PhysicsQuery& query, std::vector<btCollisionObject*>& candidates, PhysicsQueryResult& result)
+    {
+        btSphereShape sphere(query.halfExtents.x);
+        btBoxShape box(ToBtVector3(query.halfExtents));
+        const btConvexShape* shape = (query.type == PhysicsQuery::Type_SphereSweep) ? static_cast<const btConvexShape*>(&sphere) : &box;
+
+        btTransform fromTrans(btQuaternion::getIdentity(), ToBtVector3(query.from));
+        btTransform toTrans(btQuaternion::getIdentity(), ToBtVector3(query.to));
+        btVector3 fromMin, fromMax, toMin, toMax;
+        shape->getAabb(fromTrans, fromMin, fromMax);
+        shape->getAabb(toTrans, toMin, toMax);
+        fromMin.setMin(toMin);
+        fromMax.setMax(toMax);
+        btDbvtVolume volume = btDbvtVolume::FromMM(fromMin, fromMax);
+        for(int i = 0; i < 2; ++i)
+            if (sets[i].m_root)
+            {
+                CandidateCollector collector(query.collisionGroup, query.collisionMask, candidates);
+                sets[i].collideTV(sets[i].m_root, volume, collector);
+            }
+
+        float length = query.from.getDistanceFrom(query.to);
+        for(uint i = 0; i < candidates.size(); ++i)
+        {
+            ClosestSweepHit callback;
+            btCollisionWorld::objectQuerySingle(shape, fromTrans, toTrans, candidates[i], candidates[i]->getCollisionShape(), candidates[i]->getWorldTransform(), callback, 0.0f);
+            PhysicsQueryHit hit;
+            if (!callback.hasHit() || !SetHitBody(hit, candidates[i]))
+                continue;
+            hit.distance = callback.m_closestHitFraction * length;
+            hit.position = ToVector3(callback.position_);
+            hit.normal = ToVector3(callback.normal_.normalized());
+            result.hits.push_back(hit);
+        }
+    }
+
+    void RunOverlap(btDbvt* sets, const PhysicsQuery& query, std::vector<btCollisionObject*>& candidates, PhysicsQueryResult& result)
+    {
+        btSphereShape sphere(query.halfExtents.x);
+        btBoxShape box(ToBtVector3(query.halfExtents));
+        const btConvexShape* shape = (query.type == PhysicsQuery::Type_SphereOverlap) ? static_cast<const btConvexShape*>(&sphere) : &box;
+
+        btTransform trans(btQuaternion::getIdentity(), ToBtVector3(query.from));
+        btVector3 aabbMin, aabbMax;
+        shape->getAabb(trans, aabbMin, aabbMax);
+        btDbvtVolume volume = btDbvtVolume::FromMM(aabbMin, aabbMax);
+        for(int i = 0; i < 2; ++i)
+            if (sets[i].m_root)
+            {
+                CandidateCollector collector(query.collisionGroup, query.collisionMask, candidates);
+                sets[i].collideTV(sets[i].m_root, volume, collector);
+            }
+
+        for(uint i = 0; i < candidates.size(); ++i)
+        {
+            PhysicsQueryHit hit;
+            if (ShapesOverlap(shape, trans, candidates[i]->getCollisionShape(), candidates[i]->getWorldTransform()) && SetHitBody(hit, candidates[i]))
+            {
+                result.hits.push_back(hit);
+                if (query.closestOnly)
+                    break;
+            }
+        }
+    }
+}
+
+PhysicsQuery::PhysicsQuery() :
+    type(Type_Ray),
+    collisionGroup(0),
+    collisionMask(0),
+    closestOnly(false)
+{
+}
+
+PhysicsQuery PhysicsQuery::CreateRay(const Vector3df& origin, const Vector3df& direction, float maxDistance)
+{
+    Vector3df normalizedDir = direction;
+    normalizedDir.normalize();
+
+    PhysicsQuery query;
+    query.type = Type_Ray;
+    query.from = origin;
+    query.to = origin + maxDistance * normalizedDir;
+    return query;
+}
+
+PhysicsQuery PhysicsQuery::CreateSphereSweep(const Vector3df& from, const Vector3df& to, float radius)
+{
+    PhysicsQuery query;
+    query.type = Type_SphereSweep;
+    query.from = from;
+    query.to = to;
+    query.halfExtents = Vector3df(radius, radius, radius);
+    return query;
+}
+
+PhysicsQuery PhysicsQuery::CreateBoxSweep(const Vector3df& from, const Vector3df& to, const Vector3df& halfExtents)
+{
+    PhysicsQuery query;
+    query.type = Type_BoxSweep;
+    query.from = from;
+    query.to = to;
+    query.halfExtents = halfExtents;
+    return query;
+}
+
+PhysicsQuery PhysicsQuery::CreateSphereOverlap(const Vector3df& center, float radius)
+{
+    PhysicsQuery query;
+    query.type = Type_SphereOverlap;
+    query.from = center;
+    query.to = center;
+    query.halfExtents = Vector3df(radius, radius, radius);
+    return query;
+}
+
+PhysicsQuery PhysicsQuery::CreateBoxOverlap(const Vector3df& center, const Vector3df& halfExtents)
+{
+    PhysicsQuery query;
+    query.type = Type_BoxOverlap;
+    query.from = center;
+    query.to = center;
+    query.halfExtents = halfExtents;
+    return query;
+}
+
+void RunPhysicsQuery(btDbvtBroadphase* broadphase, const PhysicsQuery& query, PhysicsQueryResult& result)
+{
+    result.hits.clear();
+
+    // Same defaults as btCollisionWorld uses for its queries
+    PhysicsQuery filtered = query;
+    if ((!query.collisionGroup) || (!query.collisionMask))
+    {
+        filtered.collisionGroup = btBroadphaseProxy::DefaultFilter;
+        filtered.collisionMask = btBroadphaseProxy::AllFilter;
+    }
+
+    // The dynamic and static trees of the broadphase. Only read here; the broadphase's own query functions use shared stacks
+    btDbvt* sets = broadphase->m_sets;
+    std::vector<btCollisionObject*> candidates;
+    switch(query.type)
+    {
+    case PhysicsQuery::Type_Ray:
+        RunRay(sets, filtered, candidates, result);
+        break;
+    case PhysicsQuery::Type_SphereSweep:
+    case PhysicsQuery::Type_BoxSweep:
+        RunSweep(sets, filtered, candidates, result);
+        break;
+    case PhysicsQuery::Type_SphereOverlap:
+    case PhysicsQuery::Type_BoxOverlap:
+        RunOverlap(sets, filtered, candidates, result);
+        break;
+    }
+
+    if (query.type == PhysicsQuery::Type_Ray || query.type == PhysicsQuery::Type_SphereSweep || query.type == PhysicsQuery::Type_BoxSweep)
+    {
+        std::sort(result.hits.begin(), result.hits.end(), HitDistanceLess);
+        if (query.closestOnly && result.hits.size() > 1)
+            result.hits.resize(1);
+    }
+}
+
+}
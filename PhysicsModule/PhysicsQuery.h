@@ -0,0 +1,109 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Physics_PhysicsQuery_h
+#define incl_Physics_PhysicsQuery_h
+
+#include "Core.h"
+#include "SceneFwd.h"
+#include "PhysicsModuleApi.h"
+
+class EC_RigidBody;
+class btDbvtBroadphase;
+
+namespace Physics
+{
+
+//! A query of a batch run with PhysicsWorld::RunQueries(): a raycast, a sphere or box sweep, or a sphere or box overlap test.
+/*! Use the Create functions to make queries. Boxes are axis-aligned.
+ */
+struct PHYSICS_MODULE_API PhysicsQuery
+{
+    enum Type
+    {
+        Type_Ray,
+        Type_SphereSweep,
+        Type_BoxSweep,
+        Type_SphereOverlap,
+        Type_BoxOverlap
+    };
+
+    PhysicsQuery();
+
+    //! Create a raycast
+    /*! \param origin World origin position
+        \param direction Direction to raycast to. Will be normalized automatically
+        \param maxDistance Length of ray
+     */
+    static PhysicsQuery CreateRay(const Vector3df& origin, const Vector3df& direction, float maxDistance);
+
+    //! Create a sweep of a sphere from one position to another
+    static PhysicsQuery CreateSphereSweep(const Vector3df& from, const Vector3df& to, float radius);
+
+    //! Create a sweep of an axis-aligned box from one position to another
+    static PhysicsQuery CreateBoxSweep(const Vector3df& from, const Vector3df& to, const Vector3df& halfExtents);
+
+    //! Create a test for the bodies overlapping a sphere
+    static PhysicsQuery CreateSphereOverlap(const Vector3df& center, float radius);
+
+    //! Create a test for the bodies overlapping an axis-aligned box
+    static PhysicsQuery CreateBoxOverlap(const Vector3df& center, const Vector3df& halfExtents);
+
+    //! Type of the query
+    Type type;
+
+    //! Start of the ray or sweep, or the center of the overlap test
+    Vector3df from;
+
+    //! End of the ray or sweep
+    Vector3df to;
+
+    //! Half extents of the box, or the radius of the sphere in x
+    Vector3df halfExtents;
+
+    //! Collision filter group (0 = use default)
+    int collisionGroup;
+
+    //! Collision filter mask (0 = use default)
+    int collisionMask;
+
+    //! If true, only the closest hit is returned. By default all the hit bodies are returned
+    bool closestOnly;
+};
+
+//! A body hit by a PhysicsQuery
+struct PHYSICS_MODULE_API PhysicsQueryHit
+{
+    PhysicsQueryHit() : entity(0), body(0), distance(0.0f) {}
+
+    //! The entity of the body. May be null
+    Scene::Entity* entity;
+
+    //! The body
+    EC_RigidBody* body;
+
+    //! World position of the hit. For sweeps, the position of the contact. Not set for overlap tests
+    Vector3df position;
+
+    //! World normal of the hit surface. Not set for overlap tests
+    Vector3df normal;
+
+    //! Distance from the start of the ray or sweep to the hit. 0 for overlap tests
+    float distance;
+};
+
+//! The result of a PhysicsQuery: the bodies it hit, nearest first.
+struct PHYSICS_MODULE_API PhysicsQueryResult
+{
+    //! The hit bodies. Rays and sweeps report the nearest hit of each body, sorted by distance
+    std::vector<PhysicsQueryHit> hits;
+
+    //! Return whether the query hit anything
+    bool HasHit() const { return !hits.empty(); }
+};
+
+//! Run a single query against the bodies in a broadphase. Thread-safe, as long as the world is not simulated at the same time.
+void RunPhysicsQuery(btDbvtBroadphase* broadphase, const PhysicsQuery& query, PhysicsQueryResult& result);
+
+}
+
+#endif
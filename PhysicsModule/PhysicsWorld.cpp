@@ -3,12 +3,17 @@
 #include "StableHeaders.h"
 #include "DebugOperatorNew.h"
 #include "btBulletDynamicsCommon.h"
+#include <BulletCollision/BroadphaseCollision/btDbvtBroadphase.h>
 #include "MemoryLeakCheck.h"
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "PhysicsUtils.h"
 #include "Profiler.h"
 #include "EC_RigidBody.h"
+#include "Framework.h"
+#include "JobSystem.h"
+
+#include <algorithm>
 
 
 namespace Physics
@@ -17,6 +22,9 @@ namespace Physics
 // Assume we generate at least 10 frames per second. If less, the physics will start to slow down.
 static const float cMinFps = 10.0f;
 
+// Number of queries run in one job by RunQueries()
+static const int cQueryGrainSize = 16;
+
 void TickCallback(btDynamicsWorld *world, btScalar timeStep)
 {
     static_cast<Physics::PhysicsWorld*>(world->getWorldUserInfo())->ProcessPostTick(timeStep);
@@ -29,7 +37,18 @@ PhysicsWorld::PhysicsWorld(PhysicsModule* owner, bool isClient) :
     solver_(0),
     world_(0),
     physicsUpdatePeriod_(1.0f / 60.0f),
-    isClient_(isClient)
+    isClient_(isClient),
+    jobs_(owner->GetFramework()->GetJobSystem().get()),
+    reportPersistentCollisions_(true),
+    stepNumber_(0),
+    reportingCollisions_(false),
+    threaded_(false),
+    stepFrameTime_(0.0),
+    stepUpdatePeriod_(0.0f),
+    stepPending_(false),
+    stepDone_(false),
+    exitThread_(false),
+    stepStarted_(false)
 {
     collisionConfiguration_ = new btDefaultCollisionConfiguration();
     collisionDispatcher_ = new btCollisionDispatcher(collisionConfiguration_);
@@ -42,6 +61,8 @@ PhysicsWorld::PhysicsWorld(PhysicsModule* owner, bool isClient) :
 
 PhysicsWorld::~PhysicsWorld()
 {
+    StopThread();
+    
     delete world_;
     world_ = 0;
     
@@ -68,6 +89,7 @@ void PhysicsWorld::SetPhysicsUpdatePeriod(float updatePeriod)
 
 void PhysicsWorld::SetGravity(const Vector3df& gravity)
 {
+    WaitForStep();
     world_->setGravity(ToBtVector3(gravity));
 }
 
@@ -85,84 +107,427 @@ void PhysicsWorld::Simulate(f64 frametime)
 {
     PROFILE(PhysicsWorld_Simulate);
     
-    int maxSubSteps = (int)((1.0f / physicsUpdatePeriod_) / cMinFps);
-    world_->stepSimulation((float)frametime, maxSubSteps, physicsUpdatePeriod_);
+    if (!threaded_)
+    {
+        StepSimulation(frametime, physicsUpdatePeriod_);
+        return;
+    }
+    
+    // Hand the results of the previous step to the scene
+    WaitForStep();
+    ApplyBodyStates();
+    SendCollisionEvents();
+    RunDeferredCalls();
+    
+    // Start the next step, which runs while the rest of the frame is processed
+    {
+        MutexLock lock(stepMutex_);
+        stepFrameTime_ = frametime;
+        stepUpdatePeriod_ = physicsUpdatePeriod_;
+        stepPending_ = true;
+    }
+    stepStarted_ = true;
+    stepRequested_.notify_one();
+}
+
+void PhysicsWorld::StepSimulation(f64 frametime, float updatePeriod)
+{
+    PROFILE(PhysicsWorld_StepSimulation);
+    ALLOCATION_SCOPE(Physics);
+    
+    int maxSubSteps = (int)((1.0f / updatePeriod) / cMinFps);
+    world_->stepSimulation((float)frametime, maxSubSteps, updatePeriod);
+}
+
+void PhysicsWorld::SetThreaded(bool enable)
+{
+    if (enable == threaded_)
+        return;
+    
+    if (enable)
+    {
+        threaded_ = true;
+        exitThread_ = false;
+        thread_ = boost::shared_ptr<Thread>(new Thread(boost::bind(&PhysicsWorld::RunThread, this)));
+    }
+    else
+    {
+        StopThread();
+        ApplyBodyStates();
+        SendCollisionEvents();
+        RunDeferredCalls();
+    }
+}
+
+void PhysicsWorld::StopThread()
+{
+    if (!thread_)
+        return;
+    
+    WaitForStep();
+    {
+        MutexLock lock(stepMutex_);
+        exitThread_ = true;
+    }
+    stepRequested_.notify_one();
+    thread_->join();
+    thread_.reset();
+    threaded_ = false;
+}
+
+void PhysicsWorld::RunThread()
+{
+    for(;;)
+    {
+        f64 frametime;
+        float updatePeriod;
+        {
+            ScopedLock lock(stepMutex_);
+            while ((!stepPending_) && (!exitThread_))
+                stepRequested_.wait(lock);
+            if (exitThread_)
+                return;
+            stepPending_ = false;
+            frametime = stepFrameTime_;
+            updatePeriod = stepUpdatePeriod_;
+        }
+        
+        StepSimulation(frametime, updatePeriod);
+        
+        {
+            MutexLock lock(stepMutex_);
+            stepDone_ = true;
+        }
+        stepFinished_.notify_one();
+    }
+}
+
+void PhysicsWorld::WaitForStep()
+{
+    if (!stepStarted_)
+        return;
+    
+    PROFILE(PhysicsWorld_WaitForStep);
+    ScopedLock lock(stepMutex_);
+    while (!stepDone_)
+        stepFinished_.wait(lock);
+    stepDone_ = false;
+    stepStarted_ = false;
+}
+
+void PhysicsWorld::DeferCall(const ComponentPtr& component, const boost::function<void()>& call)
+{
+    DeferredCall deferred;
+    deferred.component = component;
+    deferred.call = call;
+    deferredCalls_.push_back(deferred);
+}
+
+void PhysicsWorld::RunDeferredCalls()
+{
+    if (deferredCalls_.empty())
+        return;
+    
+    PROFILE(PhysicsWorld_RunDeferredCalls);
+    
+    // The calls may defer more calls, if they start a step of another world; those are left for the next frame
+    std::vector<DeferredCall> calls;
+    calls.swap(deferredCalls_);
+    for (uint i = 0; i < calls.size(); ++i)
+    {
+        ComponentPtr component = calls[i].component.lock();
+        if (!component)
+            continue;
+        checked_static_cast<EC_RigidBody*>(component.get())->stateOverridePending_ = false;
+        calls[i].call();
+    }
+}
+
+void PhysicsWorld::StoreBodyState(btRigidBody* body, const btTransform& transform)
+{
+    BodyState state;
+    state.object = body;
+    state.position = ToVector3(transform.getOrigin());
+    state.orientation = ToQuaternion(transform.getRotation());
+    state.linearVelocity = ToVector3(body->getLinearVelocity());
+    state.angularVelocity = ToVector3(body->getAngularVelocity());
+    bodyStates_.push_back(state);
+}
+
+void PhysicsWorld::ApplyBodyStates()
+{
+    if (bodyStates_.empty())
+        return;
+    
+    PROFILE(PhysicsWorld_ApplyBodyStates);
+    
+    for (uint i = 0; i < bodyStates_.size(); ++i)
+    {
+        const BodyState& state = bodyStates_[i];
+        EC_RigidBody* body = static_cast<EC_RigidBody*>(state.object->getUserPointer());
+        if (!body)
+            continue;
+        // A teleport or a velocity change made during the step wins over the simulated state
+        if (body->stateOverridePending_)
+            continue;
+        body->ApplyWorldTransform(state.position, state.orientation, state.linearVelocity, state.angularVelocity);
+    }
+    bodyStates_.clear();
 }
 
 void PhysicsWorld::ProcessPostTick(float substeptime)
 {
-    // Check contacts and send collision signals for them
+    PROFILE(PhysicsWorld_ProcessPostTick);
+    
+    ++stepNumber_;
+    
+    // Gather the manifolds with contacts, grouped by the colliding pair
+    manifolds_.clear();
     int numManifolds = collisionDispatcher_->getNumManifolds();
+    for (int i = 0; i < numManifolds; ++i)
+    {
+        btPersistentManifold* contactManifold = collisionDispatcher_->getManifoldByIndexInternal(i);
+        if (!contactManifold->getNumContacts())
+            continue;
+        
+        btCollisionObject* objectA = static_cast<btCollisionObject*>(contactManifold->getBody0());
+        btCollisionObject* objectB = static_cast<btCollisionObject*>(contactManifold->getBody1());
+        EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
+        EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
+        
+        // We are only interested in collisions where both EC_RigidBody components are known
+        if ((!bodyA) || (!bodyB))
+            continue;
+        // Also, both bodies should have valid parent entities
+        if ((!bodyA->GetParentEntity()) || (!bodyB->GetParentEntity()))
+            continue;
+        
+        manifolds_.push_back(PairManifold(CollisionPair(objectA, objectB), contactManifold));
+    }
+    std::sort(manifolds_.begin(), manifolds_.end());
     
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > currentCollisions;
+    currentCollisions_.clear();
+    if (!manifolds_.empty())
+    {
+        bool worldListeners = receivers(SIGNAL(PhysicsCollision(Scene::Entity*, Scene::Entity*, const Vector3df&, const Vector3df&, float, float, bool))) > 0;
+        
+        uint first = 0;
+        while (first < manifolds_.size())
+        {
+            const CollisionPair& pair = manifolds_[first].pair;
+            uint last = first + 1;
+            while (last < manifolds_.size() && manifolds_[last].pair == pair)
+                ++last;
+            
+            currentCollisions_.push_back(pair);
+            StoreCollision(pair, &manifolds_[first], last - first, worldListeners);
+            first = last;
+        }
+    }
     
-    if (numManifolds)
+    // Store the collisions that were on the previous step but not anymore. Both lists are sorted
+    if (!previousCollisions_.empty())
     {
-        PROFILE(PhysicsWorld_SendCollisions);
+        bool worldListeners = receivers(SIGNAL(PhysicsCollisionEnded(Scene::Entity*, Scene::Entity*))) > 0;
         
-        for (int i = 0; i < numManifolds; ++i)
+        std::vector<CollisionPair>::const_iterator current = currentCollisions_.begin();
+        for (std::vector<CollisionPair>::const_iterator i = previousCollisions_.begin(); i != previousCollisions_.end(); ++i)
         {
-            btPersistentManifold* contactManifold = collisionDispatcher_->getManifoldByIndexInternal(i);
-            int numContacts = contactManifold->getNumContacts();
-            if (!numContacts)
+            while (current != currentCollisions_.end() && *current < *i)
+                ++current;
+            if (current != currentCollisions_.end() && *current == *i)
                 continue;
             
-            btCollisionObject* objectA = static_cast<btCollisionObject*>(contactManifold->getBody0());
-            btCollisionObject* objectB = static_cast<btCollisionObject*>(contactManifold->getBody1());
-            std::pair<btCollisionObject*, btCollisionObject*> objectPair;
-            if (objectA < objectB)
-                objectPair = std::make_pair(objectA, objectB);
-            else
-                objectPair = std::make_pair(objectB, objectA);
-            
-            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
-            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
-            
-            // We are only interested in collisions where both EC_RigidBody components are known
+            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(i->objectA->getUserPointer());
+            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(i->objectB->getUserPointer());
             if ((!bodyA) || (!bodyB))
                 continue;
-            // Also, both bodies should have valid parent entities
-            Scene::Entity* entityA = bodyA->GetParentEntity();
-            Scene::Entity* entityB = bodyB->GetParentEntity();
-            if ((!entityA) || (!entityB))
-                continue;
-            // Check that at least one of the bodies is active
-            if ((!objectA->isActive()) && (!objectB->isActive()))
-                continue;
-            
-            bool newCollision = previousCollisions_.find(objectPair) == previousCollisions_.end();
-            
-            for (int j = 0; j < numContacts; ++j)
+            if ((worldListeners) || (bodyA->HasCollisionListeners(stepNumber_)) || (bodyB->HasCollisionListeners(stepNumber_)))
+                collisionEvents_.push_back(CollisionEvent(CollisionEvent::Type_Ended, *i));
+        }
+    }
+    
+    previousCollisions_.swap(currentCollisions_);
+    
+    CollisionEvent stepEnd(CollisionEvent::Type_StepEnd, CollisionPair(0, 0));
+    stepEnd.stepTime = substeptime;
+    collisionEvents_.push_back(stepEnd);
+    
+    // In threaded mode the signals are sent from the main thread after the step
+    if (!threaded_)
+        SendCollisionEvents();
+}
+
+void PhysicsWorld::StoreCollision(const CollisionPair& pair, const PairManifold* manifolds, uint numManifolds, bool worldListeners)
+{
+    // Check that at least one of the bodies is active. The collisions of sleeping bodies are kept, but not signalled again
+    if ((!pair.objectA->isActive()) && (!pair.objectB->isActive()))
+        return;
+    
+    bool newCollision = !std::binary_search(previousCollisions_.begin(), previousCollisions_.end(), pair);
+    if ((!newCollision) && (!reportPersistentCollisions_))
+        return;
+    
+    EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(pair.objectA->getUserPointer());
+    EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(pair.objectB->getUserPointer());
+    if ((!worldListeners) && (!bodyA->HasCollisionListeners(stepNumber_)) && (!bodyB->HasCollisionListeners(stepNumber_)))
+        return;
+    
+    // Summarize the contacts with the deepest one and the total impulse
+    const btManifoldPoint* deepest = 0;
+    bool flipNormal = false;
+    float impulse = 0.0f;
+    for (uint i = 0; i < numManifolds; ++i)
+    {
+        btPersistentManifold* contactManifold = manifolds[i].manifold;
+        for (int j = 0; j < contactManifold->getNumContacts(); ++j)
+        {
+            const btManifoldPoint& point = contactManifold->getContactPoint(j);
+            impulse += point.m_appliedImpulse;
+            if ((!deepest) || (point.m_distance1 < deepest->m_distance1))
             {
-                btManifoldPoint& point = contactManifold->getContactPoint(j);
-                
-                Vector3df position = ToVector3(point.m_positionWorldOnB);
-                Vector3df normal = ToVector3(point.m_normalWorldOnB);
-                float distance = point.m_distance1;
-                float impulse = point.m_appliedImpulse;
-                
-                emit PhysicsCollision(entityA, entityB, position, normal, distance, impulse, newCollision);
-                bodyA->EmitPhysicsCollision(entityB, position, normal, distance, impulse, newCollision);
-                bodyB->EmitPhysicsCollision(entityA, position, normal, distance, impulse, newCollision);
-                
-                // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
-                // (for example play a sound -> avoid multiple sounds being played)
-                newCollision = false;
+                deepest = &point;
+                // The normal points towards body 0 of the manifold, which may be either of the pair
+                flipNormal = contactManifold->getBody0() != pair.objectA;
             }
-            
-            currentCollisions.insert(objectPair);
         }
     }
     
-    previousCollisions_ = currentCollisions;
+    CollisionEvent event(CollisionEvent::Type_Collision, pair);
+    event.position = ToVector3(deepest->m_positionWorldOnB);
+    event.normal = ToVector3(flipNormal ? -deepest->m_normalWorldOnB : deepest->m_normalWorldOnB);
+    event.distance = deepest->m_distance1;
+    event.impulse = impulse;
+    event.newCollision = newCollision;
+    collisionEvents_.push_back(event);
+}
+
+void PhysicsWorld::SendCollisionEvents()
+{
+    if (collisionEvents_.empty())
+        return;
+    
+    PROFILE(PhysicsWorld_SendCollisions);
+    
+    // Bodies removed by the signal handlers are only forgotten after all the signals have been sent
+    reportingCollisions_ = true;
+    
+    for (uint i = 0; i < collisionEvents_.size(); ++i)
+    {
+        const CollisionEvent& event = collisionEvents_[i];
+        if (event.type == CollisionEvent::Type_StepEnd)
+        {
+            emit Updated(event.stepTime);
+            continue;
+        }
+        
+        if (IsForgotten(event.pair))
+            continue;
+        EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(event.pair.objectA->getUserPointer());
+        EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(event.pair.objectB->getUserPointer());
+        if ((!bodyA) || (!bodyB))
+            continue;
+        Scene::Entity* entityA = bodyA->GetParentEntity();
+        Scene::Entity* entityB = bodyB->GetParentEntity();
+        if ((!entityA) || (!entityB))
+            continue;
+        
+        if (event.type == CollisionEvent::Type_Collision)
+        {
+            emit PhysicsCollision(entityA, entityB, event.position, event.normal, event.distance, event.impulse, event.newCollision);
+            if (!IsForgotten(event.pair))
+                bodyA->EmitPhysicsCollision(entityB, event.position, event.normal, event.distance, event.impulse, event.newCollision);
+            if (!IsForgotten(event.pair))
+                bodyB->EmitPhysicsCollision(entityA, event.position, event.normal, event.distance, event.impulse, event.newCollision);
+        }
+        else
+        {
+            emit PhysicsCollisionEnded(entityA, entityB);
+            if (!IsForgotten(event.pair))
+                bodyA->EmitPhysicsCollisionEnded(entityB);
+            if (!IsForgotten(event.pair))
+                bodyB->EmitPhysicsCollisionEnded(entityA);
+        }
+    }
+    collisionEvents_.clear();
+    
+    reportingCollisions_ = false;
+    for (uint i = 0; i < forgottenObjects_.size(); ++i)
+        ForgetObject(forgottenObjects_[i]);
+    forgottenObjects_.clear();
+}
+
+bool PhysicsWorld::IsForgotten(const CollisionPair& pair) const
+{
+    for (uint i = 0; i < forgottenObjects_.size(); ++i)
+    {
+        if (pair.objectA == forgottenObjects_[i] || pair.objectB == forgottenObjects_[i])
+            return true;
+    }
+    return false;
+}
+
+void PhysicsWorld::ForgetObject(btCollisionObject* object)
+{
+    if (reportingCollisions_)
+    {
+        forgottenObjects_.push_back(object);
+        return;
+    }
     
-    emit Updated(substeptime);
+    uint j = 0;
+    for (uint i = 0; i < previousCollisions_.size(); ++i)
+    {
+        if (previousCollisions_[i].objectA != object && previousCollisions_[i].objectB != object)
+            previousCollisions_[j++] = previousCollisions_[i];
+    }
+    previousCollisions_.resize(j, CollisionPair(0, 0));
+    
+    j = 0;
+    for (uint i = 0; i < collisionEvents_.size(); ++i)
+    {
+        if (collisionEvents_[i].pair.objectA != object && collisionEvents_[i].pair.objectB != object)
+            collisionEvents_[j++] = collisionEvents_[i];
+    }
+    collisionEvents_.resize(j, CollisionEvent(CollisionEvent::Type_StepEnd, CollisionPair(0, 0)));
+    
+    j = 0;
+    for (uint i = 0; i < bodyStates_.size(); ++i)
+    {
+        if (bodyStates_[i].object != object)
+            bodyStates_[j++] = bodyStates_[i];
+    }
+    bodyStates_.resize(j);
+}
+
+static void RunQueryRange(btDbvtBroadphase* broadphase, const std::vector<PhysicsQuery>* queries, std::vector<PhysicsQueryResult>* results, int begin, int end)
+{
+    for(int i = begin; i < end; ++i)
+        RunPhysicsQuery(broadphase, (*queries)[i], (*results)[i]);
+}
+
+void PhysicsWorld::RunQueries(const std::vector<PhysicsQuery>& queries, std::vector<PhysicsQueryResult>& results)
+{
+    PROFILE(PhysicsWorld_RunQueries);
+    
+    WaitForStep();
+    
+    results.resize(queries.size());
+    if (queries.empty())
+        return;
+    
+    if (jobs_ && queries.size() > (uint)cQueryGrainSize)
+        jobs_->ParallelFor(0, (int)queries.size(), boost::bind(&RunQueryRange, broadphase_, &queries, &results, _1, _2), cQueryGrainSize);
+    else
+        RunQueryRange(broadphase_, &queries, &results, 0, (int)queries.size());
 }
 
 PhysicsRaycastResult* PhysicsWorld::Raycast(const Vector3df& origin, const Vector3df& direction, float maxdistance, int collisiongroup, int collisionmask)
 {
     PROFILE(PhysicsWorld_Raycast);
     
+    WaitForStep();
+    
     static PhysicsRaycastResult result;
     
     Vector3df normalizedDir = direction;
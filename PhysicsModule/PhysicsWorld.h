@@ -6,18 +6,29 @@
 #include "Core.h"
 #include "SceneFwd.h"
 #include "PhysicsModuleApi.h"
+#include "PhysicsQuery.h"
 
-#include <set>
 #include <QObject>
 #include <QVector>
 
+#include <boost/function.hpp>
+
 class btCollisionConfiguration;
 class btBroadphaseInterface;
+class btDbvtBroadphase;
 class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btDispatcher;
 class btDynamicsWorld;
 class btCollisionObject;
+class btPersistentManifold;
+class btRigidBody;
+class btTransform;
+
+namespace Foundation
+{
+    class JobSystem;
+}
 
 class PhysicsRaycastResult : public QObject
 {
@@ -54,11 +65,49 @@ public:
     virtual ~PhysicsWorld();
     
     //! Step the physics world. May trigger several internal simulation substeps, according to the deltatime given.
+    /*! In threaded mode, first finishes the step started on the previous call and hands its results to the scene, then starts the next step.
+     */
     void Simulate(f64 frametime);
     
+    //! Set whether the world is simulated in a thread of its own. By default false.
+    /*! In threaded mode each step runs while the rest of the frame is processed, so simulation cost does not add to the frame time.
+        The transforms and collisions of a step are applied to the scene in the next Simulate() call, so they lag one frame behind.
+        While a step runs, the Bullet world must not be touched from the main thread: EC_RigidBody defers its forces, velocity changes
+        and teleports with DeferCall(), and waits for the step with WaitForStep() before adding or removing bodies.
+     */
+    void SetThreaded(bool enable);
+    
+    //! Return whether the world is simulated in a thread of its own
+    bool IsThreaded() const { return threaded_; }
+    
+    //! Return whether a step is running in the physics thread. Call from the main thread.
+    bool IsStepping() const { return stepStarted_; }
+    
+    //! Wait until the step running in the physics thread has finished. Afterwards the Bullet world can be modified until the next Simulate() call.
+    void WaitForStep();
+    
+    //! Queue a call to be made before the next step starts, if the component still exists then. Call from the main thread.
+    void DeferCall(const ComponentPtr& component, const boost::function<void()>& call);
+    
+    //! Store the transform a step moved a body to, to be applied on the main thread after the step. Called from the physics thread.
+    void StoreBodyState(btRigidBody* body, const btTransform& transform);
+    
     //! Process collision from an internal sub-step (Bullet post-tick callback)
     void ProcessPostTick(float substeptime);
     
+    //! Run a batch of raycasts, sweeps and overlap tests, in parallel in the job system. Returns when all have finished.
+    /*! Call from the frame update after Simulate() has returned, for example from the update of another module. Do not call it
+        from the Updated() signal: it is emitted from inside the step, while the bodies are being moved. In threaded mode the
+        running step is waited for first. The queries only read the broadphase and the bodies.
+        \param queries The queries
+        \param results Results of the queries, in the same order. Resized to the number of queries; reuse the vector between
+               calls to avoid allocating
+     */
+    void RunQueries(const std::vector<PhysicsQuery>& queries, std::vector<PhysicsQueryResult>& results);
+    
+    //! Forget the collisions and the stored state of an object that is about to be removed from the world. The end of its collisions will not be signalled.
+    void ForgetObject(btCollisionObject* object);
+    
 public slots:
     //! Set physics update period (= length of each simulation step.) By default 1/60th of a second.
     /*! \param updatePeriod Update period
@@ -86,6 +135,12 @@ public slots:
     //! Return gravity
     Vector3df GetGravity() const;
     
+    //! Set whether PhysicsCollision signals are sent on every step a collision persists, or only when it begins. By default true.
+    void SetReportPersistentCollisions(bool enable) { reportPersistentCollisions_ = enable; }
+    
+    //! Return whether PhysicsCollision signals are sent on every step a collision persists
+    bool GetReportPersistentCollisions() const { return reportPersistentCollisions_; }
+    
     //! Return the Bullet world object
     btDynamicsWorld* GetWorld() const;
     
@@ -95,16 +150,24 @@ public slots:
 signals:
     //! A physics collision has happened between two entities. 
     /*! Note: both rigidbodies participating in the collision will also emit a signal separately. 
-        Also, if there are several contact points, the signal will be sent multiple times for each contact.
+        The signal is sent once per physics step for each colliding pair, with a summary of the contact points: the position,
+        normal and distance of the deepest contact, and the total impulse. It is not sent while both bodies are sleeping.
         \param entityA The first entity
         \param entityB The second entity
         \param position World position of collision
-        \param normal World normal of collision
+        \param normal World normal of collision, pointing from entityB towards entityA
         \param distance Contact distance
         \param impulse Impulse applied to the objects to separate them
-        \param newCollision True if same collision did not happen on the previous frame. If collision has multiple contact points, newCollision can only be true for the first of them.
+        \param newCollision True if same collision did not happen on the previous step
      */
     void PhysicsCollision(Scene::Entity* entityA, Scene::Entity* entityB, const Vector3df& position, const Vector3df& normal, float distance, float impulse, bool newCollision);
+    
+    //! A physics collision between two entities has ended
+    /*! Note: both rigidbodies participating in the collision will also emit a signal separately.
+        \param entityA The first entity
+        \param entityB The second entity
+     */
+    void PhysicsCollisionEnded(Scene::Entity* entityA, Scene::Entity* entityB);
      
      //! Emitted after each simulation step
      /*! \param frametime Length of simulation step
@@ -112,12 +175,120 @@ signals:
      void Updated(float frametime);
      
 private:
+    //! Two colliding objects, ordered by address
+    struct CollisionPair
+    {
+        CollisionPair(btCollisionObject* a, btCollisionObject* b) :
+            objectA(a < b ? a : b),
+            objectB(a < b ? b : a)
+        {
+        }
+        
+        bool operator < (const CollisionPair& rhs) const
+        {
+            return objectA < rhs.objectA || (objectA == rhs.objectA && objectB < rhs.objectB);
+        }
+        
+        bool operator == (const CollisionPair& rhs) const
+        {
+            return objectA == rhs.objectA && objectB == rhs.objectB;
+        }
+        
+        btCollisionObject* objectA;
+        btCollisionObject* objectB;
+    };
+    
+    //! A contact manifold of a colliding pair. A pair has several manifolds if either of the objects has a compound shape
+    struct PairManifold
+    {
+        PairManifold(const CollisionPair& pair_, btPersistentManifold* manifold_) : pair(pair_), manifold(manifold_) {}
+        
+        bool operator < (const PairManifold& rhs) const { return pair < rhs.pair; }
+        
+        CollisionPair pair;
+        btPersistentManifold* manifold;
+    };
+    
+    //! A collision signal of a step, stored until it can be sent from the main thread
+    struct CollisionEvent
+    {
+        enum Type
+        {
+            //! A collision began or persists
+            Type_Collision,
+            //! A collision ended
+            Type_Ended,
+            //! The substep ended. stepTime is its length
+            Type_StepEnd
+        };
+        
+        CollisionEvent(Type type_, const CollisionPair& pair_) :
+            type(type_),
+            pair(pair_),
+            distance(0.0f),
+            impulse(0.0f),
+            stepTime(0.0f),
+            newCollision(false)
+        {
+        }
+        
+        Type type;
+        CollisionPair pair;
+        Vector3df position;
+        Vector3df normal;
+        float distance;
+        float impulse;
+        float stepTime;
+        bool newCollision;
+    };
+    
+    //! The transform and velocities of a body after a threaded step
+    struct BodyState
+    {
+        btCollisionObject* object;
+        Vector3df position;
+        Quaternion orientation;
+        Vector3df linearVelocity;
+        Vector3df angularVelocity;
+    };
+    
+    //! A call deferred while a step runs
+    struct DeferredCall
+    {
+        boost::weak_ptr<IComponent> component;
+        boost::function<void()> call;
+    };
+    
+    //! Step the Bullet world. Called from Simulate(), or from the physics thread
+    void StepSimulation(f64 frametime, float updatePeriod);
+    
+    //! Store the collision event of the manifolds of a pair
+    void StoreCollision(const CollisionPair& pair, const PairManifold* manifolds, uint numManifolds, bool worldListeners);
+    
+    //! Send the stored collision signals
+    void SendCollisionEvents();
+    
+    //! Apply the stored body states to the scene
+    void ApplyBodyStates();
+    
+    //! Make the deferred calls
+    void RunDeferredCalls();
+    
+    //! Main function of the physics thread
+    void RunThread();
+    
+    //! Wait for the running step and stop the physics thread, without applying the results of the step
+    void StopThread();
+    
+    //! Return whether either object of a pair has been removed during the collision signals
+    bool IsForgotten(const CollisionPair& pair) const;
+    
     //! Bullet collision config
     btCollisionConfiguration* collisionConfiguration_;
     //! Bullet collision dispatcher
     btDispatcher* collisionDispatcher_;
     //! Bullet collision broadphase
-    btBroadphaseInterface* broadphase_;
+    btDbvtBroadphase* broadphase_;
     //! Bullet constraint equation solver
     btConstraintSolver* solver_;
     //! Bullet physics world
@@ -129,8 +300,69 @@ private:
     //! Client scene flag
     bool isClient_;
     
-    //! Previous frame's collisions. We store these to know whether the collision was new or "ongoing"
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > previousCollisions_;
+    //! Job system the batched queries are run in
+    Foundation::JobSystem* jobs_;
+    
+    //! Whether PhysicsCollision is sent on every step a collision persists
+    bool reportPersistentCollisions_;
+    
+    //! Number of the current physics step. Used by the rigid bodies to check their signal listeners once per step
+    uint stepNumber_;
+    
+    //! Previous step's collisions, sorted. We store these to know whether the collision was new, "ongoing" or ended
+    std::vector<CollisionPair> previousCollisions_;
+    
+    //! Current step's collisions. Kept as a member to reuse the memory
+    std::vector<CollisionPair> currentCollisions_;
+    
+    //! Current step's contact manifolds. Kept as a member to reuse the memory
+    std::vector<PairManifold> manifolds_;
+    
+    //! Collision events waiting to be sent
+    std::vector<CollisionEvent> collisionEvents_;
+    
+    //! True while the collision signals are sent
+    bool reportingCollisions_;
+    
+    //! Objects removed by the collision signal handlers, to be forgotten after the signals
+    std::vector<btCollisionObject*> forgottenObjects_;
+    
+    //! Threaded mode flag
+    bool threaded_;
+    
+    //! The physics thread, or null if not in threaded mode
+    boost::shared_ptr<Thread> thread_;
+    
+    //! Guards the step request and completion flags shared with the physics thread
+    Mutex stepMutex_;
+    
+    //! Signalled when a step is requested or the thread should exit
+    Condition stepRequested_;
+    
+    //! Signalled when a step has finished
+    Condition stepFinished_;
+    
+    //! Frame time and update period of the requested step
+    f64 stepFrameTime_;
+    float stepUpdatePeriod_;
+    
+    //! Whether a step has been requested and not yet picked up by the physics thread
+    bool stepPending_;
+    
+    //! Whether the physics thread has finished the step
+    bool stepDone_;
+    
+    //! Whether the physics thread should exit
+    bool exitThread_;
+    
+    //! Whether a step has been started and not waited for. Only accessed from the main thread
+    bool stepStarted_;
+    
+    //! States of the bodies moved by the last threaded step
+    std::vector<BodyState> bodyStates_;
+    
+    //! Calls deferred while the step runs
+    std::vector<DeferredCall> deferredCalls_;
 };
 
 }
@@ -0,0 +1,118 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include <btBulletDynamicsCommon.h>
+#include "MemoryLeakCheck.h"
+#include "TerrainHeightField.h"
+#include "EC_Terrain.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+using Environment::EC_Terrain;
+
+namespace Physics
+{
+
+TerrainHeightField::TerrainHeightField(const boost::shared_ptr<EC_Terrain> &terrain, bool copyHeights) :
+    // The heights are read through getRawHeightFieldValue(), so no height data pointer is given to Bullet.
+    btHeightfieldTerrainShape(terrain->VerticesWidth(), terrain->VerticesHeight(), 0, 1.0f, 0.0f, 0.0f, 2, PHY_FLOAT, false),
+    terrain_(terrain),
+    terrainPtr_(terrain.get()),
+    patchWidth_(terrain->PatchWidth()),
+    patchHeight_(terrain->PatchHeight()),
+    patchMinHeights_(patchWidth_ * patchHeight_, 0.0f),
+    patchMaxHeights_(patchWidth_ * patchHeight_, 0.0f),
+    heights_(copyHeights ? terrain->VerticesWidth() * terrain->VerticesHeight() : 0, 0.0f)
+{
+    UpdateAllPatches();
+}
+
+bool TerrainHeightField::MatchesTerrainSize() const
+{
+    boost::shared_ptr<EC_Terrain> terrain = terrain_.lock();
+    return terrain && terrain->PatchWidth() == patchWidth_ && terrain->PatchHeight() == patchHeight_;
+}
+
+void TerrainHeightField::UpdatePatches(int minPatchX, int minPatchY, int maxPatchX, int maxPatchY)
+{
+    PROFILE(TerrainHeightField_UpdatePatches);
+
+    if (!MatchesTerrainSize() || patchMinHeights_.empty())
+        return;
+
+    minPatchX = std::max(minPatchX, 0);
+    minPatchY = std::max(minPatchY, 0);
+    maxPatchX = std::min(maxPatchX, patchWidth_ - 1);
+    maxPatchY = std::min(maxPatchY, patchHeight_ - 1);
+
+    for(int y = minPatchY; y <= maxPatchY; ++y)
+        for(int x = minPatchX; x <= maxPatchX; ++x)
+        {
+            // Patches that are not loaded yet are flat at zero height.
+            const std::vector<float> &heights = terrainPtr_->GetPatch(x, y).heightData;
+            const bool loaded = heights.size() >= (size_t)(EC_Terrain::cPatchSize * EC_Terrain::cPatchSize);
+            float minHeight = 0.0f;
+            float maxHeight = 0.0f;
+            if (loaded)
+            {
+                minHeight = *std::min_element(heights.begin(), heights.end());
+                maxHeight = *std::max_element(heights.begin(), heights.end());
+            }
+
+            for(int row = 0; row < EC_Terrain::cPatchSize && !heights_.empty(); ++row)
+            {
+                float *dst = &heights_[(y * EC_Terrain::cPatchSize + row) * m_heightStickWidth + x * EC_Terrain::cPatchSize];
+                if (loaded)
+                    std::copy(heights.begin() + row * EC_Terrain::cPatchSize, heights.begin() + (row + 1) * EC_Terrain::cPatchSize, dst);
+                else
+                    std::fill(dst, dst + EC_Terrain::cPatchSize, 0.0f);
+            }
+            patchMinHeights_[y * patchWidth_ + x] = minHeight;
+            patchMaxHeights_[y * patchWidth_ + x] = maxHeight;
+        }
+
+    SetHeightRange(*std::min_element(patchMinHeights_.begin(), patchMinHeights_.end()),
+        *std::max_element(patchMaxHeights_.begin(), patchMaxHeights_.end()));
+}
+
+Vector3df TerrainHeightField::GetCenter() const
+{
+    return Vector3df(m_width * 0.5f, m_length * 0.5f, (m_minHeight + m_maxHeight) * 0.5f);
+}
+
+void TerrainHeightField::processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const
+{
+    if (!terrain_.expired())
+        btHeightfieldTerrainShape::processAllTriangles(callback, aabbMin, aabbMax);
+}
+
+btScalar TerrainHeightField::getRawHeightFieldValue(int x, int y) const
+{
+    if (!heights_.empty())
+        return heights_[y * m_heightStickWidth + x];
+
+    const int patchX = x / EC_Terrain::cPatchSize;
+    const int patchY = y / EC_Terrain::cPatchSize;
+    // The terrain may have been resized since the shape was created.
+    if (!terrainPtr_->PatchExists(patchX, patchY))
+        return 0.0f;
+
+    const EC_Terrain::Patch &patch = terrainPtr_->GetPatch(patchX, patchY);
+    if (patch.heightData.size() < (size_t)(EC_Terrain::cPatchSize * EC_Terrain::cPatchSize))
+        return 0.0f;
+    return patch.GetHeightValue(x % EC_Terrain::cPatchSize, y % EC_Terrain::cPatchSize);
+}
+
+void TerrainHeightField::SetHeightRange(float minHeight, float maxHeight)
+{
+    // Same as btHeightfieldTerrainShape::initialize() does for the z up axis
+    m_minHeight = minHeight;
+    m_maxHeight = maxHeight;
+    m_localAabbMin.setValue(0, 0, minHeight);
+    m_localAabbMax.setValue(m_width, m_length, maxHeight);
+    m_localOrigin = btScalar(0.5) * (m_localAabbMin + m_localAabbMax);
+}
+
+}
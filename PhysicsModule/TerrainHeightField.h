@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#ifndef incl_Physics_TerrainHeightField_h
+#define incl_Physics_TerrainHeightField_h
+
+#include "Core.h"
+#include "PhysicsModuleApi.h"
+
+#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+
+namespace Environment
+{
+    class EC_Terrain;
+}
+
+namespace Physics
+{
+
+//! Bullet heightfield shape with the heights of an EC_Terrain.
+/*! Normally the heights are read directly from the patches of the terrain, so an edit is visible to the collision detection as soon
+    as it is made, and only the height range of the shape needs to be kept up to date with UpdatePatches().
+    With threaded physics the shape keeps a copy of the heights instead, because the physics thread may run collision detection while
+    the main thread edits, decodes or replaces the patches. UpdatePatches() then also copies the heights of the patches.
+    Either way UpdatePatches() goes through the given patches only, and must be called while no step is running.
+    The shape is shared by all the rigid bodies of the terrain, and PhysicsModule updates it once when the terrain changes,
+    see PhysicsModule::GetTerrainHeightField(). If the terrain is resized, the shape no longer matches it and a new one has to be created.
+ */
+class TerrainHeightField : public btHeightfieldTerrainShape
+{
+public:
+    //! Creates the shape with the current size and heights of the terrain.
+    /*! \param copyHeights Whether to keep a copy of the heights, for collision detection in the physics thread.
+     */
+    TerrainHeightField(const boost::shared_ptr<Environment::EC_Terrain> &terrain, bool copyHeights);
+
+    //! Returns the terrain of the shape, or null if it has been destroyed.
+    boost::shared_ptr<Environment::EC_Terrain> GetTerrain() const { return terrain_.lock(); }
+
+    //! Returns whether the shape has the same number of patches as the terrain.
+    bool MatchesTerrainSize() const;
+
+    //! Updates the height range of the shape, and the copied heights if any, after the given patches (inclusive range) have changed.
+    void UpdatePatches(int minPatchX, int minPatchY, int maxPatchX, int maxPatchY);
+
+    //! Updates the height range of the shape, and the copied heights if any, from all the patches.
+    void UpdateAllPatches() { UpdatePatches(0, 0, patchWidth_ - 1, patchHeight_ - 1); }
+
+    //! Returns the center of the shape in terrain coordinates. Bullet centers the heightfield on it.
+    Vector3df GetCenter() const;
+
+    //! btHeightfieldTerrainShape override. Does nothing if the terrain has been destroyed.
+    virtual void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const;
+
+protected:
+    //! btHeightfieldTerrainShape override. Returns the height of the terrain, or 0 where the patch is not loaded.
+    virtual btScalar getRawHeightFieldValue(int x, int y) const;
+
+private:
+    //! Sets the height range, and the bounding box and origin that depend on it.
+    void SetHeightRange(float minHeight, float maxHeight);
+
+    boost::weak_ptr<Environment::EC_Terrain> terrain_;
+
+    //! The terrain, used for the height lookups while the weak pointer is known to be valid.
+    Environment::EC_Terrain *terrainPtr_;
+
+    int patchWidth_;
+    int patchHeight_;
+
+    //! Minimum and maximum heights of each patch, so that an update needs to go through the changed patches only.
+    std::vector<float> patchMinHeights_;
+    std::vector<float> patchMaxHeights_;
+
+    //! Copy of the heights of the terrain, VerticesWidth() heights per row, read by the physics thread during a step. Empty if the heights are not copied.
+    std::vector<float> heights_;
+};
+
+}
+
+#endif
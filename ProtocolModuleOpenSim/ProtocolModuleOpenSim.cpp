@@ -51,6 +51,9 @@ namespace OpenSimProtocol
         networkStateEventCategory_ = eventManager_->RegisterEventCategory("NetworkState");
         networkEventInCategory_ = eventManager_->RegisterEventCategory("NetworkIn");
         networkEventOutCategory_ = eventManager_->RegisterEventCategory("NetworkOut");
+
+        // The module only sends events, so it need not be offered any.
+        eventManager_->UnregisterEventSubscriber(this);
     }
 
     // virtual 
@@ -22,23 +22,41 @@ namespace ProtocolUtilities
 
     u32 BitStream::ReadBits(int count)
     {
-        u8 data[4] = { 0 };
-        int cur_byte = 0;
-        int cur_bit = 0;
         assert(num_bits_in_elem_ == 8);
-        int total_bits = std::min(num_bits_in_elem_, count);
-        while(count-- > 0)
+        assert(count >= 0 && count <= 32);
+
+        // The bits are read in chunks of at most a byte. Each chunk is filled MSB first, and the chunks are packed LSB first.
+        u32 value = 0;
+        for(int shift = 0; count > 0; shift += num_bits_in_elem_)
         {
-            if (ReadBit()) ///\note Can optimize here - read several bits at a time instead of looping bit-per-bit.
-                data[cur_byte] |= 1 << (total_bits - 1 - cur_bit);
-            if (++cur_bit >= num_bits_in_elem_)
+            const int chunk_bits = std::min(num_bits_in_elem_, count);
+            count -= chunk_bits;
+
+            u32 chunk = 0;
+            if (BitsLeft() >= (size_t)chunk_bits)
+            {
+                // The chunk spans at most the current byte and the next one, so extract it from both at once.
+                u32 window = (u32)data_[elem_ofs_] << num_bits_in_elem_;
+                if (bit_ofs_ + chunk_bits > num_bits_in_elem_)
+                    window |= data_[elem_ofs_ + 1];
+                chunk = (window >> (2 * num_bits_in_elem_ - bit_ofs_ - chunk_bits)) & ((1 << chunk_bits) - 1);
+
+                bit_ofs_ += chunk_bits;
+                if (bit_ofs_ >= num_bits_in_elem_)
+                {
+                    bit_ofs_ -= num_bits_in_elem_;
+                    ++elem_ofs_;
+                }
+            }
+            else
             {
-                ++cur_byte;
-                cur_bit = 0;
-                total_bits = std::min(num_bits_in_elem_, count);
+                // Near the end of the stream, fall back to single bits, which read as zeros past the end.
+                for(int i = 0; i < chunk_bits; ++i)
+                    chunk = (chunk << 1) | (ReadBit() ? 1 : 0);
             }
+            value |= chunk << shift;
         }
-        return *reinterpret_cast<u32*>(data);
+        return value;
     }
 
     bool BitStream::ReadBit()
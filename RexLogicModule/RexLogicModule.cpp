@@ -397,6 +397,11 @@ void RexLogicModule::PostInitialize()
     eventcategoryid = eventMgr->QueryEventCategory("NetworkIn");
     event_handlers_[eventcategoryid].push_back(boost::bind(
         &NetworkEventHandler::HandleOpenSimNetworkEvent, network_handler_, _1, _2));
+
+    // Events of other categories have no handler, so don't get offered them.
+    for(LogicEventHandlerMap::const_iterator i = event_handlers_.begin(); i != event_handlers_.end(); ++i)
+        if (i->first != IllegalEventCategory)
+            eventMgr->RegisterEventInterest(this, i->first);
     
     framework_->Console()->RegisterCommand(CreateConsoleCommand("Login", 
         "Login to server. Usage: Login(user=Test User, passwd=test, server=localhost",
@@ -552,6 +552,7 @@ namespace Scene
 
     QList<Entity *> SceneManager::CreateContentFromXml(const QDomDocument &xml, bool useEntityIDsFromFile, AttributeChange::Type change)
     {
+        ALLOCATION_SCOPE(Scene);
         QList<Entity *> ret;
         // Check for existence of the scene element before we begin
         QDomElement scene_elem = xml.firstChildElement("scene");
@@ -639,6 +640,7 @@ namespace Scene
 
     QList<Entity *> SceneManager::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
     {
+        ALLOCATION_SCOPE(Scene);
         QList<Entity *> ret;
         assert(data);
         assert(numBytes > 0);
@@ -727,6 +729,7 @@ namespace Scene
 
     QList<Entity *> SceneManager::CreateContentFromSceneDesc(const SceneDesc &desc, bool useEntityIDsFromFile, AttributeChange::Type change)
     {
+        ALLOCATION_SCOPE(Scene);
         QList<Entity *> ret;
 
         if (desc.entities.empty())
@@ -1219,6 +1222,7 @@ namespace Scene
     void SceneManager::UpdateAttributeInterpolations(float frametime)
     {
         PROFILE(Scene_UpdateInterpolation);
+        ALLOCATION_SCOPE(Scene);
         
         interpolating_ = true;
         
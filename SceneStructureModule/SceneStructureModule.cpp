@@ -28,6 +28,8 @@
 #include "EC_OgreCamera.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
+#include "Renderer.h"
+#include "RaycastQuery.h"
 #include "UiAPI.h"
 #include "UiGraphicsView.h"
 #include "UiMainWindow.h"
@@ -55,7 +57,8 @@ SceneStructureModule::SceneStructureModule() :
     sceneWidget(0),
     assetsWindow(0),
     assetsWidget(0),
-    toolTipWidget(0)
+    toolTipWidget(0),
+    dropQuery(0)
 {
 }
 
@@ -67,6 +70,12 @@ SceneStructureModule::~SceneStructureModule()
     SAFE_DELETE(toolTipWidget);
 }
 
+void SceneStructureModule::Uninitialize()
+{
+    // The query must go before the renderer.
+    SAFE_DELETE(dropQuery);
+}
+
 void SceneStructureModule::PostInitialize()
 {
 	//Assets panel
@@ -498,23 +507,19 @@ void SceneStructureModule::HandleDragMoveEvent(QDragMoveEvent *e)
             e->setAccepted(false);
             currentToolTipDestination = "<br><span style='font-weight:bold;'>Destination:</span> ";
             // Raycast to see if there is a submesh under the material drop
-            Foundation::RenderServiceInterface *renderer = framework_->GetService<Foundation::RenderServiceInterface>();
-            if (renderer)
+            const OgreRenderer::RaycastHit *hit = RaycastDropPosition(e->pos());
+            if (hit)
             {
-                RaycastResult* res = renderer->Raycast(e->pos().x(), e->pos().y());
-                if (res->entity_)
+                EC_Mesh *mesh = hit->entity->GetComponent<EC_Mesh>().get();
+                if (mesh)
                 {
-                    EC_Mesh *mesh = res->entity_->GetComponent<EC_Mesh>().get();
-                    if (mesh)
-                    {
-                        currentToolTipDestination.append("Submesh " + QString::number(res->submesh_));
-                        if (!mesh->Name().isEmpty())
-                            currentToolTipDestination.append(" on " + mesh->Name());
-                        else if (!mesh->GetParentEntity()->GetName().isEmpty())
-                            currentToolTipDestination.append(" on " + mesh->GetParentEntity()->GetName());
-                        currentToolTipDestination.append("</p>");
-                        e->accept();
-                    }
+                    currentToolTipDestination.append("Submesh " + QString::number(hit->submesh));
+                    if (!mesh->Name().isEmpty())
+                        currentToolTipDestination.append(" on " + mesh->Name());
+                    else if (!mesh->GetParentEntity()->GetName().isEmpty())
+                        currentToolTipDestination.append(" on " + mesh->GetParentEntity()->GetName());
+                    currentToolTipDestination.append("</p>");
+                    e->accept();
                 }
             }
             if (!e->isAccepted())
@@ -527,30 +532,23 @@ void SceneStructureModule::HandleDragMoveEvent(QDragMoveEvent *e)
 
     if (e->isAccepted() && currentToolTipDestination.isEmpty())
     {
-        Foundation::RenderServiceInterface *renderer = framework_->GetService<Foundation::RenderServiceInterface>();
-        if (renderer)
+        const OgreRenderer::RaycastHit *hit = RaycastDropPosition(e->pos());
+        if (hit)
         {
-            RaycastResult* res = renderer->Raycast(e->pos().x(), e->pos().y());
-            if (res)
-            {
-                if (res->entity_)
-                {
-                    QString entityName = res->entity_->GetName();
-                    currentToolTipDestination = "<br><span style='font-weight:bold;'>Destination:</span> ";
-                    if (!entityName.isEmpty())
-                        currentToolTipDestination.append(entityName + " ");
-                    QString xStr = QString::number(res->pos_.x);
-                    xStr = xStr.left(xStr.indexOf(".")+3);
-                    QString yStr = QString::number(res->pos_.y);
-                    yStr = yStr.left(yStr.indexOf(".")+3);
-                    QString zStr = QString::number(res->pos_.z);
-                    zStr = zStr.left(zStr.indexOf(".")+3);
-                    currentToolTipDestination.append(QString("(%2 %3 %4)</p>").arg(xStr, yStr, zStr));
-                }
-                else
-                    currentToolTipDestination = "<br><span style='font-weight:bold;'>Destination:</span> Dropping in front of camera</p>";
-            }
+            QString entityName = hit->entity->GetName();
+            currentToolTipDestination = "<br><span style='font-weight:bold;'>Destination:</span> ";
+            if (!entityName.isEmpty())
+                currentToolTipDestination.append(entityName + " ");
+            QString xStr = QString::number(hit->pos.x);
+            xStr = xStr.left(xStr.indexOf(".")+3);
+            QString yStr = QString::number(hit->pos.y);
+            yStr = yStr.left(yStr.indexOf(".")+3);
+            QString zStr = QString::number(hit->pos.z);
+            zStr = zStr.left(zStr.indexOf(".")+3);
+            currentToolTipDestination.append(QString("(%2 %3 %4)</p>").arg(xStr, yStr, zStr));
         }
+        else
+            currentToolTipDestination = "<br><span style='font-weight:bold;'>Destination:</span> Dropping in front of camera</p>";
     }
     
     if (toolTipWidget && !currentToolTipSource.isEmpty())
@@ -591,13 +589,12 @@ void SceneStructureModule::HandleDropEvent(QDropEvent *e)
         // Handle other supported file types
         QList<Scene::Entity *> importedEntities;
 
-        Foundation::RenderServiceInterface *renderer = framework_->GetService<Foundation::RenderServiceInterface>();
-        if (!renderer)
+        if (!framework_->GetService<OgreRenderer::Renderer>())
             return;
 
         Vector3df worldPos;
-        RaycastResult* res = renderer->Raycast(e->pos().x(), e->pos().y());
-        if (!res->entity_)
+        const OgreRenderer::RaycastHit *hit = RaycastDropPosition(e->pos());
+        if (!hit)
         {
             // No entity hit, use camera's position with hard-coded offset.
             const Scene::ScenePtr &scene = GetFramework()->Scene()->GetDefaultScene();
@@ -620,7 +617,7 @@ void SceneStructureModule::HandleDropEvent(QDropEvent *e)
                 }
         }
         else
-            worldPos = res->pos_;
+            worldPos = hit->pos;
 
         foreach (QUrl url, e->mimeData()->urls())
         {
@@ -637,128 +634,138 @@ void SceneStructureModule::HandleDropEvent(QDropEvent *e)
     }
 }
 
+const OgreRenderer::RaycastHit *SceneStructureModule::RaycastDropPosition(const QPoint &pos)
+{
+    if (!dropQuery)
+    {
+        OgreRenderer::Renderer *renderer = framework_->GetService<OgreRenderer::Renderer>();
+        if (!renderer || !renderer->GetSceneManager())
+            return 0;
+        dropQuery = new OgreRenderer::RaycastQuery(renderer);
+    }
+
+    const std::vector<OgreRenderer::RaycastHit> &hits = dropQuery->CastFromScreen(pos.x(), pos.y());
+    return hits.empty() ? 0 : &hits.front();
+}
+
 void SceneStructureModule::HandleMaterialDropEvent(QDropEvent *e, const QString &materialRef)
 {   
     // Raycast to see if there is a submesh under the material drop
-    Foundation::RenderServiceInterface *renderer = framework_->GetService<Foundation::RenderServiceInterface>();
-    if (renderer)
+    const OgreRenderer::RaycastHit *hit = RaycastDropPosition(e->pos());
+    if (hit)
     {
-        RaycastResult* res = renderer->Raycast(e->pos().x(), e->pos().y());
-        if (res->entity_)
+        EC_Mesh *mesh = hit->entity->GetComponent<EC_Mesh>().get();
+        if (mesh)
         {
-            EC_Mesh *mesh = res->entity_->GetComponent<EC_Mesh>().get();
-            if (mesh)
+            uint subMeshCount = mesh->GetNumSubMeshes();
+            uint subMeshIndex = hit->submesh;
+            if (subMeshIndex < subMeshCount)
             {
-                uint subMeshCount = mesh->GetNumSubMeshes();
-                uint subMeshIndex = res->submesh_;
-                if (subMeshIndex < subMeshCount)
-                {
-                    materialDropData.affectedIndexes.clear();
+                materialDropData.affectedIndexes.clear();
 
-                    // Get the filename
-                    QString matName = materialRef;
-                    matName.replace("\\", "/");
-                    matName = matName.split("/").last();
+                // Get the filename
+                QString matName = materialRef;
+                matName.replace("\\", "/");
+                matName = matName.split("/").last();
 
-                    QString cleanMaterialRef = matName;
+                QString cleanMaterialRef = matName;
 
-                    // Add our dropped material to the raycasted submesh,
-                    // append empty string or the current material string to the rest of them
-                    AssetReferenceList currentMaterials = mesh->getmeshMaterial();
-                    AssetReferenceList afterMaterials;
-                    for(uint i=0; i<subMeshCount; ++i)
-                    {
-                        if (i == subMeshIndex)
-                        {
-                            afterMaterials.Append(cleanMaterialRef);
-                            materialDropData.affectedIndexes.append(i);
-                        }
-                        else if (i < currentMaterials.Size())
-                            afterMaterials.Append(currentMaterials[i]);
-                        else
-                            afterMaterials.Append(AssetReference());
-                    }
-                    // Clear our any empty ones from the end
-                    for(uint i=afterMaterials.Size(); i>0; --i)
+                // Add our dropped material to the raycasted submesh,
+                // append empty string or the current material string to the rest of them
+                AssetReferenceList currentMaterials = mesh->getmeshMaterial();
+                AssetReferenceList afterMaterials;
+                for(uint i=0; i<subMeshCount; ++i)
+                {
+                    if (i == subMeshIndex)
                     {
-                        AssetReference assetRef = afterMaterials[i-1];
-                        if (assetRef.ref.isEmpty())
-                            afterMaterials.RemoveLast();
-                        else
-                            break;
+                        afterMaterials.Append(cleanMaterialRef);
+                        materialDropData.affectedIndexes.append(i);
                     }
+                    else if (i < currentMaterials.Size())
+                        afterMaterials.Append(currentMaterials[i]);
+                    else
+                        afterMaterials.Append(AssetReference());
+                }
+                // Clear our any empty ones from the end
+                for(uint i=afterMaterials.Size(); i>0; --i)
+                {
+                    AssetReference assetRef = afterMaterials[i-1];
+                    if (assetRef.ref.isEmpty())
+                        afterMaterials.RemoveLast();
+                    else
+                        break;
+                }
 
-                    // Url: Finish now
-                    // File: Finish when add content dialog gives Completed signal
-                    materialDropData.mesh = mesh;
-                    materialDropData.materials = afterMaterials;
+                // Url: Finish now
+                // File: Finish when add content dialog gives Completed signal
+                materialDropData.mesh = mesh;
+                materialDropData.materials = afterMaterials;
 
-                    if (IsUrl(materialRef))
+                if (IsUrl(materialRef))
+                {
+                    QString baseUrl = materialRef.left(materialRef.length() - cleanMaterialRef.length());
+                    FinishMaterialDrop(true, baseUrl);
+                }
+                else
+                {
+                    const Scene::ScenePtr &scene = GetFramework()->Scene()->GetDefaultScene();
+                    if (!scene)
                     {
-                        QString baseUrl = materialRef.left(materialRef.length() - cleanMaterialRef.length());
-                        FinishMaterialDrop(true, baseUrl);
+                        LogError("Could not retrieve default world scene.");
+                        return;
                     }
-                    else
+
+                    // Open source file for reading
+                    QFile materialFile(materialRef);
+                    if (!materialFile.open(QIODevice::ReadOnly))
                     {
-                        const Scene::ScenePtr &scene = GetFramework()->Scene()->GetDefaultScene();
-                        if (!scene)
-                        {
-                            LogError("Could not retrieve default world scene.");
-                            return;
-                        }
+                        LogError("Could not open dropped material file.");
+                        return;
+                    }
 
-                        // Open source file for reading
-                        QFile materialFile(materialRef);
-                        if (!materialFile.open(QIODevice::ReadOnly))
-                        {
-                            LogError("Could not open dropped material file.");
-                            return;
-                        }
+                    // Create scene description
+                    SceneDesc sceneDesc;
+                    sceneDesc.type = SceneDesc::AssetUpload;
+                    sceneDesc.filename = materialRef;
+
+                    // Add our material asset to scene description
+                    AssetDesc ad;
+                    ad.typeName = "material";
+                    ad.source = materialRef;
+                    ad.destinationName = matName;
+                    ad.data = materialFile.readAll();
+                    ad.dataInMemory = true;
+
+                    sceneDesc.assets[qMakePair(ad.source, ad.subname)] = ad;
+                    materialFile.close();
+
+                    // Add texture assets to scene description
+                    TundraLogic::SceneImporter importer(scene);
+                    QSet<QString> textures = importer.ProcessMaterialForTextures(ad.data);
+                    if (!textures.empty())
+                    {
+                        QString dropFolder = materialRef;
+                        dropFolder = dropFolder.replace("\\", "/");
+                        dropFolder = dropFolder.left(dropFolder.lastIndexOf("/")+1);
 
-                        // Create scene description
-                        SceneDesc sceneDesc;
-                        sceneDesc.type = SceneDesc::AssetUpload;
-                        sceneDesc.filename = materialRef;
-
-                        // Add our material asset to scene description
-                        AssetDesc ad;
-                        ad.typeName = "material";
-                        ad.source = materialRef;
-                        ad.destinationName = matName;
-                        ad.data = materialFile.readAll();
-                        ad.dataInMemory = true;
-
-                        sceneDesc.assets[qMakePair(ad.source, ad.subname)] = ad;
-                        materialFile.close();
-
-                        // Add texture assets to scene description
-                        TundraLogic::SceneImporter importer(scene);
-                        QSet<QString> textures = importer.ProcessMaterialForTextures(ad.data);
-                        if (!textures.empty())
+                        foreach(QString textureName, textures)
                         {
-                            QString dropFolder = materialRef;
-                            dropFolder = dropFolder.replace("\\", "/");
-                            dropFolder = dropFolder.left(dropFolder.lastIndexOf("/")+1);
-
-                            foreach(QString textureName, textures)
-                            {
-                                AssetDesc ad;
-                                ad.typeName = "texture";
-                                ad.source = dropFolder + textureName;
-                                ad.destinationName = textureName;
-                                ad.dataInMemory = false;
-                                sceneDesc.assets[qMakePair(ad.source, ad.subname)] = ad;
-                            }
+                            AssetDesc ad;
+                            ad.typeName = "texture";
+                            ad.source = dropFolder + textureName;
+                            ad.destinationName = textureName;
+                            ad.dataInMemory = false;
+                            sceneDesc.assets[qMakePair(ad.source, ad.subname)] = ad;
                         }
-
-                        // Show add content window
-                        AddContentWindow *addMaterials = new AddContentWindow(framework_, scene);
-                        connect(addMaterials, SIGNAL(Completed(bool, const QString&)), SLOT(FinishMaterialDrop(bool, const QString&)));
-                        addMaterials->AddDescription(sceneDesc);
-                        addMaterials->show();
                     }
-                    e->acceptProposedAction();
+
+                    // Show add content window
+                    AddContentWindow *addMaterials = new AddContentWindow(framework_, scene);
+                    connect(addMaterials, SIGNAL(Completed(bool, const QString&)), SLOT(FinishMaterialDrop(bool, const QString&)));
+                    addMaterials->AddDescription(sceneDesc);
+                    addMaterials->show();
                 }
+                e->acceptProposedAction();
             }
         }
     }
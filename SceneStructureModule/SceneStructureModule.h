@@ -32,6 +32,12 @@ struct SceneDesc;
 
 class EC_Mesh;
 
+namespace OgreRenderer
+{
+    class RaycastQuery;
+    struct RaycastHit;
+}
+
 struct SceneMaterialDropData
 {
     EC_Mesh *mesh;
@@ -55,6 +61,9 @@ public:
     /// IModule override.
     void PostInitialize();
 
+    /// IModule override.
+    void Uninitialize();
+
 public slots:
     /// Instantiates new content from file to the scene.
     /** @param filename File name.
@@ -128,6 +137,11 @@ private:
     QLabel *toolTip;
     QString currentToolTipSource;
     QString currentToolTipDestination;   
+    OgreRenderer::RaycastQuery *dropQuery; ///< Query for picking the drop destination, created on first use.
+
+    /// Returns the nearest entity hit under a position of the main window, or null if there is none.
+    /** The hit is valid until the next call. */
+    const OgreRenderer::RaycastHit *RaycastDropPosition(const QPoint &pos);
 
 private slots:
     /// Handles KeyPressed() signal from input context.
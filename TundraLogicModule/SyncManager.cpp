@@ -420,6 +420,7 @@ void SyncManager::OnUserActionTriggered(UserConnection* user, Scene::Entity *ent
 void SyncManager::Update(f64 frametime)
 {
     PROFILE(SyncManager_Update);
+    ALLOCATION_SCOPE(Sync);
     
     update_acc_ += (float)frametime;
     if (update_acc_ < update_period_)
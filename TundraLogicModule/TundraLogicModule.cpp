@@ -65,6 +65,10 @@ void TundraLogicModule::PostInitialize()
 {
     kristalliEventCategory_ = framework_->GetEventManager()->QueryEventCategory("Kristalli");
     frameworkEventCategory_ = framework_->GetEventManager()->QueryEventCategory("Framework");
+
+    // Only the Tundra and Kristalli events are handled, so don't get offered the rest.
+    framework_->GetEventManager()->RegisterEventInterest(this, tundraEventCategory_);
+    framework_->GetEventManager()->RegisterEventInterest(this, kristalliEventCategory_);
     
     framework_->Console()->RegisterCommand(CreateConsoleCommand("startserver", 
         "Starts a server. Usage: startserver(port)",
@@ -175,6 +179,18 @@ void TundraLogicModule::Update(f64 frametime)
     RESETPROFILER;
 }
 
+ModuleUpdateInfo TundraLogicModule::UpdateInfo() const
+{
+    // The sync manager reads the scene and sends the changes through the kNet connections owned by KristalliProtocolModule,
+    // and the attribute interpolation writes the scene, which emits Qt signals to the components. Keep it on the main thread,
+    // but declare the accesses so that it does not conflict with updates that touch neither the scene nor the network.
+    ModuleUpdateInfo info;
+    info.reads = MUA_Scene | MUA_Network | MUA_Assets;
+    info.writes = MUA_Scene | MUA_Network | MUA_Events;
+    info.mainThreadOnly = true;
+    return info;
+}
+
 void TundraLogicModule::LoadStartupScene()
 {
     const boost::program_options::variables_map &options = GetFramework()->ProgramOptions();
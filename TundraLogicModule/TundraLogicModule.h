@@ -54,6 +54,9 @@ public:
     /// IModule override.
     void Update(f64 frametime);
 
+    /// IModule override. The scene sync stays on the main thread, see the implementation.
+    ModuleUpdateInfo UpdateInfo() const;
+
     /// IModule override.
     bool HandleEvent(event_category_id_t category_id, event_id_t event_id, IEventData* data);
 
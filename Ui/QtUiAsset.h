@@ -38,6 +38,10 @@ public slots:
     /// Returns true if this UI asset is valid and loaded in memory.
     bool IsLoaded() const;
 
+public:
+    /// Returns 0, since unloading a ui asset frees nothing (see DoUnload), and the asset memory budget must not try to evict it.
+    virtual size_t MemoryUsage() const { return 0; }
+
 private:
     /// Unloading a ui asset does not have any meaning, as it's not a GPU resource and it doesn't have any kind of decompress/unpack step.
     /// Implementation for this asset is a no-op.
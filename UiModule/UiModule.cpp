@@ -91,6 +91,9 @@ namespace UiServices
 
     void UiModule::Initialize()
     {
+        // HandleEvent ignores every event, so don't get offered any.
+        framework_->GetEventManager()->UnregisterEventSubscriber(this);
+
 		if (GetFramework()->IsHeadless())
 			return;
 